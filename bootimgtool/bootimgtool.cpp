@@ -17,13 +17,19 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <limits>
 #include <memory>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <cassert>
+#include <cinttypes>
 #include <climits>
 #include <cstdarg>
 #include <cstdio>
@@ -32,8 +38,16 @@
 
 #include <getopt.h>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
 // libmbcommon
 #include <mbcommon/common.h>
+#include <mbcommon/file/standard.h>
+#include <mbcommon/finally.h>
 #include <mbcommon/integer.h>
 #include <mbcommon/libc/stdio.h>
 
@@ -123,6 +137,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Available commands:\n" \
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
+    "  batch          Unpack or pack multiple boot images in parallel\n" \
     "\n" \
     "Pass -h/--help as a argument to a command to see its available options.\n"
 
@@ -232,6 +247,75 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "        bootimgtool pack boot.img -i /tmp/android --input-kernel /tmp/newkernel\n" \
     "\n"
 
+#define HELP_BATCH_USAGE \
+    "Usage: bootimgtool batch <manifest file | directory> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -o, --output <output directory>\n" \
+    "                  Base output directory for unpacked images\n" \
+    "                  (current directory if unspecified)\n" \
+    "  -j, --jobs <jobs>\n" \
+    "                  Number of worker threads (number of CPUs if unspecified)\n" \
+    "  -s, --summary <summary file>\n" \
+    "                  Path to write the summary to (stdout if unspecified)\n" \
+    "  -t, --type <type>\n" \
+    "                  Input type for unpack jobs (autodetect if unspecified)\n" \
+    "                  and output type for pack jobs (android if unspecified)\n" \
+    "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "\n" \
+    "Manifest format:\n" \
+    "\n" \
+    "Each line in the manifest file describes one job. Lines containing only\n" \
+    "whitespace and lines that begin with '#' are ignored. The fields of a line are\n" \
+    "separated by tabs.\n" \
+    "\n" \
+    "    <image>\n" \
+    "        Unpack <image> to <output directory>/<image file name>/\n" \
+    "    unpack<TAB><image><TAB><directory>\n" \
+    "        Unpack <image> to <directory>\n" \
+    "    pack<TAB><image><TAB><directory>\n" \
+    "        Build <image> from the files in <directory>\n" \
+    "\n" \
+    "If a directory is specified instead of a manifest file, then every regular\n" \
+    "file in the directory is unpacked as if it were listed using the first form.\n" \
+    "\n" \
+    "Item filenames do not have a prefix (as if -n/--noprefix were passed to the\n" \
+    "unpack and pack commands).\n" \
+    "\n" \
+    "Summary format:\n" \
+    "\n" \
+    "The summary is a JSON object of the following form. The results are listed\n" \
+    "in the same order as the jobs.\n" \
+    "\n" \
+    "    {\n" \
+    "      \"jobs\": <number of worker threads>,\n" \
+    "      \"succeeded\": <number of successful jobs>,\n" \
+    "      \"failed\": <number of failed jobs>,\n" \
+    "      \"elapsed_ms\": <total wall clock time>,\n" \
+    "      \"results\": [\n" \
+    "        {\n" \
+    "          \"action\": \"unpack\" | \"pack\",\n" \
+    "          \"image\": <image path>,\n" \
+    "          \"directory\": <directory path>,\n" \
+    "          \"success\": true | false,\n" \
+    "          \"format\": <boot image format name>,\n" \
+    "          \"bytes\": <size of boot image>,\n" \
+    "          \"elapsed_ms\": <time spent on job>,\n" \
+    "          \"throughput_mib_s\": <boot image size / time spent on job>\n" \
+    "        },\n" \
+    "        ...\n" \
+    "      ]\n" \
+    "    }\n" \
+    "\n" \
+    "Error messages for failed jobs are printed to stderr.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Unpack every boot image in images/ to extracted/<name>/ using 4 threads\n" \
+    "\n" \
+    "        bootimgtool batch images -o extracted -j 4 -s summary.json\n" \
+    "\n"
+
 template <typename F>
 class Finally {
 public:
@@ -723,6 +807,144 @@ static bool write_data_entry_to_file(const std::string &path, Reader &reader)
     return true;
 }
 
+#if defined(__linux__) && defined(__NR_copy_file_range)
+/*!
+ * \brief Copy part of a file in the kernel
+ *
+ * \return Number of bytes copied. If copy_file_range() is not supported for
+ *         the files, fewer bytes than requested may be copied. The caller
+ *         should copy the remaining bytes manually. -1 is returned if an error
+ *         occurs.
+ */
+static int64_t copy_range_in_kernel(const std::string &input_file,
+                                    uint64_t offset, uint64_t size, int fd_out)
+{
+    int fd_in = open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_in < 0) {
+        return 0;
+    }
+
+    auto close_fd_in = mb::finally([&] {
+        close(fd_in);
+    });
+
+    auto off_in = static_cast<loff_t>(offset);
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        auto n = syscall(__NR_copy_file_range, fd_in, &off_in, fd_out, nullptr,
+                         static_cast<size_t>(std::min<uint64_t>(
+                                 size - copied, 1u << 30)), 0u);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                    || errno == EBADF || errno == EOPNOTSUPP) {
+                break;
+            }
+            return -1;
+        } else if (n == 0) {
+            // Truncated file
+            break;
+        }
+
+        copied += static_cast<uint64_t>(n);
+    }
+
+    return static_cast<int64_t>(copied);
+}
+#endif
+
+/*!
+ * \brief Write entry to file by copying its extent from the input file
+ *
+ * This avoids copying the data through the Reader.
+ */
+static bool write_extent_to_file(const std::string &input_file,
+                                 const EntryExtent &extent,
+                                 const std::string &path)
+{
+    ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    uint64_t offset = extent.offset;
+    uint64_t remaining = extent.size;
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    // Nothing has been written to fp yet, so the fd can be used directly
+    auto copied = copy_range_in_kernel(input_file, offset, remaining,
+                                       fileno(fp.get()));
+    if (copied < 0) {
+        fprintf(stderr, "%s: Failed to copy data: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    offset += static_cast<uint64_t>(copied);
+    remaining -= static_cast<uint64_t>(copied);
+
+    if (remaining > 0 && fseek(fp.get(), 0, SEEK_END) < 0) {
+        fprintf(stderr, "%s: Failed to seek file: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+#endif
+
+    if (remaining > 0) {
+        mb::StandardFile file;
+
+        auto ret = file.open(input_file, mb::FileOpenMode::ReadOnly);
+        if (!ret) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    input_file.c_str(), ret.error().message().c_str());
+            return false;
+        }
+
+        auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
+        if (!seek_ret) {
+            fprintf(stderr, "%s: Failed to seek file: %s\n",
+                    input_file.c_str(), seek_ret.error().message().c_str());
+            return false;
+        }
+
+        std::unique_ptr<char[]> buf(new char[1024 * 1024]);
+
+        while (remaining > 0) {
+            auto n = file.read(buf.get(), static_cast<size_t>(
+                    std::min<uint64_t>(remaining, 1024 * 1024)));
+            if (!n) {
+                fprintf(stderr, "%s: Failed to read data: %s\n",
+                        input_file.c_str(), n.error().message().c_str());
+                return false;
+            } else if (n.value() == 0) {
+                fprintf(stderr, "%s: Entry data is truncated\n",
+                        input_file.c_str());
+                return false;
+            }
+
+            if (fwrite(buf.get(), 1, n.value(), fp.get()) != n.value()) {
+                fprintf(stderr, "%s: Failed to write data: %s\n",
+                        path.c_str(), strerror(errno));
+                return false;
+            }
+
+            remaining -= n.value();
+        }
+    }
+
+    if (fclose(fp.release()) < 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 static bool write_file_to_entry(const Paths &paths, Writer &writer,
                                 const Entry &entry)
 {
@@ -782,7 +1004,8 @@ static bool write_file_to_entry(const Paths &paths, Writer &writer,
 }
 
 static bool write_entry_to_file(const Paths &paths, Reader &reader,
-                                const Entry &entry)
+                                const Entry &entry,
+                                const std::string &input_file)
 {
     std::string path;
 
@@ -829,9 +1052,187 @@ static bool write_entry_to_file(const Paths &paths, Reader &reader,
         return false;
     }
 
+    // Copy directly from the input file if the format supports it
+    auto extent = reader.entry_extent();
+    if (extent && extent.value().contiguous) {
+        return write_extent_to_file(input_file, extent.value(), path);
+    } else if (!extent && extent.error() != ReaderError::UnsupportedExtent) {
+        fprintf(stderr, "Failed to get entry extent: %s\n",
+                extent.error().message().c_str());
+        return false;
+    }
+
     return write_data_entry_to_file(path, reader);
 }
 
+static bool enable_reader_formats(Reader &reader, const char *type)
+{
+    if (type) {
+        auto ret = reader.enable_format_by_name(type);
+        if (!ret) {
+            fprintf(stderr, "Failed to enable format '%s': %s\n",
+                    type, ret.error().message().c_str());
+            return false;
+        }
+    } else {
+        auto ret = reader.enable_format_all();
+        if (!ret) {
+            fprintf(stderr, "Failed to enable all formats: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Unpack a boot image
+ *
+ * \param reader Reader with the desired formats enabled. The reader is closed
+ *               before returning so that it can be reused for the next image.
+ * \param input_file Path to boot image
+ * \param output_dir Directory to create before unpacking
+ * \param paths Output paths for the header and images
+ * \param[out] format If not null, set to the name of the detected format
+ *
+ * \return Whether the boot image was successfully unpacked
+ */
+static bool unpack_image(Reader &reader, const std::string &input_file,
+                         const std::string &output_dir, const Paths &paths,
+                         std::string *format)
+{
+    if (!mb::io::create_directories(output_dir)) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n",
+                output_dir.c_str(), mb::io::last_error_string().c_str());
+        return false;
+    }
+
+    Header header;
+    Entry entry;
+
+    auto close_reader = finally([&] {
+        (void) reader.close();
+    });
+
+    auto ret = reader.open_filename(input_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    if (format) {
+        *format = reader.format_name();
+    }
+
+    ret = reader.read_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    if (!write_header(paths.header, header)) {
+        return false;
+    }
+
+    while (true) {
+        ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "%s: Failed to read entry: %s\n",
+                    input_file.c_str(), ret.error().message().c_str());
+            return false;
+        }
+
+        if (!write_entry_to_file(paths, reader, entry, input_file)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Pack a boot image
+ *
+ * \param writer Writer to use. The writer is closed before returning so that it
+ *               can be reused for the next image.
+ * \param type Output format name
+ * \param output_file Path to boot image
+ * \param paths Input paths for the header and images
+ *
+ * \return Whether the boot image was successfully packed
+ */
+static bool pack_image(Writer &writer, const char *type,
+                       const std::string &output_file, const Paths &paths)
+{
+    Header header;
+    Entry entry;
+
+    if (!writer.set_format_by_name(type)) {
+        fprintf(stderr, "Invalid boot image type: %s\n", type);
+        return false;
+    }
+
+    auto close_writer = finally([&] {
+        (void) writer.close();
+    });
+
+    auto ret = writer.open_filename(output_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = writer.get_header(header);
+    if (!ret) {
+        fprintf(stderr, "Failed to get header instance: %s\n",
+                ret.error().message().c_str());
+        return false;
+    }
+
+    if (!read_header(paths.header, header)) {
+        return false;
+    }
+
+    ret = writer.write_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    while (true) {
+        ret = writer.get_entry(entry);
+        if (!ret) {
+            if (ret.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "%s: Failed to get next entry: %s\n",
+                    output_file.c_str(), ret.error().message().c_str());
+            return false;
+        }
+
+        if (!write_file_to_entry(paths, writer, entry)) {
+            return false;
+        }
+    }
+
+    ret = writer.close();
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to close boot image: %s\n",
+                output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 static bool unpack_main(int argc, char *argv[])
 {
     int opt;
@@ -932,68 +1333,10 @@ static bool unpack_main(int argc, char *argv[])
 
     prepend_if_empty(paths, output_dir, prefix);
 
-    if (!mb::io::create_directories(output_dir)) {
-        fprintf(stderr, "%s: Failed to create directory: %s\n",
-                output_dir.c_str(), mb::io::last_error_string().c_str());
-        return false;
-    }
-
-    // Load the boot image
     Reader reader;
-    Header header;
-    Entry entry;
 
-    if (type) {
-        auto ret = reader.enable_format_by_name(type);
-        if (!ret) {
-            fprintf(stderr, "Failed to enable format '%s': %s\n",
-                    type, ret.error().message().c_str());
-            return false;
-        }
-    } else {
-        auto ret = reader.enable_format_all();
-        if (!ret) {
-            fprintf(stderr, "Failed to enable all formats: %s\n",
-                    ret.error().message().c_str());
-            return false;
-        }
-    }
-
-    auto ret = reader.open_filename(input_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
-
-    ret = reader.read_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
-
-    if (!write_header(paths.header, header)) {
-        return false;
-    }
-
-    while (true) {
-        ret = reader.read_entry(entry);
-        if (!ret) {
-            if (ret.error() == ReaderError::EndOfEntries) {
-                break;
-            }
-            fprintf(stderr, "Failed to read entry: %s\n",
-                    ret.error().message().c_str());
-            return false;
-        }
-
-        if (!write_entry_to_file(paths, reader, entry)) {
-            return false;
-        }
-    }
-
-    return true;
+    return enable_reader_formats(reader, type)
+            && unpack_image(reader, input_file, output_dir, paths, nullptr);
 }
 
 static bool pack_main(int argc, char *argv[])
@@ -1100,65 +1443,399 @@ static bool pack_main(int argc, char *argv[])
 
     prepend_if_empty(paths, input_dir, prefix);
 
-    // Load the boot image
     Writer writer;
-    Header header;
-    Entry entry;
 
-    if (!writer.set_format_by_name(type)) {
-        fprintf(stderr, "Invalid boot image type: %s\n", type);
+    return pack_image(writer, type, output_file, paths);
+}
+
+enum class BatchAction
+{
+    Unpack,
+    Pack,
+};
+
+struct BatchJob
+{
+    BatchAction action;
+    std::string image;
+    std::string directory;
+};
+
+struct BatchResult
+{
+    bool success = false;
+    std::string format;
+    uint64_t bytes = 0;
+    std::chrono::steady_clock::duration elapsed{};
+};
+
+static bool load_batch_manifest(const std::string &path,
+                                const std::string &output_dir,
+                                std::vector<BatchJob> &jobs)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    auto ret = writer.open_filename(output_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
-        return false;
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+
+    auto free_line = finally([&]{
+        free(line);
+    });
+
+    while ((read = mb_getline(&line, &len, fp.get())) >= 0) {
+        char *ptr = line;
+
+        // Skip leading whitespace
+        while (*ptr && isspace(*ptr)) {
+            ++ptr;
+        }
+
+        // Skip empty and commented lines
+        if (*ptr == '\0' || *ptr == '#') {
+            continue;
+        }
+
+        // Strip newline
+        while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+            line[read - 1] = '\0';
+            --read;
+        }
+
+        std::vector<std::string> fields;
+        for (char *tab; (tab = strchr(ptr, '\t')); ptr = tab + 1) {
+            fields.emplace_back(ptr, tab);
+        }
+        fields.emplace_back(ptr);
+
+        BatchJob job;
+
+        if (fields.size() == 1) {
+            job.action = BatchAction::Unpack;
+            job.image = fields[0];
+            job.directory = mb::io::path_join(
+                    {output_dir, mb::io::base_name(job.image)});
+        } else if (fields.size() == 3 && fields[0] == "unpack") {
+            job.action = BatchAction::Unpack;
+            job.image = fields[1];
+            job.directory = fields[2];
+        } else if (fields.size() == 3 && fields[0] == "pack") {
+            job.action = BatchAction::Pack;
+            job.image = fields[1];
+            job.directory = fields[2];
+        } else {
+            fprintf(stderr, "%s: Invalid line: %s\n", path.c_str(), line);
+            return false;
+        }
+
+        jobs.push_back(std::move(job));
     }
 
-    ret = writer.get_header(header);
-    if (!ret) {
-        fprintf(stderr, "Failed to get header instance: %s\n",
-                ret.error().message().c_str());
+    return true;
+}
+
+static bool load_batch_directory(const std::string &path,
+                                 const std::string &output_dir,
+                                 std::vector<BatchJob> &jobs)
+{
+    std::vector<std::string> names;
+
+    if (!mb::io::list_files(path, names)) {
+        fprintf(stderr, "%s\n", mb::io::last_error_string().c_str());
         return false;
     }
 
-    if (!read_header(paths.header, header)) {
-        return false;
+    // Process images in a deterministic order
+    std::sort(names.begin(), names.end());
+
+    for (auto const &name : names) {
+        BatchJob job;
+        job.action = BatchAction::Unpack;
+        job.image = mb::io::path_join({path, name});
+        job.directory = mb::io::path_join({output_dir, name});
+
+        jobs.push_back(std::move(job));
     }
 
-    ret = writer.write_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
-        return false;
+    return true;
+}
+
+/*!
+ * \brief Process batch jobs until none are left
+ *
+ * Each worker has its own Reader and Writer, which are reused for every job
+ * that the worker processes.
+ */
+static void batch_worker(const std::vector<BatchJob> &jobs,
+                         std::vector<BatchResult> &results,
+                         std::atomic<size_t> &next_job,
+                         const char *unpack_type, const char *pack_type)
+{
+    Reader reader;
+    Writer writer;
+
+    // The formats were already validated by the caller
+    if (!enable_reader_formats(reader, unpack_type)) {
+        return;
     }
 
-    while (true) {
-        ret = writer.get_entry(entry);
-        if (!ret) {
-            if (ret.error() == WriterError::EndOfEntries) {
-                break;
+    size_t i;
+
+    while ((i = next_job.fetch_add(1)) < jobs.size()) {
+        auto const &job = jobs[i];
+        auto &result = results[i];
+
+        Paths paths;
+        prepend_if_empty(paths, job.directory, "");
+
+        auto start = std::chrono::steady_clock::now();
+
+        switch (job.action) {
+        case BatchAction::Unpack:
+            result.success = unpack_image(reader, job.image, job.directory,
+                                          paths, &result.format);
+            break;
+        case BatchAction::Pack:
+            result.success = pack_image(writer, pack_type, job.image, paths);
+            result.format = pack_type;
+            break;
+        }
+
+        result.elapsed = std::chrono::steady_clock::now() - start;
+
+        mb::StandardFile file;
+        if (file.open(job.image, mb::FileOpenMode::ReadOnly)) {
+            auto size = file.seek(0, SEEK_END);
+            if (size) {
+                result.bytes = size.value();
             }
-            fprintf(stderr, "Failed to get next entry: %s\n",
-                    ret.error().message().c_str());
+        }
+    }
+}
+
+static void write_json_string(FILE *fp, const std::string &str)
+{
+    fputc('"', fp);
+
+    for (char c : str) {
+        auto uc = static_cast<unsigned char>(c);
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(uc, fp);
+        } else if (uc < 0x20) {
+            fprintf(fp, "\\u%04x", static_cast<unsigned int>(uc));
+        } else {
+            fputc(uc, fp);
+        }
+    }
+
+    fputc('"', fp);
+}
+
+static double to_ms(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static bool write_batch_summary(FILE *fp, unsigned int threads,
+                                const std::vector<BatchJob> &jobs,
+                                const std::vector<BatchResult> &results,
+                                std::chrono::steady_clock::duration elapsed)
+{
+    auto succeeded = std::count_if(results.begin(), results.end(),
+                                   [](const BatchResult &r) {
+        return r.success;
+    });
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"jobs\": %u,\n", threads);
+    fprintf(fp, "  \"succeeded\": %zu,\n", static_cast<size_t>(succeeded));
+    fprintf(fp, "  \"failed\": %zu,\n", results.size()
+            - static_cast<size_t>(succeeded));
+    fprintf(fp, "  \"elapsed_ms\": %.3f,\n", to_ms(elapsed));
+    fprintf(fp, "  \"results\": [");
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto const &job = jobs[i];
+        auto const &result = results[i];
+
+        double ms = to_ms(result.elapsed);
+        double mib_s = ms > 0
+                ? static_cast<double>(result.bytes) / 1024 / 1024 / ms * 1000
+                : 0;
+
+        fprintf(fp, "%s\n    {\n", i == 0 ? "" : ",");
+        fprintf(fp, "      \"action\": \"%s\",\n",
+                job.action == BatchAction::Pack ? "pack" : "unpack");
+        fprintf(fp, "      \"image\": ");
+        write_json_string(fp, job.image);
+        fprintf(fp, ",\n      \"directory\": ");
+        write_json_string(fp, job.directory);
+        fprintf(fp, ",\n      \"success\": %s,\n",
+                result.success ? "true" : "false");
+        fprintf(fp, "      \"format\": ");
+        write_json_string(fp, result.format);
+        fprintf(fp, ",\n      \"bytes\": %" PRIu64 ",\n", result.bytes);
+        fprintf(fp, "      \"elapsed_ms\": %.3f,\n", ms);
+        fprintf(fp, "      \"throughput_mib_s\": %.3f\n", mib_s);
+        fprintf(fp, "    }");
+    }
+
+    fprintf(fp, "%s]\n}\n", jobs.empty() ? "" : "\n  ");
+
+    return !ferror(fp);
+}
+
+static bool batch_main(int argc, char *argv[])
+{
+    int opt;
+    std::string input;
+    std::string output_dir;
+    std::string summary_file;
+    unsigned int threads = 0;
+    const char *type = nullptr;
+
+    static const char short_options[] = "o:j:s:t:" "h";
+
+    static struct option long_options[] = {
+        {"output",  required_argument, nullptr, 'o'},
+        {"jobs",    required_argument, nullptr, 'j'},
+        {"summary", required_argument, nullptr, 's'},
+        {"type",    required_argument, nullptr, 't'},
+        {"help",    no_argument,       nullptr, 'h'},
+        {nullptr,   0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'o':
+            output_dir = optarg;
+            break;
+
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, threads) || threads == 0) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return false;
+            }
+            break;
+
+        case 's':
+            summary_file = optarg;
+            break;
+
+        case 't':
+            type = optarg;
+            break;
+
+        case 'h':
+            fputs(HELP_BATCH_USAGE, stdout);
+            return true;
+
+        default:
+            fputs(HELP_BATCH_USAGE, stderr);
             return false;
         }
+    }
 
-        if (!write_file_to_entry(paths, writer, entry)) {
+    // There should be one other argument
+    if (argc - optind != 1) {
+        fputs(HELP_BATCH_USAGE, stderr);
+        return false;
+    }
+
+    input = argv[optind];
+
+    if (output_dir.empty()) {
+        output_dir = ".";
+    }
+
+    const char *pack_type = type ? type : FORMAT_NAME_ANDROID;
+
+    // Validate the formats once instead of failing every job
+    {
+        Reader reader;
+        Writer writer;
+
+        if (!enable_reader_formats(reader, type)) {
+            return false;
+        }
+        if (!writer.set_format_by_name(pack_type)) {
+            fprintf(stderr, "Invalid boot image type: %s\n", pack_type);
             return false;
         }
     }
 
-    ret = writer.close();
-    if (!ret) {
-        fprintf(stderr, "Failed to close boot image: %s\n",
-                ret.error().message().c_str());
+    std::vector<BatchJob> jobs;
+
+    if (mb::io::is_directory(input)) {
+        if (!load_batch_directory(input, output_dir, jobs)) {
+            return false;
+        }
+    } else if (!load_batch_manifest(input, output_dir, jobs)) {
         return false;
     }
 
-    return true;
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    if (threads > jobs.size()) {
+        threads = std::max<unsigned int>(
+                static_cast<unsigned int>(jobs.size()), 1u);
+    }
+
+    std::vector<BatchResult> results(jobs.size());
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back(batch_worker, std::cref(jobs), std::ref(results),
+                             std::ref(next_job), type, pack_type);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ScopedFILE fp(nullptr, fclose);
+    FILE *summary_fp = stdout;
+
+    if (!summary_file.empty()) {
+        fp.reset(fopen(summary_file.c_str(), "wb"));
+        if (!fp) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    summary_file.c_str(), strerror(errno));
+            return false;
+        }
+        summary_fp = fp.get();
+    }
+
+    if (!write_batch_summary(summary_fp, threads, jobs, results, elapsed)) {
+        fprintf(stderr, "Failed to write summary: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (fp && fclose(fp.release()) != 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                summary_file.c_str(), strerror(errno));
+        return false;
+    }
+
+    return std::all_of(results.begin(), results.end(),
+                       [](const BatchResult &r) {
+        return r.success;
+    });
 }
 
 int main(int argc, char *argv[])
@@ -1175,6 +1852,8 @@ int main(int argc, char *argv[])
         ret = unpack_main(--argc, ++argv);
     } else if (command == "pack") {
         ret = pack_main(--argc, ++argv);
+    } else if (command == "batch") {
+        ret = batch_main(--argc, ++argv);
     } else {
         fputs(HELP_MAIN_USAGE, stderr);
         return EXIT_FAILURE;
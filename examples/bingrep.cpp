@@ -20,7 +20,9 @@
 #include "mbcommon/file_util.h"
 
 #include <limits>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -37,15 +39,22 @@
 
 static void usage(FILE *stream, const char *prog_name)
 {
-    fprintf(stream, "Usage: %s {-p <hex> | -t <text>} [option...] [<file>...]\n"
+    fprintf(stream, "Usage: %s {-p <hex> | -t <text>}... [option...] [<file>...]\n"
                     "\n"
                     "Options:\n"
                     "  -p, --hex <hex pattern>\n"
                     "                  Search file for hex pattern\n"
                     "  -t, --text <text pattern>\n"
                     "                  Search file for text pattern\n"
+                    "\n"
+                    "  Multiple patterns can be specified and will be searched\n"
+                    "  for in a single pass.\n"
+                    "\n"
                     "  -n, --num-matches\n"
                     "                  Maximum number of matches\n"
+                    "  -j, --jobs <threads>\n"
+                    "                  Search files with multiple threads (0 = number of\n"
+                    "                  CPUs). Only used with a single pattern.\n"
                     "  --start-offset  Starting boundary offset for search\n"
                     "  --end-offset    Ending boundary offset for search\n"
                     "  --buffer-size   Buffer size\n",
@@ -65,57 +74,79 @@ static int ascii_to_hex(char c)
     }
 }
 
-static bool hex_to_binary(const char *hex, void **data, size_t *data_size)
+static bool hex_to_binary(const char *hex, std::string &data_out)
 {
     size_t size = strlen(hex);
-    unsigned char *buf;
+    std::string data;
 
     if (size & 1) {
         errno = EINVAL;
         return false;
     }
 
-    buf = static_cast<unsigned char *>(malloc(size / 2));
-    if (!buf) {
-        return false;
-    }
+    data.reserve(size / 2);
 
     for (size_t i = 0; i < size; i += 2) {
         int hi = ascii_to_hex(hex[i]);
         int lo = ascii_to_hex(hex[i + 1]);
 
         if (hi < 0 || lo < 0) {
-            free(buf);
             errno = EINVAL;
             return false;
         }
 
-        buf[i / 2] = static_cast<unsigned char>((hi << 4) | lo);
+        data += static_cast<char>((hi << 4) | lo);
     }
 
-    *data = buf;
-    *data_size = size / 2;
+    data_out.swap(data);
 
     return true;
 }
 
+struct SearchContext
+{
+    const char *name;
+    const std::vector<mb::FileSearchPattern> *patterns;
+};
+
 static mb::oc::result<mb::FileSearchAction>
-search_result_cb(mb::File &file, void *userdata, uint64_t offset)
+search_result_cb(mb::File &file, void *userdata, size_t index, uint64_t offset)
 {
     (void) file;
-    const char *name = static_cast<char *>(userdata);
-    printf("%s: 0x%016" PRIx64 "\n", name, offset);
+    auto ctx = static_cast<SearchContext *>(userdata);
+
+    if (ctx->patterns->size() > 1) {
+        printf("%s: 0x%016" PRIx64 ": pattern %zu\n", ctx->name, offset, index);
+    } else {
+        printf("%s: 0x%016" PRIx64 "\n", ctx->name, offset);
+    }
+
     return mb::FileSearchAction::Continue;
 }
 
+static mb::oc::result<mb::FileSearchAction>
+parallel_search_result_cb(mb::File &file, void *userdata, uint64_t offset)
+{
+    return search_result_cb(file, userdata, 0, offset);
+}
+
 static bool search(const char *name, mb::File &file,
-                   int64_t start, int64_t end,
-                   size_t bsize, const void *pattern,
-                   size_t pattern_size, int64_t max_matches)
+                   int64_t start, int64_t end, size_t bsize,
+                   const std::vector<mb::FileSearchPattern> &patterns,
+                   int64_t max_matches, unsigned int jobs)
 {
-    auto ret = mb::file_search(file, start, end, bsize, pattern, pattern_size,
-                               max_matches, &search_result_cb,
-                               const_cast<char *>(name));
+    SearchContext ctx{name, &patterns};
+    mb::oc::result<void> ret = mb::oc::success();
+
+    if (jobs != 1 && patterns.size() == 1) {
+        ret = mb::file_search_parallel(file, start, end, bsize,
+                                       patterns[0].data, patterns[0].size,
+                                       max_matches, jobs,
+                                       &parallel_search_result_cb, &ctx);
+    } else {
+        ret = mb::file_search_multi(file, start, end, bsize, patterns,
+                                    max_matches, &search_result_cb, &ctx);
+    }
     if (!ret) {
         fprintf(stderr, "%s: Search failed: %s\n",
                 name, ret.error().message().c_str());
@@ -124,9 +155,9 @@ static bool search(const char *name, mb::File &file,
     return true;
 }
 
-static bool search_stdin(int64_t start, int64_t end,
-                         size_t bsize, const void *pattern,
-                         size_t pattern_size, int64_t max_matches)
+static bool search_stdin(int64_t start, int64_t end, size_t bsize,
+                         const std::vector<mb::FileSearchPattern> &patterns,
+                         int64_t max_matches)
 {
     mb::PosixFile file;
 
@@ -137,13 +168,14 @@ static bool search_stdin(int64_t start, int64_t end,
         return false;
     }
 
-    return search("stdin", file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    // stdin may not be seekable, so always search it sequentially
+    return search("stdin", file, start, end, bsize, patterns, max_matches, 1);
 }
 
 static bool search_file(const char *path, int64_t start, int64_t end,
-                        size_t bsize, const void *pattern,
-                        size_t pattern_size, int64_t max_matches)
+                        size_t bsize,
+                        const std::vector<mb::FileSearchPattern> &patterns,
+                        int64_t max_matches, unsigned int jobs)
 {
     mb::StandardFile file;
 
@@ -154,8 +186,8 @@ static bool search_file(const char *path, int64_t start, int64_t end,
         return false;
     }
 
-    return search(path, file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    return search(path, file, start, end, bsize, patterns, max_matches,
+                  jobs);
 }
 
 int main(int argc, char *argv[])
@@ -164,12 +196,10 @@ int main(int argc, char *argv[])
     int64_t end = -1;
     size_t bsize = 0;
     int64_t max_matches = -1;
+    unsigned int jobs = 1;
 
-    const char *text_pattern = nullptr;
-    const char *hex_pattern = nullptr;
-    void *pattern = nullptr;
-    size_t pattern_size = 0;
-    bool pattern_needs_free = false;
+    std::vector<std::string> pattern_data;
+    std::vector<mb::FileSearchPattern> patterns;
 
     int opt;
 
@@ -181,11 +211,12 @@ int main(int argc, char *argv[])
         OPT_BUFFER_SIZE          = CHAR_MAX + 3,
     };
 
-    static const char short_options[] = "hn:p:t:";
+    static const char short_options[] = "hj:n:p:t:";
 
     static struct option long_options[] = {
         // Arguments with short versions
         {"help",         no_argument,       nullptr, 'h'},
+        {"jobs",         required_argument, nullptr, 'j'},
         {"num-matches",  required_argument, nullptr, 'n'},
         {"hex",          required_argument, nullptr, 'p'},
         {"text",         required_argument, nullptr, 't'},
@@ -201,6 +232,13 @@ int main(int argc, char *argv[])
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs)) {
+                fprintf(stderr, "Invalid value for -j/--jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
         case 'n':
             if (!mb::str_to_num(optarg, 10, max_matches)) {
                 fprintf(stderr, "Invalid value for -n/--num-matches: %s\n",
@@ -210,11 +248,15 @@ int main(int argc, char *argv[])
             break;
 
         case 'p':
-            hex_pattern = optarg;
+            pattern_data.emplace_back();
+            if (!hex_to_binary(optarg, pattern_data.back())) {
+                fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
             break;
 
         case 't':
-            text_pattern = optarg;
+            pattern_data.emplace_back(optarg);
             break;
 
         case OPT_START_OFFSET:
@@ -251,38 +293,28 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!hex_pattern && !text_pattern) {
+    if (pattern_data.empty()) {
         fprintf(stderr, "No pattern provided\n");
         return EXIT_FAILURE;
-    } else if (hex_pattern) {
-        if (!hex_to_binary(hex_pattern, &pattern, &pattern_size)) {
-            fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
-            return EXIT_FAILURE;
-        }
-        pattern_needs_free = true;
-    } else if (text_pattern) {
-        pattern = const_cast<char *>(text_pattern);
-        pattern_size = strlen(text_pattern);
+    }
+
+    for (auto const &data : pattern_data) {
+        patterns.push_back({data.data(), data.size()});
     }
 
     bool ret = true;
 
     if (optind == argc) {
-        ret = search_stdin(start, end, bsize, pattern, pattern_size,
-                           max_matches);
+        ret = search_stdin(start, end, bsize, patterns, max_matches);
     } else {
         for (int i = optind; i < argc; ++i) {
-            bool ret2 = search_file(argv[i], start, end, bsize, pattern,
-                                    pattern_size, max_matches);
+            bool ret2 = search_file(argv[i], start, end, bsize, patterns,
+                                    max_matches, jobs);
             if (!ret2) {
                 ret = false;
             }
         }
     }
 
-    if (pattern_needs_free) {
-        free(pattern);
-    }
-
     return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -48,6 +48,8 @@ public:
     int type() override;
     std::string name() override;
 
+    std::vector<detail::ProbeRange> probe_ranges() override;
+
     oc::result<void> set_option(const char *key, const char *value) override;
     oc::result<int> open(File &file, int best_bid) override;
     oc::result<void> close(File &file) override;
@@ -55,6 +57,7 @@ public:
     oc::result<void> read_entry(File &file, Entry &entry) override;
     oc::result<void> go_to_entry(File &file, Entry &entry, int entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<EntryExtent> entry_extent(File &file) override;
 
     static oc::result<void>
     find_header(Reader &reader, File &file,
@@ -21,8 +21,7 @@
 
 #include "mbbootimg/guard_p.h"
 
-#include <openssl/sha.h>
-
+#include "mbcommon/hash.h"
 #include "mbcommon/optional.h"
 
 #include "mbbootimg/format/android_p.h"
@@ -65,7 +64,7 @@ private:
     // Header values
     AndroidHeader m_hdr;
 
-    SHA_CTX m_sha_ctx;
+    Hasher m_hasher;
 
     optional<SegmentWriter> m_seg;
 };
@@ -23,8 +23,7 @@
 
 #include <vector>
 
-#include <openssl/sha.h>
-
+#include "mbcommon/hash.h"
 #include "mbcommon/optional.h"
 
 #include "mbbootimg/format/android_p.h"
@@ -67,7 +66,7 @@ private:
 
     std::vector<unsigned char> m_aboot;
 
-    SHA_CTX m_sha_ctx;
+    Hasher m_hasher;
 
     optional<SegmentWriter> m_seg;
 };
@@ -64,6 +64,7 @@ public:
                                  Reader &reader);
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size,
                                  Reader &reader);
+    oc::result<EntryExtent> entry_extent(File &file, Reader &reader);
 
 private:
     SegmentReaderState m_state;
@@ -46,12 +46,15 @@ public:
     int type() override;
     std::string name() override;
 
+    std::vector<detail::ProbeRange> probe_ranges() override;
+
     oc::result<int> open(File &file, int best_bid) override;
     oc::result<void> close(File &file) override;
     oc::result<void> read_header(File &file, Header &header) override;
     oc::result<void> read_entry(File &file, Entry &entry) override;
     oc::result<void> go_to_entry(File &file, Entry &entry, int entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<EntryExtent> entry_extent(File &file) override;
 
     static oc::result<void>
     find_sony_elf_header(Reader &reader, File &file,
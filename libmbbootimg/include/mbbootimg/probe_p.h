@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+#include "mbcommon/optional.h"
+
+#include "mbbootimg/reader_p.h"
+
+namespace mb
+{
+namespace bootimg
+{
+namespace detail
+{
+
+class ProbeFile : public File
+{
+public:
+    ProbeFile();
+    ProbeFile(File *file, const std::vector<ProbeRange> &ranges);
+    virtual ~ProbeFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProbeFile)
+
+    oc::result<void> open(File *file, const std::vector<ProbeRange> &ranges);
+
+    uint64_t underlying_reads() const;
+
+    std::pair<const void *, size_t> mapping() const override;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    struct Segment
+    {
+        uint64_t offset;
+        std::vector<unsigned char> data;
+    };
+
+    oc::result<uint64_t> file_size();
+    oc::result<void> fetch(uint64_t offset, size_t size);
+
+    File *m_file;
+    std::vector<ProbeRange> m_ranges;
+
+    // Cached ranges, sorted by offset and non-overlapping
+    std::vector<Segment> m_segments;
+    optional<uint64_t> m_size;
+    uint64_t m_offset;
+    uint64_t m_underlying_reads;
+};
+
+}
+}
+}
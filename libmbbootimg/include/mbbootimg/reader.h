@@ -42,6 +42,24 @@ namespace bootimg
 class Entry;
 class Header;
 
+/*!
+ * \brief Location of an entry's data in the boot image file
+ */
+struct EntryExtent
+{
+    /*! \brief Offset of the entry data in the file */
+    uint64_t offset;
+    /*! \brief Size of the entry data */
+    uint64_t size;
+    /*!
+     * \brief Whether the entry data is stored as-is in the byte range
+     *
+     * If false, the byte range only describes where the entry is located and
+     * Reader::read_data() must be used to get the data.
+     */
+    bool contiguous;
+};
+
 class MB_EXPORT Reader
 {
 public:
@@ -65,6 +83,7 @@ public:
     oc::result<void> read_entry(Entry &entry);
     oc::result<void> go_to_entry(Entry &entry, int entry_type);
     oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<EntryExtent> entry_extent();
 
     // Format operations
     int format_code();
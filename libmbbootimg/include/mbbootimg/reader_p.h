@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
@@ -35,10 +36,22 @@ class File;
 namespace bootimg
 {
 class Reader;
+struct EntryExtent;
 
 namespace detail
 {
 
+/*!
+ * \brief Byte range of a boot image that a format reader needs for bidding
+ */
+struct ProbeRange
+{
+    /*! \brief Offset of range (relative to end of file if negative) */
+    int64_t offset;
+    /*! \brief Size of range */
+    size_t size;
+};
+
 class FormatReader
 {
 public:
@@ -53,6 +66,8 @@ public:
 
     virtual oc::result<void>
     set_option(const char *key, const char *value);
+    virtual std::vector<ProbeRange>
+    probe_ranges();
     virtual oc::result<int>
     open(File &file, int best_bid) = 0;
     virtual oc::result<void>
@@ -65,6 +80,8 @@ public:
     go_to_entry(File &file, Entry &entry, int entry_type);
     virtual oc::result<size_t>
     read_data(File &file, void *buf, size_t buf_size) = 0;
+    virtual oc::result<EntryExtent>
+    entry_extent(File &file);
 
 protected:
     Reader &m_reader;
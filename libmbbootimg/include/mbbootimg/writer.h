@@ -79,6 +79,10 @@ public:
     oc::result<void> set_format_mtk();
     oc::result<void> set_format_sony_elf();
 
+    // Output options
+    oc::result<void> set_streaming(bool streaming);
+    bool is_streaming();
+
     // Writer state
     bool is_open();
     bool is_fatal();
@@ -94,6 +98,10 @@ private:
     std::unique_ptr<File> m_owned_file;
     File *m_file;
 
+    // Streaming output
+    bool m_streaming;
+    std::unique_ptr<detail::StagedOutput> m_staged;
+
     std::unique_ptr<detail::FormatWriter> m_format;
 };
 
@@ -41,6 +41,8 @@ enum class WriterError
     NoFormatRegistered      = 33,
 
     EndOfEntries            = 40,
+
+    UnsupportedReplace      = 50,
 };
 
 MB_EXPORT std::error_code make_error_code(WriterError e);
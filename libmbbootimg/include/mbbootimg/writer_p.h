@@ -74,6 +74,8 @@ protected:
     Writer &m_writer;
 };
 
+struct StagedOutput;
+
 enum class WriterState : uint8_t
 {
     New     = 1u << 1,
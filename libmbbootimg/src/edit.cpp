@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/edit.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/hash.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/align_p.h"
+#include "mbbootimg/format/android_error.h"
+#include "mbbootimg/format/android_reader_p.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer_error.h"
+
+/*!
+ * \file mbbootimg/edit.h
+ * \brief In-place boot image editing API
+ */
+
+namespace mb
+{
+namespace bootimg
+{
+
+using namespace android;
+
+/*! \brief Size of the buffer used for copying and hashing entry data */
+static constexpr size_t EDIT_BUF_SIZE = 65536;
+
+static oc::result<void> write_zeros(File &file, uint64_t size)
+{
+    static const char zeros[4096] = {};
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), size));
+        OUTCOME_TRYV(file_write_exact(file, zeros, n));
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> copy_data(File &input, File &output, uint64_t size,
+                                  char *buf, size_t buf_size)
+{
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(buf_size, size));
+        OUTCOME_TRYV(file_read_exact(input, buf, n));
+        OUTCOME_TRYV(file_write_exact(output, buf, n));
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> hash_data(Hasher &hasher, File &file, uint64_t offset,
+                                  uint64_t size, char *buf, size_t buf_size)
+{
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(buf_size, size));
+        OUTCOME_TRYV(file_read_exact(file, buf, n));
+
+        if (!hasher.update(buf, n)) {
+            return AndroidError::Sha1UpdateError;
+        }
+
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> replace_android_entry(File &file, int entry_type,
+                                              File &data, uint64_t data_size)
+{
+    // Only used for reporting fatal errors, which don't matter here
+    Reader reader;
+    AndroidHeader hdr;
+    uint64_t header_offset;
+
+    OUTCOME_TRYV(AndroidFormatReader::find_header(
+            reader, file, MAX_HEADER_OFFSET, hdr, header_offset));
+
+    if (hdr.page_size == 0 || (hdr.page_size & (hdr.page_size - 1)) != 0) {
+        return AndroidError::InvalidPageSize;
+    }
+
+    // Segments in the order they appear in the file
+    const int types[] = {
+        ENTRY_TYPE_KERNEL,
+        ENTRY_TYPE_RAMDISK,
+        ENTRY_TYPE_SECONDBOOT,
+        ENTRY_TYPE_DEVICE_TREE,
+    };
+    uint32_t * const sizes[] = {
+        &hdr.kernel_size,
+        &hdr.ramdisk_size,
+        &hdr.second_size,
+        &hdr.dt_size,
+    };
+    constexpr size_t count = sizeof(types) / sizeof(types[0]);
+
+    auto it = std::find(std::begin(types), std::end(types), entry_type);
+    if (it == std::end(types)) {
+        return WriterError::UnsupportedReplace;
+    }
+    auto index = static_cast<size_t>(it - std::begin(types));
+
+    if (data_size > UINT32_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto aligned = [&](uint64_t size) {
+        return size + align_page_size<uint64_t>(size, hdr.page_size);
+    };
+
+    // Offset of the first segment
+    uint64_t begin = aligned(header_offset + sizeof(AndroidHeader));
+
+    uint64_t offset = begin;
+    for (size_t i = 0; i < index; ++i) {
+        offset += aligned(*sizes[i]);
+    }
+
+    // Everything after the segment, including the following segments and the
+    // SEAndroid or Bump magic, is shifted if the page-aligned size changes
+    OUTCOME_TRY(file_size, file.seek(0, SEEK_END));
+
+    uint64_t old_tail = offset + aligned(*sizes[index]);
+    uint64_t new_tail = offset + aligned(data_size);
+    uint64_t tail_size = file_size > old_tail ? file_size - old_tail : 0;
+
+    if (new_tail != old_tail && tail_size > 0) {
+        OUTCOME_TRY(n, file_move(file, old_tail, new_tail, tail_size));
+        if (n != tail_size) {
+            return FileError::UnexpectedEof;
+        }
+    }
+
+    std::unique_ptr<char[]> buf(new char[EDIT_BUF_SIZE]);
+
+    // Write new data and clear the old data in the page padding
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+    OUTCOME_TRYV(copy_data(data, file, data_size, buf.get(), EDIT_BUF_SIZE));
+    OUTCOME_TRYV(write_zeros(file, new_tail - offset - data_size));
+
+    if (new_tail < old_tail && file_size > new_tail + tail_size) {
+        OUTCOME_TRYV(file.truncate(new_tail + tail_size));
+    }
+
+    *sizes[index] = static_cast<uint32_t>(data_size);
+
+    // Recompute the ID the same way as AndroidFormatWriter
+    Hasher hasher;
+    if (!hasher.init(HashAlgorithm::Sha1, HashFlag::Background)) {
+        return AndroidError::Sha1InitError;
+    }
+
+    offset = begin;
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRYV(hash_data(hasher, file, offset, *sizes[i], buf.get(),
+                               EDIT_BUF_SIZE));
+
+        // Include size for everything except empty DT images
+        uint32_t le32_size = mb_htole32(*sizes[i]);
+        if ((types[i] != ENTRY_TYPE_DEVICE_TREE || *sizes[i] > 0)
+                && !hasher.update(&le32_size, sizeof(le32_size))) {
+            return AndroidError::Sha1UpdateError;
+        }
+
+        offset += aligned(*sizes[i]);
+    }
+
+    auto digest = hasher.finish();
+    if (!digest) {
+        return AndroidError::Sha1UpdateError;
+    }
+    memcpy(hdr.id, digest.value().data(), digest.value().size());
+
+    // Convert fields back to little-endian
+    android_fix_header_byte_order(hdr);
+
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(header_offset), SEEK_SET));
+    OUTCOME_TRYV(file_write_exact(file, &hdr, sizeof(hdr)));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Replace an entry in an existing boot image
+ *
+ * Unlike reading the boot image and writing a new one with Writer, this only
+ * rewrites the specified entry and the data that follows it. If the
+ * page-aligned size of the entry does not change, then the following data is
+ * not touched at all. Otherwise, it is moved with file_move(). The header is
+ * updated with the new entry size and ID.
+ *
+ * This is currently only supported for Android and Bump boot images. If the
+ * boot image is in any other format or the format does not have an entry of
+ * type \p entry_type, WriterError::UnsupportedReplace is returned.
+ *
+ * \note If an error occurs, the boot image may be left in an inconsistent
+ *       state.
+ *
+ * \param file Boot image file opened for reading and writing. It must be
+ *             seekable.
+ * \param entry_type Type of entry to replace
+ * \param data File to read the new entry data from. The data is read from
+ *             the current file position.
+ * \param data_size Size of the new entry data
+ *
+ * \return Nothing if the entry is successfully replaced. Otherwise, the error
+ *         code.
+ */
+oc::result<void> replace_entry(File &file, int entry_type,
+                               File &data, uint64_t data_size)
+{
+    int format;
+
+    {
+        Reader reader;
+
+        OUTCOME_TRYV(reader.enable_format_all());
+        OUTCOME_TRYV(reader.open(&file));
+
+        format = reader.format_code();
+    }
+
+    switch (format) {
+    case FORMAT_ANDROID:
+    case FORMAT_BUMP:
+        return replace_android_entry(file, entry_type, data, data_size);
+    default:
+        return WriterError::UnsupportedReplace;
+    }
+}
+
+}
+}
@@ -78,6 +78,15 @@ std::string AndroidFormatReader::name()
     }
 }
 
+std::vector<detail::ProbeRange> AndroidFormatReader::probe_ranges()
+{
+    // The Samsung SEAndroid and Bump magic strings are located after the
+    // image data, so they can only be found after the header is read
+    return {
+        { 0, MAX_HEADER_OFFSET + sizeof(AndroidHeader) },
+    };
+}
+
 oc::result<void> AndroidFormatReader::set_option(const char *key,
                                                  const char *value)
 {
@@ -199,6 +208,11 @@ oc::result<size_t> AndroidFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<EntryExtent> AndroidFormatReader::entry_extent(File &file)
+{
+    return m_seg->entry_extent(file, m_reader);
+}
+
 /*!
  * \brief Find and read Android boot image header
  *
@@ -230,7 +244,9 @@ AndroidFormatReader::find_header(Reader &reader, File &file,
                                  uint64_t &offset_out)
 {
     unsigned char buf[MAX_HEADER_OFFSET + sizeof(AndroidHeader)];
-    void *ptr;
+    const unsigned char *data = buf;
+    size_t data_size;
+    const void *ptr;
     size_t offset;
 
     if (max_header_offset > MAX_HEADER_OFFSET) {
@@ -239,29 +255,44 @@ AndroidFormatReader::find_header(Reader &reader, File &file,
         return AndroidError::InvalidArgument;
     }
 
-    auto seek_ret = file.seek(0, SEEK_SET);
-    if (!seek_ret) {
-        if (file.is_fatal()) { reader.set_fatal(); }
-        return seek_ret.as_failure();
-    }
+    size_t to_search = static_cast<size_t>(max_header_offset)
+            + sizeof(AndroidHeader);
 
-    auto n = file_read_retry(file, buf, static_cast<size_t>(max_header_offset)
-                             + sizeof(AndroidHeader));
-    if (!n) {
-        if (file.is_fatal()) { reader.set_fatal(); }
-        return n.as_failure();
+    auto mapping = file.mapping();
+
+    if (mapping.first) {
+        // Search the mapping directly
+        data = static_cast<const unsigned char *>(mapping.first);
+        data_size = std::min(mapping.second, to_search);
+    } else {
+        auto seek_ret = file.seek(0, SEEK_SET);
+        if (!seek_ret) {
+            if (file.is_fatal()) { reader.set_fatal(); }
+            return seek_ret.as_failure();
+        }
+
+        auto n = file_read_retry(file, buf, to_search);
+        if (!n) {
+            if (file.is_fatal()) { reader.set_fatal(); }
+            return n.as_failure();
+        }
+
+        data_size = n.value();
     }
 
-    ptr = mb_memmem(buf, n.value(), BOOT_MAGIC, BOOT_MAGIC_SIZE);
+    ptr = data_size > 0
+            ? mb_memmem(data, data_size, BOOT_MAGIC, BOOT_MAGIC_SIZE)
+            : nullptr;
     if (!ptr) {
         //DEBUG("Android magic not found in first %" MB_PRIzu " bytes",
         //      MAX_HEADER_OFFSET);
         return AndroidError::HeaderNotFound;
     }
 
-    offset = static_cast<size_t>(static_cast<unsigned char *>(ptr) - buf);
+    offset = static_cast<size_t>(static_cast<const unsigned char *>(ptr)
+            - data);
 
-    if (n.value() - offset < sizeof(AndroidHeader)) {
+    if (data_size - offset < sizeof(AndroidHeader)) {
         //DEBUG("Android header at %" MB_PRIzu " exceeds file size", offset);
         return AndroidError::HeaderOutOfBounds;
     }
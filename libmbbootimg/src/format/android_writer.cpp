@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -53,7 +51,7 @@ AndroidFormatWriter::AndroidFormatWriter(Writer &writer, bool is_bump)
     : FormatWriter(writer)
     , m_is_bump(is_bump)
     , m_hdr()
-    , m_sha_ctx()
+    , m_hasher()
 {
 }
 
@@ -81,7 +79,8 @@ oc::result<void> AndroidFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
+    // Hash on a helper thread so that SHA1 overlaps with the writes
+    if (!m_hasher.init(HashAlgorithm::Sha1, HashFlag::Background)) {
         return AndroidError::Sha1InitError;
     }
 
@@ -94,7 +93,7 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 {
     auto reset_state = finally([&] {
         m_hdr = {};
-        m_sha_ctx = {};
+        m_hasher.reset();
         m_seg = {};
     });
 
@@ -117,12 +116,12 @@ oc::result<void> AndroidFormatWriter::close(File &file)
             }
 
             // Set ID
-            unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            auto digest = m_hasher.finish();
+            if (!digest) {
                 m_writer.set_fatal();
                 return AndroidError::Sha1UpdateError;
             }
-            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
+            memcpy(m_hdr.id, digest.value().data(), digest.value().size());
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -252,7 +251,7 @@ oc::result<size_t> AndroidFormatWriter::write_data(File &file, const void *buf,
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
+    if (!m_hasher.update(buf, n)) {
         // This must be fatal as the write already happened and cannot be
         // reattempted
         m_writer.set_fatal();
@@ -273,7 +272,7 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
 
     // Include size for everything except empty DT images
     if ((swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
+            && !m_hasher.update(&le32_size, sizeof(le32_size))) {
         m_writer.set_fatal();
         return AndroidError::Sha1UpdateError;
     }
@@ -68,6 +68,14 @@ std::string LokiFormatReader::name()
     return FORMAT_NAME_LOKI;
 }
 
+std::vector<detail::ProbeRange> LokiFormatReader::probe_ranges()
+{
+    return {
+        { 0, LOKI_MAX_HEADER_OFFSET + sizeof(android::AndroidHeader) },
+        { LOKI_MAGIC_OFFSET, sizeof(LokiHeader) },
+    };
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -191,6 +199,11 @@ oc::result<size_t> LokiFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<EntryExtent> LokiFormatReader::entry_extent(File &file)
+{
+    return m_seg->entry_extent(file, m_reader);
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
@@ -218,19 +231,32 @@ oc::result<void> LokiFormatReader::find_loki_header(Reader &reader, File &file,
 {
     LokiHeader header;
 
-    auto seek_ret = file.seek(LOKI_MAGIC_OFFSET, SEEK_SET);
-    if (!seek_ret) {
-        if (file.is_fatal()) { reader.set_fatal(); }
-        return seek_ret.as_failure();
-    }
+    auto mapping = file.mapping();
 
-    auto ret = file_read_exact(file, &header, sizeof(header));
-    if (!ret) {
-        if (ret.error() == FileError::UnexpectedEof) {
+    if (mapping.first) {
+        // Copy directly from the mapping
+        if (mapping.second < LOKI_MAGIC_OFFSET
+                || mapping.second - LOKI_MAGIC_OFFSET < sizeof(header)) {
             return LokiError::LokiHeaderTooSmall;
-        } else {
+        }
+
+        memcpy(&header, static_cast<const unsigned char *>(mapping.first)
+               + LOKI_MAGIC_OFFSET, sizeof(header));
+    } else {
+        auto seek_ret = file.seek(LOKI_MAGIC_OFFSET, SEEK_SET);
+        if (!seek_ret) {
             if (file.is_fatal()) { reader.set_fatal(); }
-            return ret.as_failure();
+            return seek_ret.as_failure();
+        }
+
+        auto ret = file_read_exact(file, &header, sizeof(header));
+        if (!ret) {
+            if (ret.error() == FileError::UnexpectedEof) {
+                return LokiError::LokiHeaderTooSmall;
+            } else {
+                if (file.is_fatal()) { reader.set_fatal(); }
+                return ret.as_failure();
+            }
         }
     }
 
@@ -370,51 +396,37 @@ LokiFormatReader::find_gzip_offset_old(Reader &reader, File &file,
     // byte 8   : compression flags
     // byte 9   : operating system
 
-    static const unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
+    static const unsigned char gzip_deflate_flag0[] = { 0x1f, 0x8b, 0x08, 0x00 };
+    static const unsigned char gzip_deflate_flag8[] = { 0x1f, 0x8b, 0x08, 0x08 };
 
     SearchResult result = {};
 
-    // Find first result with flags == 0x00 and flags == 0x08
-    auto result_cb = [](File &file_, void *userdata, uint64_t offset)
-            -> oc::result<FileSearchAction> {
+    // Find first result with flags == 0x00 and flags == 0x08. Both headers are
+    // searched for in a single pass, so there's no need to seek to read the
+    // flags byte for each match.
+    auto result_cb = [](File &file_, void *userdata, size_t index,
+                        uint64_t offset) -> oc::result<FileSearchAction> {
+        (void) file_;
         auto result_ = static_cast<SearchResult *>(userdata);
-        unsigned char flags;
 
-        // Stop early if possible
-        if (result_->flag0_offset && result_->flag8_offset) {
-            return FileSearchAction::Stop;
-        }
-
-        // Save original position
-        OUTCOME_TRY(orig_offset, file_.seek(0, SEEK_CUR));
-
-        // Seek to flags byte
-        OUTCOME_TRYV(file_.seek(static_cast<int64_t>(offset + 3), SEEK_SET));
-
-        // Read next bytes for flags
-        auto ret = file_read_exact(file_, &flags, sizeof(flags));
-        if (!ret) {
-            if (ret.error() == FileError::UnexpectedEof) {
-                return FileSearchAction::Stop;
-            } else {
-                return ret.as_failure();
-            }
-        }
-
-        if (!result_->flag0_offset && flags == 0x00) {
+        if (index == 0 && !result_->flag0_offset) {
             result_->flag0_offset = offset;
-        } else if (!result_->flag8_offset && flags == 0x08) {
+        } else if (index == 1 && !result_->flag8_offset) {
             result_->flag8_offset = offset;
         }
 
-        // Restore original position as per contract
-        OUTCOME_TRYV(file_.seek(static_cast<int64_t>(orig_offset), SEEK_SET));
+        // Stop early if possible
+        if (result_->flag0_offset && result_->flag8_offset) {
+            return FileSearchAction::Stop;
+        }
 
         return FileSearchAction::Continue;
     };
 
-    auto ret = file_search(file, start_offset, -1, 0, gzip_deflate_magic,
-                           sizeof(gzip_deflate_magic), -1, result_cb, &result);
+    auto ret = file_search_multi(file, start_offset, -1, 0, {
+        { gzip_deflate_flag0, sizeof(gzip_deflate_flag0) },
+        { gzip_deflate_flag8, sizeof(gzip_deflate_flag8) },
+    }, -1, result_cb, &result);
     if (!ret) {
         if (file.is_fatal()) { reader.set_fatal(); }
         return ret.as_failure();
@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -55,7 +53,7 @@ constexpr size_t MAX_ABOOT_SIZE = 2 * 1024 * 1024;
 LokiFormatWriter::LokiFormatWriter(Writer &writer)
     : FormatWriter(writer)
     , m_hdr()
-    , m_sha_ctx()
+    , m_hasher()
 {
 }
 
@@ -75,7 +73,7 @@ oc::result<void> LokiFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
+    if (!m_hasher.init(HashAlgorithm::Sha1, HashFlag::Background)) {
         return android::AndroidError::Sha1InitError;
     }
 
@@ -89,7 +87,7 @@ oc::result<void> LokiFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_aboot.clear();
-        m_sha_ctx = {};
+        m_hasher.reset();
         m_seg = {};
     });
 
@@ -112,12 +110,12 @@ oc::result<void> LokiFormatWriter::close(File &file)
             }
 
             // Set ID
-            unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            auto digest = m_hasher.finish();
+            if (!digest) {
                 m_writer.set_fatal();
                 return android::AndroidError::Sha1UpdateError;
             }
-            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
+            memcpy(m_hdr.id, digest.value().data(), digest.value().size());
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -265,7 +263,7 @@ oc::result<size_t> LokiFormatWriter::write_data(File &file, const void *buf,
 
         // We always include the image in the hash. The size is sometimes
         // included and is handled in finish_entry().
-        if (!SHA1_Update(&m_sha_ctx, buf, n)) {
+        if (!m_hasher.update(buf, n)) {
             // This must be fatal as the write already happened and cannot be
             // reattempted
             m_writer.set_fatal();
@@ -287,7 +285,7 @@ oc::result<void> LokiFormatWriter::finish_entry(File &file)
 
     // Include fake 0 size for unsupported secondboot image
     if (swentry->type == ENTRY_TYPE_DEVICE_TREE
-            && !SHA1_Update(&m_sha_ctx, "\x00\x00\x00\x00", 4)) {
+            && !m_hasher.update("\x00\x00\x00\x00", 4)) {
         m_writer.set_fatal();
         return android::AndroidError::Sha1UpdateError;
     }
@@ -295,7 +293,7 @@ oc::result<void> LokiFormatWriter::finish_entry(File &file)
     // Include size for everything except empty DT images
     if (swentry->type != ENTRY_TYPE_ABOOT
             && (swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
+            && !m_hasher.update(&le32_size, sizeof(le32_size))) {
         m_writer.set_fatal();
         return android::AndroidError::Sha1UpdateError;
     }
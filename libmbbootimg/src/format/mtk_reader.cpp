@@ -181,6 +181,15 @@ std::string MtkFormatReader::name()
     return FORMAT_NAME_MTK;
 }
 
+std::vector<detail::ProbeRange> MtkFormatReader::probe_ranges()
+{
+    // The MTK headers are located at the beginning of the kernel and ramdisk
+    // images, so they can only be found after the Android header is read
+    return {
+        { 0, android::MAX_HEADER_OFFSET + sizeof(android::AndroidHeader) },
+    };
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -353,6 +362,11 @@ oc::result<size_t> MtkFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<EntryExtent> MtkFormatReader::entry_extent(File &file)
+{
+    return m_seg->entry_extent(file, m_reader);
+}
+
 }
 
 /*!
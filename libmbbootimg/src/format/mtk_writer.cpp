@@ -26,12 +26,11 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/hash.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/android_error.h"
@@ -77,15 +76,16 @@ _mtk_header_update_size(Writer &writer, File &file,
 
 static oc::result<void>
 _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
-                  File &file, unsigned char digest[SHA_DIGEST_LENGTH])
+                  File &file, unsigned char *digest)
 {
-    SHA_CTX sha_ctx;
+    Hasher hasher;
     char buf[10240];
 
     uint32_t kernel_mtkhdr_size = 0;
     uint32_t ramdisk_mtkhdr_size = 0;
 
-    if (!SHA1_Init(&sha_ctx)) {
+    // Hash on a helper thread so that SHA1 overlaps with the reads
+    if (!hasher.init(HashAlgorithm::Sha1, HashFlag::Background)) {
         return android::AndroidError::Sha1InitError;
     }
 
@@ -109,7 +109,7 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
                 return ret.as_failure();
             }
 
-            if (!SHA1_Update(&sha_ctx, buf, static_cast<size_t>(to_read))) {
+            if (!hasher.update(buf, static_cast<size_t>(to_read))) {
                 return android::AndroidError::Sha1UpdateError;
             }
 
@@ -145,15 +145,18 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
             continue;
         }
 
-        if (!SHA1_Update(&sha_ctx, &le32_size, sizeof(le32_size))) {
+        if (!hasher.update(&le32_size, sizeof(le32_size))) {
             return android::AndroidError::Sha1UpdateError;
         }
     }
 
-    if (!SHA1_Final(digest, &sha_ctx)) {
+    auto result = hasher.finish();
+    if (!result) {
         return android::AndroidError::Sha1UpdateError;
     }
 
+    memcpy(digest, result.value().data(), result.value().size());
+
     return oc::success();
 }
 
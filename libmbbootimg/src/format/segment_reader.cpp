@@ -176,5 +176,44 @@ oc::result<size_t> SegmentReader::read_data(File &file, void *buf,
     return n.value();
 }
 
+oc::result<EntryExtent> SegmentReader::entry_extent(File &file,
+                                                    Reader &reader)
+{
+    if (m_state != SegmentReaderState::Entries
+            || m_entry == m_entries.end()) {
+        return ReaderError::InvalidState;
+    }
+
+    EntryExtent extent;
+    extent.offset = m_entry->offset;
+    extent.size = m_entry->size;
+    extent.contiguous = true;
+
+    // Truncated entries only extend to the end of the file
+    if (m_entry->can_truncate) {
+        auto size = file.seek(0, SEEK_END);
+        if (!size) {
+            if (file.is_fatal()) { reader.set_fatal(); }
+            return size.as_failure();
+        }
+
+        auto seek_ret = file.seek(
+                static_cast<int64_t>(m_read_cur_offset), SEEK_SET);
+        if (!seek_ret) {
+            // The file position is now unknown
+            reader.set_fatal();
+            return seek_ret.as_failure();
+        }
+
+        if (extent.offset >= size.value()) {
+            extent.size = 0;
+        } else {
+            extent.size = std::min(extent.size, size.value() - extent.offset);
+        }
+    }
+
+    return extent;
+}
+
 }
 }
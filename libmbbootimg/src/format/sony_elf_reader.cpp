@@ -65,6 +65,13 @@ std::string SonyElfFormatReader::name()
     return FORMAT_NAME_SONY_ELF;
 }
 
+std::vector<detail::ProbeRange> SonyElfFormatReader::probe_ranges()
+{
+    return {
+        { 0, sizeof(Sony_Elf32_Ehdr) },
+    };
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -244,6 +251,11 @@ oc::result<size_t> SonyElfFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<EntryExtent> SonyElfFormatReader::entry_extent(File &file)
+{
+    return m_seg->entry_extent(file, m_reader);
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_p.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_util.h"
+
+namespace mb
+{
+namespace bootimg
+{
+namespace detail
+{
+
+/*! \brief Minimum number of bytes to read when reading an uncached range */
+static constexpr size_t MIN_FETCH_SIZE = 4096;
+
+/*!
+ * \class ProbeFile
+ *
+ * \brief Read-only file that caches the ranges of a file needed for bidding
+ *
+ * The ranges declared by the format readers are read from the underlying file
+ * once when the ProbeFile is opened. Reads of other ranges are passed through
+ * to the underlying file and are cached as well, so if multiple bidders read
+ * the same data (eg. the Samsung SEAndroid and Bump magic strings at the end
+ * of an Android boot image), the underlying file is only read once.
+ *
+ * If the underlying file provides a mapping (see File::mapping()), nothing is
+ * cached. The mapping is exposed through mapping() so that bidders can search
+ * it in place and reads are copied directly from it.
+ *
+ * The position of the underlying file is not preserved.
+ */
+
+/*!
+ * \brief Construct unbound ProbeFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+ProbeFile::ProbeFile()
+    : File()
+    , m_file(nullptr)
+    , m_offset(0)
+    , m_underlying_reads(0)
+{
+}
+
+/*!
+ * \brief Open File handle for probing.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, const std::vector<ProbeRange> &)
+ *
+ * \param file File to cache
+ * \param ranges Ranges to read when the file is opened
+ */
+ProbeFile::ProbeFile(File *file, const std::vector<ProbeRange> &ranges)
+    : ProbeFile()
+{
+    (void) open(file, ranges);
+}
+
+ProbeFile::~ProbeFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle for probing.
+ *
+ * \param file File to cache. It must remain valid for as long as the
+ *             ProbeFile is open.
+ * \param ranges Ranges to read when the file is opened. Overlapping ranges are
+ *               merged and ranges past the end of the file are ignored.
+ *
+ * \return Nothing if the ranges are successfully read. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ProbeFile::open(File *file,
+                                 const std::vector<ProbeRange> &ranges)
+{
+    if (state() == mb::detail::FileState::New) {
+        m_file = file;
+        m_ranges = ranges;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Number of reads performed on the underlying file
+ */
+uint64_t ProbeFile::underlying_reads() const
+{
+    return m_underlying_reads;
+}
+
+/*!
+ * \brief Get mapping of the underlying file, if it has one
+ */
+std::pair<const void *, size_t> ProbeFile::mapping() const
+{
+    if (m_file) {
+        return m_file->mapping();
+    }
+
+    return { nullptr, 0 };
+}
+
+oc::result<void> ProbeFile::on_open()
+{
+    if (!m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_file->mapping().first) {
+        // Everything is already in memory
+        return oc::success();
+    }
+
+    // Resolve offsets relative to the end of the file
+    std::vector<std::pair<uint64_t, uint64_t>> spans;
+
+    for (auto const &r : m_ranges) {
+        uint64_t begin;
+
+        if (r.offset < 0) {
+            OUTCOME_TRY(size, file_size());
+            auto distance = static_cast<uint64_t>(-r.offset);
+            begin = distance > size ? 0 : size - distance;
+        } else {
+            begin = static_cast<uint64_t>(r.offset);
+        }
+
+        if (r.size > 0) {
+            spans.emplace_back(begin, begin + r.size);
+        }
+    }
+
+    // Merge overlapping and adjacent spans so each byte is read only once
+    std::sort(spans.begin(), spans.end());
+
+    std::vector<std::pair<uint64_t, uint64_t>> merged;
+
+    for (auto const &span : spans) {
+        if (!merged.empty() && span.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, span.second);
+        } else {
+            merged.push_back(span);
+        }
+    }
+
+    for (auto const &span : merged) {
+        OUTCOME_TRYV(fetch(span.first,
+                           static_cast<size_t>(span.second - span.first)));
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ProbeFile::on_close()
+{
+    m_file = nullptr;
+    m_ranges.clear();
+    m_segments.clear();
+    m_size = {};
+    m_offset = 0;
+    m_underlying_reads = 0;
+
+    return oc::success();
+}
+
+oc::result<size_t> ProbeFile::on_read(void *buf, size_t size)
+{
+    auto contains = [this](const Segment &seg) {
+        return m_offset >= seg.offset
+                && m_offset - seg.offset < seg.data.size();
+    };
+
+    if (size == 0 || (m_size && m_offset >= *m_size)) {
+        return 0;
+    }
+
+    auto mapping = m_file->mapping();
+    if (mapping.first) {
+        if (m_offset >= mapping.second) {
+            return 0;
+        }
+
+        size_t n = std::min(size, static_cast<size_t>(mapping.second
+                                                      - m_offset));
+        memcpy(buf, static_cast<const unsigned char *>(mapping.first)
+               + m_offset, n);
+        m_offset += n;
+
+        return n;
+    }
+
+    auto it = std::find_if(m_segments.begin(), m_segments.end(), contains);
+    if (it == m_segments.end()) {
+        // Read at least MIN_FETCH_SIZE bytes, but don't overlap the next
+        // cached segment
+        uint64_t to_fetch = std::max(size, MIN_FETCH_SIZE);
+
+        auto next = std::find_if(m_segments.begin(), m_segments.end(),
+                                 [this](const Segment &seg) {
+            return seg.offset > m_offset;
+        });
+        if (next != m_segments.end()) {
+            to_fetch = std::min(to_fetch, next->offset - m_offset);
+        }
+
+        OUTCOME_TRYV(fetch(m_offset, static_cast<size_t>(to_fetch)));
+
+        it = std::find_if(m_segments.begin(), m_segments.end(), contains);
+        if (it == m_segments.end()) {
+            // EOF
+            return 0;
+        }
+    }
+
+    auto seg_offset = static_cast<size_t>(m_offset - it->offset);
+    size_t n = std::min(size, it->data.size() - seg_offset);
+
+    memcpy(buf, it->data.data() + seg_offset, n);
+    m_offset += n;
+
+    return n;
+}
+
+oc::result<uint64_t> ProbeFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_offset;
+        break;
+    case SEEK_END: {
+        OUTCOME_TRY(size, file_size());
+        base = size;
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_offset = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::IntegerOverflow;
+        }
+        m_offset = base + static_cast<uint64_t>(offset);
+    }
+
+    return m_offset;
+}
+
+oc::result<uint64_t> ProbeFile::file_size()
+{
+    auto mapping = m_file->mapping();
+    if (mapping.first) {
+        return mapping.second;
+    }
+
+    if (!m_size) {
+        OUTCOME_TRY(size, m_file->seek(0, SEEK_END));
+        m_size = size;
+    }
+
+    return *m_size;
+}
+
+/*!
+ * \brief Read range from underlying file and cache it
+ *
+ * \pre The range must not overlap any existing segment
+ */
+oc::result<void> ProbeFile::fetch(uint64_t offset, size_t size)
+{
+    Segment seg;
+    seg.offset = offset;
+    seg.data.resize(size);
+
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(offset), SEEK_SET));
+    OUTCOME_TRY(n, file_read_retry(*m_file, seg.data.data(), size));
+    ++m_underlying_reads;
+
+    if (n < size) {
+        // Short read means that we've reached EOF. A read that starts past EOF
+        // returns nothing and says nothing about where EOF actually is.
+        if (n > 0) {
+            m_size = offset + n;
+        }
+        seg.data.resize(n);
+    }
+
+    if (!seg.data.empty()) {
+        auto it = std::upper_bound(m_segments.begin(), m_segments.end(), seg,
+                                   [](const Segment &a, const Segment &b) {
+            return a.offset < b.offset;
+        });
+        m_segments.insert(it, std::move(seg));
+    }
+
+    return oc::success();
+}
+
+}
+}
+}
@@ -26,11 +26,15 @@
 #include <cstring>
 
 #include "mbcommon/file.h"
+#ifndef _WIN32
+#  include "mbcommon/file/mmap.h"
+#endif
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_p.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -69,6 +73,21 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::probe_ranges
+ *
+ * \brief Format reader callback to get byte ranges needed for bidding
+ *
+ * Before bidding, Reader::open() reads the union of the ranges requested by
+ * every registered format reader in a single pass. All bidders then read from
+ * the shared cached data instead of each reading the file separately. Ranges
+ * that are not declared (eg. offsets computed from header fields) can still be
+ * read during bidding and are cached after the first read.
+ *
+ * \return List of ranges. Negative offsets are relative to the end of the
+ *         file. The default implementation returns an empty list.
+ */
+
 /*!
  * \fn FormatReader::open
  *
@@ -80,6 +99,10 @@
  * file position is set to the beginning of the file before this function is
  * called and also after.
  *
+ * \p file is not the user's file handle. It serves reads from the data cached
+ * during the probe stage (see probe_ranges()) and must not be used after this
+ * function returns.
+ *
  * If this function returns an error code or if the bid is lost, close() will be
  * called in Reader::open() to clean up any state. Otherwise, close() will be
  * called in Reader::close() when the user closes the Reader.
@@ -174,6 +197,24 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::entry_extent
+ *
+ * \brief Format reader callback to get the location of the entry data
+ *
+ * \note This function must not change the state of the format reader. In
+ *       particular, a subsequent call to read_data() must behave as if this
+ *       function was never called.
+ *
+ * \param[in] file Reference to file handle
+ *
+ * \return
+ *   * Return the entry's extent if the entry data is stored in the file
+ *   * Return ReaderError::UnsupportedExtent if the format cannot describe the
+ *     entry's location
+ *   * Return a specific error code if an error occurs
+ */
+
 ///
 
 namespace mb
@@ -226,6 +267,11 @@ oc::result<void> FormatReader::set_option(const char *key, const char *value)
     return ReaderError::UnknownOption;
 }
 
+std::vector<ProbeRange> FormatReader::probe_ranges()
+{
+    return {};
+}
+
 oc::result<void> FormatReader::close(File &file)
 {
     (void) file;
@@ -241,6 +287,12 @@ oc::result<void> FormatReader::go_to_entry(File &file, Entry &entry,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<EntryExtent> FormatReader::entry_extent(File &file)
+{
+    (void) file;
+    return ReaderError::UnsupportedExtent;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -295,6 +347,9 @@ Reader & Reader::operator=(Reader &&rhs) noexcept
 /*!
  * \brief Open boot image from filename (MBS).
  *
+ * On Unix-like systems, regular files are opened with MmapFile. Other files,
+ * such as block devices, are opened with StandardFile.
+ *
  * \param filename MBS filename
  *
  * \return Nothing if the boot image is successfully opened. Otherwise, a
@@ -304,6 +359,14 @@ oc::result<void> Reader::open_filename(const std::string &filename)
 {
     ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
 
+#ifndef _WIN32
+    // Prefer a memory mapping so that formats can search the image in place
+    auto mmap_file = std::make_unique<MmapFile>();
+    if (mmap_file->open(filename)) {
+        return open(std::move(mmap_file));
+    }
+#endif
+
     auto file = std::make_unique<StandardFile>();
     OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
 
@@ -313,6 +376,8 @@ oc::result<void> Reader::open_filename(const std::string &filename)
 /*!
  * \brief Open boot image from filename (WCS).
  *
+ * \sa open_filename()
+ *
  * \param filename WCS filename
  *
  * \return Nothing if the boot image is successfully opened. Otherwise, a
@@ -322,6 +387,14 @@ oc::result<void> Reader::open_filename_w(const std::wstring &filename)
 {
     ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
 
+#ifndef _WIN32
+    // Prefer a memory mapping so that formats can search the image in place
+    auto mmap_file = std::make_unique<MmapFile>();
+    if (mmap_file->open(filename)) {
+        return open(std::move(mmap_file));
+    }
+#endif
+
     auto file = std::make_unique<StandardFile>();
     OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
 
@@ -380,20 +453,31 @@ oc::result<void> Reader::open(File *file)
 
     // Perform bid if a format wasn't explicitly chosen
     if (!m_format) {
+        // Read the ranges needed by all of the bidders in one pass
+        std::vector<ProbeRange> ranges;
+        for (auto &f : m_formats) {
+            auto f_ranges = f->probe_ranges();
+            ranges.insert(ranges.end(), f_ranges.begin(), f_ranges.end());
+        }
+
+        ProbeFile probe_file;
+
+        auto open_ret = probe_file.open(file, ranges);
+        if (!open_ret) {
+            if (file->is_fatal()) { set_fatal(); }
+            return open_ret.as_failure();
+        }
+
         for (auto &f : m_formats) {
             // Seek to beginning
-            auto seek_ret = file->seek(0, SEEK_SET);
-            if (!seek_ret) {
-                if (file->is_fatal()) { set_fatal(); }
-                return seek_ret.as_failure();
-            }
+            OUTCOME_TRYV(probe_file.seek(0, SEEK_SET));
 
             auto close_f = finally([&] {
                 (void) f->close(*file);
             });
 
             // Call bidder
-            OUTCOME_TRY(bid, f->open(*file, best_bid));
+            OUTCOME_TRY(bid, f->open(probe_file, best_bid));
 
             if (bid > best_bid) {
                 // Close previous best format
@@ -413,6 +497,13 @@ oc::result<void> Reader::open(File *file)
             return ReaderError::UnknownFileFormat;
         }
 
+        // Bidders only ever read from the probe file
+        auto seek_ret = file->seek(0, SEEK_SET);
+        if (!seek_ret) {
+            if (file->is_fatal()) { set_fatal(); }
+            return seek_ret.as_failure();
+        }
+
         // We've found a matching format, so don't close it
         close_format.dismiss();
 
@@ -565,6 +656,30 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Get location of current boot image entry data.
+ *
+ * This allows the entry data to be accessed directly in the underlying file
+ * (eg. with `copy_file_range()`, `sendfile()`, or `mmap()`) instead of being
+ * copied through read_data(). If the returned extent is not contiguous or if
+ * ReaderError::UnsupportedExtent is returned, read_data() must be used
+ * instead.
+ *
+ * If the entry is allowed to be truncated, the size of the extent will be
+ * limited to the amount of data available in the file.
+ *
+ * This function does not affect subsequent calls to read_data().
+ *
+ * \return Extent of the entry data in the file. If an error occurs, a specific
+ *         error code will be returned.
+ */
+oc::result<EntryExtent> Reader::entry_extent()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Data);
+
+    return m_format->entry_extent(*m_file);
+}
+
 /*!
  * \brief Get detected or forced boot image format code.
  *
@@ -72,6 +72,8 @@ std::string ReaderErrorCategory::message(int ev) const
         return "end of entries";
     case ReaderError::UnsupportedGoTo:
         return "go to entry not supported";
+    case ReaderError::UnsupportedExtent:
+        return "entry extent not supported";
     default:
         return "(unknown reader error)";
     }
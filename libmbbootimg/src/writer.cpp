@@ -26,7 +26,9 @@
 #include <cstring>
 
 #include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
@@ -221,6 +223,29 @@ static struct
     },
 };
 
+namespace detail
+{
+
+/*!
+ * \brief In-memory copy of the boot image being written in streaming mode
+ */
+struct StagedOutput
+{
+    void *data = nullptr;
+    size_t size = 0;
+    MemoryFile file;
+    // Forward-only file that receives the finished boot image
+    File *output = nullptr;
+
+    ~StagedOutput()
+    {
+        (void) file.close();
+        free(data);
+    }
+};
+
+}
+
 FormatWriter::FormatWriter(Writer &writer)
     : m_writer(writer)
 {
@@ -260,6 +285,8 @@ Writer::Writer()
     : m_state(WriterState::New)
     , m_owned_file()
     , m_file()
+    , m_streaming(false)
+    , m_staged()
     , m_format()
 {
 }
@@ -280,6 +307,8 @@ Writer::Writer(Writer &&other) noexcept
     : m_state(other.m_state)
     , m_owned_file(std::move(other.m_owned_file))
     , m_file(other.m_file)
+    , m_streaming(other.m_streaming)
+    , m_staged(std::move(other.m_staged))
     , m_format(std::move(other.m_format))
 {
     other.m_state = WriterState::Moved;
@@ -292,6 +321,8 @@ Writer & Writer::operator=(Writer &&rhs) noexcept
     m_state = rhs.m_state;
     m_owned_file.swap(rhs.m_owned_file);
     m_file = rhs.m_file;
+    m_streaming = rhs.m_streaming;
+    m_staged.swap(rhs.m_staged);
     m_format.swap(rhs.m_format);
 
     rhs.m_state = WriterState::Moved;
@@ -378,6 +409,19 @@ oc::result<void> Writer::open(File *file)
         return WriterError::NoFormatRegistered;
     }
 
+    std::unique_ptr<StagedOutput> staged;
+
+    if (m_streaming) {
+        // The format writer gets a seekable in-memory file instead and the
+        // result is copied to the real output file when the writer is closed
+        staged = std::make_unique<StagedOutput>();
+        staged->output = file;
+
+        OUTCOME_TRYV(staged->file.open(&staged->data, &staged->size));
+
+        file = &staged->file;
+    }
+
     auto ret = m_format->open(*file);
     if (!ret) {
         (void) m_format->close(*file);
@@ -386,6 +430,7 @@ oc::result<void> Writer::open(File *file)
 
     m_state = WriterState::Header;
     m_file = file;
+    m_staged = std::move(staged);
 
     return oc::success();
 }
@@ -412,6 +457,7 @@ oc::result<void> Writer::close()
 
         m_owned_file.reset();
         m_file = nullptr;
+        m_staged.reset();
     });
 
     oc::result<void> ret = oc::success();
@@ -419,6 +465,12 @@ oc::result<void> Writer::close()
     if (m_state != WriterState::New) {
         ret = m_format->close(*m_file);
 
+        // Write out the finished boot image in one forward-only pass
+        if (ret && m_staged && m_state != WriterState::Fatal) {
+            ret = file_write_exact(*m_staged->output, m_staged->data,
+                                   m_staged->size);
+        }
+
         if (m_owned_file) {
             auto close_ret = m_owned_file->close();
             if (ret && !close_ret) {
@@ -622,6 +674,43 @@ oc::result<void> Writer::set_format_by_name(const std::string &name)
     return WriterError::InvalidFormatName;
 }
 
+/*!
+ * \brief Set whether the boot image should be written in streaming mode
+ *
+ * Most formats write the header last because it contains the sizes of (or
+ * checksums over) the entries. This requires the output file to be seekable.
+ *
+ * In streaming mode, the boot image is assembled in memory and written to the
+ * output file sequentially when the writer is closed. The output file only
+ * needs to support writing, so it can be a pipe, a socket, or a zip entry.
+ * Enough memory must be available to hold the entire boot image.
+ *
+ * The setting persists across calls to close() and open().
+ *
+ * \param streaming Whether to enable streaming mode
+ *
+ * \return Nothing if the setting is successfully changed. Otherwise, the error
+ *         code.
+ */
+oc::result<void> Writer::set_streaming(bool streaming)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(WriterState::New);
+
+    m_streaming = streaming;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Check whether streaming mode is enabled
+ *
+ * \return Whether streaming mode is enabled
+ */
+bool Writer::is_streaming()
+{
+    return m_streaming;
+}
+
 /*!
  * \brief Check whether writer is opened
  *
@@ -66,6 +66,8 @@ std::string WriterErrorCategory::message(int ev) const
         return "no format registered";
     case WriterError::EndOfEntries:
         return "end of entries";
+    case WriterError::UnsupportedReplace:
+        return "entry replacement not supported";
     default:
         return "(unknown writer error)";
     }
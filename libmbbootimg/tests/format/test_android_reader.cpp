@@ -397,3 +397,40 @@ TEST_F(AndroidReaderGoToEntryTest, GoToMissingEntryShouldFail)
     ASSERT_FALSE(ret);
     ASSERT_EQ(ret.error(), ReaderError::EndOfEntries);
 }
+
+TEST_F(AndroidReaderGoToEntryTest, EntryExtentShouldMatchData)
+{
+    Entry entry;
+    char buf[50];
+
+    ASSERT_TRUE(_reader.go_to_entry(entry, ENTRY_TYPE_RAMDISK));
+
+    auto extent = _reader.entry_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_EQ(extent.value().offset, 2 * 2048u);
+    ASSERT_EQ(extent.value().size, 7u);
+    ASSERT_TRUE(extent.value().contiguous);
+    ASSERT_EQ(memcmp(_data.data() + extent.value().offset, "ramdisk",
+                     extent.value().size), 0);
+
+    // Getting the extent should not affect reading the data
+    auto n = _reader.read_data(buf, 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+
+    extent = _reader.entry_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_EQ(extent.value().offset, 2 * 2048u);
+
+    n = _reader.read_data(buf + 3, sizeof(buf) - 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(buf, "ramdisk", 7), 0);
+}
+
+TEST_F(AndroidReaderGoToEntryTest, EntryExtentBeforeEntryShouldFail)
+{
+    auto extent = _reader.entry_extent();
+    ASSERT_FALSE(extent);
+    ASSERT_EQ(extent.error(), ReaderError::InvalidState);
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/edit.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct ReplaceEntryTest : testing::Test
+{
+    struct Contents
+    {
+        std::string kernel;
+        std::string ramdisk;
+        std::string second;
+        std::string dt;
+    };
+
+    static std::string pattern(size_t size, char c)
+    {
+        std::string result;
+        for (size_t i = 0; i < size; ++i) {
+            result += static_cast<char>(c + static_cast<char>(i % 7));
+        }
+        return result;
+    }
+
+    static void build_image(int format, const Contents &contents,
+                            std::vector<unsigned char> &out)
+    {
+        void *buf = nullptr;
+        size_t buf_size = 0;
+
+        {
+            MemoryFile file(&buf, &buf_size);
+            ASSERT_TRUE(file.is_open());
+
+            Writer writer;
+            Header header;
+            Entry entry;
+
+            ASSERT_TRUE(writer.set_format_by_code(format));
+            ASSERT_TRUE(writer.open(&file));
+            ASSERT_TRUE(writer.get_header(header));
+            header.set_page_size(2048);
+            header.set_kernel_cmdline(std::string("console=null"));
+            ASSERT_TRUE(writer.write_header(header));
+
+            while (true) {
+                auto ret = writer.get_entry(entry);
+                if (!ret) {
+                    ASSERT_EQ(ret.error(), WriterError::EndOfEntries);
+                    break;
+                }
+
+                ASSERT_TRUE(writer.write_entry(entry));
+
+                const std::string *data = nullptr;
+
+                switch (*entry.type()) {
+                case ENTRY_TYPE_KERNEL:
+                    data = &contents.kernel;
+                    break;
+                case ENTRY_TYPE_RAMDISK:
+                    data = &contents.ramdisk;
+                    break;
+                case ENTRY_TYPE_SECONDBOOT:
+                    data = &contents.second;
+                    break;
+                case ENTRY_TYPE_DEVICE_TREE:
+                    data = &contents.dt;
+                    break;
+                }
+
+                if (data && !data->empty()) {
+                    ASSERT_TRUE(writer.write_data(data->data(), data->size()));
+                }
+            }
+
+            ASSERT_TRUE(writer.close());
+        }
+
+        auto ptr = static_cast<unsigned char *>(buf);
+        out.assign(ptr, ptr + buf_size);
+        free(buf);
+    }
+
+    static void check_replace(int format, Contents contents, int entry_type,
+                              const std::string &new_data)
+    {
+        std::vector<unsigned char> image;
+        build_image(format, contents, image);
+
+        switch (entry_type) {
+        case ENTRY_TYPE_KERNEL:
+            contents.kernel = new_data;
+            break;
+        case ENTRY_TYPE_RAMDISK:
+            contents.ramdisk = new_data;
+            break;
+        case ENTRY_TYPE_SECONDBOOT:
+            contents.second = new_data;
+            break;
+        case ENTRY_TYPE_DEVICE_TREE:
+            contents.dt = new_data;
+            break;
+        }
+
+        std::vector<unsigned char> expected;
+        build_image(format, contents, expected);
+
+        void *buf = malloc(image.size());
+        size_t buf_size = image.size();
+        ASSERT_NE(buf, nullptr);
+        memcpy(buf, image.data(), image.size());
+
+        MemoryFile file(&buf, &buf_size);
+        ASSERT_TRUE(file.is_open());
+        MemoryFile data(new_data.data(), new_data.size());
+        ASSERT_TRUE(data.is_open());
+
+        auto ret = replace_entry(file, entry_type, data, new_data.size());
+        ASSERT_TRUE(ret) << ret.error().message();
+        ASSERT_TRUE(file.close());
+
+        auto ptr = static_cast<unsigned char *>(buf);
+        std::vector<unsigned char> result(ptr, ptr + buf_size);
+        free(buf);
+
+        ASSERT_EQ(result, expected);
+    }
+};
+
+TEST_F(ReplaceEntryTest, ReplaceWithSamePageAlignedSize)
+{
+    check_replace(FORMAT_ANDROID,
+                  { pattern(3000, 'a'), pattern(5000, 'b'), "", "" },
+                  ENTRY_TYPE_RAMDISK, pattern(4500, 'c'));
+}
+
+TEST_F(ReplaceEntryTest, ReplaceWithLargerEntry)
+{
+    check_replace(FORMAT_ANDROID,
+                  { pattern(3000, 'a'), pattern(5000, 'b'),
+                    pattern(100, 'd'), pattern(2500, 'e') },
+                  ENTRY_TYPE_RAMDISK, pattern(20000, 'c'));
+}
+
+TEST_F(ReplaceEntryTest, ReplaceWithSmallerEntry)
+{
+    check_replace(FORMAT_ANDROID,
+                  { pattern(30000, 'a'), pattern(5000, 'b'),
+                    "", pattern(2500, 'e') },
+                  ENTRY_TYPE_KERNEL, pattern(1000, 'c'));
+}
+
+TEST_F(ReplaceEntryTest, ReplaceLastEntry)
+{
+    check_replace(FORMAT_ANDROID,
+                  { pattern(3000, 'a'), pattern(5000, 'b'), "", "" },
+                  ENTRY_TYPE_DEVICE_TREE, pattern(3000, 'c'));
+}
+
+TEST_F(ReplaceEntryTest, ReplaceInBumpImage)
+{
+    check_replace(FORMAT_BUMP,
+                  { pattern(3000, 'a'), pattern(5000, 'b'), "", "" },
+                  ENTRY_TYPE_RAMDISK, pattern(9000, 'c'));
+}
+
+TEST_F(ReplaceEntryTest, CheckUnsupportedFormatFails)
+{
+    std::vector<unsigned char> image;
+    build_image(FORMAT_SONY_ELF,
+                { pattern(3000, 'a'), pattern(5000, 'b'), "", "" }, image);
+
+    MemoryFile file(image.data(), image.size());
+    ASSERT_TRUE(file.is_open());
+    MemoryFile data("abc", 3);
+    ASSERT_TRUE(data.is_open());
+
+    auto ret = replace_entry(file, ENTRY_TYPE_RAMDISK, data, 3);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), WriterError::UnsupportedReplace);
+}
+
+TEST_F(ReplaceEntryTest, CheckUnsupportedEntryTypeFails)
+{
+    std::vector<unsigned char> image;
+    build_image(FORMAT_ANDROID,
+                { pattern(3000, 'a'), pattern(5000, 'b'), "", "" }, image);
+
+    MemoryFile file(image.data(), image.size());
+    ASSERT_TRUE(file.is_open());
+    MemoryFile data("abc", 3);
+    ASSERT_TRUE(data.is_open());
+
+    auto ret = replace_entry(file, ENTRY_TYPE_ABOOT, data, 3);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), WriterError::UnsupportedReplace);
+}
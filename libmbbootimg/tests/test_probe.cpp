@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/probe_p.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::detail;
+
+class MappedMemoryFile : public MemoryFile
+{
+public:
+    MappedMemoryFile(const std::vector<unsigned char> &data)
+        : MemoryFile(data.data(), data.size())
+        , _data(data)
+    {
+    }
+
+    std::pair<const void *, size_t> mapping() const override
+    {
+        return { _data.data(), _data.size() };
+    }
+
+private:
+    const std::vector<unsigned char> &_data;
+};
+
+struct ProbeFileTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+    MemoryFile _file;
+
+    void SetUp() override
+    {
+        for (size_t i = 0; i < 10000; ++i) {
+            _data.push_back(static_cast<unsigned char>(i * 7));
+        }
+
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+    }
+
+    void check_read(ProbeFile &probe, uint64_t offset, size_t size)
+    {
+        std::vector<unsigned char> buf(size);
+
+        ASSERT_TRUE(probe.seek(static_cast<int64_t>(offset), SEEK_SET));
+        auto n = file_read_retry(probe, buf.data(), buf.size());
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), size);
+        ASSERT_TRUE(std::equal(buf.begin(), buf.end(),
+                               _data.begin() + static_cast<long>(offset)));
+    }
+};
+
+TEST_F(ProbeFileTest, CheckDeclaredRangesAreMerged)
+{
+    ProbeFile probe(&_file, {
+        { 0, 100 },
+        { 50, 200 },
+        { 250, 10 },
+        { -16, 16 },
+    });
+    ASSERT_TRUE(probe.is_open());
+
+    // [0, 260) and [9984, 10000)
+    ASSERT_EQ(probe.underlying_reads(), 2u);
+
+    check_read(probe, 0, 260);
+    check_read(probe, 9984, 16);
+    ASSERT_EQ(probe.underlying_reads(), 2u);
+}
+
+TEST_F(ProbeFileTest, CheckUndeclaredRangesAreCached)
+{
+    ProbeFile probe(&_file, { { 0, 16 } });
+    ASSERT_TRUE(probe.is_open());
+    ASSERT_EQ(probe.underlying_reads(), 1u);
+
+    check_read(probe, 5000, 16);
+    ASSERT_EQ(probe.underlying_reads(), 2u);
+
+    // Same range is served from the cache
+    check_read(probe, 5004, 8);
+    ASSERT_EQ(probe.underlying_reads(), 2u);
+
+    // Read spanning the declared range and an uncached range
+    check_read(probe, 8, 100);
+    ASSERT_EQ(probe.underlying_reads(), 3u);
+}
+
+TEST_F(ProbeFileTest, CheckReadAtEof)
+{
+    ProbeFile probe(&_file, { { 9990, 100 } });
+    ASSERT_TRUE(probe.is_open());
+
+    check_read(probe, 9990, 10);
+
+    char c;
+    ASSERT_TRUE(probe.seek(0, SEEK_END));
+    auto n = probe.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    ASSERT_TRUE(probe.seek(20000, SEEK_SET));
+    n = probe.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(ProbeFileTest, CheckReadPastEofKeepsSize)
+{
+    ProbeFile probe(&_file, { { 0, 16 } });
+    ASSERT_TRUE(probe.is_open());
+
+    char c;
+    ASSERT_TRUE(probe.seek(20000, SEEK_SET));
+    auto n = probe.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    auto size = probe.seek(0, SEEK_END);
+    ASSERT_TRUE(size);
+    ASSERT_EQ(size.value(), _data.size());
+}
+
+TEST_F(ProbeFileTest, CheckMappingIsForwarded)
+{
+    MappedMemoryFile mapped(_data);
+    ASSERT_TRUE(mapped.is_open());
+
+    ProbeFile probe(&mapped, { { 0, 100 } });
+    ASSERT_TRUE(probe.is_open());
+
+    auto mapping = probe.mapping();
+    ASSERT_EQ(mapping.first, _data.data());
+    ASSERT_EQ(mapping.second, _data.size());
+
+    // Reads are served from the mapping without touching the file
+    check_read(probe, 0, 100);
+    check_read(probe, 9990, 10);
+    ASSERT_EQ(probe.underlying_reads(), 0u);
+
+    // Non-mapped files have no mapping
+    ProbeFile unmapped(&_file, {});
+    ASSERT_TRUE(unmapped.is_open());
+    ASSERT_EQ(unmapped.mapping().first, nullptr);
+}
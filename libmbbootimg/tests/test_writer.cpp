@@ -18,3 +18,133 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+class ForwardOnlyMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+protected:
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+};
+
+struct WriterStreamingTest : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+    void *_stream_buf = nullptr;
+    size_t _stream_buf_size = 0;
+
+    virtual ~WriterStreamingTest()
+    {
+        free(_buf);
+        free(_stream_buf);
+    }
+
+    static oc::result<void> write_image(Writer &writer)
+    {
+        Header header;
+        Entry entry;
+
+        OUTCOME_TRYV(writer.get_header(header));
+        header.set_page_size(2048);
+        header.set_kernel_cmdline(std::string("console=null"));
+        OUTCOME_TRYV(writer.write_header(header));
+
+        while (true) {
+            auto ret = writer.get_entry(entry);
+            if (!ret) {
+                if (ret.error() == WriterError::EndOfEntries) {
+                    break;
+                }
+                return ret.as_failure();
+            }
+
+            OUTCOME_TRYV(writer.write_entry(entry));
+
+            if (*entry.type() == ENTRY_TYPE_KERNEL) {
+                OUTCOME_TRYV(writer.write_data("hello", 5));
+            } else if (*entry.type() == ENTRY_TYPE_RAMDISK) {
+                OUTCOME_TRYV(writer.write_data("world!", 6));
+            }
+        }
+
+        return writer.close();
+    }
+};
+
+TEST_F(WriterStreamingTest, CheckStreamedImageMatchesSeekedImage)
+{
+    MemoryFile file(&_buf, &_buf_size);
+    ASSERT_TRUE(file.is_open());
+    ForwardOnlyMemoryFile stream_file(&_stream_buf, &_stream_buf_size);
+    ASSERT_TRUE(stream_file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_android());
+    ASSERT_TRUE(writer.open(&file));
+    ASSERT_TRUE(write_image(writer));
+
+    Writer stream_writer;
+    ASSERT_TRUE(stream_writer.set_streaming(true));
+    ASSERT_TRUE(stream_writer.is_streaming());
+    ASSERT_TRUE(stream_writer.set_format_android());
+    ASSERT_TRUE(stream_writer.open(&stream_file));
+    ASSERT_TRUE(write_image(stream_writer));
+
+    ASSERT_GT(_buf_size, 0u);
+    ASSERT_EQ(_stream_buf_size, _buf_size);
+    ASSERT_EQ(memcmp(_stream_buf, _buf, _buf_size), 0);
+}
+
+TEST_F(WriterStreamingTest, CheckNonStreamingFailsOnForwardOnlyFile)
+{
+    ForwardOnlyMemoryFile stream_file(&_stream_buf, &_stream_buf_size);
+    ASSERT_TRUE(stream_file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_android());
+    ASSERT_TRUE(writer.open(&stream_file));
+
+    Header header;
+    ASSERT_TRUE(writer.get_header(header));
+    header.set_page_size(2048);
+
+    auto ret = writer.write_header(header);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+}
+
+TEST_F(WriterStreamingTest, CheckSettingStreamingWhileOpenFails)
+{
+    MemoryFile file(&_buf, &_buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_android());
+    ASSERT_TRUE(writer.open(&file));
+
+    auto ret = writer.set_streaming(true);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), WriterError::InvalidState);
+    ASSERT_FALSE(writer.is_streaming());
+}
@@ -23,6 +23,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 
 #include <cstddef>
 #include <cstdint>
@@ -34,6 +35,12 @@
 namespace mb
 {
 
+struct FileIoVec
+{
+    void *base;
+    size_t size;
+};
+
 class MB_EXPORT File
 {
 public:
@@ -51,11 +58,24 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence);
     oc::result<void> truncate(uint64_t size);
 
+    // Positional and vectored file operations
+    oc::result<size_t> pread(void *buf, size_t size, uint64_t offset);
+    oc::result<size_t> pwrite(const void *buf, size_t size, uint64_t offset);
+    oc::result<size_t> readv(const FileIoVec *iov, size_t iov_count);
+    oc::result<size_t> writev(const FileIoVec *iov, size_t iov_count);
+
+    // Range operations
+    oc::result<void> insert_range(uint64_t offset, uint64_t size);
+    oc::result<void> collapse_range(uint64_t offset, uint64_t size);
+
     // File state
     bool is_open();
     bool is_fatal();
     void set_fatal();
 
+    // Direct access to file contents
+    virtual std::pair<const void *, size_t> mapping() const;
+
 protected:
     File(File &&other) noexcept;
     File & operator=(File &&rhs) noexcept;
@@ -72,6 +92,16 @@ protected:
     virtual oc::result<size_t> on_write(const void *buf, size_t size);
     virtual oc::result<uint64_t> on_seek(int64_t offset, int whence);
     virtual oc::result<void> on_truncate(uint64_t size);
+    virtual oc::result<size_t> on_pread(void *buf, size_t size,
+                                        uint64_t offset);
+    virtual oc::result<size_t> on_pwrite(const void *buf, size_t size,
+                                         uint64_t offset);
+    virtual oc::result<size_t> on_readv(const FileIoVec *iov,
+                                        size_t iov_count);
+    virtual oc::result<size_t> on_writev(const FileIoVec *iov,
+                                         size_t iov_count);
+    virtual oc::result<void> on_insert_range(uint64_t offset, uint64_t size);
+    virtual oc::result<void> on_collapse_range(uint64_t offset, uint64_t size);
 
 private:
     /*! \cond INTERNAL */
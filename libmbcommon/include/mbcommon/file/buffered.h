@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    BufferedFile();
+    BufferedFile(File *file);
+    BufferedFile(File *file, size_t read_buf_size, size_t write_buf_size);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    oc::result<void> open(File *file);
+    oc::result<void> open(File *file, size_t read_buf_size,
+                          size_t write_buf_size);
+
+    oc::result<void> flush();
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_pread(void *buf, size_t size,
+                                uint64_t offset) override;
+    oc::result<size_t> on_pwrite(const void *buf, size_t size,
+                                 uint64_t offset) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> flush_write_buffer();
+    oc::result<void> discard_read_buffer();
+
+    File *m_file;
+
+    std::vector<unsigned char> m_rbuf;
+    // Offset of next unread byte in m_rbuf
+    size_t m_rpos;
+    // Number of valid bytes in m_rbuf
+    size_t m_rlen;
+
+    std::vector<unsigned char> m_wbuf;
+    // Number of pending bytes in m_wbuf
+    size_t m_wlen;
+
+    size_t m_rbuf_size;
+    size_t m_wbuf_size;
+
+    // Position of the underlying file, if it is known
+    bool m_have_file_pos;
+    uint64_t m_file_pos;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include "mbcommon/file.h"
+#include "mbcommon/optional.h"
+
+namespace mb
+{
+
+enum class CompressionFormat
+{
+    Gzip,
+    Lz4,
+    Lz4Legacy,
+    Xz,
+};
+
+enum class CompressedFileMode
+{
+    Decompress,
+    Compress,
+};
+
+enum class CompressedFileError
+{
+    InvalidHeader           = 10,
+    CorruptData             = 11,
+    ChecksumMismatch        = 12,
+    TruncatedData           = 13,
+
+    UnsupportedOptions      = 20,
+
+    BackendError            = 30,
+};
+
+MB_EXPORT std::error_code make_error_code(CompressedFileError e);
+
+MB_EXPORT const std::error_category & compressed_file_error_category();
+
+namespace detail
+{
+class CompressedCodec;
+}
+
+class MB_EXPORT CompressedFile : public File
+{
+public:
+    static constexpr int DEFAULT_LEVEL = -1;
+
+    CompressedFile();
+    CompressedFile(File *file, CompressionFormat format,
+                   CompressedFileMode mode);
+    CompressedFile(File *file, CompressionFormat format,
+                   CompressedFileMode mode, int level);
+    virtual ~CompressedFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompressedFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CompressedFile)
+
+    oc::result<void> open(File *file, CompressionFormat format,
+                          CompressedFileMode mode);
+    oc::result<void> open(File *file, CompressionFormat format,
+                          CompressedFileMode mode, int level);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> skip_to(uint64_t offset);
+
+    File *m_file;
+    CompressionFormat m_format;
+    CompressedFileMode m_mode;
+    int m_level;
+
+    std::unique_ptr<detail::CompressedCodec> m_codec;
+
+    // Logical file position
+    uint64_t m_pos;
+    // Uncompressed offset of the decoder. This only differs from m_pos if the
+    // file position is past the end of the file.
+    uint64_t m_decoded;
+    // Uncompressed size, once the decoder has reached the end of the stream
+    optional<uint64_t> m_size;
+
+    std::vector<unsigned char> m_skip_buf;
+    /*! \endcond */
+};
+
+}
+
+namespace std
+{
+    template<>
+    struct MB_EXPORT is_error_code_enum<mb::CompressedFileError> : true_type
+    {
+    };
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+/*! \cond INTERNAL */
+namespace mb
+{
+namespace detail
+{
+
+class CompressedInput
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    explicit CompressedInput(File &file);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompressedInput)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CompressedInput)
+
+    oc::result<void> init();
+
+    bool seekable() const;
+    uint64_t offset() const;
+
+    const unsigned char * data() const;
+    size_t available() const;
+    void consume(size_t n);
+
+    oc::result<size_t> fill();
+    oc::result<bool> ensure(size_t n);
+    oc::result<void> read(void *buf, size_t size);
+    oc::result<void> seek(uint64_t offset);
+
+private:
+    File &m_file;
+    std::vector<unsigned char> m_buf;
+    // Offset of next unconsumed byte in m_buf
+    size_t m_pos;
+    // Number of valid bytes in m_buf
+    size_t m_len;
+    // Compressed offset of m_buf[0]
+    uint64_t m_offset;
+
+    bool m_seekable;
+    // Position of the underlying file where the compressed stream begins
+    uint64_t m_start;
+};
+
+class CompressedCodec
+{
+public:
+    explicit CompressedCodec(File &file);
+    virtual ~CompressedCodec();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompressedCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CompressedCodec)
+
+    oc::result<void> open_decoder();
+    bool can_restore() const;
+
+    // Decompression
+    virtual oc::result<void> reset_decoder() = 0;
+    virtual oc::result<size_t> decode(void *buf, size_t size) = 0;
+    virtual oc::result<uint64_t> restore_decoder(uint64_t offset);
+
+    // Compression
+    virtual oc::result<void> init_encoder(int level) = 0;
+    virtual oc::result<void> encode(const void *buf, size_t size) = 0;
+    virtual oc::result<void> finish_encoder() = 0;
+
+protected:
+    File &m_file;
+    CompressedInput m_input;
+};
+
+std::unique_ptr<CompressedCodec> create_gzip_codec(File &file);
+std::unique_ptr<CompressedCodec> create_lz4_codec(File &file, bool legacy);
+std::unique_ptr<CompressedCodec> create_xz_codec(File &file);
+
+}
+}
+/*! \endcond */
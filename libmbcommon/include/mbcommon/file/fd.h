@@ -62,6 +62,21 @@ protected:
     oc::result<size_t> on_write(const void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
+#ifndef _WIN32
+    oc::result<size_t> on_pread(void *buf, size_t size,
+                                uint64_t offset) override;
+    oc::result<size_t> on_pwrite(const void *buf, size_t size,
+                                 uint64_t offset) override;
+    oc::result<size_t> on_readv(const FileIoVec *iov,
+                                size_t iov_count) override;
+    oc::result<size_t> on_writev(const FileIoVec *iov,
+                                 size_t iov_count) override;
+#endif
+#ifdef __linux__
+    oc::result<void> on_insert_range(uint64_t offset, uint64_t size) override;
+    oc::result<void> on_collapse_range(uint64_t offset,
+                                       uint64_t size) override;
+#endif
 
 private:
     /*! \cond INTERNAL */
@@ -46,11 +46,18 @@ protected:
     oc::result<size_t> on_write(const void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_pread(void *buf, size_t size,
+                                uint64_t offset) override;
+    oc::result<size_t> on_pwrite(const void *buf, size_t size,
+                                 uint64_t offset) override;
 
 private:
     /*! \cond INTERNAL */
     void clear();
 
+    size_t read_at(void *buf, size_t size, size_t pos);
+    oc::result<size_t> write_at(const void *buf, size_t size, size_t pos);
+
     void *m_data;
     size_t m_size;
 
@@ -64,10 +64,24 @@ protected:
     oc::result<size_t> on_write(const void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
+#ifndef _WIN32
+    oc::result<size_t> on_pread(void *buf, size_t size,
+                                uint64_t offset) override;
+    oc::result<size_t> on_pwrite(const void *buf, size_t size,
+                                 uint64_t offset) override;
+#endif
+#ifdef __linux__
+    oc::result<void> on_insert_range(uint64_t offset, uint64_t size) override;
+    oc::result<void> on_collapse_range(uint64_t offset,
+                                       uint64_t size) override;
+#endif
 
 private:
     /*! \cond INTERNAL */
     void clear();
+#ifdef __linux__
+    oc::result<void> shift_range(int mode, uint64_t offset, uint64_t size);
+#endif
 
     detail::PosixFileFuncs *m_funcs;
 
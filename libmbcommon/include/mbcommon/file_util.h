@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "mbcommon/file.h"
 
 namespace mb
@@ -34,6 +36,16 @@ using FileSearchResultCallback =
         oc::result<FileSearchAction> (*)(File &file, void *userdata,
                                          uint64_t offset);
 
+struct FileSearchPattern
+{
+    const void *data;
+    size_t size;
+};
+
+using FileMultiSearchResultCallback =
+        oc::result<FileSearchAction> (*)(File &file, void *userdata,
+                                         size_t index, uint64_t offset);
+
 MB_EXPORT oc::result<size_t> file_read_retry(File &file,
                                              void *buf, size_t size);
 MB_EXPORT oc::result<size_t> file_write_retry(File &file,
@@ -44,6 +56,16 @@ MB_EXPORT oc::result<void> file_read_exact(File &file,
 MB_EXPORT oc::result<void> file_write_exact(File &file,
                                             const void *buf, size_t size);
 
+MB_EXPORT oc::result<size_t> file_pread_retry(File &file, void *buf,
+                                              size_t size, uint64_t offset);
+MB_EXPORT oc::result<size_t> file_pwrite_retry(File &file, const void *buf,
+                                               size_t size, uint64_t offset);
+
+MB_EXPORT oc::result<void> file_pread_exact(File &file, void *buf,
+                                            size_t size, uint64_t offset);
+MB_EXPORT oc::result<void> file_pwrite_exact(File &file, const void *buf,
+                                             size_t size, uint64_t offset);
+
 MB_EXPORT oc::result<uint64_t> file_read_discard(File &file, uint64_t size);
 
 MB_EXPORT oc::result<void> file_search(File &file, int64_t start, int64_t end,
@@ -52,6 +74,18 @@ MB_EXPORT oc::result<void> file_search(File &file, int64_t start, int64_t end,
                                        FileSearchResultCallback result_cb,
                                        void *userdata);
 
+MB_EXPORT oc::result<void>
+file_search_parallel(File &file, int64_t start, int64_t end, size_t bsize,
+                     const void *pattern, size_t pattern_size,
+                     int64_t max_matches, unsigned int threads,
+                     FileSearchResultCallback result_cb, void *userdata);
+
+MB_EXPORT oc::result<void>
+file_search_multi(File &file, int64_t start, int64_t end, size_t bsize,
+                  const std::vector<FileSearchPattern> &patterns,
+                  int64_t max_matches, FileMultiSearchResultCallback result_cb,
+                  void *userdata);
+
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
                                          uint64_t dest, uint64_t size);
 
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/flags.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+enum class HashAlgorithm
+{
+    Sha1,
+    Sha256,
+    Sha512,
+};
+
+enum class HashFlag : uint8_t
+{
+    Background  = 1 << 0,
+};
+MB_DECLARE_FLAGS(HashFlags, HashFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(HashFlags)
+
+enum class HashError
+{
+    InvalidState            = 10,
+
+    BackendError            = 20,
+};
+
+MB_EXPORT std::error_code make_error_code(HashError e);
+
+MB_EXPORT const std::error_category & hash_error_category();
+
+namespace detail
+{
+struct HasherImpl;
+}
+
+class MB_EXPORT Hasher
+{
+public:
+    Hasher();
+    ~Hasher();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Hasher)
+
+    Hasher(Hasher &&other) noexcept;
+    Hasher & operator=(Hasher &&rhs) noexcept;
+
+    oc::result<void> init(HashAlgorithm algorithm, HashFlags flags = {});
+    oc::result<void> update(const void *data, size_t size);
+    oc::result<std::vector<unsigned char>> finish();
+    void reset();
+
+    bool is_active() const;
+
+private:
+    std::unique_ptr<detail::HasherImpl> m_impl;
+};
+
+MB_EXPORT size_t hash_digest_size(HashAlgorithm algorithm);
+
+MB_EXPORT oc::result<std::vector<unsigned char>>
+compute_hash(HashAlgorithm algorithm, const void *data, size_t size);
+
+}
+
+namespace std
+{
+    template<>
+    struct MB_EXPORT is_error_code_enum<mb::HashError> : true_type
+    {
+    };
+}
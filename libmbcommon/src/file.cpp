@@ -22,6 +22,7 @@
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 
@@ -49,6 +50,26 @@ namespace mb
 
 using namespace detail;
 
+/*!
+ * \struct FileIoVec
+ *
+ * \brief Buffer descriptor for File::readv() and File::writev()
+ *
+ * This is the platform-independent equivalent of `struct iovec`.
+ */
+
+/*!
+ * \var FileIoVec::base
+ *
+ * \brief Pointer to the buffer
+ */
+
+/*!
+ * \var FileIoVec::size
+ *
+ * \brief Size of the buffer
+ */
+
 /*!
  * \class File
  *
@@ -286,6 +307,137 @@ oc::result<void> File::truncate(uint64_t size)
     return on_truncate(size);
 }
 
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This function reads from \p offset without using or changing the file
+ * position. File implementations with native support for positional reads
+ * (eg. FdFile) can be shared between threads that only use pread(). Other
+ * implementations emulate the operation with seek() and read(), which is *not*
+ * thread safe.
+ *
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ *
+ * \return Number of bytes read if some bytes were read or EOF was reached.
+ *         Otherwise, the error code.
+ */
+oc::result<size_t> File::pread(void *buf, size_t size, uint64_t offset)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_pread(buf, size, offset);
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This function writes to \p offset without using or changing the file
+ * position. See pread() for the thread safety guarantees.
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ * \param offset File offset to write to
+ *
+ * \return Number of bytes that were written if some bytes were successfully
+ *         written or EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::pwrite(const void *buf, size_t size, uint64_t offset)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_pwrite(buf, size, offset);
+}
+
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * The buffers in \p iov are filled in order, starting from the current file
+ * position. Like File::read(), fewer bytes than requested may be read.
+ *
+ * \param iov Array of buffers to read into
+ * \param iov_count Number of elements in \p iov
+ *
+ * \return Total number of bytes read if some bytes were read or EOF was
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::readv(const FileIoVec *iov, size_t iov_count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_readv(iov, iov_count);
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * The buffers in \p iov are written in order, starting from the current file
+ * position. Like File::write(), fewer bytes than requested may be written.
+ *
+ * \param iov Array of buffers to write from
+ * \param iov_count Number of elements in \p iov
+ *
+ * \return Total number of bytes written if some bytes were successfully
+ *         written or EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::writev(const FileIoVec *iov, size_t iov_count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_writev(iov, iov_count);
+}
+
+/*!
+ * \brief Insert space into a file without rewriting the data after it.
+ *
+ * The data starting at \p offset is shifted forwards by \p size bytes and the
+ * file size increases by \p size bytes. The contents of the inserted range are
+ * zeros. The file position is not changed.
+ *
+ * This is an optional operation that is only supported by some File
+ * implementations and filesystems (eg. `FALLOC_FL_INSERT_RANGE` on Linux).
+ * Filesystems usually require \p offset and \p size to be multiples of the
+ * block size.
+ *
+ * \param offset Offset to insert space at. Must be less than the file size.
+ * \param size Number of bytes to insert
+ *
+ * \return Nothing if the space was successfully inserted. Otherwise, the error
+ *         code. If the operation is not supported, the error code will be
+ *         equivalent to FileErrorC::Unsupported.
+ */
+oc::result<void> File::insert_range(uint64_t offset, uint64_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_insert_range(offset, size);
+}
+
+/*!
+ * \brief Remove a range from a file without rewriting the data after it.
+ *
+ * The data starting at \p offset + \p size is shifted backwards by \p size
+ * bytes and the file size decreases by \p size bytes. The file position is not
+ * changed.
+ *
+ * This has the same restrictions as insert_range().
+ *
+ * \param offset Offset of range to remove
+ * \param size Number of bytes to remove. The range must end before the end of
+ *             the file.
+ *
+ * \return Nothing if the range was successfully removed. Otherwise, the error
+ *         code. If the operation is not supported, the error code will be
+ *         equivalent to FileErrorC::Unsupported.
+ */
+oc::result<void> File::collapse_range(uint64_t offset, uint64_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_collapse_range(offset, size);
+}
+
 /*!
  * \brief Check whether file is opened
  *
@@ -324,6 +476,25 @@ void File::set_fatal()
     }
 }
 
+/*!
+ * \brief Get in-memory view of the entire file contents
+ *
+ * Files that keep their whole contents addressable in memory (eg. MmapFile)
+ * override this so that callers can inspect the data in place instead of
+ * seeking and reading. The view is only valid while the file is open.
+ *
+ * \note Callers must not assume that a file without a mapping is empty. The
+ *       default implementation returns `{nullptr, 0}`, which only means that
+ *       the contents must be accessed with read().
+ *
+ * \return Pointer to the first byte of the file and the size of the file or
+ *         `{nullptr, 0}` if the file does not provide a mapping
+ */
+std::pair<const void *, size_t> File::mapping() const
+{
+    return { nullptr, 0 };
+}
+
 /*!
  * \brief Get current state of the File handle
  *
@@ -517,4 +688,205 @@ oc::result<void> File::on_truncate(uint64_t size)
     return FileError::UnsupportedTruncate;
 }
 
+/*!
+ * \brief File positional read callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * reading at an offset without changing the file position.
+ *
+ * If this method is not overridden, it will be emulated by saving the file
+ * position with on_seek(), seeking to \p offset, calling on_read(), and then
+ * restoring the file position. If the file position cannot be restored, the
+ * file handle will be set to the fatal state.
+ *
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ *
+ * \return Number of bytes read if some bytes were successfully read or EOF was
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::on_pread(void *buf, size_t size, uint64_t offset)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(old_pos, on_seek(0, SEEK_CUR));
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto ret = on_read(buf, size);
+
+    auto restore_ret = on_seek(static_cast<int64_t>(old_pos), SEEK_SET);
+    if (!restore_ret) {
+        set_fatal();
+        return restore_ret.as_failure();
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief File positional write callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * writing at an offset without changing the file position.
+ *
+ * If this method is not overridden, it will be emulated with on_seek() and
+ * on_write() in the same way as on_pread().
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ * \param offset File offset to write to
+ *
+ * \return Number of bytes written if some bytes were successfully written or
+ *         EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::on_pwrite(const void *buf, size_t size,
+                                   uint64_t offset)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(old_pos, on_seek(0, SEEK_CUR));
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto ret = on_write(buf, size);
+
+    auto restore_ret = on_seek(static_cast<int64_t>(old_pos), SEEK_SET);
+    if (!restore_ret) {
+        set_fatal();
+        return restore_ret.as_failure();
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief File vectored read callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * scatter reads.
+ *
+ * If this method is not overridden, on_read() will be called for each buffer
+ * until a short read occurs. If an error occurs after some bytes have already
+ * been read, the number of bytes read so far is returned and the error will be
+ * reported by the next operation.
+ *
+ * \param iov Array of buffers to read into
+ * \param iov_count Number of elements in \p iov
+ *
+ * \return Total number of bytes read if some bytes were successfully read or
+ *         EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::on_readv(const FileIoVec *iov, size_t iov_count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < iov_count; ++i) {
+        auto n = on_read(iov[i].base, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File vectored write callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * gather writes.
+ *
+ * If this method is not overridden, on_write() will be called for each buffer
+ * in the same way as on_readv().
+ *
+ * \param iov Array of buffers to write from
+ * \param iov_count Number of elements in \p iov
+ *
+ * \return Total number of bytes written if some bytes were successfully
+ *         written or EOF was reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::on_writev(const FileIoVec *iov, size_t iov_count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < iov_count; ++i) {
+        auto n = on_write(iov[i].base, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File range insertion callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * inserting space without rewriting the data after it.
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * If this method is not overridden, it will simply return
+ * FileError::UnsupportedShift.
+ *
+ * \param offset Offset to insert space at
+ * \param size Number of bytes to insert
+ *
+ * \return Always returns #FileError::UnsupportedShift
+ */
+oc::result<void> File::on_insert_range(uint64_t offset, uint64_t size)
+{
+    (void) offset;
+    (void) size;
+
+    return FileError::UnsupportedShift;
+}
+
+/*!
+ * \brief File range removal callback
+ *
+ * Subclasses should override this method if the underlying file supports
+ * removing a range without rewriting the data after it.
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * If this method is not overridden, it will simply return
+ * FileError::UnsupportedShift.
+ *
+ * \param offset Offset of range to remove
+ * \param size Number of bytes to remove
+ *
+ * \return Always returns #FileError::UnsupportedShift
+ */
+oc::result<void> File::on_collapse_range(uint64_t offset, uint64_t size)
+{
+    (void) offset;
+    (void) size;
+
+    return FileError::UnsupportedShift;
+}
+
 }
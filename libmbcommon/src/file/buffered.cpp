@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Add read and write buffering to another File handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Buffer reads and writes of another File handle.
+ *
+ * Small reads are served from a read-ahead buffer and small writes are
+ * coalesced in a write buffer before being passed to the underlying File
+ * handle. Reads and writes that are at least as large as the respective buffer
+ * bypass the buffer entirely.
+ *
+ * Seeking within the read buffer does not touch the underlying file. Any other
+ * operation that moves the file position or changes the file contents, such as
+ * seek(), truncate() or pwrite(), first flushes pending writes and, if needed,
+ * discards the read buffer. pread() only flushes pending writes.
+ *
+ * Pending writes are flushed when flush() or close() is called. If flushing
+ * fails, the buffered data is lost and the handle is put in the fatal state.
+ * When the handle is closed, the position of a seekable underlying file is
+ * moved back to the logical file position of the BufferedFile.
+ *
+ * \note The underlying file must not be accessed directly while it is wrapped
+ *       by a BufferedFile. Wrapping files opened in append mode is not
+ *       supported.
+ */
+
+/*!
+ * \var BufferedFile::DEFAULT_BUFFER_SIZE
+ *
+ * \brief Default size of the read and write buffers
+ */
+constexpr size_t BufferedFile::DEFAULT_BUFFER_SIZE;
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+BufferedFile::BufferedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *)
+ *
+ * \param file File to wrap
+ */
+BufferedFile::BufferedFile(File *file)
+    : BufferedFile()
+{
+    (void) open(file);
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle with custom buffer
+ *        sizes.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t, size_t)
+ *
+ * \param file File to wrap
+ * \param read_buf_size Size of read buffer
+ * \param write_buf_size Size of write buffer
+ */
+BufferedFile::BufferedFile(File *file, size_t read_buf_size,
+                           size_t write_buf_size)
+    : BufferedFile()
+{
+    (void) open(file, read_buf_size, write_buf_size);
+}
+
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_rbuf(std::move(other.m_rbuf))
+    , m_rpos(other.m_rpos)
+    , m_rlen(other.m_rlen)
+    , m_wbuf(std::move(other.m_wbuf))
+    , m_wlen(other.m_wlen)
+    , m_rbuf_size(other.m_rbuf_size)
+    , m_wbuf_size(other.m_wbuf_size)
+    , m_have_file_pos(other.m_have_file_pos)
+    , m_file_pos(other.m_file_pos)
+{
+    other.clear();
+}
+
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_rbuf.swap(rhs.m_rbuf);
+    m_rpos = rhs.m_rpos;
+    m_rlen = rhs.m_rlen;
+    m_wbuf.swap(rhs.m_wbuf);
+    m_wlen = rhs.m_wlen;
+    m_rbuf_size = rhs.m_rbuf_size;
+    m_wbuf_size = rhs.m_wbuf_size;
+    m_have_file_pos = rhs.m_have_file_pos;
+    m_file_pos = rhs.m_file_pos;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle.
+ *
+ * The read and write buffers will be #DEFAULT_BUFFER_SIZE bytes.
+ *
+ * \note The BufferedFile will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed. The BufferedFile must be closed first so that pending writes
+ *       are flushed.
+ *
+ * \param file File to wrap
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file)
+{
+    return open(file, DEFAULT_BUFFER_SIZE, DEFAULT_BUFFER_SIZE);
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle with custom buffer
+ *        sizes.
+ *
+ * A buffer size of 0 disables buffering in that direction.
+ *
+ * \sa open(File *)
+ *
+ * \param file File to wrap
+ * \param read_buf_size Size of read buffer
+ * \param write_buf_size Size of write buffer
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file, size_t read_buf_size,
+                                    size_t write_buf_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_rbuf_size = read_buf_size;
+        m_wbuf_size = write_buf_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Write pending data to the underlying file.
+ *
+ * \return Nothing if all pending data was written. Otherwise, the error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return flush_write_buffer();
+}
+
+oc::result<void> BufferedFile::on_open()
+{
+    m_rbuf.resize(m_rbuf_size);
+    m_wbuf.resize(m_wbuf_size);
+
+    // The position is needed for seeking within the read buffer
+    auto pos = m_file->seek(0, SEEK_CUR);
+    if (pos) {
+        m_have_file_pos = true;
+        m_file_pos = pos.value();
+    } else if (pos.error() != FileErrorC::Unsupported) {
+        return pos.as_failure();
+    }
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    OUTCOME_TRYV(flush_write_buffer());
+
+    // Leave the underlying file at the logical file position
+    if (m_have_file_pos) {
+        OUTCOME_TRYV(discard_read_buffer());
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> BufferedFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRYV(flush_write_buffer());
+
+    if (m_rpos == m_rlen) {
+        m_rpos = 0;
+        m_rlen = 0;
+
+        // Large reads bypass the buffer
+        if (size >= m_rbuf.size()) {
+            auto n = m_file->read(buf, size);
+            if (!n) {
+                if (m_file->is_fatal()) { set_fatal(); }
+                return n.as_failure();
+            }
+
+            m_file_pos += n.value();
+            return n.value();
+        }
+
+        auto n = m_file->read(m_rbuf.data(), m_rbuf.size());
+        if (!n) {
+            if (m_file->is_fatal()) { set_fatal(); }
+            return n.as_failure();
+        }
+
+        m_rlen = n.value();
+        m_file_pos += m_rlen;
+    }
+
+    size_t to_copy = std::min(size, m_rlen - m_rpos);
+    memcpy(buf, m_rbuf.data() + m_rpos, to_copy);
+    m_rpos += to_copy;
+
+    return to_copy;
+}
+
+oc::result<size_t> BufferedFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRYV(discard_read_buffer());
+
+    if (size > m_wbuf.size() - m_wlen) {
+        OUTCOME_TRYV(flush_write_buffer());
+
+        // Large writes bypass the buffer
+        if (size >= m_wbuf.size()) {
+            auto n = m_file->write(buf, size);
+            if (!n) {
+                if (m_file->is_fatal()) { set_fatal(); }
+                return n.as_failure();
+            }
+
+            m_file_pos += n.value();
+            return n.value();
+        }
+    }
+
+    memcpy(m_wbuf.data() + m_wlen, buf, size);
+    m_wlen += size;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::on_seek(int64_t offset, int whence)
+{
+    // Seek within the read buffer if possible
+    if (m_have_file_pos && m_rlen > 0) {
+        uint64_t buf_begin = m_file_pos - m_rlen;
+
+        if (whence == SEEK_SET && offset >= 0
+                && static_cast<uint64_t>(offset) >= buf_begin
+                && static_cast<uint64_t>(offset) - buf_begin <= m_rlen) {
+            m_rpos = static_cast<size_t>(static_cast<uint64_t>(offset)
+                    - buf_begin);
+            return static_cast<uint64_t>(offset);
+        } else if (whence == SEEK_CUR
+                && ((offset >= 0
+                        && static_cast<uint64_t>(offset) <= m_rlen - m_rpos)
+                || (offset < 0
+                        && offset >= -static_cast<int64_t>(m_rpos)))) {
+            m_rpos = static_cast<size_t>(static_cast<int64_t>(m_rpos) + offset);
+            return buf_begin + m_rpos;
+        }
+    }
+
+    OUTCOME_TRYV(flush_write_buffer());
+
+    // The underlying file position is ahead by the number of unread bytes
+    if (whence == SEEK_CUR && m_rlen > m_rpos) {
+        auto unread = static_cast<int64_t>(m_rlen - m_rpos);
+        if (offset < INT64_MIN + unread) {
+            return FileError::ArgumentOutOfRange;
+        }
+        offset -= unread;
+    }
+
+    auto pos = m_file->seek(offset, whence);
+    if (!pos) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return pos.as_failure();
+    }
+
+    m_rpos = 0;
+    m_rlen = 0;
+    m_have_file_pos = true;
+    m_file_pos = pos.value();
+
+    return pos.value();
+}
+
+oc::result<void> BufferedFile::on_truncate(uint64_t size)
+{
+    OUTCOME_TRYV(flush_write_buffer());
+    OUTCOME_TRYV(discard_read_buffer());
+
+    auto ret = m_file->truncate(size);
+    if (!ret) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return ret.as_failure();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> BufferedFile::on_pread(void *buf, size_t size,
+                                          uint64_t offset)
+{
+    OUTCOME_TRYV(flush_write_buffer());
+
+    auto n = m_file->pread(buf, size, offset);
+    if (!n) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return n.as_failure();
+    }
+
+    return n.value();
+}
+
+oc::result<size_t> BufferedFile::on_pwrite(const void *buf, size_t size,
+                                           uint64_t offset)
+{
+    OUTCOME_TRYV(flush_write_buffer());
+    OUTCOME_TRYV(discard_read_buffer());
+
+    auto n = m_file->pwrite(buf, size, offset);
+    if (!n) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return n.as_failure();
+    }
+
+    return n.value();
+}
+
+void BufferedFile::clear()
+{
+    m_file = nullptr;
+    m_rbuf.clear();
+    m_rbuf.shrink_to_fit();
+    m_rpos = 0;
+    m_rlen = 0;
+    m_wbuf.clear();
+    m_wbuf.shrink_to_fit();
+    m_wlen = 0;
+    m_rbuf_size = DEFAULT_BUFFER_SIZE;
+    m_wbuf_size = DEFAULT_BUFFER_SIZE;
+    m_have_file_pos = false;
+    m_file_pos = 0;
+}
+
+oc::result<void> BufferedFile::flush_write_buffer()
+{
+    if (m_wlen == 0) {
+        return oc::success();
+    }
+
+    auto ret = file_write_exact(*m_file, m_wbuf.data(), m_wlen);
+    if (!ret) {
+        // There's no way to know how much of the buffer was written
+        m_wlen = 0;
+        m_have_file_pos = false;
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    m_file_pos += m_wlen;
+    m_wlen = 0;
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::discard_read_buffer()
+{
+    if (m_rlen > m_rpos) {
+        // Move the underlying file position back to the logical position
+        auto pos = m_file->seek(-static_cast<int64_t>(m_rlen - m_rpos),
+                                SEEK_CUR);
+        if (!pos) {
+            if (m_file->is_fatal()) { set_fatal(); }
+            return pos.as_failure();
+        }
+
+        m_file_pos = pos.value();
+    }
+
+    m_rpos = 0;
+    m_rlen = 0;
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,670 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed.h"
+
+#include <algorithm>
+#include <string>
+
+#include <cstring>
+
+#include "mbcommon/file/compressed_p.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/compressed.h
+ * \brief Transparently decompress or compress data of another File handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+struct CompressedFileErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const std::error_category & compressed_file_error_category()
+{
+    static CompressedFileErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(CompressedFileError e)
+{
+    return {static_cast<int>(e), compressed_file_error_category()};
+}
+
+const char * CompressedFileErrorCategory::name() const noexcept
+{
+    return "compressed_file";
+}
+
+std::string CompressedFileErrorCategory::message(int ev) const
+{
+    switch (static_cast<CompressedFileError>(ev)) {
+    case CompressedFileError::InvalidHeader:
+        return "invalid stream header";
+    case CompressedFileError::CorruptData:
+        return "compressed data is corrupt";
+    case CompressedFileError::ChecksumMismatch:
+        return "checksum mismatch";
+    case CompressedFileError::TruncatedData:
+        return "compressed data is truncated";
+    case CompressedFileError::UnsupportedOptions:
+        return "stream uses unsupported options";
+    case CompressedFileError::BackendError:
+        return "compression library error";
+    default:
+        return "(unknown compressed file error)";
+    }
+}
+
+namespace detail
+{
+
+constexpr size_t CompressedInput::BUFFER_SIZE;
+
+CompressedInput::CompressedInput(File &file)
+    : m_file(file)
+    , m_pos(0)
+    , m_len(0)
+    , m_offset(0)
+    , m_seekable(false)
+    , m_start(0)
+{
+}
+
+/*!
+ * \brief Record the position of the underlying file as the start of the
+ *        compressed stream
+ *
+ * If the underlying file cannot seek, the stream can only be read once.
+ */
+oc::result<void> CompressedInput::init()
+{
+    m_buf.resize(BUFFER_SIZE);
+    m_pos = 0;
+    m_len = 0;
+    m_offset = 0;
+
+    auto pos = m_file.seek(0, SEEK_CUR);
+    if (pos) {
+        m_seekable = true;
+        m_start = pos.value();
+    } else if (pos.error() == FileErrorC::Unsupported) {
+        m_seekable = false;
+        m_start = 0;
+    } else {
+        return pos.as_failure();
+    }
+
+    return oc::success();
+}
+
+bool CompressedInput::seekable() const
+{
+    return m_seekable;
+}
+
+/*!
+ * \brief Offset of the next unconsumed byte, relative to the start of the
+ *        compressed stream
+ */
+uint64_t CompressedInput::offset() const
+{
+    return m_offset + m_pos;
+}
+
+const unsigned char * CompressedInput::data() const
+{
+    return m_buf.data() + m_pos;
+}
+
+size_t CompressedInput::available() const
+{
+    return m_len - m_pos;
+}
+
+void CompressedInput::consume(size_t n)
+{
+    m_pos += std::min(n, available());
+}
+
+/*!
+ * \brief Read more data if the buffer is empty
+ *
+ * \return Number of available bytes. This is only 0 at the end of the
+ *         underlying file.
+ */
+oc::result<size_t> CompressedInput::fill()
+{
+    if (m_pos == m_len) {
+        m_offset += m_len;
+        m_pos = 0;
+        m_len = 0;
+
+        OUTCOME_TRY(n, file_read_retry(m_file, m_buf.data(), m_buf.size()));
+        m_len = n;
+    }
+
+    return available();
+}
+
+/*!
+ * \brief Ensure that at least \p n contiguous bytes are available
+ *
+ * \pre \p n must not be larger than #BUFFER_SIZE
+ *
+ * \return Whether \p n bytes are available. This is only false if the end of
+ *         the underlying file is reached first.
+ */
+oc::result<bool> CompressedInput::ensure(size_t n)
+{
+    if (available() >= n) {
+        return true;
+    }
+
+    // Move the remaining data to the beginning of the buffer
+    memmove(m_buf.data(), m_buf.data() + m_pos, available());
+    m_offset += m_pos;
+    m_len -= m_pos;
+    m_pos = 0;
+
+    while (m_len < n) {
+        OUTCOME_TRY(n_read, m_file.read(m_buf.data() + m_len,
+                                        m_buf.size() - m_len));
+        if (n_read == 0) {
+            return false;
+        }
+        m_len += n_read;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read exactly \p size bytes
+ *
+ * \return Nothing if \p size bytes were read. Otherwise, the error code.
+ *         CompressedFileError::TruncatedData is returned if the end of the
+ *         underlying file is reached first.
+ */
+oc::result<void> CompressedInput::read(void *buf, size_t size)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        OUTCOME_TRY(n, fill());
+        if (n == 0) {
+            return CompressedFileError::TruncatedData;
+        }
+
+        n = std::min(n, size);
+        memcpy(ptr, data(), n);
+        consume(n);
+
+        ptr += n;
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Seek to an offset relative to the start of the compressed stream
+ *
+ * \pre The underlying file must be seekable
+ */
+oc::result<void> CompressedInput::seek(uint64_t offset)
+{
+    // Seek within the buffer if possible
+    if (offset >= m_offset && offset - m_offset <= m_len) {
+        m_pos = static_cast<size_t>(offset - m_offset);
+        return oc::success();
+    }
+
+    if (!m_seekable) {
+        return FileError::UnsupportedSeek;
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX) - m_start) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRYV(m_file.seek(static_cast<int64_t>(m_start + offset),
+                             SEEK_SET));
+
+    m_pos = 0;
+    m_len = 0;
+    m_offset = offset;
+
+    return oc::success();
+}
+
+CompressedCodec::CompressedCodec(File &file)
+    : m_file(file)
+    , m_input(file)
+{
+}
+
+CompressedCodec::~CompressedCodec() = default;
+
+/*!
+ * \brief Start decoding at the current position of the underlying file
+ */
+oc::result<void> CompressedCodec::open_decoder()
+{
+    OUTCOME_TRYV(m_input.init());
+    return reset_decoder();
+}
+
+/*!
+ * \brief Whether restore_decoder() can move the decoder backwards
+ */
+bool CompressedCodec::can_restore() const
+{
+    return m_input.seekable();
+}
+
+/*!
+ * \brief Move the decoder to the closest checkpoint at or before \p offset
+ *
+ * The default implementation restarts decoding from the beginning of the
+ * stream.
+ *
+ * \return Uncompressed offset at which the decoder was placed
+ */
+oc::result<uint64_t> CompressedCodec::restore_decoder(uint64_t offset)
+{
+    (void) offset;
+
+    OUTCOME_TRYV(m_input.seek(0));
+    OUTCOME_TRYV(reset_decoder());
+
+    return 0;
+}
+
+}
+
+/*!
+ * \class CompressedFile
+ *
+ * \brief Decompress or compress the data of another File handle.
+ *
+ * In CompressedFileMode::Decompress mode, reads return the decompressed data of
+ * the underlying file. Concatenated streams (eg. multi-member gzip files) are
+ * read as one stream and data following the last stream is ignored.
+ *
+ * Seeking is supported if the underlying file is seekable. While reading, the
+ * decoder records checkpoints from which decompression can be resumed:
+ *
+ * * gzip: every 1 MiB of uncompressed data at a deflate block boundary, along
+ *   with the 32 KiB window needed to resume inflating
+ * * xz: at the start of every block
+ * * lz4: at the start of every frame and at every legacy-format block
+ *
+ * Seeking backwards resumes decompression from the nearest checkpoint before
+ * the target offset. Seeking forwards decompresses and discards data up to the
+ * target offset. Seeking relative to the end of the file requires the entire
+ * file to be decompressed the first time it is done.
+ *
+ * In CompressedFileMode::Compress mode, writes are compressed and written to
+ * the underlying file. The stream is finalized when the file is closed. Only
+ * the current position can be queried with `seek(0, SEEK_CUR)`.
+ *
+ * Compressed gzip streams use zlib's default header. xz streams are written as
+ * a single block with a CRC32 check so that they can be decompressed by the
+ * Linux kernel. CompressionFormat::Lz4Legacy writes the legacy lz4 format used
+ * by the Linux kernel for ramdisks and CompressionFormat::Lz4 writes the lz4
+ * frame format. When decompressing, both lz4 formats are accepted.
+ *
+ * \note The underlying file must not be accessed directly while it is wrapped
+ *       by a CompressedFile.
+ */
+
+/*!
+ * \var CompressedFile::DEFAULT_LEVEL
+ *
+ * \brief Use the compression library's default compression level
+ */
+constexpr int CompressedFile::DEFAULT_LEVEL;
+
+/*! \brief Size of the buffer used for discarding data when seeking */
+static constexpr size_t SKIP_BUF_SIZE = 64 * 1024;
+
+/*!
+ * \brief Construct unbound CompressedFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+CompressedFile::CompressedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, CompressionFormat, CompressedFileMode)
+ *
+ * \param file File to wrap
+ * \param format Compression format
+ * \param mode Whether to decompress or compress
+ */
+CompressedFile::CompressedFile(File *file, CompressionFormat format,
+                               CompressedFileMode mode)
+    : CompressedFile()
+{
+    (void) open(file, format, mode);
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle with a custom
+ *        compression level.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, CompressionFormat, CompressedFileMode, int)
+ *
+ * \param file File to wrap
+ * \param format Compression format
+ * \param mode Whether to decompress or compress
+ * \param level Compression level
+ */
+CompressedFile::CompressedFile(File *file, CompressionFormat format,
+                               CompressedFileMode mode, int level)
+    : CompressedFile()
+{
+    (void) open(file, format, mode, level);
+}
+
+CompressedFile::~CompressedFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle.
+ *
+ * The library's default compression level is used.
+ *
+ * \note The CompressedFile will *not* take ownership of \p file. The caller
+ *       must ensure that it is properly closed and destroyed when it is no
+ *       longer needed. When compressing, the CompressedFile must be closed
+ *       first so that the stream is finalized.
+ *
+ * \param file File to wrap. The compressed stream starts at the current file
+ *             position.
+ * \param format Compression format
+ * \param mode Whether to decompress or compress
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> CompressedFile::open(File *file, CompressionFormat format,
+                                      CompressedFileMode mode)
+{
+    return open(file, format, mode, DEFAULT_LEVEL);
+}
+
+/*!
+ * \brief Open File handle wrapping another File handle with a custom
+ *        compression level.
+ *
+ * \sa open(File *, CompressionFormat, CompressedFileMode)
+ *
+ * \param file File to wrap
+ * \param format Compression format
+ * \param mode Whether to decompress or compress
+ * \param level Compression level. The range depends on the format: 0-9 for
+ *              gzip and xz, and 1-12 for lz4, where levels 3 and above use lz4
+ *              HC. This is ignored when decompressing.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> CompressedFile::open(File *file, CompressionFormat format,
+                                      CompressedFileMode mode, int level)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_format = format;
+        m_mode = mode;
+        m_level = level;
+    }
+
+    return File::open();
+}
+
+oc::result<void> CompressedFile::on_open()
+{
+    switch (m_format) {
+    case CompressionFormat::Gzip:
+        m_codec = create_gzip_codec(*m_file);
+        break;
+    case CompressionFormat::Lz4:
+        m_codec = create_lz4_codec(*m_file, false);
+        break;
+    case CompressionFormat::Lz4Legacy:
+        m_codec = create_lz4_codec(*m_file, true);
+        break;
+    case CompressionFormat::Xz:
+        m_codec = create_xz_codec(*m_file);
+        break;
+    default:
+        MB_UNREACHABLE("Invalid compression format: %d",
+                       static_cast<int>(m_format));
+    }
+
+    if (m_mode == CompressedFileMode::Decompress) {
+        return m_codec->open_decoder();
+    } else {
+        return m_codec->init_encoder(m_level);
+    }
+}
+
+oc::result<void> CompressedFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    // Finalize the stream unless opening failed or a write failed
+    if (m_codec && m_mode == CompressedFileMode::Compress && is_open()) {
+        OUTCOME_TRYV(m_codec->finish_encoder());
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> CompressedFile::on_read(void *buf, size_t size)
+{
+    if (m_mode != CompressedFileMode::Decompress) {
+        return FileError::UnsupportedRead;
+    }
+
+    // Reading past the end of the file
+    if (m_pos != m_decoded) {
+        return 0;
+    }
+
+    auto n = m_codec->decode(buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return n.as_failure();
+    }
+
+    if (n.value() == 0 && size > 0) {
+        m_size = m_decoded;
+    }
+
+    m_decoded += n.value();
+    m_pos = m_decoded;
+
+    return n.value();
+}
+
+oc::result<size_t> CompressedFile::on_write(const void *buf, size_t size)
+{
+    if (m_mode != CompressedFileMode::Compress) {
+        return FileError::UnsupportedWrite;
+    }
+
+    auto ret = m_codec->encode(buf, size);
+    if (!ret) {
+        // There's no way to know how much of the stream was written
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    m_pos += size;
+
+    return size;
+}
+
+oc::result<uint64_t> CompressedFile::on_seek(int64_t offset, int whence)
+{
+    if (m_mode != CompressedFileMode::Decompress) {
+        // Only allow querying the current position
+        if (offset == 0 && whence == SEEK_CUR) {
+            return m_pos;
+        }
+        return FileError::UnsupportedSeek;
+    }
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        if (!m_size) {
+            OUTCOME_TRYV(skip_to(UINT64_MAX));
+        }
+        base = *m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    uint64_t target;
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        target = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::IntegerOverflow;
+        }
+        target = base + static_cast<uint64_t>(offset);
+    }
+
+    if (target > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRYV(skip_to(target));
+    m_pos = target;
+
+    return m_pos;
+}
+
+void CompressedFile::clear()
+{
+    m_file = nullptr;
+    m_format = CompressionFormat::Gzip;
+    m_mode = CompressedFileMode::Decompress;
+    m_level = DEFAULT_LEVEL;
+    m_codec.reset();
+    m_pos = 0;
+    m_decoded = 0;
+    m_size = {};
+    m_skip_buf.clear();
+    m_skip_buf.shrink_to_fit();
+}
+
+/*!
+ * \brief Move the decoder to \p offset or to the end of the stream, whichever
+ *        comes first
+ */
+oc::result<void> CompressedFile::skip_to(uint64_t offset)
+{
+    if (offset < m_decoded) {
+        if (!m_codec->can_restore()) {
+            return FileError::UnsupportedSeek;
+        }
+
+        auto restored = m_codec->restore_decoder(offset);
+        if (!restored) {
+            if (m_file->is_fatal()) { set_fatal(); }
+            return restored.as_failure();
+        }
+
+        m_decoded = restored.value();
+        m_pos = m_decoded;
+    }
+
+    if (m_decoded < offset && m_skip_buf.empty()) {
+        m_skip_buf.resize(SKIP_BUF_SIZE);
+    }
+
+    while (m_decoded < offset) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(m_skip_buf.size(), offset - m_decoded));
+
+        auto n = m_codec->decode(m_skip_buf.data(), to_read);
+        if (!n) {
+            // Keep the position consistent with the decoder
+            m_pos = m_decoded;
+            if (m_file->is_fatal()) { set_fatal(); }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            m_size = m_decoded;
+            break;
+        }
+
+        m_decoded += n.value();
+    }
+
+    m_pos = m_decoded;
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <climits>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file_util.h"
+
+namespace mb
+{
+namespace detail
+{
+
+// Minimum amount of uncompressed data between checkpoints
+static constexpr uint64_t GZIP_CHECKPOINT_SPAN = 1024 * 1024;
+
+static constexpr size_t GZIP_OUT_BUF_SIZE = 64 * 1024;
+static constexpr size_t GZIP_HEADER_SIZE = 10;
+static constexpr size_t GZIP_TRAILER_SIZE = 8;
+
+static constexpr unsigned char GZIP_FHCRC = 1 << 1;
+static constexpr unsigned char GZIP_FEXTRA = 1 << 2;
+static constexpr unsigned char GZIP_FNAME = 1 << 3;
+static constexpr unsigned char GZIP_FCOMMENT = 1 << 4;
+static constexpr unsigned char GZIP_FRESERVED = 0xe0;
+
+struct GzipCheckpoint
+{
+    // Uncompressed offset
+    uint64_t out_offset;
+    // Compressed offset of the first byte that has not been fully consumed
+    uint64_t in_offset;
+    // Number of bits of the byte before in_offset that have not been consumed
+    int bits;
+    // Whether the checkpoint is at the start of a gzip member. If so, the
+    // following fields are unused.
+    bool member_start;
+    // Running CRC32 and size of the current member
+    uint32_t crc;
+    uint32_t member_size;
+    // Last 32 KiB of uncompressed data
+    std::vector<unsigned char> window;
+};
+
+class GzipCodec : public CompressedCodec
+{
+public:
+    explicit GzipCodec(File &file);
+    virtual ~GzipCodec();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(GzipCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(GzipCodec)
+
+    oc::result<void> reset_decoder() override;
+    oc::result<size_t> decode(void *buf, size_t size) override;
+    oc::result<uint64_t> restore_decoder(uint64_t offset) override;
+
+    oc::result<void> init_encoder(int level) override;
+    oc::result<void> encode(const void *buf, size_t size) override;
+    oc::result<void> finish_encoder() override;
+
+private:
+    enum class State
+    {
+        Header,
+        Inflate,
+        Done,
+    };
+
+    oc::result<bool> read_header();
+    oc::result<void> read_trailer();
+    oc::result<void> skip_string();
+    oc::result<void> skip_bytes(size_t size);
+    void add_checkpoint(bool member_start);
+
+    oc::result<void> deflate_and_write(int flush);
+
+    z_stream m_strm;
+    bool m_inflate_init;
+    bool m_deflate_init;
+
+    State m_state;
+    bool m_first_member;
+    uint64_t m_out_offset;
+    uint32_t m_crc;
+    uint32_t m_member_size;
+
+    std::vector<GzipCheckpoint> m_checkpoints;
+
+    std::vector<unsigned char> m_out_buf;
+};
+
+static std::error_code zlib_error(int ret)
+{
+    switch (ret) {
+    case Z_DATA_ERROR:
+    case Z_NEED_DICT:
+        return CompressedFileError::CorruptData;
+    case Z_STREAM_ERROR:
+        return CompressedFileError::UnsupportedOptions;
+    default:
+        return CompressedFileError::BackendError;
+    }
+}
+
+GzipCodec::GzipCodec(File &file)
+    : CompressedCodec(file)
+    , m_strm()
+    , m_inflate_init(false)
+    , m_deflate_init(false)
+    , m_state(State::Header)
+    , m_first_member(true)
+    , m_out_offset(0)
+    , m_crc(0)
+    , m_member_size(0)
+{
+}
+
+GzipCodec::~GzipCodec()
+{
+    if (m_inflate_init) {
+        inflateEnd(&m_strm);
+    }
+    if (m_deflate_init) {
+        deflateEnd(&m_strm);
+    }
+}
+
+oc::result<void> GzipCodec::reset_decoder()
+{
+    // The gzip header and trailer are parsed manually so that inflating can
+    // be resumed at any checkpoint with a raw inflate stream
+    if (!m_inflate_init) {
+        int ret = inflateInit2(&m_strm, -MAX_WBITS);
+        if (ret != Z_OK) {
+            return zlib_error(ret);
+        }
+        m_inflate_init = true;
+    }
+
+    m_state = State::Header;
+    m_first_member = true;
+    m_out_offset = 0;
+
+    return oc::success();
+}
+
+oc::result<size_t> GzipCodec::decode(void *buf, size_t size)
+{
+    auto out = static_cast<unsigned char *>(buf);
+    size_t produced = 0;
+
+    while (produced == 0 && size > 0) {
+        switch (m_state) {
+        case State::Header: {
+            OUTCOME_TRY(more, read_header());
+            if (!more) {
+                m_state = State::Done;
+            }
+            continue;
+        }
+
+        case State::Done:
+            return 0;
+
+        case State::Inflate:
+            break;
+        }
+
+        OUTCOME_TRY(avail, m_input.fill());
+        if (avail == 0) {
+            return CompressedFileError::TruncatedData;
+        }
+
+        auto in_size = static_cast<uInt>(std::min<size_t>(avail, UINT_MAX));
+        auto out_size = static_cast<uInt>(
+                std::min<size_t>(size - produced, UINT_MAX));
+
+        m_strm.next_in = const_cast<Bytef *>(m_input.data());
+        m_strm.avail_in = in_size;
+        m_strm.next_out = out + produced;
+        m_strm.avail_out = out_size;
+
+        // Stop at block boundaries so that checkpoints can be recorded
+        int ret = inflate(&m_strm, Z_BLOCK);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            return zlib_error(ret);
+        }
+
+        m_input.consume(in_size - m_strm.avail_in);
+
+        size_t n = out_size - m_strm.avail_out;
+        m_crc = static_cast<uint32_t>(crc32(m_crc, out + produced,
+                                            static_cast<uInt>(n)));
+        m_member_size += static_cast<uint32_t>(n);
+        m_out_offset += n;
+        produced += n;
+
+        if (ret == Z_STREAM_END) {
+            OUTCOME_TRYV(read_trailer());
+            m_state = State::Header;
+            m_first_member = false;
+        } else if ((m_strm.data_type & 128) && !(m_strm.data_type & 64)) {
+            add_checkpoint(false);
+        }
+    }
+
+    return produced;
+}
+
+oc::result<uint64_t> GzipCodec::restore_decoder(uint64_t offset)
+{
+    auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(),
+                               offset, [](uint64_t o, const GzipCheckpoint &c) {
+        return o < c.out_offset;
+    });
+    if (it == m_checkpoints.begin()) {
+        return CompressedCodec::restore_decoder(offset);
+    }
+
+    auto const &cp = *(it - 1);
+
+    if (cp.member_start) {
+        OUTCOME_TRYV(m_input.seek(cp.in_offset));
+        m_state = State::Header;
+    } else {
+        int ret = inflateReset(&m_strm);
+        if (ret != Z_OK) {
+            return zlib_error(ret);
+        }
+
+        if (cp.bits > 0) {
+            unsigned char c;
+
+            OUTCOME_TRYV(m_input.seek(cp.in_offset - 1));
+            OUTCOME_TRYV(m_input.read(&c, 1));
+
+            ret = inflatePrime(&m_strm, cp.bits, c >> (8 - cp.bits));
+            if (ret != Z_OK) {
+                return zlib_error(ret);
+            }
+        } else {
+            OUTCOME_TRYV(m_input.seek(cp.in_offset));
+        }
+
+        ret = inflateSetDictionary(&m_strm, cp.window.data(),
+                                   static_cast<uInt>(cp.window.size()));
+        if (ret != Z_OK) {
+            return zlib_error(ret);
+        }
+
+        m_crc = cp.crc;
+        m_member_size = cp.member_size;
+        m_state = State::Inflate;
+    }
+
+    m_first_member = false;
+    m_out_offset = cp.out_offset;
+
+    return m_out_offset;
+}
+
+/*!
+ * \brief Parse gzip member header
+ *
+ * \return Whether a member was found. Data following the last member is
+ *         ignored.
+ */
+oc::result<bool> GzipCodec::read_header()
+{
+    OUTCOME_TRY(have_header, m_input.ensure(GZIP_HEADER_SIZE));
+
+    auto header = m_input.data();
+    bool have_magic = m_input.available() >= 2
+            && header[0] == 0x1f && header[1] == 0x8b;
+
+    if (!have_magic) {
+        if (!m_first_member) {
+            return false;
+        }
+        return m_input.available() < 2
+                ? CompressedFileError::TruncatedData
+                : CompressedFileError::InvalidHeader;
+    } else if (!have_header) {
+        return CompressedFileError::TruncatedData;
+    } else if (header[2] != Z_DEFLATED) {
+        return CompressedFileError::UnsupportedOptions;
+    } else if (header[3] & GZIP_FRESERVED) {
+        return CompressedFileError::InvalidHeader;
+    }
+
+    if (!m_first_member) {
+        add_checkpoint(true);
+    }
+
+    unsigned char flags = header[3];
+    m_input.consume(GZIP_HEADER_SIZE);
+
+    if (flags & GZIP_FEXTRA) {
+        uint16_t xlen;
+        OUTCOME_TRYV(m_input.read(&xlen, sizeof(xlen)));
+        OUTCOME_TRYV(skip_bytes(mb_le16toh(xlen)));
+    }
+    if (flags & GZIP_FNAME) {
+        OUTCOME_TRYV(skip_string());
+    }
+    if (flags & GZIP_FCOMMENT) {
+        OUTCOME_TRYV(skip_string());
+    }
+    if (flags & GZIP_FHCRC) {
+        OUTCOME_TRYV(skip_bytes(2));
+    }
+
+    int ret = inflateReset(&m_strm);
+    if (ret != Z_OK) {
+        return zlib_error(ret);
+    }
+
+    m_crc = static_cast<uint32_t>(crc32(0, nullptr, 0));
+    m_member_size = 0;
+    m_state = State::Inflate;
+
+    return true;
+}
+
+/*!
+ * \brief Parse and verify gzip member trailer
+ */
+oc::result<void> GzipCodec::read_trailer()
+{
+    unsigned char trailer[GZIP_TRAILER_SIZE];
+    uint32_t crc;
+    uint32_t size;
+
+    OUTCOME_TRYV(m_input.read(trailer, sizeof(trailer)));
+
+    memcpy(&crc, trailer, sizeof(crc));
+    memcpy(&size, trailer + 4, sizeof(size));
+
+    if (mb_le32toh(crc) != m_crc || mb_le32toh(size) != m_member_size) {
+        return CompressedFileError::ChecksumMismatch;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> GzipCodec::skip_string()
+{
+    while (true) {
+        OUTCOME_TRY(avail, m_input.fill());
+        if (avail == 0) {
+            return CompressedFileError::TruncatedData;
+        }
+
+        auto end = static_cast<const unsigned char *>(
+                memchr(m_input.data(), '\0', avail));
+        if (end) {
+            m_input.consume(static_cast<size_t>(end - m_input.data()) + 1);
+            return oc::success();
+        }
+
+        m_input.consume(avail);
+    }
+}
+
+oc::result<void> GzipCodec::skip_bytes(size_t size)
+{
+    while (size > 0) {
+        OUTCOME_TRY(avail, m_input.fill());
+        if (avail == 0) {
+            return CompressedFileError::TruncatedData;
+        }
+
+        size_t n = std::min(avail, size);
+        m_input.consume(n);
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+void GzipCodec::add_checkpoint(bool member_start)
+{
+    uint64_t last = m_checkpoints.empty() ? 0 : m_checkpoints.back().out_offset;
+    if (m_out_offset < last + GZIP_CHECKPOINT_SPAN) {
+        return;
+    }
+
+    GzipCheckpoint cp;
+    cp.out_offset = m_out_offset;
+    cp.in_offset = m_input.offset();
+    cp.member_start = member_start;
+
+    if (member_start) {
+        cp.bits = 0;
+        cp.crc = 0;
+        cp.member_size = 0;
+    } else {
+        cp.bits = m_strm.data_type & 7;
+        cp.crc = m_crc;
+        cp.member_size = m_member_size;
+
+        uInt window_size = 32768;
+        cp.window.resize(window_size);
+
+        if (inflateGetDictionary(&m_strm, cp.window.data(), &window_size)
+                != Z_OK) {
+            // Not fatal. Seeking will just be slower.
+            return;
+        }
+        cp.window.resize(window_size);
+    }
+
+    m_checkpoints.push_back(std::move(cp));
+}
+
+oc::result<void> GzipCodec::init_encoder(int level)
+{
+    // 16 + MAX_WBITS writes a gzip header and trailer
+    int ret = deflateInit2(&m_strm, level, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                           Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        return zlib_error(ret);
+    }
+    m_deflate_init = true;
+
+    m_out_buf.resize(GZIP_OUT_BUF_SIZE);
+
+    return oc::success();
+}
+
+oc::result<void> GzipCodec::encode(const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        auto n = static_cast<uInt>(std::min<size_t>(size, UINT_MAX));
+
+        m_strm.next_in = const_cast<Bytef *>(ptr);
+        m_strm.avail_in = n;
+
+        OUTCOME_TRYV(deflate_and_write(Z_NO_FLUSH));
+
+        ptr += n;
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> GzipCodec::finish_encoder()
+{
+    m_strm.next_in = nullptr;
+    m_strm.avail_in = 0;
+
+    return deflate_and_write(Z_FINISH);
+}
+
+/*!
+ * \brief Deflate all pending input and write the compressed data
+ */
+oc::result<void> GzipCodec::deflate_and_write(int flush)
+{
+    int ret;
+
+    do {
+        m_strm.next_out = m_out_buf.data();
+        m_strm.avail_out = static_cast<uInt>(m_out_buf.size());
+
+        ret = deflate(&m_strm, flush);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return zlib_error(ret);
+        }
+
+        size_t n = m_out_buf.size() - m_strm.avail_out;
+        OUTCOME_TRYV(file_write_exact(m_file, m_out_buf.data(), n));
+    } while (m_strm.avail_out == 0
+            || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+    return oc::success();
+}
+
+std::unique_ptr<CompressedCodec> create_gzip_codec(File &file)
+{
+    return std::make_unique<GzipCodec>(file);
+}
+
+}
+}
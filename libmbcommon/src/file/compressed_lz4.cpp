@@ -0,0 +1,503 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <lz4hc.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file_util.h"
+
+namespace mb
+{
+namespace detail
+{
+
+static constexpr uint32_t LZ4_FRAME_MAGIC = 0x184d2204;
+static constexpr uint32_t LZ4_LEGACY_MAGIC = 0x184c2102;
+static constexpr uint32_t LZ4_SKIPPABLE_MAGIC = 0x184d2a50;
+static constexpr uint32_t LZ4_SKIPPABLE_MASK = 0xfffffff0;
+
+// Uncompressed size of each block in the legacy format. This is fixed by the
+// format.
+static constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+
+// Amount of input to pass to the frame compressor at a time
+static constexpr size_t LZ4_FRAME_CHUNK_SIZE = 64 * 1024;
+
+static constexpr int LZ4_LEVEL_MIN = 1;
+
+struct Lz4Checkpoint
+{
+    // Uncompressed offset
+    uint64_t out_offset;
+    // Compressed offset of the frame magic or legacy block size
+    uint64_t in_offset;
+    bool legacy_block;
+};
+
+class Lz4Codec : public CompressedCodec
+{
+public:
+    Lz4Codec(File &file, bool legacy);
+    virtual ~Lz4Codec();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Lz4Codec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Lz4Codec)
+
+    oc::result<void> reset_decoder() override;
+    oc::result<size_t> decode(void *buf, size_t size) override;
+    oc::result<uint64_t> restore_decoder(uint64_t offset) override;
+
+    oc::result<void> init_encoder(int level) override;
+    oc::result<void> encode(const void *buf, size_t size) override;
+    oc::result<void> finish_encoder() override;
+
+private:
+    enum class State
+    {
+        Magic,
+        Frame,
+        LegacyBlock,
+        LegacyOutput,
+        Done,
+    };
+
+    oc::result<void> read_magic();
+    oc::result<size_t> decode_frame(void *buf, size_t size);
+    oc::result<void> read_legacy_block();
+    void add_checkpoint(bool legacy_block);
+
+    oc::result<void> write_legacy_block();
+
+    bool m_legacy;
+
+    LZ4F_dctx *m_dctx;
+    LZ4F_cctx *m_cctx;
+
+    State m_state;
+    bool m_first_frame;
+    uint64_t m_out_offset;
+
+    std::vector<Lz4Checkpoint> m_checkpoints;
+
+    int m_level;
+
+    // Compressed and uncompressed data of the current legacy block
+    std::vector<char> m_block_in;
+    std::vector<char> m_block_out;
+    size_t m_block_pos;
+    size_t m_block_len;
+};
+
+Lz4Codec::Lz4Codec(File &file, bool legacy)
+    : CompressedCodec(file)
+    , m_legacy(legacy)
+    , m_dctx(nullptr)
+    , m_cctx(nullptr)
+    , m_state(State::Magic)
+    , m_first_frame(true)
+    , m_out_offset(0)
+    , m_level(CompressedFile::DEFAULT_LEVEL)
+    , m_block_pos(0)
+    , m_block_len(0)
+{
+}
+
+Lz4Codec::~Lz4Codec()
+{
+    LZ4F_freeDecompressionContext(m_dctx);
+    LZ4F_freeCompressionContext(m_cctx);
+}
+
+oc::result<void> Lz4Codec::reset_decoder()
+{
+    m_state = State::Magic;
+    m_first_frame = true;
+    m_out_offset = 0;
+    m_block_pos = 0;
+    m_block_len = 0;
+
+    return oc::success();
+}
+
+oc::result<size_t> Lz4Codec::decode(void *buf, size_t size)
+{
+    size_t produced = 0;
+
+    while (produced == 0 && size > 0) {
+        switch (m_state) {
+        case State::Magic: {
+            OUTCOME_TRYV(read_magic());
+            break;
+        }
+        case State::Frame: {
+            OUTCOME_TRY(n, decode_frame(buf, size));
+            produced = n;
+            break;
+        }
+        case State::LegacyBlock: {
+            OUTCOME_TRYV(read_legacy_block());
+            break;
+        }
+        case State::LegacyOutput:
+            produced = std::min(size, m_block_len - m_block_pos);
+            memcpy(buf, m_block_out.data() + m_block_pos, produced);
+            m_block_pos += produced;
+            m_out_offset += produced;
+            if (m_block_pos == m_block_len) {
+                m_state = State::LegacyBlock;
+            }
+            break;
+        case State::Done:
+            return 0;
+        }
+    }
+
+    return produced;
+}
+
+oc::result<uint64_t> Lz4Codec::restore_decoder(uint64_t offset)
+{
+    auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(),
+                               offset, [](uint64_t o, const Lz4Checkpoint &c) {
+        return o < c.out_offset;
+    });
+    if (it == m_checkpoints.begin()) {
+        return CompressedCodec::restore_decoder(offset);
+    }
+
+    auto const &cp = *(it - 1);
+
+    OUTCOME_TRYV(m_input.seek(cp.in_offset));
+
+    m_state = cp.legacy_block ? State::LegacyBlock : State::Magic;
+    m_first_frame = false;
+    m_out_offset = cp.out_offset;
+    m_block_pos = 0;
+    m_block_len = 0;
+
+    return m_out_offset;
+}
+
+/*!
+ * \brief Identify the next frame
+ *
+ * Skippable frames are skipped. Data following the last frame is ignored.
+ */
+oc::result<void> Lz4Codec::read_magic()
+{
+    OUTCOME_TRY(have, m_input.ensure(sizeof(uint32_t)));
+    if (!have) {
+        if (m_first_frame) {
+            return CompressedFileError::TruncatedData;
+        }
+        m_state = State::Done;
+        return oc::success();
+    }
+
+    uint32_t magic;
+    memcpy(&magic, m_input.data(), sizeof(magic));
+    magic = mb_le32toh(magic);
+
+    if (magic == LZ4_FRAME_MAGIC) {
+        add_checkpoint(false);
+
+        // The frame decoder parses the magic itself. A new context is used for
+        // every frame in case the previous frame was not fully decoded.
+        LZ4F_freeDecompressionContext(m_dctx);
+        m_dctx = nullptr;
+
+        if (LZ4F_isError(LZ4F_createDecompressionContext(
+                &m_dctx, LZ4F_VERSION))) {
+            return CompressedFileError::BackendError;
+        }
+
+        m_state = State::Frame;
+    } else if (magic == LZ4_LEGACY_MAGIC) {
+        m_input.consume(sizeof(magic));
+        m_state = State::LegacyBlock;
+    } else if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+        unsigned char header[8];
+        uint32_t skip_size;
+
+        OUTCOME_TRYV(m_input.read(header, sizeof(header)));
+        memcpy(&skip_size, header + 4, sizeof(skip_size));
+        skip_size = mb_le32toh(skip_size);
+
+        while (skip_size > 0) {
+            OUTCOME_TRY(avail, m_input.fill());
+            if (avail == 0) {
+                return CompressedFileError::TruncatedData;
+            }
+
+            size_t n = std::min<size_t>(avail, skip_size);
+            m_input.consume(n);
+            skip_size -= static_cast<uint32_t>(n);
+        }
+    } else if (m_first_frame) {
+        return CompressedFileError::InvalidHeader;
+    } else {
+        m_state = State::Done;
+        return oc::success();
+    }
+
+    m_first_frame = false;
+
+    return oc::success();
+}
+
+oc::result<size_t> Lz4Codec::decode_frame(void *buf, size_t size)
+{
+    OUTCOME_TRY(avail, m_input.fill());
+    if (avail == 0) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    size_t in_size = avail;
+    size_t out_size = size;
+
+    // The frame decoder verifies the checksums
+    size_t ret = LZ4F_decompress(m_dctx, buf, &out_size, m_input.data(),
+                                 &in_size, nullptr);
+    if (LZ4F_isError(ret)) {
+        return CompressedFileError::CorruptData;
+    }
+
+    m_input.consume(in_size);
+    m_out_offset += out_size;
+
+    if (ret == 0) {
+        // End of frame
+        m_state = State::Magic;
+    }
+
+    return out_size;
+}
+
+oc::result<void> Lz4Codec::read_legacy_block()
+{
+    OUTCOME_TRY(have, m_input.ensure(sizeof(uint32_t)));
+    if (!have) {
+        if (m_input.available() > 0) {
+            return CompressedFileError::TruncatedData;
+        }
+        m_state = State::Done;
+        return oc::success();
+    }
+
+    uint32_t block_size;
+    memcpy(&block_size, m_input.data(), sizeof(block_size));
+    block_size = mb_le32toh(block_size);
+
+    if (block_size == LZ4_LEGACY_MAGIC) {
+        // Concatenated legacy stream
+        m_input.consume(sizeof(block_size));
+        return oc::success();
+    } else if (block_size == LZ4_FRAME_MAGIC
+            || (block_size & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+        m_state = State::Magic;
+        return oc::success();
+    } else if (block_size == 0) {
+        // Zero padding after the last block
+        m_state = State::Done;
+        return oc::success();
+    } else if (block_size > static_cast<uint32_t>(
+            LZ4_compressBound(static_cast<int>(LZ4_LEGACY_BLOCK_SIZE)))) {
+        return CompressedFileError::CorruptData;
+    }
+
+    add_checkpoint(true);
+
+    m_input.consume(sizeof(block_size));
+
+    m_block_in.resize(block_size);
+    m_block_out.resize(LZ4_LEGACY_BLOCK_SIZE);
+
+    OUTCOME_TRYV(m_input.read(m_block_in.data(), block_size));
+
+    int n = LZ4_decompress_safe(m_block_in.data(), m_block_out.data(),
+                                static_cast<int>(block_size),
+                                static_cast<int>(m_block_out.size()));
+    if (n < 0) {
+        return CompressedFileError::CorruptData;
+    }
+
+    m_block_pos = 0;
+    m_block_len = static_cast<size_t>(n);
+    m_state = m_block_len > 0 ? State::LegacyOutput : State::LegacyBlock;
+
+    return oc::success();
+}
+
+void Lz4Codec::add_checkpoint(bool legacy_block)
+{
+    uint64_t in_offset = m_input.offset();
+
+    // The start of the stream is handled by restarting
+    if (in_offset == 0) {
+        return;
+    }
+
+    if (m_checkpoints.empty() || in_offset > m_checkpoints.back().in_offset) {
+        m_checkpoints.push_back({ m_out_offset, in_offset, legacy_block });
+    }
+}
+
+oc::result<void> Lz4Codec::init_encoder(int level)
+{
+    if (level != CompressedFile::DEFAULT_LEVEL
+            && (level < LZ4_LEVEL_MIN || level > LZ4HC_CLEVEL_MAX)) {
+        return CompressedFileError::UnsupportedOptions;
+    }
+    m_level = level;
+
+    if (m_legacy) {
+        uint32_t magic = mb_htole32(LZ4_LEGACY_MAGIC);
+
+        m_block_in.resize(LZ4_LEGACY_BLOCK_SIZE);
+        m_block_out.resize(static_cast<size_t>(
+                LZ4_compressBound(static_cast<int>(LZ4_LEGACY_BLOCK_SIZE))));
+        m_block_len = 0;
+
+        return file_write_exact(m_file, &magic, sizeof(magic));
+    }
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION))) {
+        return CompressedFileError::BackendError;
+    }
+
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    prefs.compressionLevel = level == CompressedFile::DEFAULT_LEVEL ? 0 : level;
+
+    m_block_out.resize(std::max<size_t>(
+            LZ4F_compressBound(LZ4_FRAME_CHUNK_SIZE, &prefs),
+            LZ4F_HEADER_SIZE_MAX));
+
+    size_t n = LZ4F_compressBegin(m_cctx, m_block_out.data(),
+                                  m_block_out.size(), &prefs);
+    if (LZ4F_isError(n)) {
+        return CompressedFileError::BackendError;
+    }
+
+    return file_write_exact(m_file, m_block_out.data(), n);
+}
+
+oc::result<void> Lz4Codec::encode(const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        if (m_legacy) {
+            size_t n = std::min(size, m_block_in.size() - m_block_len);
+            memcpy(m_block_in.data() + m_block_len, ptr, n);
+            m_block_len += n;
+
+            if (m_block_len == m_block_in.size()) {
+                OUTCOME_TRYV(write_legacy_block());
+            }
+
+            ptr += n;
+            size -= n;
+        } else {
+            size_t to_compress = std::min(size, LZ4_FRAME_CHUNK_SIZE);
+
+            size_t n = LZ4F_compressUpdate(m_cctx, m_block_out.data(),
+                                           m_block_out.size(), ptr,
+                                           to_compress, nullptr);
+            if (LZ4F_isError(n)) {
+                return CompressedFileError::BackendError;
+            }
+
+            OUTCOME_TRYV(file_write_exact(m_file, m_block_out.data(), n));
+
+            ptr += to_compress;
+            size -= to_compress;
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> Lz4Codec::finish_encoder()
+{
+    if (m_legacy) {
+        if (m_block_len > 0) {
+            OUTCOME_TRYV(write_legacy_block());
+        }
+        return oc::success();
+    }
+
+    size_t n = LZ4F_compressEnd(m_cctx, m_block_out.data(),
+                                m_block_out.size(), nullptr);
+    if (LZ4F_isError(n)) {
+        return CompressedFileError::BackendError;
+    }
+
+    return file_write_exact(m_file, m_block_out.data(), n);
+}
+
+/*!
+ * \brief Compress and write the buffered legacy block
+ */
+oc::result<void> Lz4Codec::write_legacy_block()
+{
+    int n;
+
+    if (m_level >= LZ4HC_CLEVEL_MIN) {
+        n = LZ4_compress_HC(m_block_in.data(), m_block_out.data(),
+                            static_cast<int>(m_block_len),
+                            static_cast<int>(m_block_out.size()), m_level);
+    } else {
+        n = LZ4_compress_default(m_block_in.data(), m_block_out.data(),
+                                 static_cast<int>(m_block_len),
+                                 static_cast<int>(m_block_out.size()));
+    }
+    if (n <= 0) {
+        return CompressedFileError::BackendError;
+    }
+
+    uint32_t block_size = mb_htole32(static_cast<uint32_t>(n));
+
+    OUTCOME_TRYV(file_write_exact(m_file, &block_size, sizeof(block_size)));
+    OUTCOME_TRYV(file_write_exact(m_file, m_block_out.data(),
+                                  static_cast<size_t>(n)));
+
+    m_block_len = 0;
+
+    return oc::success();
+}
+
+std::unique_ptr<CompressedCodec> create_lz4_codec(File &file, bool legacy)
+{
+    return std::make_unique<Lz4Codec>(file, legacy);
+}
+
+}
+}
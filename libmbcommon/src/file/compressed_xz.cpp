@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed_p.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <lzma.h>
+
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file_util.h"
+
+namespace mb
+{
+namespace detail
+{
+
+static constexpr size_t XZ_OUT_BUF_SIZE = 64 * 1024;
+static constexpr size_t XZ_PADDING_ALIGNMENT = 4;
+static constexpr unsigned char XZ_MAGIC[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+
+struct XzCheckpoint
+{
+    // Uncompressed offset
+    uint64_t out_offset;
+    // Compressed offset of the block header
+    uint64_t in_offset;
+    // Compressed offset of the stream header
+    uint64_t stream_offset;
+    lzma_stream_flags flags;
+    // Index record for the block. These are only valid once the block has
+    // been fully decoded and are needed to verify the stream index after
+    // resuming in the middle of a stream.
+    lzma_vli unpadded_size;
+    lzma_vli uncompressed_size;
+};
+
+class XzCodec : public CompressedCodec
+{
+public:
+    explicit XzCodec(File &file);
+    virtual ~XzCodec();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(XzCodec)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(XzCodec)
+
+    oc::result<void> reset_decoder() override;
+    oc::result<size_t> decode(void *buf, size_t size) override;
+    oc::result<uint64_t> restore_decoder(uint64_t offset) override;
+
+    oc::result<void> init_encoder(int level) override;
+    oc::result<void> encode(const void *buf, size_t size) override;
+    oc::result<void> finish_encoder() override;
+
+private:
+    enum class State
+    {
+        StreamHeader,
+        BlockHeader,
+        Block,
+        Index,
+        StreamFooter,
+        StreamPadding,
+        Done,
+    };
+
+    oc::result<void> read_stream_header();
+    oc::result<void> read_block_header();
+    oc::result<size_t> decode_block(void *buf, size_t size);
+    oc::result<void> read_index();
+    oc::result<void> read_stream_footer();
+    oc::result<void> read_stream_padding();
+    oc::result<void> reset_index_hash();
+
+    void free_filter_options();
+
+    oc::result<void> code_and_write(lzma_action action);
+
+    lzma_stream m_strm;
+    lzma_index_hash *m_index_hash;
+    lzma_block m_block;
+    lzma_filter m_filters[LZMA_FILTERS_MAX + 1];
+
+    State m_state;
+    uint64_t m_out_offset;
+    uint64_t m_stream_offset;
+    lzma_stream_flags m_flags;
+
+    std::vector<XzCheckpoint> m_checkpoints;
+    // Checkpoint of the current block if it was newly recorded
+    size_t m_block_checkpoint;
+
+    std::vector<unsigned char> m_out_buf;
+};
+
+static std::error_code lzma_error(lzma_ret ret)
+{
+    switch (ret) {
+    case LZMA_FORMAT_ERROR:
+        return CompressedFileError::InvalidHeader;
+    case LZMA_DATA_ERROR:
+    case LZMA_BUF_ERROR:
+        return CompressedFileError::CorruptData;
+    case LZMA_OPTIONS_ERROR:
+    case LZMA_UNSUPPORTED_CHECK:
+        return CompressedFileError::UnsupportedOptions;
+    default:
+        return CompressedFileError::BackendError;
+    }
+}
+
+XzCodec::XzCodec(File &file)
+    : CompressedCodec(file)
+    , m_strm(LZMA_STREAM_INIT)
+    , m_index_hash(nullptr)
+    , m_block()
+    , m_filters()
+    , m_state(State::StreamHeader)
+    , m_out_offset(0)
+    , m_stream_offset(0)
+    , m_flags()
+    , m_block_checkpoint(SIZE_MAX)
+{
+    m_filters[0].id = LZMA_VLI_UNKNOWN;
+}
+
+XzCodec::~XzCodec()
+{
+    free_filter_options();
+    lzma_index_hash_end(m_index_hash, nullptr);
+    lzma_end(&m_strm);
+}
+
+oc::result<void> XzCodec::reset_decoder()
+{
+    // Streams, blocks and the index are parsed manually so that decoding can
+    // be resumed at the start of any block
+    m_state = State::StreamHeader;
+    m_out_offset = 0;
+    m_block_checkpoint = SIZE_MAX;
+
+    return oc::success();
+}
+
+oc::result<size_t> XzCodec::decode(void *buf, size_t size)
+{
+    size_t produced = 0;
+
+    while (produced == 0 && size > 0) {
+        switch (m_state) {
+        case State::StreamHeader: {
+            OUTCOME_TRYV(read_stream_header());
+            break;
+        }
+        case State::BlockHeader: {
+            OUTCOME_TRYV(read_block_header());
+            break;
+        }
+        case State::Block: {
+            OUTCOME_TRY(n, decode_block(buf, size));
+            produced = n;
+            break;
+        }
+        case State::Index: {
+            OUTCOME_TRYV(read_index());
+            break;
+        }
+        case State::StreamFooter: {
+            OUTCOME_TRYV(read_stream_footer());
+            break;
+        }
+        case State::StreamPadding: {
+            OUTCOME_TRYV(read_stream_padding());
+            break;
+        }
+        case State::Done:
+            return 0;
+        }
+    }
+
+    return produced;
+}
+
+oc::result<uint64_t> XzCodec::restore_decoder(uint64_t offset)
+{
+    auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(),
+                               offset, [](uint64_t o, const XzCheckpoint &c) {
+        return o < c.out_offset;
+    });
+    if (it == m_checkpoints.begin()) {
+        return CompressedCodec::restore_decoder(offset);
+    }
+
+    auto const &cp = *(it - 1);
+
+    OUTCOME_TRYV(m_input.seek(cp.in_offset));
+    OUTCOME_TRYV(reset_index_hash());
+
+    // Add the records of the previous blocks in the stream so that the index
+    // can still be verified
+    for (auto prev = m_checkpoints.begin(); prev != it - 1; ++prev) {
+        if (prev->stream_offset != cp.stream_offset) {
+            continue;
+        }
+
+        lzma_ret ret = lzma_index_hash_append(
+                m_index_hash, prev->unpadded_size, prev->uncompressed_size);
+        if (ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+    }
+
+    m_state = State::BlockHeader;
+    m_out_offset = cp.out_offset;
+    m_stream_offset = cp.stream_offset;
+    m_flags = cp.flags;
+    m_block_checkpoint = SIZE_MAX;
+
+    return m_out_offset;
+}
+
+oc::result<void> XzCodec::read_stream_header()
+{
+    OUTCOME_TRY(have, m_input.ensure(LZMA_STREAM_HEADER_SIZE));
+    if (!have) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    lzma_ret ret = lzma_stream_header_decode(&m_flags, m_input.data());
+    if (ret != LZMA_OK) {
+        return lzma_error(ret);
+    }
+
+    m_stream_offset = m_input.offset();
+    m_input.consume(LZMA_STREAM_HEADER_SIZE);
+
+    OUTCOME_TRYV(reset_index_hash());
+
+    m_state = State::BlockHeader;
+
+    return oc::success();
+}
+
+oc::result<void> XzCodec::read_block_header()
+{
+    OUTCOME_TRY(have_size, m_input.ensure(1));
+    if (!have_size) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    // A zero byte is the index indicator
+    if (m_input.data()[0] == 0) {
+        m_state = State::Index;
+        return oc::success();
+    }
+
+    uint32_t header_size = lzma_block_header_size_decode(m_input.data()[0]);
+
+    OUTCOME_TRY(have_header, m_input.ensure(header_size));
+    if (!have_header) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    if (m_checkpoints.empty()
+            || m_input.offset() > m_checkpoints.back().in_offset) {
+        XzCheckpoint cp;
+        cp.out_offset = m_out_offset;
+        cp.in_offset = m_input.offset();
+        cp.stream_offset = m_stream_offset;
+        cp.flags = m_flags;
+        cp.unpadded_size = 0;
+        cp.uncompressed_size = 0;
+
+        m_checkpoints.push_back(cp);
+        m_block_checkpoint = m_checkpoints.size() - 1;
+    } else {
+        m_block_checkpoint = SIZE_MAX;
+    }
+
+    m_block = {};
+    m_block.version = 0;
+    m_block.check = m_flags.check;
+    m_block.filters = m_filters;
+    m_block.header_size = header_size;
+
+    lzma_ret ret = lzma_block_header_decode(&m_block, nullptr,
+                                            m_input.data());
+    if (ret != LZMA_OK) {
+        return lzma_error(ret);
+    }
+
+    m_input.consume(header_size);
+
+    ret = lzma_block_decoder(&m_strm, &m_block);
+
+    // The filter options are only needed to initialize the decoder
+    free_filter_options();
+
+    if (ret != LZMA_OK) {
+        return lzma_error(ret);
+    }
+
+    m_state = State::Block;
+
+    return oc::success();
+}
+
+oc::result<size_t> XzCodec::decode_block(void *buf, size_t size)
+{
+    OUTCOME_TRY(avail, m_input.fill());
+    if (avail == 0) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    m_strm.next_in = m_input.data();
+    m_strm.avail_in = avail;
+    m_strm.next_out = static_cast<uint8_t *>(buf);
+    m_strm.avail_out = size;
+
+    // The block decoder verifies the block padding and check
+    lzma_ret ret = lzma_code(&m_strm, LZMA_RUN);
+    if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+        return lzma_error(ret);
+    }
+
+    m_input.consume(avail - m_strm.avail_in);
+
+    size_t n = size - m_strm.avail_out;
+    m_out_offset += n;
+
+    if (ret == LZMA_STREAM_END) {
+        lzma_vli unpadded_size = lzma_block_unpadded_size(&m_block);
+
+        ret = lzma_index_hash_append(m_index_hash, unpadded_size,
+                                     m_block.uncompressed_size);
+        if (ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        if (m_block_checkpoint != SIZE_MAX) {
+            auto &cp = m_checkpoints[m_block_checkpoint];
+            cp.unpadded_size = unpadded_size;
+            cp.uncompressed_size = m_block.uncompressed_size;
+        }
+
+        m_state = State::BlockHeader;
+    }
+
+    return n;
+}
+
+oc::result<void> XzCodec::read_index()
+{
+    OUTCOME_TRY(avail, m_input.fill());
+    if (avail == 0) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    size_t in_pos = 0;
+
+    // This verifies that the index matches the decoded blocks
+    lzma_ret ret = lzma_index_hash_decode(m_index_hash, m_input.data(),
+                                          &in_pos, avail);
+    m_input.consume(in_pos);
+
+    if (ret == LZMA_STREAM_END) {
+        m_state = State::StreamFooter;
+    } else if (ret != LZMA_OK) {
+        return lzma_error(ret);
+    }
+
+    return oc::success();
+}
+
+oc::result<void> XzCodec::read_stream_footer()
+{
+    OUTCOME_TRY(have, m_input.ensure(LZMA_STREAM_HEADER_SIZE));
+    if (!have) {
+        return CompressedFileError::TruncatedData;
+    }
+
+    lzma_stream_flags footer_flags;
+
+    lzma_ret ret = lzma_stream_footer_decode(&footer_flags, m_input.data());
+    if (ret != LZMA_OK) {
+        return ret == LZMA_FORMAT_ERROR
+                ? CompressedFileError::CorruptData : lzma_error(ret);
+    }
+
+    if (lzma_stream_flags_compare(&m_flags, &footer_flags) != LZMA_OK
+            || footer_flags.backward_size
+                    != lzma_index_hash_size(m_index_hash)) {
+        return CompressedFileError::CorruptData;
+    }
+
+    m_input.consume(LZMA_STREAM_HEADER_SIZE);
+    m_state = State::StreamPadding;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Skip stream padding and check if another stream follows
+ *
+ * Data following the last stream is ignored.
+ */
+oc::result<void> XzCodec::read_stream_padding()
+{
+    OUTCOME_TRY(have, m_input.ensure(sizeof(XZ_MAGIC)));
+
+    if (have && memcmp(m_input.data(), XZ_MAGIC, sizeof(XZ_MAGIC)) == 0) {
+        m_state = State::StreamHeader;
+    } else if (m_input.available() >= XZ_PADDING_ALIGNMENT
+            && memcmp(m_input.data(), "\0\0\0\0", XZ_PADDING_ALIGNMENT) == 0) {
+        m_input.consume(XZ_PADDING_ALIGNMENT);
+    } else {
+        m_state = State::Done;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> XzCodec::reset_index_hash()
+{
+    m_index_hash = lzma_index_hash_init(m_index_hash, nullptr);
+    if (!m_index_hash) {
+        return CompressedFileError::BackendError;
+    }
+
+    return oc::success();
+}
+
+void XzCodec::free_filter_options()
+{
+    for (size_t i = 0; m_filters[i].id != LZMA_VLI_UNKNOWN; ++i) {
+        free(m_filters[i].options);
+        m_filters[i].options = nullptr;
+    }
+    m_filters[0].id = LZMA_VLI_UNKNOWN;
+}
+
+oc::result<void> XzCodec::init_encoder(int level)
+{
+    uint32_t preset = LZMA_PRESET_DEFAULT;
+
+    if (level != CompressedFile::DEFAULT_LEVEL) {
+        if (level < 0 || level > 9) {
+            return CompressedFileError::UnsupportedOptions;
+        }
+        preset = static_cast<uint32_t>(level);
+    }
+
+    // The kernel's xz decoder only supports CRC32 checks
+    lzma_ret ret = lzma_easy_encoder(&m_strm, preset, LZMA_CHECK_CRC32);
+    if (ret != LZMA_OK) {
+        return lzma_error(ret);
+    }
+
+    m_out_buf.resize(XZ_OUT_BUF_SIZE);
+
+    return oc::success();
+}
+
+oc::result<void> XzCodec::encode(const void *buf, size_t size)
+{
+    m_strm.next_in = static_cast<const uint8_t *>(buf);
+    m_strm.avail_in = size;
+
+    return code_and_write(LZMA_RUN);
+}
+
+oc::result<void> XzCodec::finish_encoder()
+{
+    m_strm.next_in = nullptr;
+    m_strm.avail_in = 0;
+
+    return code_and_write(LZMA_FINISH);
+}
+
+/*!
+ * \brief Encode all pending input and write the compressed data
+ */
+oc::result<void> XzCodec::code_and_write(lzma_action action)
+{
+    lzma_ret ret;
+
+    do {
+        m_strm.next_out = m_out_buf.data();
+        m_strm.avail_out = m_out_buf.size();
+
+        ret = lzma_code(&m_strm, action);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+            return lzma_error(ret);
+        }
+
+        size_t n = m_out_buf.size() - m_strm.avail_out;
+        OUTCOME_TRYV(file_write_exact(m_file, m_out_buf.data(), n));
+    } while (m_strm.avail_in > 0 || m_strm.avail_out == 0
+            || (action == LZMA_FINISH && ret != LZMA_STREAM_END));
+
+    return oc::success();
+}
+
+std::unique_ptr<CompressedCodec> create_xz_codec(File &file)
+{
+    return std::make_unique<XzCodec>(file);
+}
+
+}
+}
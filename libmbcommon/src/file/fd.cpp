@@ -21,11 +21,18 @@
 
 #include <cerrno>
 #include <climits>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -89,11 +96,70 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return writev(fd, iov, iovcnt);
+    }
+#endif
+#ifdef __linux__
+
+    int fn_fallocate64(int fd, int mode, off64_t offset, off64_t len) override
+    {
+        return fallocate64(fd, mode, offset, len);
+    }
+#endif
 };
 /*! \endcond */
 
 static RealFdFileFuncs g_default_funcs;
 
+#ifdef __linux__
+#  ifndef FALLOC_FL_COLLAPSE_RANGE
+#    define FALLOC_FL_COLLAPSE_RANGE 0x08
+#  endif
+#  ifndef FALLOC_FL_INSERT_RANGE
+#    define FALLOC_FL_INSERT_RANGE 0x20
+#  endif
+
+static oc::result<void> shift_range(FdFileFuncs *funcs, int fd, int mode,
+                                    uint64_t offset, uint64_t size)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)
+            || size > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (funcs->fn_fallocate64(fd, mode, static_cast<off64_t>(offset),
+                              static_cast<off64_t>(size)) < 0) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            return FileError::UnsupportedShift;
+        }
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+#endif
+
 /*! \cond INTERNAL */
 
 FdFileFuncs::~FdFileFuncs() = default;
@@ -135,6 +201,49 @@ static int convert_mode(FileOpenMode mode)
     return ret;
 }
 
+#ifndef _WIN32
+// Maximum number of iovecs passed to a single readv()/writev() call
+#  if defined(IOV_MAX) && IOV_MAX < 64
+static constexpr size_t MAX_IOV_BATCH = IOV_MAX;
+#  else
+static constexpr size_t MAX_IOV_BATCH = 64;
+#  endif
+
+struct IoVecBatch
+{
+    struct iovec iov[MAX_IOV_BATCH];
+    int count;
+    size_t size;
+    // Whether the last iovec had to be shortened to fit in SSIZE_MAX
+    bool truncated;
+};
+
+static void fill_iovec_batch(IoVecBatch &batch, const FileIoVec *iov,
+                             size_t iov_count)
+{
+    batch.count = 0;
+    batch.size = 0;
+    batch.truncated = false;
+
+    for (size_t i = 0; i < iov_count && i < MAX_IOV_BATCH; ++i) {
+        size_t len = iov[i].size;
+        if (len > SSIZE_MAX - batch.size) {
+            len = SSIZE_MAX - batch.size;
+            batch.truncated = true;
+        }
+
+        batch.iov[i].iov_base = iov[i].base;
+        batch.iov[i].iov_len = len;
+        batch.size += len;
+        ++batch.count;
+
+        if (batch.truncated) {
+            break;
+        }
+    }
+}
+#endif
+
 /*! \endcond */
 
 /*!
@@ -462,6 +571,117 @@ oc::result<void> FdFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+#ifndef _WIN32
+oc::result<size_t> FdFile::on_pread(void *buf, size_t size, uint64_t offset)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::on_pwrite(const void *buf, size_t size,
+                                     uint64_t offset)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::on_readv(const FileIoVec *iov, size_t iov_count)
+{
+    IoVecBatch batch;
+    size_t total = 0;
+
+    while (iov_count > 0) {
+        fill_iovec_batch(batch, iov, iov_count);
+
+        ssize_t n = m_funcs->fn_readv(m_fd, batch.iov, batch.count);
+        if (n < 0) {
+            if (total > 0) {
+                break;
+            }
+            return ec_from_errno();
+        }
+
+        total += static_cast<size_t>(n);
+
+        if (static_cast<size_t>(n) < batch.size || batch.truncated) {
+            break;
+        }
+
+        iov += batch.count;
+        iov_count -= static_cast<size_t>(batch.count);
+    }
+
+    return total;
+}
+
+oc::result<size_t> FdFile::on_writev(const FileIoVec *iov, size_t iov_count)
+{
+    IoVecBatch batch;
+    size_t total = 0;
+
+    while (iov_count > 0) {
+        fill_iovec_batch(batch, iov, iov_count);
+
+        ssize_t n = m_funcs->fn_writev(m_fd, batch.iov, batch.count);
+        if (n < 0) {
+            if (total > 0) {
+                break;
+            }
+            return ec_from_errno();
+        }
+
+        total += static_cast<size_t>(n);
+
+        if (static_cast<size_t>(n) < batch.size || batch.truncated) {
+            break;
+        }
+
+        iov += batch.count;
+        iov_count -= static_cast<size_t>(batch.count);
+    }
+
+    return total;
+}
+#endif
+
+#ifdef __linux__
+oc::result<void> FdFile::on_insert_range(uint64_t offset, uint64_t size)
+{
+    return shift_range(m_funcs, m_fd, FALLOC_FL_INSERT_RANGE, offset, size);
+}
+
+oc::result<void> FdFile::on_collapse_range(uint64_t offset, uint64_t size)
+{
+    return shift_range(m_funcs, m_fd, FALLOC_FL_COLLAPSE_RANGE, offset, size);
+}
+#endif
+
 void FdFile::clear()
 {
     m_fd = -1;
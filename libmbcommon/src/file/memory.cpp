@@ -181,55 +181,18 @@ oc::result<void> MemoryFile::on_close()
 
 oc::result<size_t> MemoryFile::on_read(void *buf, size_t size)
 {
-    size_t to_read = 0;
-    if (m_pos < m_size) {
-        to_read = std::min(m_size - m_pos, size);
-    }
-
-    memcpy(buf, static_cast<char *>(m_data) + m_pos, to_read);
-    m_pos += to_read;
+    size_t n = read_at(buf, size, m_pos);
+    m_pos += n;
 
-    return to_read;
+    return n;
 }
 
 oc::result<size_t> MemoryFile::on_write(const void *buf, size_t size)
 {
-    if (m_pos > SIZE_MAX - size) {
-        return FileError::ArgumentOutOfRange;
-    }
-
-    size_t desired_size = m_pos + size;
-    size_t to_write = size;
-
-    if (desired_size > m_size) {
-        if (m_fixed_size) {
-            to_write = m_pos <= m_size ? m_size - m_pos : 0;
-        } else {
-            // Enlarge buffer
-            void *new_data = realloc(m_data, desired_size);
-            if (!new_data) {
-                return ec_from_errno();
-            }
-
-            // Zero-initialize new space
-            memset(static_cast<char *>(new_data) + m_size, 0,
-                   desired_size - m_size);
-
-            m_data = new_data;
-            m_size = desired_size;
-            if (m_data_ptr) {
-                *m_data_ptr = m_data;
-            }
-            if (m_size_ptr) {
-                *m_size_ptr = m_size;
-            }
-        }
-    }
-
-    memcpy(static_cast<char *>(m_data) + m_pos, buf, to_write);
-    m_pos += to_write;
+    OUTCOME_TRY(n, write_at(buf, size, m_pos));
+    m_pos += n;
 
-    return to_write;
+    return n;
 }
 
 oc::result<uint64_t> MemoryFile::on_seek(int64_t offset, int whence)
@@ -289,6 +252,26 @@ oc::result<void> MemoryFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+oc::result<size_t> MemoryFile::on_pread(void *buf, size_t size,
+                                        uint64_t offset)
+{
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return read_at(buf, size, static_cast<size_t>(offset));
+}
+
+oc::result<size_t> MemoryFile::on_pwrite(const void *buf, size_t size,
+                                         uint64_t offset)
+{
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return write_at(buf, size, static_cast<size_t>(offset));
+}
+
 void MemoryFile::clear()
 {
     m_data = nullptr;
@@ -299,4 +282,56 @@ void MemoryFile::clear()
     m_fixed_size = false;
 }
 
+size_t MemoryFile::read_at(void *buf, size_t size, size_t pos)
+{
+    size_t to_read = 0;
+    if (pos < m_size) {
+        to_read = std::min(m_size - pos, size);
+    }
+
+    memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+
+    return to_read;
+}
+
+oc::result<size_t> MemoryFile::write_at(const void *buf, size_t size,
+                                        size_t pos)
+{
+    if (pos > SIZE_MAX - size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    size_t desired_size = pos + size;
+    size_t to_write = size;
+
+    if (desired_size > m_size) {
+        if (m_fixed_size) {
+            to_write = pos <= m_size ? m_size - pos : 0;
+        } else {
+            // Enlarge buffer
+            void *new_data = realloc(m_data, desired_size);
+            if (!new_data) {
+                return ec_from_errno();
+            }
+
+            // Zero-initialize new space
+            memset(static_cast<char *>(new_data) + m_size, 0,
+                   desired_size - m_size);
+
+            m_data = new_data;
+            m_size = desired_size;
+            if (m_data_ptr) {
+                *m_data_ptr = m_data;
+            }
+            if (m_size_ptr) {
+                *m_size_ptr = m_size;
+            }
+        }
+    }
+
+    memcpy(static_cast<char *>(m_data) + pos, buf, to_write);
+
+    return to_write;
+}
+
 }
@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open file as a read-only memory mapping
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+struct RealMmapFileFuncs : public MmapFileFuncs
+{
+    int fn_open(const char *path, int flags, mode_t mode) override
+    {
+        return ::open(path, flags, mode);
+    }
+
+    void * fn_mmap(void *addr, size_t length, int prot, int flags,
+                   int fd, off_t offset) override
+    {
+        return mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    int fn_munmap(void *addr, size_t length) override
+    {
+        return munmap(addr, length);
+    }
+
+    int fn_madvise(void *addr, size_t length, int advice) override
+    {
+        return madvise(addr, length, advice);
+    }
+
+    int fn_fstat(int fildes, struct stat *buf) override
+    {
+        return fstat(fildes, buf);
+    }
+
+    int fn_close(int fd) override
+    {
+        return close(fd);
+    }
+};
+/*! \endcond */
+
+static RealMmapFileFuncs g_default_funcs;
+
+/*! \cond INTERNAL */
+
+MmapFileFuncs::~MmapFileFuncs() = default;
+
+/*! \endcond */
+
+/*!
+ * \class MmapFile
+ *
+ * \brief Open a regular file as a read-only memory mapping.
+ *
+ * The entire file is mapped when the handle is opened. Reads are served by
+ * copying from the mapping, but callers that only need to inspect the data can
+ * use data() and size() or mapping() to access the mapping directly without any
+ * copies.
+ *
+ * Writing and truncating are not supported.
+ *
+ * \note The file must not be truncated by another process while it is mapped.
+ *       Accessing pages past the new end of the file will raise `SIGBUS`.
+ */
+
+/*!
+ * \brief Construct unbound MmapFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+MmapFile::MmapFile()
+    : MmapFile(&g_default_funcs)
+{
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int, bool)
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ */
+MmapFile::MmapFile(int fd, bool owned)
+    : MmapFile(&g_default_funcs, fd, owned)
+{
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &)
+ *
+ * \param filename MBS filename
+ */
+MmapFile::MmapFile(const std::string &filename)
+    : MmapFile(&g_default_funcs, filename)
+{
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &)
+ *
+ * \param filename WCS filename
+ */
+MmapFile::MmapFile(const std::wstring &filename)
+    : MmapFile(&g_default_funcs, filename)
+{
+}
+
+/*! \cond INTERNAL */
+
+MmapFile::MmapFile(MmapFileFuncs *funcs)
+    : File(), m_funcs(funcs)
+{
+    clear();
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   int fd, bool owned)
+    : MmapFile(funcs)
+{
+    (void) open(fd, owned);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::string &filename)
+    : MmapFile(funcs)
+{
+    (void) open(filename);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::wstring &filename)
+    : MmapFile(funcs)
+{
+    (void) open(filename);
+}
+
+/*! \endcond */
+
+MmapFile::~MmapFile()
+{
+    (void) close();
+}
+
+MmapFile::MmapFile(MmapFile &&other) noexcept
+    : File(std::move(other))
+    , m_funcs(other.m_funcs)
+    , m_fd(other.m_fd)
+    , m_owned(other.m_owned)
+    , m_filename(std::move(other.m_filename))
+    , m_data(other.m_data)
+    , m_size(other.m_size)
+    , m_pos(other.m_pos)
+{
+    other.clear();
+}
+
+MmapFile & MmapFile::operator=(MmapFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_funcs = rhs.m_funcs;
+    m_fd = rhs.m_fd;
+    m_owned = rhs.m_owned;
+    m_filename.swap(rhs.m_filename);
+    m_data = rhs.m_data;
+    m_size = rhs.m_size;
+    m_pos = rhs.m_pos;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open from file descriptor.
+ *
+ * If \p owned is true, then the File handle will take ownership of the file
+ * descriptor. In other words, the file descriptor will be closed when the
+ * File handle is closed.
+ *
+ * \note The file descriptor must refer to a regular file that was opened for
+ *       reading.
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(int fd, bool owned)
+{
+    if (state() == FileState::New) {
+        m_fd = fd;
+        m_owned = owned;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a multi-byte filename.
+ *
+ * \p filename is directly passed to `open()`.
+ *
+ * \param filename MBS filename
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::string &filename)
+{
+    if (state() == FileState::New) {
+        m_fd = -1;
+        m_owned = true;
+        m_filename = filename;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::wstring &filename)
+{
+    if (state() == FileState::New) {
+        auto converted = wcs_to_mbs(filename);
+        if (!converted) {
+            return FileError::CannotConvertEncoding;
+        }
+
+        m_fd = -1;
+        m_owned = true;
+        m_filename = std::move(converted.value());
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get pointer to the mapped file contents
+ *
+ * \note The pointer is only valid while the file is open. If the file is empty,
+ *       nullptr is returned.
+ *
+ * \return Pointer to the beginning of the mapping
+ */
+const void * MmapFile::data() const
+{
+    return m_data;
+}
+
+/*!
+ * \brief Get size of the mapped file contents
+ *
+ * \return Size of the mapping, which is the size of the file at the time it
+ *         was opened
+ */
+size_t MmapFile::size() const
+{
+    return m_size;
+}
+
+/*!
+ * \brief Get in-memory view of the entire file contents
+ *
+ * \return data() and size()
+ */
+std::pair<const void *, size_t> MmapFile::mapping() const
+{
+    return { m_data, m_size };
+}
+
+oc::result<void> MmapFile::on_open()
+{
+    if (!m_filename.empty()) {
+        m_fd = m_funcs->fn_open(m_filename.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (m_fd < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    struct stat sb;
+
+    if (m_funcs->fn_fstat(m_fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    } else if (!S_ISREG(sb.st_mode)) {
+        // Only regular files have a meaningful size to map
+        return std::make_error_code(std::errc::no_such_device);
+    }
+
+    if (static_cast<uint64_t>(sb.st_size) > SIZE_MAX) {
+        return FileError::IntegerOverflow;
+    }
+
+    m_size = static_cast<size_t>(sb.st_size);
+
+    // mmap() does not allow zero-length mappings
+    if (m_size > 0) {
+        void *data = m_funcs->fn_mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE,
+                                      m_fd, 0);
+        if (data == MAP_FAILED) {
+            m_size = 0;
+            return ec_from_errno();
+        }
+
+        m_data = data;
+
+        // Most users scan the file from beginning to end. This is only a hint,
+        // so failures are ignored.
+        (void) m_funcs->fn_madvise(m_data, m_size, MADV_SEQUENTIAL);
+    }
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    bool failed = false;
+    int saved_errno = 0;
+
+    if (m_data && m_funcs->fn_munmap(m_data, m_size) < 0) {
+        failed = true;
+        saved_errno = errno;
+    }
+
+    if (m_owned && m_fd >= 0 && m_funcs->fn_close(m_fd) < 0 && !failed) {
+        failed = true;
+        saved_errno = errno;
+    }
+
+    if (failed) {
+        return ec_from_errno(saved_errno);
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> MmapFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_pread(buf, size, m_pos));
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> MmapFile::on_seek(int64_t offset, int whence)
+{
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<size_t>(offset);
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > m_pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - m_pos)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos += static_cast<size_t>(offset);
+    case SEEK_END:
+        if ((offset < 0 && static_cast<size_t>(-offset) > m_size)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - m_size)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = m_size + static_cast<size_t>(offset);
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<size_t> MmapFile::on_pread(void *buf, size_t size, uint64_t offset)
+{
+    if (offset >= m_size) {
+        return 0;
+    }
+
+    size_t to_read = std::min(m_size - static_cast<size_t>(offset), size);
+    memcpy(buf, static_cast<const char *>(m_data) + offset, to_read);
+
+    return to_read;
+}
+
+void MmapFile::clear()
+{
+    m_fd = -1;
+    m_owned = false;
+    m_filename.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
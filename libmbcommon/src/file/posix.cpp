@@ -20,10 +20,16 @@
 #include "mbcommon/file/posix.h"
 
 #include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/falloc.h>
+#endif
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -63,6 +69,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -105,6 +116,27 @@ struct RealPosixFileFuncs : public PosixFileFuncs
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+#endif
+#ifdef __linux__
+
+    int fn_fallocate64(int fd, int mode, off64_t offset, off64_t len) override
+    {
+        return fallocate64(fd, mode, offset, len);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -525,6 +557,119 @@ oc::result<void> PosixFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+#ifndef _WIN32
+oc::result<size_t> PosixFile::on_pread(void *buf, size_t size,
+                                       uint64_t offset)
+{
+    // Use the file descriptor directly if there is a seekable one
+    int fd = m_can_seek ? m_funcs->fn_fileno(m_fp) : -1;
+    if (fd < 0) {
+        return File::on_pread(buf, size, offset);
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    // Make pending buffered writes visible to the file descriptor
+    if (m_funcs->fn_fflush(m_fp) == EOF) {
+        return ec_from_errno();
+    }
+
+    ssize_t n = m_funcs->fn_pread64(fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> PosixFile::on_pwrite(const void *buf, size_t size,
+                                        uint64_t offset)
+{
+    int fd = m_can_seek ? m_funcs->fn_fileno(m_fp) : -1;
+    if (fd < 0) {
+        return File::on_pwrite(buf, size, offset);
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    // Write out pending buffered data and discard buffered input, which may
+    // become stale
+    if (m_funcs->fn_fflush(m_fp) == EOF) {
+        return ec_from_errno();
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+#endif
+
+#ifdef __linux__
+#  ifndef FALLOC_FL_COLLAPSE_RANGE
+#    define FALLOC_FL_COLLAPSE_RANGE 0x08
+#  endif
+#  ifndef FALLOC_FL_INSERT_RANGE
+#    define FALLOC_FL_INSERT_RANGE 0x20
+#  endif
+
+oc::result<void> PosixFile::on_insert_range(uint64_t offset, uint64_t size)
+{
+    return shift_range(FALLOC_FL_INSERT_RANGE, offset, size);
+}
+
+oc::result<void> PosixFile::on_collapse_range(uint64_t offset, uint64_t size)
+{
+    return shift_range(FALLOC_FL_COLLAPSE_RANGE, offset, size);
+}
+
+oc::result<void> PosixFile::shift_range(int mode, uint64_t offset,
+                                        uint64_t size)
+{
+    int fd = m_can_seek ? m_funcs->fn_fileno(m_fp) : -1;
+    if (fd < 0) {
+        return FileError::UnsupportedShift;
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)
+            || size > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Write out pending buffered data and discard buffered input, which will
+    // become stale
+    if (m_funcs->fn_fflush(m_fp) == EOF) {
+        return ec_from_errno();
+    }
+
+    if (m_funcs->fn_fallocate64(fd, mode, static_cast<off64_t>(offset),
+                                static_cast<off64_t>(size)) < 0) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            return FileError::UnsupportedShift;
+        }
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+#endif
+
 void PosixFile::clear()
 {
     m_fp = nullptr;
@@ -20,13 +20,19 @@
 #include "mbcommon/file_util.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/libc/string.h"
 
 #define DEFAULT_BUFFER_SIZE             (8 * 1024 * 1024)
@@ -183,6 +189,148 @@ oc::result<void> file_write_exact(File &file, const void *buf, size_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This function differs from File::pread() in that it will call File::pread()
+ * repeatedly until \p size bytes are read or EOF is reached. If File::pread()
+ * returns std::errc::interrupted, then the read operation will be
+ * automatically reattempted.
+ *
+ * \param[in] file File handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ *
+ * \return Number of bytes read if some are successfully read or EOF is reached.
+ *         Otherwise, the error code.
+ */
+oc::result<size_t> file_pread_retry(File &file, void *buf, size_t size,
+                                    uint64_t offset)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < size) {
+        if (offset > UINT64_MAX - bytes_read) {
+            return FileError::IntegerOverflow;
+        }
+
+        auto n = file.pread(static_cast<char *>(buf) + bytes_read,
+                            size - bytes_read, offset + bytes_read);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_read += n.value();
+    }
+
+    return bytes_read;
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This function differs from File::pwrite() in that it will call
+ * File::pwrite() repeatedly until \p size bytes are written or EOF is reached.
+ * If File::pwrite() returns std::errc::interrupted, then the write operation is
+ * automatically reattempted.
+ *
+ * \param file File handle
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ * \param offset File offset to write to
+ *
+ * \return Number of bytes written if some are successfully written or EOF is
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> file_pwrite_retry(File &file, const void *buf, size_t size,
+                                     uint64_t offset)
+{
+    size_t bytes_written = 0;
+
+    while (bytes_written < size) {
+        if (offset > UINT64_MAX - bytes_written) {
+            return FileError::IntegerOverflow;
+        }
+
+        auto n = file.pwrite(static_cast<const char *>(buf) + bytes_written,
+                             size - bytes_written, offset + bytes_written);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_written += n.value();
+    }
+
+    return bytes_written;
+}
+
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This function is the positional equivalent of file_read_exact(). If EOF is
+ * reached before \p size bytes are read, then FileError::UnexpectedEof will be
+ * returned.
+ *
+ * \param[in] file File handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ *
+ * \return Nothing if the specified number of bytes were successfully read.
+ *         Otherwise, the error code.
+ */
+oc::result<void> file_pread_exact(File &file, void *buf, size_t size,
+                                  uint64_t offset)
+{
+    OUTCOME_TRY(n, file_pread_retry(file, buf, size, offset));
+
+    if (n != size) {
+        return FileError::UnexpectedEof;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This function is the positional equivalent of file_write_exact(). If EOF is
+ * reached before \p size bytes are written, then FileError::UnexpectedEof will
+ * be returned.
+ *
+ * \param file File handle
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ * \param offset File offset to write to
+ *
+ * \return Nothing if the specified number of bytes were successfully written.
+ *         Otherwise, the error code.
+ */
+oc::result<void> file_pwrite_exact(File &file, const void *buf, size_t size,
+                                   uint64_t offset)
+{
+    OUTCOME_TRY(n, file_pwrite_retry(file, buf, size, offset));
+
+    if (n != size) {
+        return FileError::UnexpectedEof;
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Read from a File handle and discard the data.
  *
@@ -240,6 +388,83 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
  *   * An error code if file_search() should report a failure
  */
 
+/*!
+ * \brief Seek to the starting offset of a search
+ *
+ * If \p file does not support seeking, data is read and discarded instead.
+ */
+static oc::result<void> seek_to_search_start(File &file, uint64_t offset)
+{
+    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        if (seek_ret.error() == FileErrorC::Unsupported) {
+            OUTCOME_TRY(discarded, file_read_discard(file, offset));
+
+            if (discarded != offset) {
+                // Reached EOF before starting offset
+                file.set_fatal();
+                return FileError::ArgumentOutOfRange;
+            }
+        } else {
+            return seek_ret.as_failure();
+        }
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> search_mapping(File &file,
+                                       const unsigned char *data,
+                                       size_t data_size, int64_t start,
+                                       int64_t end, const void *pattern,
+                                       size_t pattern_size,
+                                       int64_t max_matches,
+                                       FileSearchResultCallback result_cb,
+                                       void *userdata)
+{
+    uint64_t begin = start >= 0 ? static_cast<uint64_t>(start) : 0;
+    uint64_t limit = data_size;
+
+    if (end >= 0 && static_cast<uint64_t>(end) < limit) {
+        limit = static_cast<uint64_t>(end);
+    }
+    if (begin >= limit) {
+        return oc::success();
+    }
+
+    const unsigned char *ptr = data + begin;
+    const unsigned char *ptr_end = data + limit;
+
+    while (static_cast<size_t>(ptr_end - ptr) >= pattern_size) {
+        auto match = static_cast<const unsigned char *>(
+                mb_memmem(ptr, static_cast<size_t>(ptr_end - ptr),
+                          pattern, pattern_size));
+        if (!match) {
+            break;
+        }
+
+        auto ret = result_cb(file, userdata,
+                             static_cast<uint64_t>(match - data));
+        if (!ret) {
+            return ret.as_failure();
+        } else if (ret.value() == FileSearchAction::Stop) {
+            return oc::success();
+        }
+
+        if (max_matches > 0) {
+            --max_matches;
+            if (max_matches == 0) {
+                return oc::success();
+            }
+        }
+
+        // We don't do overlapping searches
+        ptr = match + pattern_size;
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Search file for binary sequence
  *
@@ -250,6 +475,9 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
  * 2 * \p pattern_size would exceed the maximum value of a `size_t`, `SIZE_MAX`
  * will be used.
  *
+ * If \p file provides a mapping (see File::mapping()), then the mapping is
+ * searched directly and \p buf_size is only validated. No data is copied.
+ *
  * If \p file does not support seeking, then the file position must be set to
  * the beginning of the file before calling this function. Instead of seeking,
  * the function will read and discard any data before \p start.
@@ -319,6 +547,15 @@ oc::result<void> file_search(File &file, int64_t start, int64_t end,
         return FileError::ArgumentOutOfRange;
     }
 
+    // Search the mapping in place if possible
+    auto mapping = file.mapping();
+    if (mapping.first) {
+        return search_mapping(
+                file, static_cast<const unsigned char *>(mapping.first),
+                mapping.second, start, end, pattern, pattern_size,
+                max_matches, result_cb, userdata);
+    }
+
     std::vector<unsigned char> buf(buf_size);
 
     if (start >= 0) {
@@ -327,21 +564,7 @@ oc::result<void> file_search(File &file, int64_t start, int64_t end,
         offset = 0;
     }
 
-    // Seek to starting point
-    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
-    if (!seek_ret) {
-        if (seek_ret.error() == FileErrorC::Unsupported) {
-            OUTCOME_TRY(discarded, file_read_discard(file, offset));
-
-            if (discarded != offset) {
-                // Reached EOF before starting offset
-                file.set_fatal();
-                return FileError::ArgumentOutOfRange;
-            }
-        } else {
-            return seek_ret.as_failure();
-        }
-    }
+    OUTCOME_TRYV(seek_to_search_start(file, offset));
 
     // Initially read to beginning of buffer
     ptr = buf.data();
@@ -417,6 +640,783 @@ oc::result<void> file_search(File &file, int64_t start, int64_t end,
     }
 }
 
+namespace
+{
+
+/*! \brief Search results for one chunk of a parallel search */
+struct SearchChunk
+{
+    bool done = false;
+    std::error_code ec;
+    // Offset of the first byte in data
+    uint64_t offset = 0;
+    // Matches must begin before this offset
+    uint64_t limit = 0;
+    // Chunk data plus up to pattern_size - 1 bytes of the next chunk
+    std::vector<unsigned char> data;
+    // Non-overlapping matches, searching from the beginning of the chunk
+    std::vector<uint64_t> matches;
+};
+
+/*! \brief Shared state for a parallel search */
+struct ParallelSearch
+{
+    File *file;
+    const unsigned char *pattern;
+    size_t pattern_size;
+    uint64_t begin;
+    uint64_t limit;
+    size_t chunk_size;
+    size_t num_chunks;
+    size_t max_in_flight;
+
+    std::mutex mutex;
+    std::condition_variable cv_done;
+    std::condition_variable cv_space;
+    // Chunks that have been claimed, but not yet consumed, keyed by index
+    std::unordered_map<size_t, SearchChunk> chunks;
+    size_t next_chunk = 0;
+    size_t consumed = 0;
+    bool stop = false;
+};
+
+/*!
+ * \brief Find non-overlapping matches within a buffer
+ *
+ * \param chunk Chunk containing the data to search
+ * \param pattern Pattern to search
+ * \param pattern_size Size of pattern
+ * \param pos Offset to begin searching from
+ * \param out Output vector for matches beginning before `chunk.limit`
+ */
+void search_chunk_from(const SearchChunk &chunk, const unsigned char *pattern,
+                       size_t pattern_size, uint64_t pos,
+                       std::vector<uint64_t> &out)
+{
+    auto base = chunk.data.data();
+    auto ptr = base + (pos - chunk.offset);
+    auto ptr_end = base + chunk.data.size();
+
+    while (static_cast<size_t>(ptr_end - ptr) >= pattern_size) {
+        auto match = static_cast<const unsigned char *>(
+                mb_memmem(ptr, static_cast<size_t>(ptr_end - ptr),
+                          pattern, pattern_size));
+        if (!match) {
+            break;
+        }
+
+        uint64_t match_offset = chunk.offset + static_cast<size_t>(match - base);
+        if (match_offset >= chunk.limit) {
+            break;
+        }
+
+        out.push_back(match_offset);
+
+        // We don't do overlapping searches
+        ptr = match + pattern_size;
+    }
+}
+
+void parallel_search_worker(ParallelSearch &ps)
+{
+    while (true) {
+        size_t index;
+
+        {
+            std::unique_lock<std::mutex> lock(ps.mutex);
+
+            // Bound the amount of buffered data
+            ps.cv_space.wait(lock, [&] {
+                return ps.stop || ps.next_chunk >= ps.num_chunks
+                        || ps.next_chunk < ps.consumed + ps.max_in_flight;
+            });
+
+            if (ps.stop || ps.next_chunk >= ps.num_chunks) {
+                return;
+            }
+
+            index = ps.next_chunk++;
+        }
+
+        SearchChunk chunk;
+        chunk.offset = ps.begin + index * ps.chunk_size;
+        chunk.limit = std::min<uint64_t>(chunk.offset + ps.chunk_size,
+                                         ps.limit);
+
+        uint64_t read_end = std::min<uint64_t>(
+                chunk.limit + ps.pattern_size - 1, ps.limit);
+        chunk.data.resize(static_cast<size_t>(read_end - chunk.offset));
+
+        auto n = file_pread_retry(*ps.file, chunk.data.data(),
+                                  chunk.data.size(), chunk.offset);
+        if (n) {
+            // Short reads are fine if the file was truncated
+            chunk.data.resize(n.value());
+            search_chunk_from(chunk, ps.pattern, ps.pattern_size,
+                              chunk.offset, chunk.matches);
+        } else {
+            chunk.ec = n.error();
+        }
+
+        chunk.done = true;
+
+        {
+            std::lock_guard<std::mutex> lock(ps.mutex);
+            ps.chunks[index] = std::move(chunk);
+        }
+        ps.cv_done.notify_all();
+    }
+}
+
+}
+
+/*!
+ * \brief Search file for binary sequence using multiple threads
+ *
+ * The range to search is split into chunks of \p bsize bytes, which are read
+ * with File::pread() and searched in parallel. Each chunk is extended by
+ * \p pattern_size - 1 bytes so that matches spanning chunk boundaries are
+ * found. Results are reported on the calling thread in offset order with the
+ * same non-overlapping semantics as file_search(), so for any input, this
+ * function invokes \p result_cb with exactly the same offsets.
+ *
+ * \p file must be seekable and must support concurrent calls to File::pread()
+ * (eg. FdFile, PosixFile, MemoryFile, or MmapFile). The file position is not
+ * used for reading, but the file is seeked to determine its size.
+ *
+ * \note The file position after this function returns is undefined. Be sure to
+ *       seek to a known location before attempting further read or write
+ *       operations.
+ *
+ * \param file File handle
+ * \param start Start offset or negative number for beginning of file
+ * \param end End offset or negative number for end of file
+ * \param bsize Chunk size or 0 to automatically choose a size. Must not be
+ *              smaller than \p pattern_size.
+ * \param pattern Pattern to search
+ * \param pattern_size Size of pattern
+ * \param max_matches Maximum number of matches or -1 to find all matches
+ * \param threads Number of threads or 0 to use the number of CPUs
+ * \param result_cb Callback to invoke upon finding a match
+ * \param userdata User callback data
+ *
+ * \return Nothing if the search completes successfully. Otherwise, the error
+ *         code.
+ */
+oc::result<void> file_search_parallel(File &file, int64_t start, int64_t end,
+                                      size_t bsize, const void *pattern,
+                                      size_t pattern_size, int64_t max_matches,
+                                      unsigned int threads,
+                                      FileSearchResultCallback result_cb,
+                                      void *userdata)
+{
+    // Check boundaries
+    if (start >= 0 && end >= 0 && end < start) {
+        // End offset < start offset
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Trivial case
+    if (max_matches == 0 || pattern_size == 0) {
+        return oc::success();
+    }
+
+    size_t chunk_size = bsize != 0 ? bsize : DEFAULT_BUFFER_SIZE;
+    if (chunk_size < pattern_size) {
+        // Chunk size cannot be less than pattern size
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    OUTCOME_TRY(file_size, file.seek(0, SEEK_END));
+
+    ParallelSearch ps;
+    ps.file = &file;
+    ps.pattern = static_cast<const unsigned char *>(pattern);
+    ps.pattern_size = pattern_size;
+    ps.begin = start >= 0 ? static_cast<uint64_t>(start) : 0;
+    ps.limit = file_size;
+    ps.chunk_size = chunk_size;
+
+    if (end >= 0 && static_cast<uint64_t>(end) < ps.limit) {
+        ps.limit = static_cast<uint64_t>(end);
+    }
+    if (ps.begin >= ps.limit || ps.limit - ps.begin < pattern_size) {
+        return oc::success();
+    }
+
+    ps.num_chunks = static_cast<size_t>(
+            (ps.limit - ps.begin + chunk_size - 1) / chunk_size);
+    threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, ps.num_chunks));
+    ps.max_in_flight = 2 * static_cast<size_t>(threads);
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+
+    auto join_workers = finally([&] {
+        {
+            std::lock_guard<std::mutex> lock(ps.mutex);
+            ps.stop = true;
+        }
+        ps.cv_space.notify_all();
+
+        for (auto &t : workers) {
+            t.join();
+        }
+    });
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back(parallel_search_worker, std::ref(ps));
+    }
+
+    // Matches before this offset overlap the previous match
+    uint64_t next_allowed = 0;
+
+    // Report a match and return whether the search should continue
+    auto report = [&](uint64_t offset) -> oc::result<bool> {
+        OUTCOME_TRY(action, result_cb(file, userdata, offset));
+
+        if (action == FileSearchAction::Stop) {
+            // Stop searching early
+            return false;
+        }
+
+        next_allowed = offset + pattern_size;
+
+        if (max_matches > 0) {
+            --max_matches;
+            if (max_matches == 0) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    for (size_t index = 0; index < ps.num_chunks; ++index) {
+        SearchChunk chunk;
+
+        {
+            std::unique_lock<std::mutex> lock(ps.mutex);
+
+            ps.cv_done.wait(lock, [&] {
+                auto it = ps.chunks.find(index);
+                return it != ps.chunks.end() && it->second.done;
+            });
+
+            auto it = ps.chunks.find(index);
+            chunk = std::move(it->second);
+            ps.chunks.erase(it);
+            ++ps.consumed;
+        }
+        ps.cv_space.notify_all();
+
+        if (chunk.ec) {
+            return chunk.ec;
+        }
+
+        auto const *matches = &chunk.matches;
+        std::vector<uint64_t> resynced;
+
+        if (next_allowed > chunk.offset) {
+            // The previous match extends into this chunk, so the worker's
+            // results may not be valid. Search again from the end of the
+            // previous match until the results converge with the worker's.
+            auto it = chunk.matches.begin();
+            uint64_t pos = std::min<uint64_t>(
+                    next_allowed, chunk.offset + chunk.data.size());
+
+            while (true) {
+                auto base = chunk.data.data() + (pos - chunk.offset);
+                auto remain = chunk.data.size()
+                        - static_cast<size_t>(pos - chunk.offset);
+                auto match = remain >= pattern_size
+                        ? static_cast<const unsigned char *>(mb_memmem(
+                                base, remain, pattern, pattern_size))
+                        : nullptr;
+                if (!match) {
+                    break;
+                }
+
+                uint64_t match_offset = chunk.offset + static_cast<size_t>(
+                        match - chunk.data.data());
+                if (match_offset >= chunk.limit) {
+                    break;
+                }
+
+                it = std::lower_bound(it, chunk.matches.end(), match_offset);
+                if (it != chunk.matches.end() && *it == match_offset) {
+                    // Converged
+                    resynced.insert(resynced.end(), it, chunk.matches.end());
+                    break;
+                }
+
+                resynced.push_back(match_offset);
+                pos = match_offset + pattern_size;
+            }
+
+            matches = &resynced;
+        }
+
+        for (auto offset : *matches) {
+            OUTCOME_TRY(proceed, report(offset));
+            if (!proceed) {
+                return oc::success();
+            }
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \struct FileSearchPattern
+ *
+ * \brief Pattern for file_search_multi()
+ *
+ * The pattern data is not copied and must remain valid for the duration of the
+ * search.
+ */
+
+/*!
+ * \typedef FileMultiSearchResultCallback
+ *
+ * \brief Search result callback for file_search_multi()
+ *
+ * The same restrictions as #FileSearchResultCallback apply.
+ *
+ * \sa file_search_multi()
+ *
+ * \param file File handle
+ * \param userdata User callback data
+ * \param index Index of the matched pattern
+ * \param offset File offset of search result
+ *
+ * \return
+ *   * #FileSearchAction::Continue to continue search
+ *   * #FileSearchAction::Stop to stop search, but have file_search_multi()
+ *     report a successful result
+ *   * An error code if file_search_multi() should report a failure
+ */
+
+namespace
+{
+
+/*! \brief Marker for missing trie transitions */
+constexpr uint32_t NO_STATE = UINT32_MAX;
+
+/*!
+ * \brief Aho-Corasick automaton for finding multiple patterns in one pass
+ *
+ * The automaton is stored as a dense transition table with 256 entries per
+ * state, so memory usage is proportional to the total size of the patterns.
+ * While in the root state, bytes that cannot start any pattern are skipped
+ * without going through the transition table.
+ */
+class MultiPatternMatcher
+{
+public:
+    explicit MultiPatternMatcher(const std::vector<FileSearchPattern> &patterns)
+        : m_patterns(patterns)
+        , m_first()
+        , m_first_count(0)
+        , m_first_byte(0)
+        , m_next_start(patterns.size())
+        , m_state(0)
+    {
+        // Root state
+        add_state();
+
+        // Build trie
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            auto data = static_cast<const unsigned char *>(patterns[i].data);
+            uint32_t state = 0;
+
+            if (patterns[i].size == 0) {
+                continue;
+            }
+
+            for (size_t j = 0; j < patterns[i].size; ++j) {
+                uint32_t next = m_goto[state * 256 + data[j]];
+                if (next == NO_STATE) {
+                    next = add_state();
+                    m_goto[state * 256 + data[j]] = next;
+                }
+                state = next;
+            }
+
+            m_outputs[state].push_back(i);
+
+            if (!m_first[data[0]]) {
+                m_first[data[0]] = true;
+                m_first_byte = data[0];
+                ++m_first_count;
+            }
+        }
+
+        // Compute failure links in breadth-first order and turn the trie into
+        // a complete transition table
+        std::vector<uint32_t> queue;
+
+        for (size_t c = 0; c < 256; ++c) {
+            uint32_t &next = m_goto[c];
+            if (next == NO_STATE) {
+                next = 0;
+            } else {
+                m_fail[next] = 0;
+                queue.push_back(next);
+            }
+        }
+
+        for (size_t i = 0; i < queue.size(); ++i) {
+            uint32_t state = queue[i];
+
+            for (size_t c = 0; c < 256; ++c) {
+                uint32_t next = m_goto[state * 256 + c];
+                uint32_t fallback = m_goto[m_fail[state] * 256 + c];
+
+                if (next == NO_STATE) {
+                    m_goto[state * 256 + c] = fallback;
+                } else {
+                    m_fail[next] = fallback;
+                    // Longer matches are reported before shorter suffixes
+                    m_outputs[next].insert(m_outputs[next].end(),
+                                           m_outputs[fallback].begin(),
+                                           m_outputs[fallback].end());
+                    queue.push_back(next);
+                }
+            }
+        }
+    }
+
+    /*!
+     * \brief Feed data into the automaton
+     *
+     * \param data Data to search
+     * \param size Size of \p data
+     * \param offset File offset of \p data
+     * \param match_cb Callable invoked as `match_cb(index, offset)` for each
+     *                 match. It returns `oc::result<bool>`, where false stops
+     *                 the search.
+     *
+     * \return Whether the search should continue or the error returned by
+     *         \p match_cb
+     */
+    template<typename MatchFn>
+    oc::result<bool> feed(const unsigned char *data, size_t size,
+                          uint64_t offset, MatchFn &match_cb)
+    {
+        const unsigned char *ptr = data;
+        const unsigned char *end = data + size;
+
+        while (ptr != end) {
+            if (m_state == 0) {
+                ptr = skip_to_candidate(ptr, end);
+                if (ptr == end) {
+                    break;
+                }
+            }
+
+            m_state = m_goto[m_state * 256 + *ptr];
+            ++ptr;
+
+            auto const &outputs = m_outputs[m_state];
+            if (outputs.empty()) {
+                continue;
+            }
+
+            uint64_t match_end = offset + static_cast<size_t>(ptr - data);
+
+            for (size_t index : outputs) {
+                uint64_t match_start = match_end - m_patterns[index].size;
+
+                // We don't do overlapping searches (per pattern)
+                if (match_start < m_next_start[index]) {
+                    continue;
+                }
+                m_next_start[index] = match_end;
+
+                OUTCOME_TRY(proceed, match_cb(index, match_start));
+                if (!proceed) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    uint32_t add_state()
+    {
+        auto state = static_cast<uint32_t>(m_fail.size());
+
+        m_goto.resize(m_goto.size() + 256, NO_STATE);
+        m_fail.push_back(0);
+        m_outputs.emplace_back();
+
+        return state;
+    }
+
+    const unsigned char * skip_to_candidate(const unsigned char *ptr,
+                                            const unsigned char *end) const
+    {
+        if (m_first_count == 1) {
+            auto match = memchr(ptr, m_first_byte,
+                                static_cast<size_t>(end - ptr));
+            return match ? static_cast<const unsigned char *>(match) : end;
+        }
+
+        while (ptr != end && !m_first[*ptr]) {
+            ++ptr;
+        }
+
+        return ptr;
+    }
+
+    const std::vector<FileSearchPattern> &m_patterns;
+
+    // Bytes that begin at least one pattern
+    bool m_first[256];
+    size_t m_first_count;
+    unsigned char m_first_byte;
+
+    std::vector<uint32_t> m_goto;
+    std::vector<uint32_t> m_fail;
+    std::vector<std::vector<size_t>> m_outputs;
+
+    // Offset where the next match of each pattern may begin
+    std::vector<uint64_t> m_next_start;
+    uint32_t m_state;
+};
+
+}
+
+/*!
+ * \brief Search file for multiple binary sequences in a single pass
+ *
+ * This is equivalent to calling file_search() for each pattern and merging the
+ * results, except that the file is only read once. Matches are reported in the
+ * order in which they end in the file. If multiple matches end at the same
+ * offset, longer patterns are reported first. Like file_search(), the search is
+ * not overlapping for matches of the same pattern, but matches of different
+ * patterns may overlap.
+ *
+ * If \p file provides a mapping (see File::mapping()), then the mapping is
+ * searched directly. If \p file does not support seeking, then the file
+ * position must be set to the beginning of the file before calling this
+ * function.
+ *
+ * \note The file position after this function returns is undefined. Be sure to
+ *       seek to a known location before attempting further read or write
+ *       operations.
+ *
+ * \param file File handle
+ * \param start Start offset or negative number for beginning of file
+ * \param end End offset or negative number for end of file
+ * \param bsize Buffer size or 0 to use the default size of 8 MiB. Unlike
+ *              file_search(), any non-zero size is valid since matches can
+ *              span multiple reads.
+ * \param patterns Patterns to search. Empty patterns never match.
+ * \param max_matches Maximum total number of matches or -1 to find all matches
+ * \param result_cb Callback to invoke upon finding a match
+ * \param userdata User callback data
+ *
+ * \return Nothing if the search completes successfully. Otherwise, the error
+ *         code.
+ */
+oc::result<void> file_search_multi(File &file, int64_t start, int64_t end,
+                                   size_t bsize,
+                                   const std::vector<FileSearchPattern> &patterns,
+                                   int64_t max_matches,
+                                   FileMultiSearchResultCallback result_cb,
+                                   void *userdata)
+{
+    // Check boundaries
+    if (start >= 0 && end >= 0 && end < start) {
+        // End offset < start offset
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Trivial case
+    if (max_matches == 0 || std::none_of(patterns.begin(), patterns.end(),
+                                         [](const FileSearchPattern &p) {
+        return p.size > 0;
+    })) {
+        return oc::success();
+    }
+
+    MultiPatternMatcher matcher(patterns);
+
+    auto match_cb = [&](size_t index, uint64_t offset) -> oc::result<bool> {
+        OUTCOME_TRY(action, result_cb(file, userdata, index, offset));
+
+        if (action == FileSearchAction::Stop) {
+            // Stop searching early
+            return false;
+        }
+
+        if (max_matches > 0) {
+            --max_matches;
+            if (max_matches == 0) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    uint64_t offset = start >= 0 ? static_cast<uint64_t>(start) : 0;
+
+    // Search the mapping in place if possible
+    auto mapping = file.mapping();
+    if (mapping.first) {
+        uint64_t limit = mapping.second;
+
+        if (end >= 0 && static_cast<uint64_t>(end) < limit) {
+            limit = static_cast<uint64_t>(end);
+        }
+        if (offset >= limit) {
+            return oc::success();
+        }
+
+        auto data = static_cast<const unsigned char *>(mapping.first);
+        OUTCOME_TRYV(matcher.feed(data + offset,
+                                  static_cast<size_t>(limit - offset),
+                                  offset, match_cb));
+
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(seek_to_search_start(file, offset));
+
+    std::vector<unsigned char> buf(bsize != 0 ? bsize : DEFAULT_BUFFER_SIZE);
+
+    while (true) {
+        size_t to_read = buf.size();
+
+        if (end >= 0) {
+            if (offset >= static_cast<uint64_t>(end)) {
+                // Artificial EOF
+                break;
+            }
+
+            to_read = static_cast<size_t>(std::min<uint64_t>(
+                    to_read, static_cast<uint64_t>(end) - offset));
+        }
+
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), to_read));
+        if (n == 0) {
+            // Reached EOF
+            break;
+        }
+
+        if (n > UINT64_MAX - offset) {
+            // Read overflows offset value
+            return FileError::IntegerOverflow;
+        }
+
+        OUTCOME_TRY(proceed, matcher.feed(buf.data(), n, offset, match_cb));
+        if (!proceed) {
+            break;
+        }
+
+        offset += n;
+    }
+
+    return oc::success();
+}
+
+/*! \brief Size of the buffer used when file_move() has to copy data */
+static constexpr size_t FILE_MOVE_BUF_SIZE = 1024 * 1024;
+
+/*!
+ * \brief Copy non-overlapping range within a file
+ *
+ * \return Nothing if all \p size bytes were copied. Otherwise, the error code.
+ */
+static oc::result<void> copy_range(File &file, uint64_t src, uint64_t dest,
+                                   uint64_t size,
+                                   std::vector<unsigned char> &buf)
+{
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(buf.size(), size - copied));
+
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(src + copied), SEEK_SET));
+        OUTCOME_TRYV(file_read_exact(file, buf.data(), to_read));
+
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(dest + copied), SEEK_SET));
+        OUTCOME_TRYV(file_write_exact(file, buf.data(), to_read));
+
+        copied += to_read;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Try to move the data at the end of a file by shifting it in place
+ *
+ * If the source region extends to the end of the file and overlaps the
+ * destination region, the file's insert_range() or collapse_range() is used to
+ * shift the overlapping portion without rewriting it. Only the
+ * `|dest - src|` bytes that the shift does not handle are copied.
+ *
+ * \return
+ *   * True if the data was moved
+ *   * False if the fast path does not apply or if the file or filesystem does
+ *     not support the range operation (eg. due to alignment requirements). The
+ *     file is unmodified in this case.
+ *   * Otherwise, the error code
+ */
+static oc::result<bool> try_shift_move(File &file, uint64_t src, uint64_t dest,
+                                       uint64_t size,
+                                       std::vector<unsigned char> &buf)
+{
+    uint64_t distance = dest > src ? dest - src : src - dest;
+
+    if (distance >= size) {
+        // Regions don't overlap, so there's nothing to gain
+        return false;
+    }
+
+    OUTCOME_TRY(file_size, file.seek(0, SEEK_END));
+    if (src + size != file_size) {
+        return false;
+    }
+
+    auto ret = dest > src
+            ? file.insert_range(src, distance)
+            : file.collapse_range(dest, distance);
+    if (!ret) {
+        if (ret.error() == FileErrorC::Unsupported
+                || ret.error() == std::errc::invalid_argument) {
+            return false;
+        }
+        return ret.as_failure();
+    }
+
+    if (dest > src) {
+        // [src, dest) is now a hole. memmove() semantics require it to retain
+        // the original data, which now starts at dest.
+        OUTCOME_TRYV(copy_range(file, dest, src, distance, buf));
+    } else {
+        // The file shrunk by distance bytes. memmove() semantics require the
+        // original trailing bytes, which now end at dest + size, to remain.
+        OUTCOME_TRYV(copy_range(file, dest + size - distance, dest + size,
+                                distance, buf));
+    }
+
+    return true;
+}
+
 /*!
  * \brief Move data in file
  *
@@ -425,9 +1425,15 @@ oc::result<void> file_search(File &file, int64_t start, int64_t end,
  * case where \p src == \p dest or \p size == 0, no operation will be performed,
  * but the function will return \p size accordingly.
  *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ * If the source region ends at the end of the file and overlaps the
+ * destination region, File::insert_range() or File::collapse_range() will be
+ * used to shift the data in place when the file supports it. For FdFile and
+ * PosixFile on Linux, this requires the offsets to be aligned to the
+ * filesystem block size.
+ *
+ * \note Otherwise, this function is very seek-heavy and may be slow if the
+ *       handle cannot seek efficiently. It will perform two seeks per loop
+ *       interation. Each iteration moves up to 1 MiB.
  *
  * \note If the return value, \p r, is less than \p size, then the *first* \p r
  *       bytes have been copied from offset \p src to offset \p dest. This is
@@ -444,8 +1450,6 @@ oc::result<void> file_search(File &file, int64_t start, int64_t end,
 oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
                                uint64_t size)
 {
-    char buf[10240];
-
     // Check if we need to do anything
     if (src == dest || size == 0) {
         return size;
@@ -456,13 +1460,20 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         return FileError::ArgumentOutOfRange;
     }
 
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(FILE_MOVE_BUF_SIZE, size)));
+
+    OUTCOME_TRY(shifted, try_shift_move(file, src, dest, size, buf));
+    if (shifted) {
+        return size;
+    }
+
     uint64_t size_moved = 0;
 
     if (dest < src) {
         // Copy forwards
         while (size_moved < size) {
-            auto to_read = std::min<uint64_t>(
-                    sizeof(buf), size - size_moved);
+            auto to_read = std::min<uint64_t>(buf.size(), size - size_moved);
 
             // Seek to source offset
             OUTCOME_TRYV(file.seek(static_cast<int64_t>(src + size_moved),
@@ -470,7 +1481,7 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
 
             // Read data from source
             OUTCOME_TRY(n_read, file_read_retry(
-                    file, buf, static_cast<size_t>(to_read)));
+                    file, buf.data(), static_cast<size_t>(to_read)));
             if (n_read == 0) {
                 break;
             }
@@ -480,7 +1491,7 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
                                    SEEK_SET));
 
             // Write data to destination
-            OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+            OUTCOME_TRY(n_written, file_write_retry(file, buf.data(), n_read));
 
             size_moved += n_written;
 
@@ -491,7 +1502,7 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
     } else {
         // Copy backwards
         while (size_moved < size) {
-            auto to_read = std::min<uint64_t>(sizeof(buf), size - size_moved);
+            auto to_read = std::min<uint64_t>(buf.size(), size - size_moved);
 
             // Seek to source offset
             OUTCOME_TRYV(file.seek(static_cast<int64_t>(
@@ -499,7 +1510,7 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
 
             // Read data form source
             OUTCOME_TRY(n_read, file_read_retry(
-                    file, buf, static_cast<size_t>(to_read)));
+                    file, buf.data(), static_cast<size_t>(to_read)));
             if (n_read == 0) {
                 break;
             }
@@ -509,7 +1520,8 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
                     dest + size - size_moved - n_read), SEEK_SET));
 
             // Write data to destination
-            OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+            OUTCOME_TRY(n_written, file_write_retry(
+                    file, buf.data(), n_read));
 
             size_moved += n_written;
 
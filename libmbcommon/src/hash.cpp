@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/hash.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <openssl/evp.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/hash.h
+ * \brief Streaming hash API
+ */
+
+namespace mb
+{
+
+struct HashErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const std::error_category & hash_error_category()
+{
+    static HashErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(HashError e)
+{
+    return {static_cast<int>(e), hash_error_category()};
+}
+
+const char * HashErrorCategory::name() const noexcept
+{
+    return "hash";
+}
+
+std::string HashErrorCategory::message(int ev) const
+{
+    switch (static_cast<HashError>(ev)) {
+    case HashError::InvalidState:
+        return "invalid state";
+    case HashError::BackendError:
+        return "crypto library error";
+    default:
+        return "(unknown hash error)";
+    }
+}
+
+namespace detail
+{
+
+/*! \brief Size of the chunks that data is batched into in background mode */
+static constexpr size_t HASH_CHUNK_SIZE = 256 * 1024;
+/*! \brief Maximum number of chunks waiting for the helper thread */
+static constexpr size_t HASH_MAX_QUEUED_CHUNKS = 16;
+
+struct HasherImpl
+{
+    EVP_MD_CTX *ctx = nullptr;
+
+    // Background mode. The helper thread has exclusive access to ctx while it
+    // is running.
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv_queued;
+    std::condition_variable cv_space;
+    std::deque<std::vector<unsigned char>> queue;
+    std::vector<std::vector<unsigned char>> free_chunks;
+    std::vector<unsigned char> pending;
+    bool stop = false;
+    bool failed = false;
+
+    ~HasherImpl()
+    {
+        reset();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            cv_queued.wait(lock, [&] {
+                return !queue.empty() || stop;
+            });
+
+            if (queue.empty()) {
+                break;
+            }
+
+            auto chunk = std::move(queue.front());
+            queue.pop_front();
+
+            bool ok = true;
+
+            if (!failed) {
+                lock.unlock();
+                ok = EVP_DigestUpdate(ctx, chunk.data(), chunk.size()) == 1;
+                lock.lock();
+            }
+
+            if (!ok) {
+                failed = true;
+            }
+
+            chunk.clear();
+            free_chunks.push_back(std::move(chunk));
+
+            cv_space.notify_one();
+        }
+    }
+
+    oc::result<void> flush_pending()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        cv_space.wait(lock, [&] {
+            return queue.size() < HASH_MAX_QUEUED_CHUNKS || failed;
+        });
+
+        if (failed) {
+            return HashError::BackendError;
+        }
+
+        queue.push_back(std::move(pending));
+
+        if (free_chunks.empty()) {
+            pending = {};
+            pending.reserve(HASH_CHUNK_SIZE);
+        } else {
+            pending = std::move(free_chunks.back());
+            free_chunks.pop_back();
+        }
+
+        cv_queued.notify_one();
+
+        return oc::success();
+    }
+
+    void stop_thread()
+    {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv_queued.notify_one();
+            thread.join();
+        }
+    }
+
+    void reset()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.clear();
+        }
+        stop_thread();
+
+        free_chunks.clear();
+        pending = {};
+        stop = false;
+        failed = false;
+
+        if (ctx) {
+            EVP_MD_CTX_free(ctx);
+            ctx = nullptr;
+        }
+    }
+};
+
+}
+
+using namespace detail;
+
+static const EVP_MD * get_md(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Sha1:
+        return EVP_sha1();
+    case HashAlgorithm::Sha256:
+        return EVP_sha256();
+    case HashAlgorithm::Sha512:
+        return EVP_sha512();
+    default:
+        MB_UNREACHABLE("Invalid hash algorithm: %d",
+                       static_cast<int>(algorithm));
+    }
+}
+
+/*!
+ * \class Hasher
+ *
+ * \brief Streaming SHA1/SHA256/SHA512 hasher
+ *
+ * The hashing is done by the crypto library (OpenSSL or BoringSSL), which
+ * selects the fastest implementation for the CPU at runtime (eg. the SHA
+ * extensions on x86 and the ARMv8 crypto extensions).
+ *
+ * If HashFlag::Background is specified, the data is copied and hashed on a
+ * helper thread. This allows the hashing to overlap with I/O on the calling
+ * thread, which is useful when hashing data as it is being read or written.
+ * Small updates are batched together before being passed to the helper thread.
+ */
+
+/*!
+ * \brief Construct inactive hasher
+ *
+ * init() must be called before data can be hashed.
+ */
+Hasher::Hasher() = default;
+
+Hasher::~Hasher() = default;
+
+Hasher::Hasher(Hasher &&other) noexcept = default;
+
+Hasher & Hasher::operator=(Hasher &&rhs) noexcept = default;
+
+/*!
+ * \brief Start computing a new hash
+ *
+ * If the hasher is already active, the current hash is discarded.
+ *
+ * \param algorithm Hash algorithm
+ * \param flags Hasher flags
+ *
+ * \return Nothing if the hasher is successfully initialized. Otherwise, the
+ *         error code.
+ */
+oc::result<void> Hasher::init(HashAlgorithm algorithm, HashFlags flags)
+{
+    if (m_impl) {
+        m_impl->reset();
+    } else {
+        m_impl = std::make_unique<HasherImpl>();
+    }
+
+    m_impl->ctx = EVP_MD_CTX_new();
+    if (!m_impl->ctx) {
+        return HashError::BackendError;
+    }
+
+    if (EVP_DigestInit_ex(m_impl->ctx, get_md(algorithm), nullptr) != 1) {
+        m_impl->reset();
+        return HashError::BackendError;
+    }
+
+    if (flags & HashFlag::Background) {
+        m_impl->pending.reserve(HASH_CHUNK_SIZE);
+
+        auto impl = m_impl.get();
+        impl->thread = std::thread([impl] {
+            impl->run();
+        });
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add data to the hash
+ *
+ * \param data Data to hash. In background mode, the data is copied, so the
+ *             buffer can be reused as soon as this function returns.
+ * \param size Size of data
+ *
+ * \return Nothing if the data is successfully hashed or queued. Otherwise, the
+ *         error code. If an error occurs, the hasher can only be reset.
+ */
+oc::result<void> Hasher::update(const void *data, size_t size)
+{
+    if (!is_active()) {
+        return HashError::InvalidState;
+    }
+
+    if (!m_impl->thread.joinable()) {
+        if (EVP_DigestUpdate(m_impl->ctx, data, size) != 1) {
+            return HashError::BackendError;
+        }
+        return oc::success();
+    }
+
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        auto &pending = m_impl->pending;
+        size_t n = std::min(HASH_CHUNK_SIZE - pending.size(), size);
+
+        pending.insert(pending.end(), ptr, ptr + n);
+        ptr += n;
+        size -= n;
+
+        if (pending.size() == HASH_CHUNK_SIZE) {
+            OUTCOME_TRYV(m_impl->flush_pending());
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish computing the hash
+ *
+ * After this function returns, the hasher is inactive until init() is called
+ * again.
+ *
+ * \return Digest if the hash is successfully computed. Otherwise, the error
+ *         code.
+ */
+oc::result<std::vector<unsigned char>> Hasher::finish()
+{
+    if (!is_active()) {
+        return HashError::InvalidState;
+    }
+
+    auto reset_hasher = finally([&] {
+        reset();
+    });
+
+    if (m_impl->thread.joinable()) {
+        if (!m_impl->pending.empty()) {
+            OUTCOME_TRYV(m_impl->flush_pending());
+        }
+
+        m_impl->stop_thread();
+
+        if (m_impl->failed) {
+            return HashError::BackendError;
+        }
+    }
+
+    std::vector<unsigned char> digest(EVP_MAX_MD_SIZE);
+    unsigned int digest_size;
+
+    if (EVP_DigestFinal_ex(m_impl->ctx, digest.data(), &digest_size) != 1) {
+        return HashError::BackendError;
+    }
+
+    digest.resize(digest_size);
+
+    return std::move(digest);
+}
+
+/*!
+ * \brief Discard the current hash and make the hasher inactive
+ */
+void Hasher::reset()
+{
+    if (m_impl) {
+        m_impl->reset();
+    }
+}
+
+/*!
+ * \brief Check whether a hash is being computed
+ *
+ * \return Whether init() was called and the hash has not been finished or
+ *         reset
+ */
+bool Hasher::is_active() const
+{
+    return m_impl && m_impl->ctx;
+}
+
+/*!
+ * \brief Get digest size for hash algorithm
+ *
+ * \param algorithm Hash algorithm
+ *
+ * \return Size of digest in bytes
+ */
+size_t hash_digest_size(HashAlgorithm algorithm)
+{
+    return static_cast<size_t>(EVP_MD_size(get_md(algorithm)));
+}
+
+/*!
+ * \brief Compute hash of a buffer
+ *
+ * \param algorithm Hash algorithm
+ * \param data Data to hash
+ * \param size Size of data
+ *
+ * \return Digest if the hash is successfully computed. Otherwise, the error
+ *         code.
+ */
+oc::result<std::vector<unsigned char>>
+compute_hash(HashAlgorithm algorithm, const void *data, size_t size)
+{
+    Hasher hasher;
+
+    OUTCOME_TRYV(hasher.init(algorithm));
+    OUTCOME_TRYV(hasher.update(data, size));
+
+    return hasher.finish();
+}
+
+}
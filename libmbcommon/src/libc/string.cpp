@@ -19,6 +19,7 @@
 
 #include "mbcommon/libc/string.h"
 
+#include <cstdint>
 #include <cstring>
 
 #ifndef __GLIBC__
@@ -29,12 +30,271 @@
 #  define memmem musl_memmem
 #endif
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#  include <emmintrin.h>
+#  define MEMMEM_SSE2
+#  if (defined(__x86_64__) || defined(__i386__)) && !defined(__ANDROID__)
+#    include <immintrin.h>
+#    define MEMMEM_AVX2
+#  endif
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#  include <arm_neon.h>
+#  define MEMMEM_NEON
+#endif
+
+#if defined(MEMMEM_SSE2) || defined(MEMMEM_NEON)
+#  define MEMMEM_SIMD
+#endif
+
+#ifdef MEMMEM_SIMD
+
+/*
+ * Vectorized search based on comparing blocks of the haystack against the
+ * first and last bytes of the needle at the same time. Only positions where
+ * both bytes match are verified with memcmp(). This is much faster than the
+ * two-way algorithm for the short, high-entropy needles that we search for in
+ * boot images and kernels.
+ *
+ * Needles whose first and last bytes are common in the haystack can degrade
+ * this to O(n * m), so we fall back to the linear-time two-way implementation
+ * once verification work exceeds a multiple of the bytes scanned.
+ */
+
+namespace
+{
+
+/*! \brief Verification cost (in bytes) allowed per byte scanned */
+constexpr size_t VERIFY_BUDGET_FACTOR = 4;
+
+/*! \brief Verification cost (in bytes) allowed before the budget applies */
+constexpr size_t VERIFY_BUDGET_SLACK = 4096;
+
+struct SearchState
+{
+    const unsigned char *haystack;
+    size_t haystacklen;
+    const unsigned char *needle;
+    size_t needlelen;
+    size_t verify_cost;
+};
+
+enum class BlockResult
+{
+    NoMatch,
+    Match,
+    GiveUp,
+};
+
+/*!
+ * \brief Verify candidate positions in a block
+ *
+ * \param state Search state
+ * \param pos Offset of the first byte of the block
+ * \param mask Bitmask of candidate positions within the block
+ * \param[out] match_out Offset of the match if BlockResult::Match is returned
+ */
+inline BlockResult verify_candidates(SearchState &state, size_t pos,
+                                     uint32_t mask, size_t &match_out)
+{
+    while (mask != 0) {
+        auto bit = static_cast<size_t>(__builtin_ctz(mask));
+
+        if (memcmp(state.haystack + pos + bit + 1, state.needle + 1,
+                   state.needlelen - 2) == 0) {
+            match_out = pos + bit;
+            return BlockResult::Match;
+        }
+
+        state.verify_cost += state.needlelen;
+        mask &= mask - 1;
+    }
+
+    if (state.verify_cost > VERIFY_BUDGET_SLACK
+            && state.verify_cost / VERIFY_BUDGET_FACTOR > pos) {
+        return BlockResult::GiveUp;
+    }
+
+    return BlockResult::NoMatch;
+}
+
+#ifdef MEMMEM_SSE2
+BlockResult search_sse2(SearchState &state, size_t &pos, size_t &match_out)
+{
+    const __m128i first = _mm_set1_epi8(static_cast<char>(state.needle[0]));
+    const __m128i last = _mm_set1_epi8(
+            static_cast<char>(state.needle[state.needlelen - 1]));
+
+    for (; pos + state.needlelen - 1 + 16 <= state.haystacklen; pos += 16) {
+        auto block_first = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(state.haystack + pos));
+        auto block_last = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(
+                        state.haystack + pos + state.needlelen - 1));
+
+        auto eq = _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                _mm_cmpeq_epi8(last, block_last));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+
+        if (mask != 0) {
+            auto ret = verify_candidates(state, pos, mask, match_out);
+            if (ret != BlockResult::NoMatch) {
+                return ret;
+            }
+        }
+    }
+
+    return BlockResult::NoMatch;
+}
+#endif
+
+#ifdef MEMMEM_AVX2
+__attribute__((target("avx2")))
+BlockResult search_avx2(SearchState &state, size_t &pos, size_t &match_out)
+{
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(state.needle[0]));
+    const __m256i last = _mm256_set1_epi8(
+            static_cast<char>(state.needle[state.needlelen - 1]));
+
+    for (; pos + state.needlelen - 1 + 32 <= state.haystacklen; pos += 32) {
+        auto block_first = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(state.haystack + pos));
+        auto block_last = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(
+                        state.haystack + pos + state.needlelen - 1));
+
+        auto eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                   _mm256_cmpeq_epi8(last, block_last));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+
+        if (mask != 0) {
+            auto ret = verify_candidates(state, pos, mask, match_out);
+            if (ret != BlockResult::NoMatch) {
+                return ret;
+            }
+        }
+    }
+
+    return BlockResult::NoMatch;
+}
+
+bool have_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+#ifdef MEMMEM_NEON
+BlockResult search_neon(SearchState &state, size_t &pos, size_t &match_out)
+{
+    static const uint8_t bits_data[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+    };
+
+    const uint8x16_t first = vdupq_n_u8(state.needle[0]);
+    const uint8x16_t last = vdupq_n_u8(state.needle[state.needlelen - 1]);
+    const uint8x16_t bits = vld1q_u8(bits_data);
+
+    for (; pos + state.needlelen - 1 + 16 <= state.haystacklen; pos += 16) {
+        auto block_first = vld1q_u8(state.haystack + pos);
+        auto block_last = vld1q_u8(state.haystack + pos + state.needlelen - 1);
+
+        auto eq = vandq_u8(vceqq_u8(first, block_first),
+                           vceqq_u8(last, block_last));
+
+        // Quick check for any candidates
+        auto eq64 = vreinterpretq_u64_u8(eq);
+        if ((vgetq_lane_u64(eq64, 0) | vgetq_lane_u64(eq64, 1)) == 0) {
+            continue;
+        }
+
+        // Convert to a 16-bit mask (like SSE2's movemask)
+        auto masked = vandq_u8(eq, bits);
+        auto sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(masked)));
+        auto mask = static_cast<uint32_t>(vgetq_lane_u64(sum, 0))
+                | (static_cast<uint32_t>(vgetq_lane_u64(sum, 1)) << 8);
+
+        auto ret = verify_candidates(state, pos, mask, match_out);
+        if (ret != BlockResult::NoMatch) {
+            return ret;
+        }
+    }
+
+    return BlockResult::NoMatch;
+}
+#endif
+
+}
+
+#endif
+
 MB_BEGIN_C_DECLS
 
+/*!
+ * \brief Find the first occurrence of a byte sequence
+ *
+ * This has the same semantics as the GNU `memmem()` function. When SSE2, AVX2,
+ * or NEON is available, a vectorized search is used, falling back to the libc
+ * (or musl) implementation for the tail of the haystack and for degenerate
+ * inputs.
+ *
+ * \param haystack Data to search
+ * \param haystacklen Size of \p haystack
+ * \param needle Byte sequence to search for
+ * \param needlelen Size of \p needle
+ *
+ * \return Pointer to the first match in \p haystack or `NULL` if no match is
+ *         found. If \p needlelen is 0, \p haystack is returned.
+ */
 void * mb_memmem(const void *haystack, size_t haystacklen,
                  const void *needle, size_t needlelen)
 {
+#ifdef MEMMEM_SIMD
+    if (needlelen == 0) {
+        return const_cast<void *>(haystack);
+    } else if (needlelen > haystacklen) {
+        return nullptr;
+    } else if (needlelen == 1) {
+        return const_cast<void *>(memchr(
+                haystack, *static_cast<const unsigned char *>(needle),
+                haystacklen));
+    }
+
+    SearchState state;
+    state.haystack = static_cast<const unsigned char *>(haystack);
+    state.haystacklen = haystacklen;
+    state.needle = static_cast<const unsigned char *>(needle);
+    state.needlelen = needlelen;
+    state.verify_cost = 0;
+
+    size_t pos = 0;
+    size_t match = 0;
+    BlockResult ret = BlockResult::NoMatch;
+
+#  ifdef MEMMEM_AVX2
+    if (have_avx2()) {
+        ret = search_avx2(state, pos, match);
+    }
+#  endif
+#  ifdef MEMMEM_SSE2
+    if (ret == BlockResult::NoMatch) {
+        ret = search_sse2(state, pos, match);
+    }
+#  endif
+#  ifdef MEMMEM_NEON
+    ret = search_neon(state, pos, match);
+#  endif
+
+    if (ret == BlockResult::Match) {
+        return const_cast<unsigned char *>(state.haystack + match);
+    }
+
+    // Search the remainder (or everything from the current block if the
+    // verification budget was exceeded) with the linear-time implementation
+    return memmem(state.haystack + pos, haystacklen - pos, needle, needlelen);
+#else
     return memmem(haystack, haystacklen, needle, needlelen);
+#endif
 }
 
 MB_END_C_DECLS
@@ -172,6 +172,10 @@ MockTestFile::MockTestFile(TestFileCounters *counters) : TestFile(counters)
             .WillByDefault(testing::Invoke(this, &MockTestFile::orig_on_seek));
     ON_CALL(*this, on_truncate(testing::_))
             .WillByDefault(testing::Invoke(this, &MockTestFile::orig_on_truncate));
+    ON_CALL(*this, on_pread(testing::_, testing::_, testing::_))
+            .WillByDefault(testing::Invoke(this, &MockTestFile::orig_on_pread));
+    ON_CALL(*this, on_pwrite(testing::_, testing::_, testing::_))
+            .WillByDefault(testing::Invoke(this, &MockTestFile::orig_on_pwrite));
 }
 
 MockTestFile::~MockTestFile()
@@ -207,3 +211,15 @@ oc::result<void> MockTestFile::orig_on_truncate(uint64_t size)
 {
     return TestFile::on_truncate(size);
 }
+
+oc::result<size_t> MockTestFile::orig_on_pread(void *buf, size_t size,
+                                               uint64_t offset)
+{
+    return TestFile::on_pread(buf, size, offset);
+}
+
+oc::result<size_t> MockTestFile::orig_on_pwrite(const void *buf, size_t size,
+                                                uint64_t offset)
+{
+    return TestFile::on_pwrite(buf, size, offset);
+}
@@ -79,6 +79,11 @@ struct MockTestFile : public TestFile
     MOCK_METHOD2(on_write, mb::oc::result<size_t>(const void *buf, size_t size));
     MOCK_METHOD2(on_seek, mb::oc::result<uint64_t>(int64_t offset, int whence));
     MOCK_METHOD1(on_truncate, mb::oc::result<void>(uint64_t size));
+    MOCK_METHOD3(on_pread, mb::oc::result<size_t>(void *buf, size_t size,
+                                                  uint64_t offset));
+    MOCK_METHOD3(on_pwrite, mb::oc::result<size_t>(const void *buf,
+                                                   size_t size,
+                                                   uint64_t offset));
 
     MockTestFile();
     MockTestFile(TestFileCounters *counters);
@@ -90,4 +95,8 @@ struct MockTestFile : public TestFile
     mb::oc::result<size_t> orig_on_write(const void *buf, size_t size);
     mb::oc::result<uint64_t> orig_on_seek(int64_t offset, int whence);
     mb::oc::result<void> orig_on_truncate(uint64_t size);
+    mb::oc::result<size_t> orig_on_pread(void *buf, size_t size,
+                                         uint64_t offset);
+    mb::oc::result<size_t> orig_on_pwrite(const void *buf, size_t size,
+                                          uint64_t offset);
 };
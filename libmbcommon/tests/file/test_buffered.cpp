@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file_util.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+
+static constexpr size_t TEST_BUF_SIZE = 64;
+
+struct FileBufferedTest : testing::Test
+{
+    testing::NiceMock<MockTestFile> _file;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_file.open());
+    }
+};
+
+TEST_F(FileBufferedTest, SmallReadsAreCoalesced)
+{
+    EXPECT_CALL(_file, on_read(testing::_, TEST_BUF_SIZE))
+            .Times(1);
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    for (size_t i = 0; i < 10; ++i) {
+        char c;
+        auto n = file.read(&c, 1);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), 1u);
+        ASSERT_EQ(c, static_cast<char>(_file._buf[i]));
+    }
+}
+
+TEST_F(FileBufferedTest, LargeReadBypassesBuffer)
+{
+    EXPECT_CALL(_file, on_read(testing::_, TEST_BUF_SIZE * 2))
+            .Times(1);
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[TEST_BUF_SIZE * 2];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_EQ(memcmp(buf, _file._buf.data(), sizeof(buf)), 0);
+}
+
+TEST_F(FileBufferedTest, SeekWithinReadBuffer)
+{
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_TRUE(file.read(&c, 1));
+
+    // No seeks should reach the underlying file
+    EXPECT_CALL(_file, on_seek(testing::_, testing::_))
+            .Times(0);
+
+    auto pos = file.seek(10, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 11u);
+
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(c, static_cast<char>(_file._buf[11]));
+
+    pos = file.seek(2, SEEK_SET);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 2u);
+
+    pos = file.seek(-2, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    // Closing rewinds the underlying file
+    testing::Mock::VerifyAndClearExpectations(&_file);
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(_file._position, 0u);
+}
+
+TEST_F(FileBufferedTest, SeekOutsideReadBuffer)
+{
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_TRUE(file.read(&c, 1));
+
+    // Relative seek must account for the unread bytes
+    EXPECT_CALL(_file, on_seek(100 - static_cast<int64_t>(TEST_BUF_SIZE) + 1,
+                               SEEK_CUR))
+            .Times(1);
+
+    auto pos = file.seek(100, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 101u);
+
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(c, static_cast<char>(_file._buf[101]));
+
+    testing::Mock::VerifyAndClearExpectations(&_file);
+}
+
+TEST_F(FileBufferedTest, SmallWritesAreCoalesced)
+{
+    EXPECT_CALL(_file, on_write(testing::_, testing::_))
+            .Times(1);
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_TRUE(file_write_exact(file, "x", 1));
+    }
+
+    // Position should include pending writes
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 10u);
+
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(memcmp(_file._buf.data(), "xxxxxxxxxx", 10), 0);
+}
+
+TEST_F(FileBufferedTest, LargeWriteBypassesBuffer)
+{
+    // Pending data is flushed before the large write
+    EXPECT_CALL(_file, on_write(testing::_, 1))
+            .Times(1);
+    EXPECT_CALL(_file, on_write(testing::_, TEST_BUF_SIZE))
+            .Times(1);
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[TEST_BUF_SIZE];
+    memset(buf, 'y', sizeof(buf));
+
+    ASSERT_TRUE(file_write_exact(file, "x", 1));
+    ASSERT_TRUE(file_write_exact(file, buf, sizeof(buf)));
+
+    ASSERT_EQ(_file._buf[0], 'x');
+    ASSERT_EQ(_file._buf[TEST_BUF_SIZE], 'y');
+}
+
+TEST_F(FileBufferedTest, WriteAfterRead)
+{
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_TRUE(file.read(&c, 1));
+    ASSERT_TRUE(file_write_exact(file, "X", 1));
+    ASSERT_TRUE(file.read(&c, 1));
+    ASSERT_EQ(c, static_cast<char>(_file._buf[2]));
+    ASSERT_TRUE(file.close());
+
+    ASSERT_EQ(_file._buf[1], 'X');
+    ASSERT_EQ(_file._position, 3u);
+}
+
+TEST_F(FileBufferedTest, TruncateFlushesWrites)
+{
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(0, SEEK_END));
+    ASSERT_TRUE(file_write_exact(file, "xyz", 3));
+    ASSERT_TRUE(file.truncate(INITIAL_BUF_SIZE + 2));
+
+    ASSERT_EQ(_file._buf.size(), INITIAL_BUF_SIZE + 2);
+    ASSERT_EQ(memcmp(_file._buf.data() + INITIAL_BUF_SIZE, "xy", 2), 0);
+}
+
+TEST_F(FileBufferedTest, PreadSeesPendingWrites)
+{
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "xyz", 3));
+
+    char buf[3];
+    ASSERT_TRUE(file_pread_exact(file, buf, sizeof(buf), 0));
+    ASSERT_EQ(memcmp(buf, "xyz", 3), 0);
+}
+
+TEST_F(FileBufferedTest, FlushFailureIsFatal)
+{
+    EXPECT_CALL(_file, on_write(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(std::make_error_code(std::errc::io_error)));
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "x", 1));
+
+    auto ret = file.flush();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+    ASSERT_TRUE(file.is_fatal());
+}
+
+TEST_F(FileBufferedTest, UnseekableFile)
+{
+    ON_CALL(_file, on_seek(testing::_, testing::_))
+            .WillByDefault(testing::Return(FileError::UnsupportedSeek));
+
+    BufferedFile file(&_file, TEST_BUF_SIZE, TEST_BUF_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _file._buf.data(), sizeof(buf)), 0);
+
+    auto pos = file.seek(1, SEEK_CUR);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::UnsupportedSeek);
+}
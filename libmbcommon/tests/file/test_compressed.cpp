@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+// Static memory file that counts the bytes read from it
+class CountingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    uint64_t bytes_read = 0;
+
+protected:
+    oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        auto n = MemoryFile::on_read(buf, size);
+        if (n) {
+            bytes_read += n.value();
+        }
+        return n;
+    }
+};
+
+class UnseekableMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+protected:
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+};
+
+// Compressible, but not trivially so
+static std::vector<unsigned char> generate_data(size_t size, uint32_t seed)
+{
+    static const char *words[] = {
+        "boot", "kernel", "ramdisk", "system", "data", "cache", "init",
+        "selinux", "partition", "mount", "patch", "image", "\n", " ",
+    };
+    constexpr size_t n_words = sizeof(words) / sizeof(words[0]);
+
+    std::vector<unsigned char> data;
+    data.reserve(size);
+
+    uint32_t state = seed;
+
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        const char *word = words[(state >> 16) % n_words];
+        data.insert(data.end(), word, word + strlen(word));
+
+        if ((state >> 8) % 7 == 0) {
+            data.push_back(static_cast<unsigned char>(state >> 24));
+        }
+    }
+
+    data.resize(size);
+    return data;
+}
+
+struct CompressedFileTest : testing::TestWithParam<CompressionFormat>
+{
+    void *_compressed = nullptr;
+    size_t _compressed_size = 0;
+
+    virtual ~CompressedFileTest()
+    {
+        free(_compressed);
+    }
+
+    void compress(const std::vector<unsigned char> &data)
+    {
+        MemoryFile output(&_compressed, &_compressed_size);
+        ASSERT_TRUE(output.is_open());
+        ASSERT_TRUE(output.seek(0, SEEK_END));
+
+        // Level 1 is valid for every format and keeps the tests fast
+        CompressedFile file(&output, GetParam(),
+                            CompressedFileMode::Compress, 1);
+        ASSERT_TRUE(file.is_open());
+
+        // Write in uneven chunks
+        for (size_t pos = 0; pos < data.size();) {
+            size_t n = std::min<size_t>(data.size() - pos, 100000);
+            ASSERT_TRUE(file_write_exact(file, data.data() + pos, n));
+            pos += n;
+        }
+
+        ASSERT_TRUE(file.close());
+        ASSERT_TRUE(output.close());
+    }
+
+    void check_read(File &file, uint64_t offset, size_t size,
+                    const std::vector<unsigned char> &expected)
+    {
+        std::vector<unsigned char> buf(size);
+
+        auto pos = file.seek(static_cast<int64_t>(offset), SEEK_SET);
+        ASSERT_TRUE(pos);
+        ASSERT_EQ(pos.value(), offset);
+
+        auto n = file_read_retry(file, buf.data(), buf.size());
+        ASSERT_TRUE(n);
+
+        size_t expected_n = offset >= expected.size() ? 0
+                : std::min<size_t>(size, expected.size()
+                        - static_cast<size_t>(offset));
+        ASSERT_EQ(n.value(), expected_n);
+        ASSERT_TRUE(std::equal(buf.begin(), buf.begin()
+                                       + static_cast<long>(expected_n),
+                               expected.begin() + static_cast<long>(offset)));
+    }
+};
+
+TEST_P(CompressedFileTest, RoundTrip)
+{
+    auto data = generate_data(3 * 1024 * 1024 + 123, 1);
+    compress(data);
+    ASSERT_LT(_compressed_size, data.size());
+
+    MemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<unsigned char> buf(data.size() + 1);
+    auto n = file_read_retry(file, buf.data(), buf.size());
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), data.size());
+    buf.resize(n.value());
+    ASSERT_EQ(buf, data);
+}
+
+TEST_P(CompressedFileTest, RoundTripEmpty)
+{
+    compress({});
+
+    MemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_P(CompressedFileTest, ReadConcatenatedStreams)
+{
+    auto data1 = generate_data(1000000, 1);
+    auto data2 = generate_data(2000000, 2);
+    compress(data1);
+    compress(data2);
+
+    auto expected = data1;
+    expected.insert(expected.end(), data2.begin(), data2.end());
+
+    MemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    check_read(file, 0, expected.size() + 1, expected);
+}
+
+TEST_P(CompressedFileTest, SeekAndRead)
+{
+    auto data = generate_data(5 * 1024 * 1024, 3);
+    compress(data);
+
+    MemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    auto size = file.seek(0, SEEK_END);
+    ASSERT_TRUE(size);
+    ASSERT_EQ(size.value(), data.size());
+
+    check_read(file, 4500000, 10000, data);
+    check_read(file, 100, 10000, data);
+    check_read(file, 2000000, 1500000, data);
+    check_read(file, 1999990, 20, data);
+    check_read(file, data.size() - 10, 100, data);
+    check_read(file, 0, 10, data);
+
+    // Past end of file
+    check_read(file, data.size() + 100, 10, data);
+    check_read(file, 50, 10, data);
+
+    auto pos = file.seek(-10, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 50u);
+    check_read(file, 50, 20, data);
+}
+
+TEST_P(CompressedFileTest, SeekBackwardsUsesCheckpoints)
+{
+    // Large enough for multiple legacy lz4 blocks
+    auto data1 = generate_data(9 * 1024 * 1024, 4);
+    auto data2 = generate_data(1024 * 1024, 5);
+
+    // Multiple streams so that the single-block xz and lz4 frame outputs have
+    // a checkpoint after the start
+    compress(data1);
+    compress(data2);
+
+    auto expected = data1;
+    expected.insert(expected.end(), data2.begin(), data2.end());
+
+    CountingMemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(0, SEEK_END));
+    uint64_t initial_read = input.bytes_read;
+    ASSERT_EQ(initial_read, _compressed_size);
+
+    check_read(file, expected.size() - 1000, 1000, expected);
+    ASSERT_LT(input.bytes_read - initial_read, _compressed_size / 2);
+}
+
+TEST_P(CompressedFileTest, SeekUnseekableInput)
+{
+    auto data = generate_data(100000, 6);
+    compress(data);
+
+    UnseekableMemoryFile input(_compressed, _compressed_size);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    // Forward seeks work
+    check_read(file, 1000, 1000, data);
+
+    auto pos = file.seek(0, SEEK_SET);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::UnsupportedSeek);
+}
+
+TEST_P(CompressedFileTest, TruncatedDataFails)
+{
+    auto data = generate_data(100000, 7);
+    compress(data);
+
+    MemoryFile input(_compressed, _compressed_size / 2);
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<unsigned char> buf(data.size());
+    auto n = file_read_retry(file, buf.data(), buf.size());
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), CompressedFileError::TruncatedData);
+}
+
+TEST_P(CompressedFileTest, InvalidHeaderFails)
+{
+    constexpr char buf[] = "This is not a compressed file";
+
+    MemoryFile input(buf, sizeof(buf));
+    CompressedFile file(&input, GetParam(), CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), CompressedFileError::InvalidHeader);
+}
+
+TEST_P(CompressedFileTest, UnsupportedOperations)
+{
+    MemoryFile output(&_compressed, &_compressed_size);
+    CompressedFile file(&output, GetParam(), CompressedFileMode::Compress);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.write("abc", 3));
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 3u);
+
+    pos = file.seek(0, SEEK_SET);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::UnsupportedSeek);
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedRead);
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_P(CompressedFileTest, InvalidLevelFails)
+{
+    MemoryFile output(&_compressed, &_compressed_size);
+    CompressedFile file;
+
+    auto ret = file.open(&output, GetParam(), CompressedFileMode::Compress,
+                         100);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), CompressedFileError::UnsupportedOptions);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    CompressionFormats,
+    CompressedFileTest,
+    testing::Values(CompressionFormat::Gzip,
+                    CompressionFormat::Lz4,
+                    CompressionFormat::Lz4Legacy,
+                    CompressionFormat::Xz)
+);
+
+TEST(CompressedFileLz4Test, DecompressEitherFormat)
+{
+    auto data = generate_data(100000, 8);
+
+    for (auto format : { CompressionFormat::Lz4,
+                         CompressionFormat::Lz4Legacy }) {
+        void *compressed = nullptr;
+        size_t compressed_size = 0;
+
+        {
+            MemoryFile output(&compressed, &compressed_size);
+            CompressedFile file(&output, format,
+                                CompressedFileMode::Compress, 9);
+            ASSERT_TRUE(file.is_open());
+            ASSERT_TRUE(file_write_exact(file, data.data(), data.size()));
+            ASSERT_TRUE(file.close());
+        }
+
+        MemoryFile input(compressed, compressed_size);
+        CompressedFile file(&input, CompressionFormat::Lz4,
+                            CompressedFileMode::Decompress);
+        ASSERT_TRUE(file.is_open());
+
+        std::vector<unsigned char> buf(data.size() + 1);
+        auto n = file_read_retry(file, buf.data(), buf.size());
+        free(compressed);
+
+        ASSERT_TRUE(n);
+        buf.resize(n.value());
+        ASSERT_EQ(buf, data);
+    }
+}
+
+TEST(CompressedFileGzipTest, CorruptDataFails)
+{
+    auto data = generate_data(100000, 9);
+    void *compressed = nullptr;
+    size_t compressed_size = 0;
+
+    {
+        MemoryFile output(&compressed, &compressed_size);
+        CompressedFile file(&output, CompressionFormat::Gzip,
+                            CompressedFileMode::Compress);
+        ASSERT_TRUE(file.is_open());
+        ASSERT_TRUE(file_write_exact(file, data.data(), data.size()));
+        ASSERT_TRUE(file.close());
+    }
+
+    // Corrupt the CRC32 in the trailer
+    static_cast<unsigned char *>(compressed)[compressed_size - 8] ^= 0xff;
+
+    MemoryFile input(compressed, compressed_size);
+    CompressedFile file(&input, CompressionFormat::Gzip,
+                        CompressedFileMode::Decompress);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<unsigned char> buf(data.size() + 1);
+    auto n = file_read_retry(file, buf.data(), buf.size());
+    free(compressed);
+
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), CompressedFileError::ChecksumMismatch);
+}
@@ -19,9 +19,14 @@
 
 #include <gmock/gmock.h>
 
+#include <vector>
+
 #include <climits>
 
 #include <fcntl.h>
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/fd.h"
@@ -47,6 +52,22 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+
+    // sys/uio.h
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+#endif
+#ifdef __linux__
+    MOCK_METHOD4(fn_fallocate64, int(int fd, int mode, off64_t offset,
+                                     off64_t len));
+#endif
 
     struct stat _sb_regfile{};
 
@@ -74,6 +95,23 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(testing::_, testing::_, testing::_))
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(testing::_, testing::_, testing::_,
+                                   testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_readv(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
+#ifdef __linux__
+        ON_CALL(*this, fn_fallocate64(testing::_, testing::_, testing::_,
+                                      testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void report_as_regular_file()
@@ -555,3 +593,183 @@ TEST_F(FileFdTest, TruncateFailed)
     ASSERT_FALSE(result);
     ASSERT_EQ(result.error(), std::errc::io_error);
 }
+
+#ifndef _WIN32
+TEST_F(FileFdTest, PreadSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that pread is used and that the file position is untouched
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, 1, 1024))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.pread(&c, 1, 1024);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, PreadFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.pread(&c, 1, 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, PreadInvalidOffset)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.pread(&c, 1, UINT64_MAX);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileFdTest, PwriteSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(testing::_, testing::_, 1, 1024))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.pwrite("x", 1, 1024);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, ReadvSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // All buffers should be passed to a single readv() call
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, 2))
+            .Times(1)
+            .WillOnce(testing::Return(3));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a;
+    char b[2];
+    FileIoVec iov[] = { { &a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+}
+
+TEST_F(FileFdTest, ReadvManyBuffers)
+{
+    _funcs.report_as_regular_file();
+
+    // Buffers are split into batches and reading stops after a short read
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::ReturnArg<2>())
+            .WillOnce(testing::Return(0));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<char> buf(1024);
+    std::vector<FileIoVec> iov;
+    for (auto &c : buf) {
+        iov.push_back({ &c, 1 });
+    }
+
+    auto n = file.readv(iov.data(), iov.size());
+    ASSERT_TRUE(n);
+    ASSERT_GT(n.value(), 0u);
+    ASSERT_LT(n.value(), buf.size());
+}
+
+TEST_F(FileFdTest, WritevFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_writev(testing::_, testing::_, testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    FileIoVec iov[] = { { const_cast<char *>("x"), 1 } };
+
+    auto n = file.writev(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+#endif
+
+#ifdef __linux__
+TEST_F(FileFdTest, InsertAndCollapseRangeSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(0, FALLOC_FL_INSERT_RANGE, 4096, 8192))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_fallocate64(0, FALLOC_FL_COLLAPSE_RANGE, 0, 4096))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.insert_range(4096, 8192));
+    ASSERT_TRUE(file.collapse_range(0, 4096));
+}
+
+TEST_F(FileFdTest, InsertRangeUnsupported)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(testing::_, testing::_, testing::_,
+                                       testing::_))
+            .Times(2)
+            .WillOnce(testing::SetErrnoAndReturn(EOPNOTSUPP, -1))
+            .WillOnce(testing::SetErrnoAndReturn(EINVAL, -1));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto ret = file.insert_range(0, 4096);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedShift);
+    ASSERT_EQ(ret.error(), FileErrorC::Unsupported);
+
+    ret = file.insert_range(1, 4096);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::invalid_argument);
+}
+#endif
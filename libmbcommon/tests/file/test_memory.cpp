@@ -147,6 +147,63 @@ TEST(FileStaticMemoryTest, WriteTooLarge)
     ASSERT_EQ(in[0], 'y');
 }
 
+TEST(FileStaticMemoryTest, PreadPwriteKeepPosition)
+{
+    char in[] = "abcdef";
+    constexpr size_t in_size = 6;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(1, SEEK_SET));
+
+    char out[2];
+    auto n = file.pread(out, sizeof(out), 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(out, "ef", 2), 0);
+
+    n = file.pwrite("xyz", 3, 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(in, "abcdxy", 6), 0);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 1u);
+}
+
+TEST(FileStaticMemoryTest, ReadvWritev)
+{
+    char in[] = "abcdef";
+    constexpr size_t in_size = 6;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    char a[2];
+    char b[8];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+    ASSERT_EQ(memcmp(a, "ab", 2), 0);
+    ASSERT_EQ(memcmp(b, "cdef", 4), 0);
+
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    FileIoVec wiov[] = {
+        { const_cast<char *>("12"), 2 },
+        { const_cast<char *>("34"), 2 },
+    };
+
+    n = file.writev(wiov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(in, "1234ef", 6), 0);
+}
+
 TEST(FileStaticMemoryTest, SeekNormal)
 {
     constexpr char in[] = "abcdefghijklmnopqrstuvwxyz";
@@ -522,3 +579,24 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileDynamicMemoryTest, PwriteEnlargesBuffer)
+{
+    void *in = strdup("x");
+    size_t in_size = 1;
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.pwrite("y", 1, 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+    ASSERT_EQ(in_size, 5u);
+    ASSERT_EQ(memcmp(in, "x\0\0\0y", 5), 0);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    free(in);
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+
+#include <fcntl.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+using namespace mb::detail;
+
+static char g_data[] = "abcdefabcdef";
+static constexpr size_t g_data_size = sizeof(g_data) - 1;
+
+struct MockMmapFileFuncs : public MmapFileFuncs
+{
+    // fcntl.h
+    MOCK_METHOD3(fn_open, int(const char *path, int flags, mode_t mode));
+
+    // sys/mman.h
+    MOCK_METHOD6(fn_mmap, void *(void *addr, size_t length, int prot,
+                                 int flags, int fd, off_t offset));
+    MOCK_METHOD2(fn_munmap, int(void *addr, size_t length));
+    MOCK_METHOD3(fn_madvise, int(void *addr, size_t length, int advice));
+
+    // sys/stat.h
+    MOCK_METHOD2(fn_fstat, int(int fildes, struct stat *buf));
+
+    // unistd.h
+    MOCK_METHOD1(fn_close, int(int fd));
+
+    struct stat _sb_regfile{};
+    struct stat _sb_chrdev{};
+
+    MockMmapFileFuncs()
+    {
+        _sb_regfile.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        _sb_regfile.st_size = g_data_size;
+        _sb_chrdev.st_mode = S_IFCHR | S_IRWXU | S_IRWXG | S_IRWXO;
+
+        // Fail everything by default
+        ON_CALL(*this, fn_open(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, MAP_FAILED));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_madvise(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_close(testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+    }
+
+    void report_as_regular_file()
+    {
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::DoAll(
+                        testing::SetArgPointee<1>(_sb_regfile),
+                        testing::Return(0)));
+    }
+
+    void map_with_success()
+    {
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::Return(g_data));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::Return(0));
+    }
+};
+
+class TestableMmapFile : public MmapFile
+{
+public:
+    TestableMmapFile(MmapFileFuncs *funcs)
+        : MmapFile(funcs)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, int fd, bool owned)
+        : MmapFile(funcs, fd, owned)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, const std::string &filename)
+        : MmapFile(funcs, filename)
+    {
+    }
+
+    ~TestableMmapFile()
+    {
+    }
+};
+
+struct FileMmapTest : testing::Test
+{
+    testing::NiceMock<MockMmapFileFuncs> _funcs;
+};
+
+TEST_F(FileMmapTest, OpenFilenameSuccess)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_open(testing::_, O_RDONLY | O_CLOEXEC, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_mmap(nullptr, g_data_size, PROT_READ, MAP_PRIVATE,
+                                0, 0))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open("x"));
+    ASSERT_EQ(file.data(), g_data);
+    ASSERT_EQ(file.size(), g_data_size);
+
+    File &base = file;
+    ASSERT_EQ(base.mapping().first, g_data);
+    ASSERT_EQ(base.mapping().second, g_data_size);
+}
+
+TEST_F(FileMmapTest, OpenFilenameFailure)
+{
+    EXPECT_CALL(_funcs, fn_open(testing::_, testing::_, testing::_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open("x");
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, OpenNonRegularFile)
+{
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(
+                    testing::SetArgPointee<1>(_funcs._sb_chrdev),
+                    testing::Return(0)));
+
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::no_such_device);
+}
+
+TEST_F(FileMmapTest, OpenMmapFailure)
+{
+    _funcs.report_as_regular_file();
+
+    // Owned fd should be closed on failure
+    EXPECT_CALL(_funcs, fn_close(0))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, true);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFile)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    // Zero-length mappings are not allowed
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.data(), nullptr);
+    ASSERT_EQ(file.size(), 0u);
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, CloseUnownedFile)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(g_data, g_data_size))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileMmapTest, CloseFailure)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(g_data, g_data_size))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(0))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto result = file.close();
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, ReadSeekPread)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+
+    auto pos = file.seek(-2, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), g_data_size - 2);
+
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(buf, "ef", 2), 0);
+
+    n = file.pread(buf, sizeof(buf), 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(buf, "defa", 4), 0);
+
+    n = file.pread(buf, sizeof(buf), 100);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, WriteAndTruncateUnsupported)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+
+    auto result = file.truncate(0);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::UnsupportedTruncate);
+}
+
+TEST_F(FileMmapTest, SearchMapping)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<uint64_t> offsets;
+
+    auto result_cb = [](File &, void *userdata, uint64_t offset)
+            -> oc::result<FileSearchAction> {
+        static_cast<std::vector<uint64_t> *>(userdata)->push_back(offset);
+        return FileSearchAction::Continue;
+    };
+
+    // Mapping should be searched without reading from the file
+    ASSERT_TRUE(file_search(file, -1, -1, 0, "bc", 2, -1, result_cb,
+                            &offsets));
+    ASSERT_EQ(offsets, (std::vector<uint64_t>{1, 7}));
+
+    // Boundaries should be respected
+    offsets.clear();
+    ASSERT_TRUE(file_search(file, 2, 8, 0, "bc", 2, -1, result_cb, &offsets));
+    ASSERT_TRUE(offsets.empty());
+
+    offsets.clear();
+    ASSERT_TRUE(file_search(file, 2, 9, 0, "bc", 2, -1, result_cb, &offsets));
+    ASSERT_EQ(offsets, (std::vector<uint64_t>{7}));
+
+    // Max matches should be respected
+    offsets.clear();
+    ASSERT_TRUE(file_search(file, -1, -1, 0, "bc", 2, 1, result_cb,
+                            &offsets));
+    ASSERT_EQ(offsets, (std::vector<uint64_t>{1}));
+}
@@ -36,6 +36,7 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     // stdio.h
     MOCK_METHOD1(fn_fclose, int(FILE *stream));
     MOCK_METHOD1(fn_ferror, int(FILE *stream));
+    MOCK_METHOD1(fn_fflush, int(FILE *stream));
     MOCK_METHOD1(fn_fileno, int(FILE *stream));
 #ifdef _WIN32
     MOCK_METHOD2(fn_wfopen, FILE *(const wchar_t *filename,
@@ -52,6 +53,16 @@ struct MockPosixFileFuncs : public PosixFileFuncs
 
     // unistd.h
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+#endif
+#ifdef __linux__
+    MOCK_METHOD4(fn_fallocate64, int(int fd, int mode, off64_t offset,
+                                     off64_t len));
+#endif
 
     bool stream_error = false;
 
@@ -89,6 +100,21 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                         testing::SetErrnoAndReturn(EIO, 0)));
         ON_CALL(*this, fn_ftruncate64(testing::_, testing::_))
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fflush(testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, EOF));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(testing::_, testing::_, testing::_,
+                                   testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
+#ifdef __linux__
+        ON_CALL(*this, fn_fallocate64(testing::_, testing::_, testing::_,
+                                      testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void set_ferror_fail()
@@ -682,3 +708,82 @@ TEST_F(FilePosixTest, TruncateFailed)
     ASSERT_FALSE(result);
     ASSERT_EQ(result.error(), std::errc::io_error);
 }
+
+#ifndef _WIN32
+TEST_F(FilePosixTest, PreadSeekableFile)
+{
+    // Stream must be flushed before pread() is called on the fd
+    {
+        testing::InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(g_fp))
+                .Times(1)
+                .WillOnce(testing::Return(0));
+        EXPECT_CALL(_funcs, fn_pread64(0, testing::_, 1, 1024))
+                .Times(1)
+                .WillOnce(testing::ReturnArg<2>());
+    }
+    EXPECT_CALL(_funcs, fn_fseeko(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    ON_CALL(_funcs, fn_fileno(testing::_))
+            .WillByDefault(testing::Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.pread(&c, 1, 1024);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FilePosixTest, PreadUnseekableFile)
+{
+    // Emulation requires seeking, which is unsupported
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.pread(&c, 1, 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedSeek);
+}
+
+TEST_F(FilePosixTest, PwriteFlushFailure)
+{
+    EXPECT_CALL(_funcs, fn_fflush(g_fp))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_pwrite64(testing::_, testing::_, testing::_,
+                                    testing::_))
+            .Times(0);
+
+    ON_CALL(_funcs, fn_fileno(testing::_))
+            .WillByDefault(testing::Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .WillByDefault(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                          testing::Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.pwrite("x", 1, 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/libc/string.h"
+
+// Simple reference implementation
+static const void * naive_memmem(const void *haystack, size_t haystacklen,
+                                 const void *needle, size_t needlelen)
+{
+    auto h = static_cast<const unsigned char *>(haystack);
+
+    if (needlelen > haystacklen) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i <= haystacklen - needlelen; ++i) {
+        if (memcmp(h + i, needle, needlelen) == 0) {
+            return h + i;
+        }
+    }
+
+    return nullptr;
+}
+
+TEST(MemmemTest, CheckDegenerateCases)
+{
+    static const char haystack[] = "abc";
+
+    ASSERT_EQ(mb_memmem(haystack, 3, "", 0), haystack);
+    ASSERT_EQ(mb_memmem(haystack, 3, "abcd", 4), nullptr);
+    ASSERT_EQ(mb_memmem(haystack, 3, "c", 1), haystack + 2);
+    ASSERT_EQ(mb_memmem(haystack, 0, "a", 1), nullptr);
+}
+
+TEST(MemmemTest, CheckMatchPositions)
+{
+    // Place the needle at every offset around the vector block boundaries
+    std::string needle("0123456789abcdef0123");
+
+    for (size_t size = needle.size(); size < 160; ++size) {
+        for (size_t pos = 0; pos + needle.size() <= size; ++pos) {
+            std::string haystack(size, 'x');
+            haystack.replace(pos, needle.size(), needle);
+
+            ASSERT_EQ(mb_memmem(haystack.data(), haystack.size(),
+                                needle.data(), needle.size()),
+                      haystack.data() + pos)
+                    << "size=" << size << ", pos=" << pos;
+        }
+    }
+}
+
+TEST(MemmemTest, CheckFirstAndLastByteCandidates)
+{
+    // Many candidates where only the first and last bytes match
+    std::string haystack;
+    for (int i = 0; i < 2000; ++i) {
+        haystack += "aXXa";
+    }
+    haystack += "aXYa";
+
+    auto result = mb_memmem(haystack.data(), haystack.size(), "aXYa", 4);
+    ASSERT_EQ(result, haystack.data() + haystack.size() - 4);
+}
+
+TEST(MemmemTest, CheckPathologicalInput)
+{
+    // Exceeds the verification budget and falls back to two-way search
+    std::string haystack(100000, 'a');
+    std::string needle(1000, 'a');
+    needle.back() = 'b';
+
+    ASSERT_EQ(mb_memmem(haystack.data(), haystack.size(),
+                        needle.data(), needle.size()), nullptr);
+
+    haystack.replace(haystack.size() - 1, 1, "b");
+    ASSERT_EQ(mb_memmem(haystack.data(), haystack.size(),
+                        needle.data(), needle.size()),
+              haystack.data() + haystack.size() - needle.size());
+}
+
+TEST(MemmemTest, CheckAgainstReference)
+{
+    std::vector<unsigned char> haystack(10000);
+    unsigned int seed = 1;
+
+    for (auto &c : haystack) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<unsigned char>("abc"[(seed >> 16) % 3]);
+    }
+
+    for (size_t needle_size = 2; needle_size < 12; ++needle_size) {
+        for (size_t offset = 0; offset < 5000; offset += 997) {
+            auto needle = haystack.data() + offset;
+
+            auto expected = naive_memmem(haystack.data() + 1,
+                                         haystack.size() - 1,
+                                         needle, needle_size);
+            auto actual = mb_memmem(haystack.data() + 1, haystack.size() - 1,
+                                    needle, needle_size);
+            ASSERT_EQ(actual, expected);
+        }
+    }
+}
@@ -20,6 +20,7 @@
 #include <gmock/gmock.h>
 
 #include <cinttypes>
+#include <cstring>
 
 #include "mbcommon/file.h"
 #include "mbcommon/string.h"
@@ -480,3 +481,139 @@ TEST(FileTest, TruncateReturnFailure)
     ASSERT_FALSE(file.is_fatal());
     ASSERT_EQ(file.state(), FileState::Opened);
 }
+
+TEST(FileTest, PreadEmulated)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Save position, seek to offset, read, restore position
+    EXPECT_CALL(file, on_seek(testing::_, testing::_))
+            .Times(3);
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(1);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+    ASSERT_TRUE(file.write("foobar", 6));
+
+    char buf[3];
+    auto n = file.pread(buf, sizeof(buf), 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_EQ(memcmp(buf, "bar", 3), 0);
+    ASSERT_EQ(file._position, 6u);
+}
+
+TEST(FileTest, PreadInWrongState)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(0);
+
+    char c;
+    auto n = file.pread(&c, 1, 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::InvalidState);
+}
+
+TEST(FileTest, PreadRestoreFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_seek(testing::_, testing::_))
+            .Times(3)
+            .WillOnce(testing::Return(0))
+            .WillOnce(testing::Return(0))
+            .WillOnce(testing::Return(std::make_error_code(std::errc::io_error)));
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char c;
+    auto n = file.pread(&c, 1, 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+    ASSERT_EQ(file.state(), FileState::Fatal);
+}
+
+TEST(FileTest, PwriteEmulated)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(1);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    auto n = file.pwrite("foobar", 6, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+    ASSERT_EQ(memcmp(file._buf.data() + 2, "foobar", 6), 0);
+    ASSERT_EQ(file._position, 0u);
+}
+
+TEST(FileTest, ReadvEmulated)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char a[2];
+    char b[3];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_EQ(memcmp(a, file._buf.data(), 2), 0);
+    ASSERT_EQ(memcmp(b, file._buf.data() + 2, 3), 0);
+}
+
+TEST(FileTest, ReadvPartialFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // The error from the second read is deferred because some data was read
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::ReturnArg<1>())
+            .WillOnce(testing::Return(std::make_error_code(std::errc::io_error)));
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char a[2];
+    char b[3];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+}
+
+TEST(FileTest, WritevEmulated)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    FileIoVec iov[] = {
+        { const_cast<char *>("foo"), 3 },
+        { const_cast<char *>("bar"), 3 },
+    };
+
+    auto n = file.writev(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+    ASSERT_EQ(memcmp(file._buf.data(), "foobar", 6), 0);
+}
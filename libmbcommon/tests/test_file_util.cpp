@@ -19,10 +19,13 @@
 
 #include <gmock/gmock.h>
 
+#include <algorithm>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include <cinttypes>
+#include <cstring>
 
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_util.h"
@@ -268,6 +271,72 @@ TEST_F(FileUtilTest, WriteExactPartialFail)
     ASSERT_EQ(ret.error(), std::error_code{});
 }
 
+TEST_F(FileUtilTest, PreadRetryInterrupted)
+{
+    auto eintr = std::make_error_code(std::errc::interrupted);
+
+    EXPECT_CALL(_file, on_pread(testing::_, testing::_, testing::_))
+            .Times(3)
+            .WillOnce(testing::Return(eintr))
+            .WillOnce(testing::Return(4))
+            .WillOnce(testing::Return(6));
+
+    // Open file
+    ASSERT_TRUE(_file.open());
+
+    char buf[10];
+    auto n = file_pread_retry(_file, buf, sizeof(buf), 0);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+}
+
+TEST_F(FileUtilTest, PreadExactNormal)
+{
+    EXPECT_CALL(_file, on_pread(testing::_, testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(_file.open());
+    ASSERT_TRUE(_file.write("foobar", 6));
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+
+    char buf[4];
+    ASSERT_TRUE(file_pread_exact(_file, buf, sizeof(buf), 2));
+    ASSERT_EQ(memcmp(buf, "obar", 4), 0);
+
+    // File position should not have changed
+    ASSERT_EQ(_file._position, 0u);
+    ASSERT_TRUE(file_pread_exact(_file, buf, sizeof(buf), 2));
+}
+
+TEST_F(FileUtilTest, PreadExactEOF)
+{
+    EXPECT_CALL(_file, on_pread(testing::_, testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::Return(2))
+            .WillOnce(testing::Return(0));
+
+    // Open file
+    ASSERT_TRUE(_file.open());
+
+    char buf[10];
+    auto n = file_pread_exact(_file, buf, sizeof(buf), 0);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnexpectedEof);
+}
+
+TEST_F(FileUtilTest, PwriteExactNormal)
+{
+    EXPECT_CALL(_file, on_pwrite(testing::_, testing::_, testing::_))
+            .Times(5)
+            .WillRepeatedly(testing::Return(2));
+
+    // Open file
+    ASSERT_TRUE(_file.open());
+
+    ASSERT_TRUE(file_pwrite_exact(_file, "xxxxxxxxxx", 10u, 0));
+}
+
 TEST_F(FileUtilTest, ReadDiscardNormal)
 {
     EXPECT_CALL(_file, on_read(testing::_, testing::_))
@@ -386,6 +455,261 @@ TEST_F(FileSearchTest, FindNormal)
     ASSERT_TRUE(file_search(file, -1, -1, 0, "a", 1, -1, &_result_cb, this));
 }
 
+struct FileSearchMultiTest : testing::Test
+{
+    std::vector<std::pair<size_t, uint64_t>> _matches;
+
+    static oc::result<FileSearchAction> _result_cb(File &file, void *userdata,
+                                                   size_t index,
+                                                   uint64_t offset)
+    {
+        (void) file;
+
+        auto test = static_cast<FileSearchMultiTest *>(userdata);
+        test->_matches.emplace_back(index, offset);
+
+        return FileSearchAction::Continue;
+    }
+
+    // Reference implementation using file_search() for each pattern
+    std::vector<std::pair<size_t, uint64_t>>
+    search_individually(File &file, int64_t start, int64_t end,
+                        const std::vector<FileSearchPattern> &patterns)
+    {
+        struct Ctx
+        {
+            size_t index;
+            std::vector<std::pair<size_t, uint64_t>> matches;
+        } ctx;
+
+        auto cb = [](File &file_, void *userdata, uint64_t offset)
+                -> oc::result<FileSearchAction> {
+            (void) file_;
+            auto c = static_cast<Ctx *>(userdata);
+            c->matches.emplace_back(c->index, offset);
+            return FileSearchAction::Continue;
+        };
+
+        for (ctx.index = 0; ctx.index < patterns.size(); ++ctx.index) {
+            EXPECT_TRUE(file_search(file, start, end, 0,
+                                    patterns[ctx.index].data,
+                                    patterns[ctx.index].size, -1, cb, &ctx));
+        }
+
+        std::sort(ctx.matches.begin(), ctx.matches.end(),
+                  [](const std::pair<size_t, uint64_t> &a,
+                     const std::pair<size_t, uint64_t> &b) {
+            return a.second < b.second
+                    || (a.second == b.second && a.first < b.first);
+        });
+
+        return ctx.matches;
+    }
+};
+
+TEST_F(FileSearchMultiTest, CheckInvalidBoundariesFail)
+{
+    MemoryFile file("", 0);
+    ASSERT_TRUE(file.is_open());
+
+    auto result = file_search_multi(file, 20, 10, 0, {{"x", 1}}, -1,
+                                    &_result_cb, this);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileSearchMultiTest, CheckTrivialCases)
+{
+    MemoryFile file("xyz", 3);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_search_multi(file, -1, -1, 0, {{"x", 1}}, 0,
+                                  &_result_cb, this));
+    ASSERT_TRUE(file_search_multi(file, -1, -1, 0, {}, -1,
+                                  &_result_cb, this));
+    ASSERT_TRUE(file_search_multi(file, -1, -1, 0, {{nullptr, 0}}, -1,
+                                  &_result_cb, this));
+    ASSERT_TRUE(_matches.empty());
+}
+
+TEST_F(FileSearchMultiTest, FindAllPatterns)
+{
+    static const char data[] = "she sells sea shells; he said hershey";
+
+    MemoryFile file(data, sizeof(data) - 1);
+    ASSERT_TRUE(file.is_open());
+
+    // Use a tiny buffer so that matches span multiple reads
+    ASSERT_TRUE(file_search_multi(file, -1, -1, 3,
+                                  {{"he", 2}, {"she", 3}, {"hers", 4},
+                                   {"sea", 3}}, -1, &_result_cb, this));
+
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        {1, 0}, {0, 1}, {3, 10}, {1, 14}, {0, 15}, {0, 22}, {0, 30},
+        {2, 30}, {1, 33}, {0, 34},
+    };
+    ASSERT_EQ(_matches, expected);
+}
+
+TEST_F(FileSearchMultiTest, MatchesIndividualSearches)
+{
+    std::vector<unsigned char> data;
+    for (size_t i = 0; i < 100000; ++i) {
+        data.push_back(static_cast<unsigned char>("abcab"[(i * i + i / 7) % 5]));
+    }
+
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<FileSearchPattern> patterns{
+        {"abab", 4}, {"ba", 2}, {"cabca", 5}, {"bcab", 4}, {"abab", 4},
+    };
+
+    auto expected = search_individually(file, 100, 90000, patterns);
+    ASSERT_FALSE(expected.empty());
+
+    ASSERT_TRUE(file_search_multi(file, 100, 90000, 1000, patterns, -1,
+                                  &_result_cb, this));
+
+    std::sort(_matches.begin(), _matches.end(),
+              [](const std::pair<size_t, uint64_t> &a,
+                 const std::pair<size_t, uint64_t> &b) {
+        return a.second < b.second
+                || (a.second == b.second && a.first < b.first);
+    });
+    ASSERT_EQ(_matches, expected);
+}
+
+TEST_F(FileSearchMultiTest, CheckBoundariesAndMaxMatches)
+{
+    static const char data[] = "xyzxyzxyz";
+
+    MemoryFile file(data, sizeof(data) - 1);
+    ASSERT_TRUE(file.is_open());
+
+    // Match must end before the end boundary
+    ASSERT_TRUE(file_search_multi(file, 1, 8, 0, {{"xyz", 3}, {"z", 1}}, -1,
+                                  &_result_cb, this));
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        {1, 2}, {0, 3}, {1, 5},
+    };
+    ASSERT_EQ(_matches, expected);
+
+    _matches.clear();
+    ASSERT_TRUE(file_search_multi(file, -1, -1, 0, {{"xyz", 3}, {"z", 1}}, 3,
+                                  &_result_cb, this));
+    expected = {{0, 0}, {1, 2}, {0, 3}};
+    ASSERT_EQ(_matches, expected);
+}
+
+struct FileSearchParallelTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+    std::vector<uint64_t> _offsets;
+    size_t _stop_after = 0;
+
+    static oc::result<FileSearchAction> _result_cb(File &file, void *userdata,
+                                                   uint64_t offset)
+    {
+        (void) file;
+
+        auto test = static_cast<FileSearchParallelTest *>(userdata);
+        test->_offsets.push_back(offset);
+
+        if (test->_stop_after != 0
+                && test->_offsets.size() == test->_stop_after) {
+            return FileSearchAction::Stop;
+        }
+
+        return FileSearchAction::Continue;
+    }
+
+    void SetUp() override
+    {
+        // Runs of 'a' of varying length so that overlapping candidates cross
+        // chunk boundaries at many different phases
+        for (size_t i = 0; i < 5000; ++i) {
+            _data.insert(_data.end(), i % 13, 'a');
+            _data.push_back('b');
+        }
+    }
+
+    std::vector<uint64_t> search(int64_t start, int64_t end, size_t bsize,
+                                 const char *pattern, int64_t max_matches,
+                                 unsigned int threads)
+    {
+        MemoryFile file(_data.data(), _data.size());
+        EXPECT_TRUE(file.is_open());
+
+        _offsets.clear();
+
+        if (threads == 0) {
+            EXPECT_TRUE(file_search(file, start, end, bsize, pattern,
+                                    strlen(pattern), max_matches,
+                                    &_result_cb, this));
+        } else {
+            EXPECT_TRUE(file_search_parallel(file, start, end, bsize, pattern,
+                                             strlen(pattern), max_matches,
+                                             threads, &_result_cb, this));
+        }
+
+        return _offsets;
+    }
+};
+
+TEST_F(FileSearchParallelTest, CheckInvalidArguments)
+{
+    MemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    auto result = file_search_parallel(file, 20, 10, 0, "a", 1, -1, 2,
+                                       &_result_cb, this);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+
+    result = file_search_parallel(file, -1, -1, 2, "aaa", 3, -1, 2,
+                                  &_result_cb, this);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileSearchParallelTest, MatchesSequentialSearch)
+{
+    for (auto pattern : { "aa", "aaaa", "ab", "baaab", "aaaaaaaaaaaa" }) {
+        auto expected = search(-1, -1, 0, pattern, -1, 0);
+        ASSERT_FALSE(expected.empty());
+
+        for (size_t bsize : { 13u, 64u, 1000u, 4096u }) {
+            for (unsigned int threads : { 1u, 3u, 8u }) {
+                ASSERT_EQ(search(-1, -1, bsize, pattern, -1, threads), expected)
+                        << "pattern=" << pattern << ", bsize=" << bsize
+                        << ", threads=" << threads;
+            }
+        }
+    }
+}
+
+TEST_F(FileSearchParallelTest, CheckBoundaries)
+{
+    auto expected = search(1234, 25000, 0, "aaa", -1, 0);
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(search(1234, 25000, 100, "aaa", -1, 4), expected);
+
+    ASSERT_TRUE(search(static_cast<int64_t>(_data.size()), -1, 100, "a", -1,
+                       4).empty());
+}
+
+TEST_F(FileSearchParallelTest, CheckMaxMatchesAndStop)
+{
+    auto expected = search(-1, -1, 0, "aaa", 500, 0);
+    ASSERT_EQ(expected.size(), 500u);
+    ASSERT_EQ(search(-1, -1, 64, "aaa", 500, 4), expected);
+
+    _stop_after = 321;
+    expected.resize(321);
+    ASSERT_EQ(search(-1, -1, 64, "aaa", -1, 4), expected);
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     constexpr char buf[] = "abcdef";
@@ -490,4 +814,151 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     }
 }
 
+// In-memory file that supports block-aligned range shifting
+class ShiftableFile : public File
+{
+public:
+    static constexpr uint64_t BLOCK_SIZE = 4096;
+
+    std::vector<unsigned char> data;
+    unsigned int shifts = 0;
+
+    ShiftableFile()
+    {
+        (void) open();
+    }
+
+    virtual ~ShiftableFile()
+    {
+        (void) close();
+    }
+
+protected:
+    oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        if (m_pos >= data.size()) {
+            return 0;
+        }
+        size_t n = std::min<size_t>(size, data.size() - m_pos);
+        memcpy(buf, data.data() + m_pos, n);
+        m_pos += n;
+        return n;
+    }
+
+    oc::result<size_t> on_write(const void *buf, size_t size) override
+    {
+        if (m_pos + size > data.size()) {
+            data.resize(m_pos + size);
+        }
+        memcpy(data.data() + m_pos, buf, size);
+        m_pos += size;
+        return size;
+    }
+
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override
+    {
+        switch (whence) {
+        case SEEK_SET:
+            m_pos = static_cast<size_t>(offset);
+            break;
+        case SEEK_END:
+            m_pos = static_cast<size_t>(static_cast<int64_t>(data.size())
+                    + offset);
+            break;
+        default:
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos;
+    }
+
+    oc::result<void> on_insert_range(uint64_t offset, uint64_t size) override
+    {
+        if (offset % BLOCK_SIZE != 0 || size % BLOCK_SIZE != 0
+                || offset >= data.size()) {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+        data.insert(data.begin() + static_cast<long>(offset),
+                    static_cast<size_t>(size), 0);
+        ++shifts;
+        return oc::success();
+    }
+
+    oc::result<void> on_collapse_range(uint64_t offset, uint64_t size) override
+    {
+        if (offset % BLOCK_SIZE != 0 || size % BLOCK_SIZE != 0
+                || offset + size >= data.size()) {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+        auto begin = data.begin() + static_cast<long>(offset);
+        data.erase(begin, begin + static_cast<long>(size));
+        ++shifts;
+        return oc::success();
+    }
+
+private:
+    size_t m_pos = 0;
+};
+
+struct FileMoveShiftTest : testing::Test
+{
+    ShiftableFile _file;
+    std::vector<unsigned char> _expected;
+
+    void SetUp() override
+    {
+        for (size_t i = 0; i < 10 * ShiftableFile::BLOCK_SIZE; ++i) {
+            _file.data.push_back(static_cast<unsigned char>(i * 13 + i / 256));
+        }
+        _expected = _file.data;
+    }
+
+    void check_move(uint64_t src, uint64_t dest, uint64_t size,
+                    unsigned int shifts)
+    {
+        auto n = file_move(_file, src, dest, size);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), size);
+
+        if (dest + size > _expected.size()) {
+            _expected.resize(static_cast<size_t>(dest + size));
+        }
+        memmove(_expected.data() + dest, _expected.data() + src,
+                static_cast<size_t>(size));
+
+        ASSERT_EQ(_file.data, _expected);
+        ASSERT_EQ(_file.shifts, shifts);
+    }
+};
+
+TEST_F(FileMoveShiftTest, AlignedForwardsMoveShouldInsertRange)
+{
+    auto block = ShiftableFile::BLOCK_SIZE;
+    check_move(2 * block, 3 * block, _file.data.size() - 2 * block, 1);
+}
+
+TEST_F(FileMoveShiftTest, AlignedBackwardsMoveShouldCollapseRange)
+{
+    auto block = ShiftableFile::BLOCK_SIZE;
+    check_move(3 * block, block, _file.data.size() - 3 * block, 1);
+}
+
+TEST_F(FileMoveShiftTest, UnalignedMoveShouldFallBackToCopy)
+{
+    check_move(100, 1000, _file.data.size() - 100, 0);
+    check_move(1000, 100, _file.data.size() - 1000, 0);
+}
+
+TEST_F(FileMoveShiftTest, MoveNotAtEofShouldFallBackToCopy)
+{
+    auto block = ShiftableFile::BLOCK_SIZE;
+    check_move(block, 2 * block, 4 * block, 0);
+    check_move(2 * block, block, 4 * block, 0);
+}
+
+TEST_F(FileMoveShiftTest, NonOverlappingMoveShouldFallBackToCopy)
+{
+    auto block = ShiftableFile::BLOCK_SIZE;
+    check_move(8 * block, 2 * block, 2 * block, 0);
+}
+
 // TODO: Add more tests after integrating gmock
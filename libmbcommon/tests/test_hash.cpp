@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbcommon/hash.h"
+#include "mbcommon/string.h"
+
+using namespace mb;
+
+static std::string to_hex(const std::vector<unsigned char> &digest)
+{
+    std::string result;
+    for (auto c : digest) {
+        result += format("%02x", c);
+    }
+    return result;
+}
+
+struct HashTest : testing::TestWithParam<HashFlags>
+{
+};
+
+TEST_P(HashTest, CheckKnownDigests)
+{
+    static const char data[] = "abc";
+
+    struct {
+        HashAlgorithm algorithm;
+        const char *expected;
+    } cases[] = {
+        {
+            HashAlgorithm::Sha1,
+            "a9993e364706816aba3e25717850c26c9cd0d89d"
+        }, {
+            HashAlgorithm::Sha256,
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+        }, {
+            HashAlgorithm::Sha512,
+            "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+            "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"
+        },
+    };
+
+    for (auto const &c : cases) {
+        Hasher hasher;
+        ASSERT_TRUE(hasher.init(c.algorithm, GetParam()));
+        ASSERT_TRUE(hasher.is_active());
+        ASSERT_TRUE(hasher.update(data, 1));
+        ASSERT_TRUE(hasher.update(data + 1, 2));
+
+        auto digest = hasher.finish();
+        ASSERT_TRUE(digest);
+        ASSERT_EQ(digest.value().size(), hash_digest_size(c.algorithm));
+        ASSERT_EQ(to_hex(digest.value()), c.expected);
+        ASSERT_FALSE(hasher.is_active());
+    }
+}
+
+TEST_P(HashTest, CheckLargeInputMatchesOneShot)
+{
+    // Larger than several background chunks and not a multiple of the size
+    std::vector<unsigned char> data(3 * 1024 * 1024 + 12345);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+    }
+
+    auto expected = compute_hash(HashAlgorithm::Sha512, data.data(),
+                                 data.size());
+    ASSERT_TRUE(expected);
+
+    Hasher hasher;
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha512, GetParam()));
+
+    for (size_t offset = 0; offset < data.size();) {
+        size_t n = std::min<size_t>(data.size() - offset,
+                                    offset % 3 == 0 ? 10240 : 7);
+        ASSERT_TRUE(hasher.update(data.data() + offset, n));
+        offset += n;
+    }
+
+    auto digest = hasher.finish();
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(digest.value(), expected.value());
+}
+
+TEST_P(HashTest, CheckInvalidStates)
+{
+    Hasher hasher;
+
+    auto ret = hasher.update("a", 1);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), HashError::InvalidState);
+
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha1, GetParam()));
+    ASSERT_TRUE(hasher.finish());
+
+    auto digest = hasher.finish();
+    ASSERT_FALSE(digest);
+    ASSERT_EQ(digest.error(), HashError::InvalidState);
+
+    // Reinitializing discards the existing state
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha1, GetParam()));
+    ASSERT_TRUE(hasher.update("xyz", 3));
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha1, GetParam()));
+    ASSERT_TRUE(hasher.update("abc", 3));
+    digest = hasher.finish();
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(to_hex(digest.value()),
+              "a9993e364706816aba3e25717850c26c9cd0d89d");
+
+    // Reset while data is queued
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha256, GetParam()));
+    ASSERT_TRUE(hasher.update("abc", 3));
+    hasher.reset();
+    ASSERT_FALSE(hasher.is_active());
+}
+
+TEST_P(HashTest, CheckMovedHasher)
+{
+    Hasher hasher;
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha1, GetParam()));
+    ASSERT_TRUE(hasher.update("a", 1));
+
+    Hasher other(std::move(hasher));
+    ASSERT_TRUE(other.update("bc", 2));
+
+    auto digest = other.finish();
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(to_hex(digest.value()),
+              "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
+
+INSTANTIATE_TEST_CASE_P(HashModes, HashTest,
+                        testing::Values(HashFlags(),
+                                        HashFlags(HashFlag::Background)));
@@ -47,6 +47,7 @@ public:
     std::vector<std::string> existing_files() const override;
 
     bool patch_files(const std::string &directory) override;
+    bool patch_files(FileMap &files) override;
 };
 
 }
@@ -51,6 +51,7 @@ public:
     std::vector<std::string> existing_files() const override;
 
     bool patch_files(const std::string &directory) override;
+    bool patch_files(FileMap &files) override;
 
     bool patch_updater(const std::string &directory);
     bool patch_transfer_list(const std::string &directory);
@@ -35,6 +35,7 @@ namespace patcher
 
 class Patcher;
 class AutoPatcher;
+class DeflateCache;
 
 class MB_EXPORT PatcherConfig
 {
@@ -60,6 +61,8 @@ public:
     void destroy_patcher(Patcher *patcher);
     void destroy_auto_patcher(AutoPatcher *patcher);
 
+    DeflateCache & deflate_cache();
+
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatcherConfig)
     MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatcherConfig)
 
@@ -74,6 +77,9 @@ private:
     // Created patchers
     std::vector<std::unique_ptr<Patcher>> m_patchers;
     std::vector<std::unique_ptr<AutoPatcher>> m_auto_patchers;
+
+    // Payloads compressed by patchers created from this config
+    std::unique_ptr<DeflateCache> m_deflate_cache;
 };
 
 }
@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include "mbcommon/common.h"
 
 #include "mbpatcher/errors.h"
@@ -105,6 +109,11 @@ public:
 class AutoPatcher
 {
 public:
+    /*!
+     * \brief Contents of files keyed by their path within the zip file
+     */
+    typedef std::map<std::string, std::vector<unsigned char>> FileMap;
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -140,6 +149,14 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patch_files(const std::string &directory) = 0;
+
+    /*!
+     * \brief Patch files in memory
+     *
+     * \param files Contents of the files from existing_files() that exist in
+     *              the zip file. The contents are patched in place.
+     */
+    virtual bool patch_files(FileMap &files) = 0;
 };
 
 }
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <unordered_set>
 
 #include "mbpatcher/patcherconfig.h"
@@ -32,6 +34,7 @@ namespace patcher
 
 struct UnzCtx;
 struct ZipCtx;
+class ZipSplicer;
 
 class ZipPatcher : public Patcher
 {
@@ -71,7 +74,7 @@ private:
     uint64_t m_files;
     uint64_t m_max_files;
 
-    volatile bool m_cancelled;
+    std::atomic_bool m_cancelled;
 
     ErrorCode m_error;
 
@@ -84,24 +87,29 @@ private:
     // Patching
     UnzCtx *m_z_input = nullptr;
     ZipCtx *m_z_output = nullptr;
+    std::unique_ptr<ZipSplicer> m_splicer;
     std::vector<AutoPatcher *> m_auto_patchers;
 
     bool patch_zip();
 
-    bool pass1(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &files);
+    bool read_files(const std::unordered_set<std::string> &files,
+                    AutoPatcher::FileMap &contents);
+    bool pass1(const std::unordered_set<std::string> &exclude);
+    bool splice_entries(const std::unordered_set<std::string> &exclude);
     bool open_input_archive();
     void close_input_archive();
     bool open_output_archive();
     void close_output_archive();
+    bool open_output_splicer();
+    void close_output_splicer();
 
     void update_progress(uint64_t bytes, uint64_t max_bytes);
     void update_files(uint64_t files, uint64_t max_files);
     void update_details(const std::string &msg);
 
     static void la_progress_cb(uint64_t bytes, void *userdata);
+    static bool splice_progress_cb(uint64_t entries, uint64_t bytes,
+                                   void *userdata);
 };
 
 }
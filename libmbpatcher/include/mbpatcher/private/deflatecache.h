@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/private/miniziputils.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+class DeflateCache
+{
+public:
+    DeflateCache();
+    ~DeflateCache();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DeflateCache)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DeflateCache)
+
+    ErrorCode deflate_file(const std::string &path,
+                           MinizipUtils::DeflatedData *output,
+                           int level = Z_DEFAULT_COMPRESSION);
+
+    void clear();
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    // (SHA-256 digest of the uncompressed data, compression level)
+    typedef std::pair<std::vector<unsigned char>, int> Key;
+
+    mutable std::mutex m_mutex;
+    std::map<Key, std::shared_ptr<const MinizipUtils::DeflatedData>> m_entries;
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
+
+}
+}
@@ -44,6 +44,13 @@ public:
         uint64_t total_size;
     };
 
+    struct DeflatedData {
+        std::vector<unsigned char> data;
+        uint64_t uncompressed_size;
+        uint32_t crc;
+        uint32_t dos_date;
+    };
+
     static std::string unz_error_string(int ret);
 
     static std::string zip_error_string(int ret);
@@ -89,6 +96,20 @@ public:
     static ErrorCode add_file(zipFile zf,
                               const std::string &name,
                               const std::string &path);
+
+    static bool get_file_time(const std::string &filename,
+                              uint32_t *dostime);
+
+    static ErrorCode deflate_memory(const std::vector<unsigned char> &contents,
+                                    DeflatedData *output,
+                                    int level = Z_DEFAULT_COMPRESSION);
+
+    static ErrorCode deflate_file(const std::string &path,
+                                  DeflatedData *output);
+
+    static ErrorCode add_deflated_file(zipFile zf,
+                                       const std::string &name,
+                                       const DeflatedData &deflated);
 };
 
 }
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file/fd.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/private/miniziputils.h"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+class ZipSplicer
+{
+public:
+    typedef bool (*ProgressCallback)(uint64_t entries, uint64_t bytes,
+                                     void *userdata);
+
+    ZipSplicer();
+    ~ZipSplicer();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ZipSplicer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ZipSplicer)
+
+    ErrorCode open(const std::string &input_path,
+                   const std::string &output_path);
+    ErrorCode close();
+
+    uint64_t entries() const;
+    uint64_t total_size() const;
+
+    ErrorCode copy_entries(
+            const std::unordered_set<std::string> &exclude,
+            const std::unordered_map<std::string, std::string> &renames,
+            ProgressCallback cb, void *userdata);
+
+    ErrorCode add_deflated_file(const std::string &name,
+                                const MinizipUtils::DeflatedData &deflated);
+
+private:
+    struct Entry
+    {
+        std::string name;
+        uint16_t version_made_by;
+        uint16_t version_needed;
+        uint16_t flags;
+        uint16_t method;
+        uint16_t dos_time;
+        uint16_t dos_date;
+        uint32_t crc;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        // Extra fields, excluding the zip64 extended information
+        std::vector<unsigned char> extra;
+        std::vector<unsigned char> comment;
+        uint16_t internal_attrs;
+        uint32_t external_attrs;
+        uint64_t local_offset;
+        // End of the local record (data and data descriptor) in the input
+        uint64_t record_end;
+    };
+
+    ErrorCode read_central_directory();
+    ErrorCode copy_run(const std::vector<Entry> &entries, size_t begin,
+                       size_t end, ProgressCallback cb, void *userdata);
+    ErrorCode copy_renamed(const Entry &entry, const std::string &name);
+    ErrorCode copy_data(uint64_t offset, uint64_t size);
+    ErrorCode write(const void *data, size_t size);
+
+    FdFile m_input;
+    FdFile m_output;
+#ifndef _WIN32
+    int m_input_fd;
+    int m_output_fd;
+#endif
+    bool m_kernel_copy;
+
+    bool m_open;
+
+    std::vector<Entry> m_input_entries;
+    uint64_t m_input_cd_offset;
+
+    std::vector<Entry> m_output_entries;
+    uint64_t m_output_offset;
+
+    uint64_t m_copied_entries;
+    uint64_t m_copied_bytes;
+};
+
+}
+}
@@ -74,16 +74,9 @@ static bool space_or_end(const char *ptr)
     return !*ptr || isspace(*ptr);
 }
 
-static bool patch_file(const std::string &path)
+static void patch_contents(std::string *contents)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
-    std::vector<std::string> lines = StringUtils::split(contents, '\n');
+    std::vector<std::string> lines = StringUtils::split(*contents, '\n');
 
     for (std::string &line : lines) {
         const char *ptr = line.data();
@@ -97,7 +90,20 @@ static bool patch_file(const std::string &path)
         }
     }
 
-    contents = StringUtils::join(lines, "\n");
+    *contents = StringUtils::join(lines, "\n");
+}
+
+static bool patch_file(const std::string &path)
+{
+    std::string contents;
+
+    ErrorCode ret = FileUtils::read_to_string(path, &contents);
+    if (ret != ErrorCode::NoError) {
+        return false;
+    }
+
+    patch_contents(&contents);
+
     FileUtils::write_from_string(path, contents);
 
     return true;
@@ -112,5 +118,23 @@ bool MountCmdPatcher::patch_files(const std::string &directory)
     return true;
 }
 
+bool MountCmdPatcher::patch_files(FileMap &files)
+{
+    for (auto const &name : { FlashScript, InstallerScript }) {
+        auto it = files.find(name);
+        if (it == files.end()) {
+            continue;
+        }
+
+        std::string contents(it->second.begin(), it->second.end());
+
+        patch_contents(&contents);
+
+        it->second.assign(contents.begin(), contents.end());
+    }
+
+    return true;
+}
+
 }
 }
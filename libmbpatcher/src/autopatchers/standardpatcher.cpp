@@ -533,38 +533,23 @@ replace_edify_format(std::vector<EdifyToken *> *tokens,
     return right_paren + 1;
 }
 
-bool StandardPatcher::patch_files(const std::string &directory)
-{
-    if (!patch_updater(directory)) {
-        return false;
-    }
-
-    if (!patch_transfer_list(directory)) {
-        return false;
-    }
-
-    return true;
-}
-
-bool StandardPatcher::patch_updater(const std::string &directory)
+/*!
+ * \brief Patch updater-script contents
+ *
+ * \param device Device the ROM is being patched for
+ * \param contents Script contents to patch in place
+ */
+static bool patch_updater_contents(const device::Device &device,
+                                   std::string *contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += UpdaterScript;
-
-    FileUtils::read_to_string(path, &contents);
-
-    if (contents.size() >= 2 && std::memcmp(contents.data(), "#!", 2) == 0) {
+    if (contents->size() >= 2 && std::memcmp(contents->data(), "#!", 2) == 0) {
         // Ignore any script with a shebang line
         return true;
     }
 
     std::vector<EdifyToken *> tokens;
     bool result = EdifyTokenizer::tokenize(
-            contents.data(), contents.size(), &tokens);
+            contents->data(), contents->size(), &tokens);
     if (!result) {
         LOGE("Failed to tokenize updater-script");
         return false;
@@ -574,7 +559,6 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     EdifyTokenizer::dump(tokens);
 #endif
 
-    auto &&device = m_info.device();
     auto system_devs = device.system_block_devs();
     auto cache_devs = device.cache_block_devs();
     auto data_devs = device.data_block_devs();
@@ -624,7 +608,7 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     EdifyTokenizer::dump(tokens);
 #endif
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
+    *contents = EdifyTokenizer::untokenize(tokens);
 
     for (EdifyToken *t : tokens) {
         delete t;
@@ -633,11 +617,88 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     return true;
 }
 
+/*!
+ * \brief Patch system.transfer.list contents
+ *
+ * \param contents Transfer list contents to patch in place
+ */
+static void patch_transfer_list_contents(std::string *contents)
+{
+    std::vector<std::string> lines = StringUtils::split(*contents, '\n');
+
+    for (auto it = lines.begin(); it != lines.end();) {
+        if (starts_with(*it, "erase ")) {
+            it = lines.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    *contents = StringUtils::join(lines, "\n");
+}
+
+bool StandardPatcher::patch_files(const std::string &directory)
+{
+    if (!patch_updater(directory)) {
+        return false;
+    }
+
+    if (!patch_transfer_list(directory)) {
+        return false;
+    }
+
+    return true;
+}
+
+bool StandardPatcher::patch_files(FileMap &files)
+{
+    auto it = files.find(UpdaterScript);
+    if (it != files.end()) {
+        std::string contents(it->second.begin(), it->second.end());
+
+        if (!patch_updater_contents(m_info.device(), &contents)) {
+            return false;
+        }
+
+        it->second.assign(contents.begin(), contents.end());
+    }
+
+    it = files.find(SystemTransferList);
+    if (it != files.end()) {
+        std::string contents(it->second.begin(), it->second.end());
+
+        patch_transfer_list_contents(&contents);
+
+        it->second.assign(contents.begin(), contents.end());
+    }
+
+    return true;
+}
+
+bool StandardPatcher::patch_updater(const std::string &directory)
+{
+    std::string contents;
+    std::string path;
+
+    path += directory;
+    path += "/";
+    path += UpdaterScript;
+
+    FileUtils::read_to_string(path, &contents);
+
+    if (!patch_updater_contents(m_info.device(), &contents)) {
+        return false;
+    }
+
+    FileUtils::write_from_string(path, contents);
+
+    return true;
+}
+
 bool StandardPatcher::patch_transfer_list(const std::string &directory)
 {
     std::string contents;
     std::string path;
-    std::vector<std::string> lines;
 
     path += directory;
     path += "/";
@@ -648,17 +709,8 @@ bool StandardPatcher::patch_transfer_list(const std::string &directory)
         return ret == ErrorCode::FileOpenError;
     }
 
-    lines = StringUtils::split(contents, '\n');
-
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (starts_with(*it, "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
-        }
-    }
+    patch_transfer_list_contents(&contents);
 
-    contents = StringUtils::join(lines, "\n");
     FileUtils::write_from_string(path, contents);
 
     return true;
@@ -24,6 +24,7 @@
 #include <cassert>
 
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/deflatecache.h"
 #include "mbpatcher/private/fileutils.h"
 
 // Patchers
@@ -46,7 +47,10 @@ namespace patcher
  * Blah blah documenting later ;)
  */
 
-PatcherConfig::PatcherConfig() = default;
+PatcherConfig::PatcherConfig()
+    : m_deflate_cache(std::make_unique<DeflateCache>())
+{
+}
 
 PatcherConfig::~PatcherConfig() = default;
 
@@ -231,5 +235,22 @@ void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
     m_auto_patchers.erase(it);
 }
 
+/*!
+ * \brief Get cache of payloads compressed by the patchers
+ *
+ * Patchers that add the same files to every output (eg. mbtool) compress
+ * them through this cache so that they are only compressed once for the
+ * lifetime of the PatcherConfig.
+ *
+ * \note This is for use by the patchers only. DeflateCache is not part of the
+ *       public API.
+ *
+ * \return Cache shared by all patchers created from this PatcherConfig
+ */
+DeflateCache & PatcherConfig::deflate_cache()
+{
+    return *m_deflate_cache;
+}
+
 }
 }
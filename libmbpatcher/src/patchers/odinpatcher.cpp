@@ -41,6 +41,7 @@
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patchers/zippatcher.h"
+#include "mbpatcher/private/deflatecache.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
 #include "mbpatcher/private/stringutils.h"
@@ -269,7 +270,12 @@ bool OdinPatcher::patch_tar()
 
         update_details(spec.target);
 
-        result = MinizipUtils::add_file(zf, spec.target, spec.source);
+        MinizipUtils::DeflatedData deflated;
+
+        result = m_pc.deflate_cache().deflate_file(spec.source, &deflated);
+        if (result == ErrorCode::NoError) {
+            result = MinizipUtils::add_deflated_file(zf, spec.target, deflated);
+        }
         if (result != ErrorCode::NoError) {
             m_error = result;
             return false;
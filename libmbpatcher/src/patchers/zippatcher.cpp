@@ -20,6 +20,8 @@
 #include "mbpatcher/patchers/zippatcher.h"
 
 #include <algorithm>
+#include <future>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <cassert>
@@ -29,12 +31,12 @@
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
-#include "mbpio/delete.h"
 
 #include "mbpatcher/patcherconfig.h"
-#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/deflatecache.h"
 #include "mbpatcher/private/miniziputils.h"
 #include "mbpatcher/private/stringutils.h"
+#include "mbpatcher/private/zipsplicer.h"
 
 // minizip
 #include "minizip/unzip.h"
@@ -129,6 +131,9 @@ bool ZipPatcher::patch_file(ProgressUpdatedCallback progress_cb,
     if (m_z_output != nullptr) {
         close_output_archive();
     }
+    if (m_splicer) {
+        close_output_splicer();
+    }
 
     if (m_cancelled) {
         m_error = ErrorCode::PatchingCancelled;
@@ -144,6 +149,105 @@ struct CopySpec
     std::string target;
 };
 
+struct GeneratedSpec
+{
+    std::vector<unsigned char> contents;
+    std::string target;
+};
+
+struct DeflatedEntry
+{
+    std::string name;
+    MinizipUtils::DeflatedData deflated;
+};
+
+/*!
+ * \brief Run the AutoPatchers and compress the files they produced
+ *
+ * This runs on a worker thread while the main thread copies the rest of the
+ * input zip. The files are patched in memory, so the zip handles are never
+ * accessed here.
+ */
+static ErrorCode patch_files_async(const std::vector<AutoPatcher *> &aps,
+                                   AutoPatcher::FileMap &files,
+                                   const std::atomic_bool &cancelled,
+                                   std::vector<DeflatedEntry> &entries)
+{
+    for (auto *ap : aps) {
+        if (cancelled) return ErrorCode::PatchingCancelled;
+        if (!ap->patch_files(files)) {
+            return ap->error();
+        }
+    }
+
+    // TODO Headers are being discarded
+
+    for (auto const &file : files) {
+        if (cancelled) return ErrorCode::PatchingCancelled;
+
+        DeflatedEntry entry;
+
+        // Rename the installer for mbtool
+        if (file.first == "META-INF/com/google/android/update-binary") {
+            entry.name = "META-INF/com/google/android/update-binary.orig";
+        } else {
+            entry.name = file.first;
+        }
+
+        auto ret = MinizipUtils::deflate_memory(file.second, &entry.deflated);
+        if (ret != ErrorCode::NoError) {
+            return ret;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Compress the multiboot files that are added to every zip
+ *
+ * Like patch_files_async(), this runs on a worker thread.
+ */
+static ErrorCode deflate_files_async(
+        DeflateCache &cache,
+        const std::vector<CopySpec> &to_copy,
+        const std::vector<GeneratedSpec> &to_generate,
+        const std::atomic_bool &cancelled,
+        std::vector<DeflatedEntry> &entries)
+{
+    for (auto const &spec : to_copy) {
+        if (cancelled) return ErrorCode::PatchingCancelled;
+
+        DeflatedEntry entry;
+        entry.name = spec.target;
+
+        auto ret = cache.deflate_file(spec.source, &entry.deflated);
+        if (ret != ErrorCode::NoError) {
+            return ret;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    for (auto const &spec : to_generate) {
+        if (cancelled) return ErrorCode::PatchingCancelled;
+
+        DeflatedEntry entry;
+        entry.name = spec.target;
+
+        auto ret = MinizipUtils::deflate_memory(spec.contents, &entry.deflated);
+        if (ret != ErrorCode::NoError) {
+            return ret;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    return ErrorCode::NoError;
+}
+
 bool ZipPatcher::patch_zip()
 {
     std::unordered_set<std::string> exclude_from_pass1;
@@ -170,20 +274,29 @@ bool ZipPatcher::patch_zip()
         }
     }
 
-    // Unlike the old patcher, we'll write directly to the new file
-    if (!open_output_archive()) {
+    // Unlike the old patcher, we'll write directly to the new file. Untouched
+    // entries are spliced in as raw byte ranges unless the input zip can only
+    // be handled by minizip.
+    if (!open_output_splicer() && !open_output_archive()) {
         return false;
     }
 
-    zipFile zf = MinizipUtils::ctx_get_zip_file(m_z_output);
+    zipFile zf = m_z_output ? MinizipUtils::ctx_get_zip_file(m_z_output)
+            : nullptr;
+    ErrorCode result;
 
     if (m_cancelled) return false;
 
     MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archive_stats(m_info->input_path(), &stats, {});
-    if (result != ErrorCode::NoError) {
-        m_error = result;
-        return false;
+    if (m_splicer) {
+        stats.files = m_splicer->entries();
+        stats.total_size = m_splicer->total_size();
+    } else {
+        result = MinizipUtils::archive_stats(m_info->input_path(), &stats, {});
+        if (result != ErrorCode::NoError) {
+            m_error = result;
+            return false;
+        }
     }
 
     m_max_bytes = stats.total_size;
@@ -231,78 +344,149 @@ bool ZipPatcher::patch_zip()
     m_max_files = stats.files + to_copy.size() + 2;
     update_files(m_files, m_max_files);
 
+    const std::string info_prop =
+            ZipPatcher::create_info_prop(m_info->rom_id(), false);
+
+    std::string json;
+    if (!device::device_to_json(m_info->device(), json)) {
+        m_error = ErrorCode::MemoryAllocationError;
+        return false;
+    }
+
+    std::vector<GeneratedSpec> to_generate {
+        {
+            { info_prop.begin(), info_prop.end() },
+            "multiboot/info.prop"
+        }, {
+            { json.begin(), json.end() },
+            "multiboot/device.json"
+        }
+    };
+
     if (!open_input_archive()) {
         return false;
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(m_pc.temp_directory());
+    // The AutoPatcher files are small, so read them into memory up front.
+    // Patching them and compressing the new files then happens on worker
+    // threads while the main thread streams the raw copies, which dominate for
+    // large zips.
+    AutoPatcher::FileMap patched_files;
 
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        io::delete_recursively(temp_dir);
+    if (!read_files(exclude_from_pass1, patched_files)) {
         return false;
     }
 
-    if (m_cancelled) return false;
+    std::vector<DeflatedEntry> patched_entries;
+    std::vector<DeflatedEntry> new_entries;
 
-    // On the second pass, run the autopatchers on the rest of the files
+    auto patch_task = std::async(std::launch::async, [&] {
+        return patch_files_async(m_auto_patchers, patched_files, m_cancelled,
+                                 patched_entries);
+    });
+    auto deflate_task = std::async(std::launch::async, [&] {
+        return deflate_files_async(m_pc.deflate_cache(), to_copy, to_generate,
+                                   m_cancelled, new_entries);
+    });
 
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        io::delete_recursively(temp_dir);
+    bool copied = m_splicer ? splice_entries(exclude_from_pass1)
+            : pass1(exclude_from_pass1);
+
+    ErrorCode patch_ret = patch_task.get();
+    ErrorCode deflate_ret = deflate_task.get();
+
+    if (!copied) return false;
+    if (m_cancelled) return false;
+
+    if (patch_ret != ErrorCode::NoError) {
+        m_error = patch_ret;
+        return false;
+    }
+    if (deflate_ret != ErrorCode::NoError) {
+        m_error = deflate_ret;
         return false;
     }
 
-    io::delete_recursively(temp_dir);
+    auto add_entry = [&](const DeflatedEntry &entry) {
+        if (m_splicer) {
+            return m_splicer->add_deflated_file(entry.name, entry.deflated);
+        } else {
+            return MinizipUtils::add_deflated_file(zf, entry.name,
+                                                   entry.deflated);
+        }
+    };
 
-    for (const CopySpec &spec : to_copy) {
+    // Merge the compressed entries in a fixed order so that the output does not
+    // depend on which worker finished first. The patched files were already
+    // counted during the first pass.
+    for (auto const &entry : patched_entries) {
         if (m_cancelled) return false;
 
-        update_files(++m_files, m_max_files);
-        update_details(spec.target);
+        update_details(entry.name);
 
-        result = MinizipUtils::add_file(zf, spec.target, spec.source);
+        result = add_entry(entry);
         if (result != ErrorCode::NoError) {
             m_error = result;
             return false;
         }
     }
 
-    if (m_cancelled) return false;
+    for (auto const &entry : new_entries) {
+        if (m_cancelled) return false;
 
-    update_files(++m_files, m_max_files);
-    update_details("multiboot/info.prop");
+        update_files(++m_files, m_max_files);
+        update_details(entry.name);
 
-    const std::string info_prop =
-            ZipPatcher::create_info_prop(m_info->rom_id(), false);
-    result = MinizipUtils::add_file(
-            zf, "multiboot/info.prop",
-            std::vector<unsigned char>(info_prop.begin(), info_prop.end()));
-    if (result != ErrorCode::NoError) {
-        m_error = result;
-        return false;
+        result = add_entry(entry);
+        if (result != ErrorCode::NoError) {
+            m_error = result;
+            return false;
+        }
     }
 
     if (m_cancelled) return false;
 
-    update_files(++m_files, m_max_files);
-    update_details("multiboot/device.json");
+    if (m_splicer) {
+        // The central directory is only written here
+        result = m_splicer->close();
+        m_splicer.reset();
 
-    std::string json;
-    if (!device::device_to_json(m_info->device(), json)) {
-        m_error = ErrorCode::MemoryAllocationError;
-        return false;
+        if (result != ErrorCode::NoError) {
+            m_error = result;
+            return false;
+        }
     }
 
-    result = MinizipUtils::add_file(
-            zf, "multiboot/device.json",
-            std::vector<unsigned char>(json.begin(), json.end()));
-    if (result != ErrorCode::NoError) {
-        m_error = result;
-        return false;
-    }
+    return true;
+}
 
-    if (m_cancelled) return false;
+/*!
+ * \brief Read files needed by the AutoPatchers into memory
+ *
+ * Files that do not exist in the input zip are skipped.
+ */
+bool ZipPatcher::read_files(const std::unordered_set<std::string> &files,
+                            AutoPatcher::FileMap &contents)
+{
+    unzFile uf = MinizipUtils::ctx_get_unz_file(m_z_input);
+
+    for (auto const &file : files) {
+        if (m_cancelled) return false;
+
+        int ret = unzLocateFile(uf, file.c_str(), nullptr);
+        if (ret == UNZ_END_OF_LIST_OF_FILE) {
+            continue;
+        } else if (ret != UNZ_OK) {
+            m_error = ErrorCode::ArchiveReadHeaderError;
+            return false;
+        }
+
+        if (!MinizipUtils::read_to_memory(uf, &contents[file],
+                                          nullptr, nullptr)) {
+            m_error = ErrorCode::ArchiveReadDataError;
+            return false;
+        }
+    }
 
     return true;
 }
@@ -310,13 +494,11 @@ bool ZipPatcher::patch_zip()
 /*!
  * \brief First pass of patching operation
  *
- * This performs the following operations:
- *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
- * - Otherwise, the file is copied directly to the output zip.
+ * Every file, except for those needed by an AutoPatcher, is copied directly to
+ * the output zip. The AutoPatcher files were already read by read_files()
+ * and are added after this pass.
  */
-bool ZipPatcher::pass1(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &exclude)
+bool ZipPatcher::pass1(const std::unordered_set<std::string> &exclude)
 {
     unzFile uf = MinizipUtils::ctx_get_unz_file(m_z_input);
     zipFile zf = MinizipUtils::ctx_get_zip_file(m_z_output);
@@ -341,12 +523,8 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
         update_files(++m_files, m_max_files);
         update_details(cur_file);
 
-        // Skip files that should be patched and added in pass 2
+        // Skip files that are patched and added after this pass
         if (exclude.find(cur_file) != exclude.end()) {
-            if (!MinizipUtils::extract_file(uf, temporary_dir)) {
-                m_error = ErrorCode::ArchiveReadDataError;
-                return false;
-            }
             continue;
         }
 
@@ -375,54 +553,34 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
 }
 
 /*!
- * \brief Second pass of patching operation
- *
- * This performs the following operations:
+ * \brief First pass of patching operation when splicing
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * This is equivalent to pass1(), except that consecutive untouched entries are
+ * copied from the input zip as a single byte range.
  */
-bool ZipPatcher::pass2(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &files)
+bool ZipPatcher::splice_entries(const std::unordered_set<std::string> &exclude)
 {
-    zipFile zf = MinizipUtils::ctx_get_zip_file(m_z_output);
-
-    for (auto *ap : m_auto_patchers) {
-        if (m_cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
-            m_error = ap->error();
-            return false;
-        }
-    }
-
-    // TODO Headers are being discarded
-
-    for (auto const &file : files) {
-        if (m_cancelled) return false;
-
-        ErrorCode ret;
-
-        if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::add_file(
-                    zf,
-                    "META-INF/com/google/android/update-binary.orig",
-                      temporary_dir + "/" + file);
-        } else {
-            ret = MinizipUtils::add_file(
-                    zf,
-                    file,
-                      temporary_dir + "/" + file);
+    // Rename the installer for mbtool
+    static const std::unordered_map<std::string, std::string> renames{
+        {
+            "META-INF/com/google/android/update-binary",
+            "META-INF/com/google/android/update-binary.orig"
         }
+    };
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+    auto ret = m_splicer->copy_entries(exclude, renames,
+                                       &splice_progress_cb, this);
+    if (ret != ErrorCode::NoError) {
+        if (ret != ErrorCode::PatchingCancelled) {
             m_error = ret;
-            return false;
         }
+        return false;
     }
 
-    if (m_cancelled) return false;
+    m_files += m_splicer->entries();
+    m_bytes += m_splicer->total_size();
+
+    update_files(m_files, m_max_files);
 
     return true;
 }
@@ -483,6 +641,42 @@ void ZipPatcher::close_output_archive()
     m_z_output = nullptr;
 }
 
+/*!
+ * \brief Open splicer for writing the output zip
+ *
+ * Unlike open_output_archive(), failure is not an error. The caller should
+ * fall back to writing the output zip with minizip.
+ */
+bool ZipPatcher::open_output_splicer()
+{
+    assert(!m_splicer);
+
+    std::unique_ptr<ZipSplicer> splicer(new ZipSplicer());
+
+    auto ret = splicer->open(m_info->input_path(), m_info->output_path());
+    if (ret != ErrorCode::NoError) {
+        LOGW("Cannot splice zip entries; falling back to minizip");
+        return false;
+    }
+
+    m_splicer = std::move(splicer);
+
+    return true;
+}
+
+void ZipPatcher::close_output_splicer()
+{
+    assert(m_splicer);
+
+    auto ret = m_splicer->close();
+    if (ret != ErrorCode::NoError) {
+        LOGW("Failed to close spliced archive (error code: %d)",
+             static_cast<int>(ret));
+    }
+
+    m_splicer.reset();
+}
+
 void ZipPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
     if (m_progress_cb) {
@@ -510,6 +704,15 @@ void ZipPatcher::la_progress_cb(uint64_t bytes, void *userdata)
     p->update_progress(p->m_bytes + bytes, p->m_max_bytes);
 }
 
+bool ZipPatcher::splice_progress_cb(uint64_t entries, uint64_t bytes,
+                                    void *userdata)
+{
+    auto *p = static_cast<ZipPatcher *>(userdata);
+    p->update_files(p->m_files + entries, p->m_max_files);
+    p->update_progress(p->m_bytes + bytes, p->m_max_bytes);
+    return !p->m_cancelled;
+}
+
 std::string ZipPatcher::create_info_prop(const std::string &rom_id,
                                          bool always_patch_ramdisk)
 {
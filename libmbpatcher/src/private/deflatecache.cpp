@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/deflatecache.h"
+
+#include "mbcommon/hash.h"
+
+#include "mblog/logging.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+#define LOG_TAG "mbpatcher/private/deflatecache"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+/*!
+ * \class DeflateCache
+ *
+ * \brief Cache of deflated payload files
+ *
+ * The same binaries are added to every zip that a PatcherConfig patches.
+ * Compressing them dominates the cost of adding them, so the compressed data
+ * is kept in memory, keyed by the hash of the uncompressed data and the
+ * compression level. The key does not depend on the path, so a payload that
+ * changes on disk is compressed again and identical payloads at different
+ * paths share an entry.
+ *
+ * All functions are thread safe.
+ */
+
+DeflateCache::DeflateCache()
+    : m_hits(0)
+    , m_misses(0)
+{
+}
+
+DeflateCache::~DeflateCache() = default;
+
+/*!
+ * \brief Compress file for adding to a zip with add_deflated_file()
+ *
+ * This behaves like MinizipUtils::deflate_file(), except that the compressed
+ * data is reused if a file with the same contents was compressed before at the
+ * same level. The file still has to be read and hashed, but that is much
+ * cheaper than compressing it.
+ *
+ * \return ErrorCode::FileOpenError if the file could not be opened, which
+ *         callers may treat as a missing file
+ */
+ErrorCode DeflateCache::deflate_file(const std::string &path,
+                                     MinizipUtils::DeflatedData *output,
+                                     int level)
+{
+    std::vector<unsigned char> contents;
+    uint32_t dos_date;
+
+    auto ret = FileUtils::read_to_memory(path, &contents);
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    if (!MinizipUtils::get_file_time(path, &dos_date)) {
+        LOGE("%s: Failed to get modification time", path.c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    auto digest = compute_hash(HashAlgorithm::Sha256,
+                               contents.data(), contents.size());
+    if (!digest) {
+        // Not fatal, but don't cache anything for this file
+        LOGW("%s: Failed to hash file: %s",
+             path.c_str(), digest.error().message().c_str());
+
+        ret = MinizipUtils::deflate_memory(contents, output, level);
+        output->dos_date = dos_date;
+        return ret;
+    }
+
+    Key key(std::move(digest.value()), level);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            ++m_hits;
+            *output = *it->second;
+            output->dos_date = dos_date;
+            return ErrorCode::NoError;
+        }
+
+        ++m_misses;
+    }
+
+    // Compress without holding the lock. If another thread races us on the
+    // same contents, the results are identical and either one can be kept.
+    auto deflated = std::make_shared<MinizipUtils::DeflatedData>();
+
+    ret = MinizipUtils::deflate_memory(contents, deflated.get(), level);
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    *output = *deflated;
+    output->dos_date = dos_date;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.emplace(std::move(key), std::move(deflated));
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Drop all cached entries
+ */
+void DeflateCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+/*!
+ * \brief Number of deflate_file() calls that were served from the cache
+ */
+uint64_t DeflateCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+/*!
+ * \brief Number of deflate_file() calls that had to compress the file
+ */
+uint64_t DeflateCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+}
+}
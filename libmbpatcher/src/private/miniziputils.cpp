@@ -20,6 +20,9 @@
 #include "mbpatcher/private/miniziputils.h"
 
 #include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
 
 #include <cassert>
 #include <cerrno>
@@ -30,8 +33,10 @@
 #include <time.h>
 #endif
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/locale.h"
 
 #include "mblog/logging.h"
@@ -589,7 +594,11 @@ bool MinizipUtils::extract_file(unzFile uf, const std::string &directory)
     return n == 0;
 }
 
-static bool get_file_time(const std::string &filename, uint32_t *dostime)
+/*!
+ * \brief Get modification time of a file in the DOS format used by zip headers
+ */
+bool MinizipUtils::get_file_time(const std::string &filename,
+                                 uint32_t *dostime)
 {
     // Don't fail when building with -Werror
     (void) filename;
@@ -640,10 +649,53 @@ static bool get_file_time(const std::string &filename, uint32_t *dostime)
     return false;
 }
 
+/*! \brief Size of the blocks compressed independently by ParallelDeflater */
+static constexpr size_t PARALLEL_BLOCK_SIZE = 128 * 1024;
+
+/*! \brief Number of blocks compressed per batch for each thread */
+static constexpr size_t PARALLEL_BLOCKS_PER_THREAD = 4;
+
+/*! \brief Maximum size of a deflate back-reference window */
+static constexpr size_t DEFLATE_DICT_SIZE = 32768;
+
+/*!
+ * \brief Minimum size of an entry before it is compressed on multiple threads
+ *
+ * Below this, the thread startup cost and the small loss in compression ratio
+ * are not worth it.
+ */
+static constexpr uint64_t PARALLEL_DEFLATE_THRESHOLD = 4 * 1024 * 1024;
+
+static unsigned int parallel_deflate_threads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static bool use_parallel_deflate(uint64_t size)
+{
+    return size >= PARALLEL_DEFLATE_THRESHOLD
+            && parallel_deflate_threads() > 1;
+}
+
+static ErrorCode add_file_parallel(zipFile zf, const std::string &name,
+                                   const std::string &path, StandardFile &file,
+                                   const zip_fileinfo &zi, bool zip64);
+
 ErrorCode MinizipUtils::add_file(zipFile zf,
                                  const std::string &name,
                                  const std::vector<unsigned char> &contents)
 {
+    if (use_parallel_deflate(contents.size())) {
+        DeflatedData deflated;
+
+        auto ret = deflate_memory(contents, &deflated);
+        if (ret != ErrorCode::NoError) {
+            return ret;
+        }
+
+        return add_deflated_file(zf, name, deflated);
+    }
+
     // Obviously never true, but we'll keep it here just in case
     bool zip64 = static_cast<uint64_t>(contents.size()) >= ((1ull << 32) - 1);
 
@@ -733,6 +785,10 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
         return ErrorCode::FileOpenError;
     }
 
+    if (use_parallel_deflate(size.value())) {
+        return add_file_parallel(zf, name, path, file, zi, zip64);
+    }
+
     ret = zipOpenNewFileInZip2_64(
         zf,                     // file
         name.c_str(),           // filename
@@ -792,5 +848,611 @@ ErrorCode MinizipUtils::add_file(zipFile zf,
     return ErrorCode::NoError;
 }
 
+/*!
+ * \brief Raw deflate stream used for compressing entries ahead of time
+ *
+ * The parameters match what minizip uses for Z_DEFLATED entries at
+ * Z_DEFAULT_COMPRESSION, so the output can be written with
+ * add_deflated_file() as if it were compressed by minizip itself.
+ */
+class Deflater
+{
+public:
+    Deflater(MinizipUtils::DeflatedData *output, int level)
+        : m_output(output)
+        , m_level(level)
+        , m_initialized(false)
+    {
+        memset(&m_strm, 0, sizeof(m_strm));
+
+        m_output->data.clear();
+        m_output->uncompressed_size = 0;
+        m_output->crc = static_cast<uint32_t>(crc32(0L, nullptr, 0));
+    }
+
+    ~Deflater()
+    {
+        if (m_initialized) {
+            deflateEnd(&m_strm);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Deflater)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Deflater)
+
+    bool init()
+    {
+        int ret = deflateInit2(&m_strm, m_level, Z_DEFLATED,
+                               -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) {
+            LOGE("zlib: Failed to initialize deflate: %s",
+                 zlib_error_string(ret).c_str());
+            return false;
+        }
+
+        m_initialized = true;
+        return true;
+    }
+
+    bool update(const unsigned char *data, size_t size)
+    {
+        m_output->crc = static_cast<uint32_t>(
+                crc32(m_output->crc, data, static_cast<uInt>(size)));
+        m_output->uncompressed_size += size;
+
+        return run(data, size, Z_NO_FLUSH);
+    }
+
+    bool finish()
+    {
+        return run(nullptr, 0, Z_FINISH);
+    }
+
+private:
+    bool run(const unsigned char *data, size_t size, int flush)
+    {
+        unsigned char buf[32768];
+
+        m_strm.next_in = const_cast<unsigned char *>(data);
+        m_strm.avail_in = static_cast<uInt>(size);
+
+        do {
+            m_strm.next_out = buf;
+            m_strm.avail_out = sizeof(buf);
+
+            int ret = deflate(&m_strm, flush);
+            if (ret == Z_STREAM_ERROR) {
+                LOGE("zlib: Failed to deflate data: %s",
+                     zlib_error_string(ret).c_str());
+                return false;
+            }
+
+            m_output->data.insert(m_output->data.end(), buf,
+                                  buf + sizeof(buf) - m_strm.avail_out);
+        } while (m_strm.avail_out == 0);
+
+        return true;
+    }
+
+    MinizipUtils::DeflatedData *m_output;
+    int m_level;
+    z_stream m_strm;
+    bool m_initialized;
+};
+
+/*!
+ * \brief Raw deflate stream compressed in independent blocks on many threads
+ *
+ * This works the same way as pigz. The input is split into fixed-size blocks
+ * and each block is compressed by its own zlib stream, which is primed with
+ * the last 32 KiB of the preceding input so that matches can still reach
+ * across block boundaries. Every block but the last one ends with a sync
+ * flush, which byte-aligns the output without marking the final deflate
+ * block, so the compressed blocks can simply be concatenated into a single
+ * valid stream. The CRC of each block is computed on the same thread and the
+ * results are merged with crc32_combine().
+ *
+ * The interface matches Deflater, except that no initialization is needed.
+ * The compressed data is appended to the output as each batch of blocks
+ * finishes, so callers streaming a large file may consume and clear
+ * \\a output->data between calls to update().
+ */
+class ParallelDeflater
+{
+public:
+    ParallelDeflater(MinizipUtils::DeflatedData *output, int level)
+        : m_output(output)
+        , m_level(level)
+        , m_threads(parallel_deflate_threads())
+        , m_batch_size(m_threads * PARALLEL_BLOCKS_PER_THREAD
+                * PARALLEL_BLOCK_SIZE)
+    {
+        m_output->data.clear();
+        m_output->uncompressed_size = 0;
+        m_output->crc = static_cast<uint32_t>(crc32(0L, nullptr, 0));
+
+        m_batch.reserve(m_batch_size);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+
+    bool update(const unsigned char *data, size_t size)
+    {
+        m_output->uncompressed_size += size;
+
+        while (size > 0) {
+            // Compress directly from the caller's buffer if possible
+            if (m_batch.empty() && size >= m_batch_size) {
+                if (!compress(data, m_batch_size, false)) {
+                    return false;
+                }
+
+                data += m_batch_size;
+                size -= m_batch_size;
+                continue;
+            }
+
+            size_t n = std::min(size, m_batch_size - m_batch.size());
+            m_batch.insert(m_batch.end(), data, data + n);
+            data += n;
+            size -= n;
+
+            if (m_batch.size() == m_batch_size) {
+                if (!compress(m_batch.data(), m_batch.size(), false)) {
+                    return false;
+                }
+                m_batch.clear();
+            }
+        }
+
+        return true;
+    }
+
+    bool finish()
+    {
+        // If the input was a multiple of the batch size, this writes an empty
+        // final block, which is still valid
+        bool ret = compress(m_batch.data(), m_batch.size(), true);
+        m_batch.clear();
+        return ret;
+    }
+
+private:
+    struct Block
+    {
+        std::vector<unsigned char> data;
+        uint32_t crc;
+        size_t size;
+    };
+
+    bool compress(const unsigned char *data, size_t size, bool last)
+    {
+        size_t n_blocks = std::max<size_t>(
+                1, (size + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE);
+        std::vector<Block> blocks(n_blocks);
+        std::atomic_size_t next_block(0);
+        std::atomic_bool failed(false);
+
+        auto worker = [&] {
+            size_t i;
+
+            while (!failed && (i = next_block++) < n_blocks) {
+                size_t offset = i * PARALLEL_BLOCK_SIZE;
+                const unsigned char *dict;
+                size_t dict_size;
+
+                // The first block is primed with the end of the previous
+                // batch. The others are primed from the current batch.
+                if (i == 0) {
+                    dict = m_dict.data();
+                    dict_size = m_dict.size();
+                } else {
+                    dict_size = std::min(offset, DEFLATE_DICT_SIZE);
+                    dict = data + offset - dict_size;
+                }
+
+                if (!compress_block(dict, dict_size, data + offset,
+                                    std::min(size - offset,
+                                             PARALLEL_BLOCK_SIZE),
+                                    last && i == n_blocks - 1,
+                                    blocks[i])) {
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::future<void>> futures;
+        size_t n_workers = std::min<size_t>(m_threads, n_blocks);
+
+        for (size_t i = 1; i < n_workers; ++i) {
+            futures.push_back(std::async(std::launch::async, worker));
+        }
+        worker();
+        for (auto &f : futures) {
+            f.get();
+        }
+
+        if (failed) {
+            return false;
+        }
+
+        for (auto const &block : blocks) {
+            m_output->data.insert(m_output->data.end(),
+                                  block.data.begin(), block.data.end());
+            m_output->crc = static_cast<uint32_t>(crc32_combine(
+                    m_output->crc, block.crc,
+                    static_cast<z_off_t>(block.size)));
+        }
+
+        // Keep the end of the input for priming the next batch. This must be
+        // done last because data may point into m_batch.
+        if (size >= DEFLATE_DICT_SIZE) {
+            m_dict.assign(data + size - DEFLATE_DICT_SIZE, data + size);
+        } else {
+            m_dict.insert(m_dict.end(), data, data + size);
+            if (m_dict.size() > DEFLATE_DICT_SIZE) {
+                m_dict.erase(m_dict.begin(), m_dict.end() - DEFLATE_DICT_SIZE);
+            }
+        }
+
+        return true;
+    }
+
+    bool compress_block(const unsigned char *dict, size_t dict_size,
+                        const unsigned char *data, size_t size, bool last,
+                        Block &block)
+    {
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+
+        block.crc = static_cast<uint32_t>(
+                crc32(crc32(0L, nullptr, 0), data, static_cast<uInt>(size)));
+        block.size = size;
+
+        int ret = deflateInit2(&strm, m_level, Z_DEFLATED, -MAX_WBITS, 8,
+                               Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) {
+            LOGE("zlib: Failed to initialize deflate: %s",
+                 zlib_error_string(ret).c_str());
+            return false;
+        }
+
+        auto end_stream = finally([&] {
+            deflateEnd(&strm);
+        });
+
+        if (dict_size > 0) {
+            ret = deflateSetDictionary(&strm, dict,
+                                       static_cast<uInt>(dict_size));
+            if (ret != Z_OK) {
+                LOGE("zlib: Failed to set deflate dictionary: %s",
+                     zlib_error_string(ret).c_str());
+                return false;
+            }
+        }
+
+        block.data.resize(deflateBound(&strm, static_cast<uLong>(size)) + 16);
+
+        strm.next_in = const_cast<unsigned char *>(data);
+        strm.avail_in = static_cast<uInt>(size);
+
+        int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+
+        do {
+            if (strm.total_out == block.data.size()) {
+                block.data.resize(block.data.size() * 2);
+            }
+
+            strm.next_out = block.data.data() + strm.total_out;
+            strm.avail_out = static_cast<uInt>(
+                    block.data.size() - strm.total_out);
+
+            ret = deflate(&strm, flush);
+            if (ret == Z_STREAM_ERROR) {
+                LOGE("zlib: Failed to deflate data: %s",
+                     zlib_error_string(ret).c_str());
+                return false;
+            }
+        } while (strm.avail_out == 0);
+
+        block.data.resize(strm.total_out);
+
+        return true;
+    }
+
+    MinizipUtils::DeflatedData *m_output;
+    int m_level;
+    size_t m_threads;
+    size_t m_batch_size;
+    // Input not yet compressed
+    std::vector<unsigned char> m_batch;
+    // Last DEFLATE_DICT_SIZE bytes of compressed input
+    std::vector<unsigned char> m_dict;
+};
+
+static bool write_raw_data(zipFile zf, const std::vector<unsigned char> &data)
+{
+    size_t offset = 0;
+
+    // minizip no longer supports buffers larger than UINT16_MAX
+    while (offset < data.size()) {
+        size_t n = std::min<size_t>(data.size() - offset, UINT16_MAX);
+
+        int ret = zipWriteInFileInZip(zf, data.data() + offset,
+                                      static_cast<uint32_t>(n));
+        if (ret != ZIP_OK) {
+            LOGE("minizip: Failed to write inner file data: %s",
+                 MinizipUtils::zip_error_string(ret).c_str());
+            return false;
+        }
+
+        offset += n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Add large file to zip, compressing it on multiple threads
+ *
+ * The compressed data is written to the zip as each batch completes, so only
+ * a few batches of the file are held in memory at a time.
+ */
+static ErrorCode add_file_parallel(zipFile zf, const std::string &name,
+                                   const std::string &path, StandardFile &file,
+                                   const zip_fileinfo &zi, bool zip64)
+{
+    int ret = zipOpenNewFileInZip2_64(
+        zf,                     // file
+        name.c_str(),           // filename
+        &zi,                    // zip_fileinfo
+        nullptr,                // extrafield_local
+        0,                      // size_extrafield_local
+        nullptr,                // extrafield_global
+        0,                      // size_extrafield_global
+        nullptr,                // comment
+        Z_DEFLATED,             // method
+        Z_DEFAULT_COMPRESSION,  // level
+        1,                      // raw
+        zip64                   // zip64
+    );
+
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to open inner file: %s",
+             MinizipUtils::zip_error_string(ret).c_str());
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    MinizipUtils::DeflatedData deflated;
+    ParallelDeflater deflater(&deflated, Z_DEFAULT_COMPRESSION);
+    std::vector<unsigned char> buf(1024 * 1024);
+
+    while (true) {
+        auto bytes_read = file.read(buf.data(), buf.size());
+        if (!bytes_read) {
+            LOGE("%s: Failed to read data: %s",
+                 path.c_str(), bytes_read.error().message().c_str());
+            zipCloseFileInZip(zf);
+
+            return ErrorCode::FileReadError;
+        } else if (bytes_read.value() == 0) {
+            break;
+        }
+
+        if (!deflater.update(buf.data(), bytes_read.value())
+                || !write_raw_data(zf, deflated.data)) {
+            zipCloseFileInZip(zf);
+
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        deflated.data.clear();
+    }
+
+    if (!deflater.finish() || !write_raw_data(zf, deflated.data)) {
+        zipCloseFileInZip(zf);
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    ret = zipCloseFileInZipRaw64(zf, deflated.uncompressed_size, deflated.crc);
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to close inner file: %s",
+             MinizipUtils::zip_error_string(ret).c_str());
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Compress buffer for adding to a zip with add_deflated_file()
+ *
+ * This does not touch any minizip handle, so it is safe to call from a thread
+ * other than the one writing the output zip.
+ */
+ErrorCode MinizipUtils::deflate_memory(
+        const std::vector<unsigned char> &contents, DeflatedData *output,
+        int level)
+{
+    // Matches the zero timestamp used by add_file() for in-memory contents
+    output->dos_date = 0;
+
+    if (use_parallel_deflate(contents.size())) {
+        ParallelDeflater deflater(output, level);
+
+        if (!deflater.update(contents.data(), contents.size())
+                || !deflater.finish()) {
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        return ErrorCode::NoError;
+    }
+
+    Deflater deflater(output, level);
+
+    if (!deflater.init()) {
+        return ErrorCode::MemoryAllocationError;
+    }
+
+    size_t offset = 0;
+
+    while (offset < contents.size()) {
+        size_t n = std::min<size_t>(contents.size() - offset, UINT16_MAX);
+
+        if (!deflater.update(contents.data() + offset, n)) {
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        offset += n;
+    }
+
+    if (!deflater.finish()) {
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+template<typename D>
+static ErrorCode deflate_stream(StandardFile &file, const std::string &path,
+                                D &deflater, size_t buf_size)
+{
+    std::vector<unsigned char> buf(buf_size);
+
+    while (true) {
+        auto bytes_read = file.read(buf.data(), buf.size());
+        if (!bytes_read) {
+            LOGE("%s: Failed to read data: %s",
+                 path.c_str(), bytes_read.error().message().c_str());
+            return ErrorCode::FileReadError;
+        } else if (bytes_read.value() == 0) {
+            break;
+        }
+
+        if (!deflater.update(buf.data(), bytes_read.value())) {
+            return ErrorCode::ArchiveWriteDataError;
+        }
+    }
+
+    if (!deflater.finish()) {
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Compress file for adding to a zip with add_deflated_file()
+ *
+ * Like deflate_memory(), this is safe to call from a worker thread.
+ *
+ * \return ErrorCode::FileOpenError if the file could not be opened, which
+ *         callers may treat as a missing file
+ */
+ErrorCode MinizipUtils::deflate_file(const std::string &path,
+                                     DeflatedData *output)
+{
+    StandardFile file;
+
+    auto open_ret = FileUtils::open_file(file, path,
+                                         FileOpenMode::ReadOnly);
+    if (!open_ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), open_ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    auto size = file.seek(0, SEEK_END);
+    if (!size) {
+        LOGE("%s: Failed to seek file: %s",
+             path.c_str(), size.error().message().c_str());
+        return ErrorCode::FileSeekError;
+    }
+    auto seek_ret = file.seek(0, SEEK_SET);
+    if (!seek_ret) {
+        LOGE("%s: Failed to seek file: %s",
+             path.c_str(), seek_ret.error().message().c_str());
+        return ErrorCode::FileSeekError;
+    }
+
+    if (!get_file_time(path, &output->dos_date)) {
+        LOGE("%s: Failed to get modification time", path.c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    if (use_parallel_deflate(size.value())) {
+        ParallelDeflater deflater(output, Z_DEFAULT_COMPRESSION);
+        return deflate_stream(file, path, deflater, 1024 * 1024);
+    }
+
+    Deflater deflater(output, Z_DEFAULT_COMPRESSION);
+
+    if (!deflater.init()) {
+        return ErrorCode::MemoryAllocationError;
+    }
+
+    return deflate_stream(file, path, deflater, 32768);
+}
+
+/*!
+ * \brief Add entry that was compressed by deflate_memory() or deflate_file()
+ *
+ * The compressed data is written as-is, so this only costs as much as copying
+ * the data into the output zip.
+ */
+ErrorCode MinizipUtils::add_deflated_file(zipFile zf,
+                                          const std::string &name,
+                                          const DeflatedData &deflated)
+{
+    bool zip64 = deflated.uncompressed_size >= ((1ull << 32) - 1);
+
+    zip_fileinfo zi;
+    memset(&zi, 0, sizeof(zi));
+
+    zi.dos_date = deflated.dos_date;
+
+    int ret = zipOpenNewFileInZip2_64(
+        zf,                     // file
+        name.c_str(),           // filename
+        &zi,                    // zip_fileinfo
+        nullptr,                // extrafield_local
+        0,                      // size_extrafield_local
+        nullptr,                // extrafield_global
+        0,                      // size_extrafield_global
+        nullptr,                // comment
+        Z_DEFLATED,             // method
+        Z_DEFAULT_COMPRESSION,  // level
+        1,                      // raw
+        zip64                   // zip64
+    );
+
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to open inner file: %s",
+             zip_error_string(ret).c_str());
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    if (!write_raw_data(zf, deflated.data)) {
+        zipCloseFileInZip(zf);
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    ret = zipCloseFileInZipRaw64(zf, deflated.uncompressed_size, deflated.crc);
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to close inner file: %s",
+             zip_error_string(ret).c_str());
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
 }
 }
@@ -0,0 +1,1022 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/zipsplicer.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/locale.h"
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbpatcher/private/zipsplicer"
+
+
+namespace mb
+{
+namespace patcher
+{
+
+static constexpr uint32_t LOCAL_HEADER_SIG = 0x04034b50;
+static constexpr uint32_t CENTRAL_HEADER_SIG = 0x02014b50;
+static constexpr uint32_t EOCD_SIG = 0x06054b50;
+static constexpr uint32_t ZIP64_EOCD_SIG = 0x06064b50;
+static constexpr uint32_t ZIP64_LOCATOR_SIG = 0x07064b50;
+
+static constexpr size_t LOCAL_HEADER_SIZE = 30;
+static constexpr size_t CENTRAL_HEADER_SIZE = 46;
+static constexpr size_t EOCD_SIZE = 22;
+static constexpr size_t ZIP64_EOCD_SIZE = 56;
+static constexpr size_t ZIP64_LOCATOR_SIZE = 20;
+static constexpr size_t MAX_COMMENT_SIZE = UINT16_MAX;
+
+static constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+static constexpr uint16_t DEFAULT_VERSION = 20;
+static constexpr uint16_t ZIP64_VERSION = 45;
+static constexpr uint16_t METHOD_DEFLATED = 8;
+
+static constexpr uint32_t MAX_UINT32_FIELD = UINT32_MAX;
+static constexpr uint16_t MAX_UINT16_FIELD = UINT16_MAX;
+
+// Number of bytes to copy between progress updates
+static constexpr uint64_t COPY_CHUNK_SIZE = 16 * 1024 * 1024;
+
+// Size of the buffer used if the kernel can't copy the data
+static constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | static_cast<uint32_t>(p[1]) << 8
+            | static_cast<uint32_t>(p[2]) << 16
+            | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(read_le32(p))
+            | static_cast<uint64_t>(read_le32(p + 4)) << 32;
+}
+
+static void append_le16(std::vector<unsigned char> &buf, uint16_t value)
+{
+    buf.push_back(static_cast<unsigned char>(value));
+    buf.push_back(static_cast<unsigned char>(value >> 8));
+}
+
+static void append_le32(std::vector<unsigned char> &buf, uint32_t value)
+{
+    append_le16(buf, static_cast<uint16_t>(value));
+    append_le16(buf, static_cast<uint16_t>(value >> 16));
+}
+
+static void append_le64(std::vector<unsigned char> &buf, uint64_t value)
+{
+    append_le32(buf, static_cast<uint32_t>(value));
+    append_le32(buf, static_cast<uint32_t>(value >> 32));
+}
+
+static void write_le16(unsigned char *p, uint16_t value)
+{
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+}
+
+static void append_bytes(std::vector<unsigned char> &buf, const void *data,
+                         size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+    buf.insert(buf.end(), ptr, ptr + size);
+}
+
+#ifdef _WIN32
+static oc::result<void> open_file(FdFile &file, const std::string &path,
+                                  FileOpenMode mode)
+{
+    OUTCOME_TRY(w_path, utf8_to_wcs(path));
+    return file.open(w_path, mode);
+}
+#else
+// The file descriptor is kept so that the kernel can copy data directly
+// between the files
+static oc::result<int> open_file(FdFile &file, const std::string &path,
+                                 int flags)
+{
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    OUTCOME_TRYV(file.open(fd, true));
+
+    return fd;
+}
+
+static bool is_regular_file(int fd)
+{
+    struct stat sb;
+    return fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+}
+#endif
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+// Errors reported for old kernels, cross-filesystem copies, and unsupported
+// file types
+static bool is_unsupported_copy_error(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == ENOTSUP || error == EBADF;
+}
+#endif
+
+/*!
+ * \class ZipSplicer
+ *
+ * \brief Write a zip file by splicing in entries from another zip file
+ *
+ * Entries that are copied unmodified from the input zip are copied as whole
+ * byte ranges of local file records. Consecutive entries are copied with a
+ * single operation, using `copy_file_range()` on Linux if both files are
+ * regular files. Only the central directory is regenerated, with the local
+ * header offsets adjusted for the new positions.
+ *
+ * New entries must be compressed ahead of time with
+ * MinizipUtils::deflate_memory() or MinizipUtils::deflate_file().
+ */
+
+ZipSplicer::ZipSplicer()
+#ifndef _WIN32
+    : m_input_fd(-1)
+    , m_output_fd(-1)
+    , m_kernel_copy(false)
+#else
+    : m_kernel_copy(false)
+#endif
+    , m_open(false)
+    , m_input_cd_offset(0)
+    , m_output_offset(0)
+    , m_copied_entries(0)
+    , m_copied_bytes(0)
+{
+}
+
+ZipSplicer::~ZipSplicer() = default;
+
+/*!
+ * \brief Open input zip and create output zip
+ *
+ * The input zip's central directory is read and validated. If an error is
+ * returned, the input zip cannot be spliced (eg. because it spans multiple
+ * disks or the local file records overlap), but it may still be readable by
+ * minizip.
+ */
+ErrorCode ZipSplicer::open(const std::string &input_path,
+                           const std::string &output_path)
+{
+#ifdef _WIN32
+    auto ret = open_file(m_input, input_path, FileOpenMode::ReadOnly);
+#else
+    auto ret = open_file(m_input, input_path, O_RDONLY);
+#endif
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             input_path.c_str(), ret.error().message().c_str());
+        return ErrorCode::ArchiveReadOpenError;
+    }
+#ifndef _WIN32
+    m_input_fd = ret.value();
+#endif
+
+    auto result = read_central_directory();
+    if (result != ErrorCode::NoError) {
+        (void) m_input.close();
+        return result;
+    }
+
+#ifdef _WIN32
+    ret = open_file(m_output, output_path, FileOpenMode::ReadWriteTrunc);
+#else
+    ret = open_file(m_output, output_path, O_RDWR | O_CREAT | O_TRUNC);
+#endif
+    if (!ret) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_path.c_str(), ret.error().message().c_str());
+        (void) m_input.close();
+        return ErrorCode::ArchiveWriteOpenError;
+    }
+#ifndef _WIN32
+    m_output_fd = ret.value();
+    m_kernel_copy = is_regular_file(m_input_fd)
+            && is_regular_file(m_output_fd);
+#endif
+
+    // Headers are written with pwrite(), so pipes and sockets won't work
+    auto seek_ret = m_output.seek(0, SEEK_CUR);
+    if (!seek_ret) {
+        LOGE("%s: Output is not seekable: %s",
+             output_path.c_str(), seek_ret.error().message().c_str());
+        (void) m_input.close();
+        (void) m_output.close();
+        return ErrorCode::ArchiveWriteOpenError;
+    }
+
+    m_output_entries.clear();
+    m_output_offset = 0;
+    m_copied_entries = 0;
+    m_copied_bytes = 0;
+    m_open = true;
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Write central directory and close files
+ */
+ErrorCode ZipSplicer::close()
+{
+    if (!m_open) {
+        return ErrorCode::NoError;
+    }
+
+    m_open = false;
+
+    uint64_t cd_offset = m_output_offset;
+    std::vector<unsigned char> buf;
+    ErrorCode result;
+
+    for (auto const &entry : m_output_entries) {
+        std::vector<unsigned char> zip64;
+        uint32_t compressed_size = static_cast<uint32_t>(
+                std::min<uint64_t>(entry.compressed_size, MAX_UINT32_FIELD));
+        uint32_t uncompressed_size = static_cast<uint32_t>(
+                std::min<uint64_t>(entry.uncompressed_size, MAX_UINT32_FIELD));
+        uint32_t local_offset = static_cast<uint32_t>(
+                std::min<uint64_t>(entry.local_offset, MAX_UINT32_FIELD));
+
+        // Fields must be in this order and are only present if the
+        // corresponding header field is saturated
+        if (uncompressed_size == MAX_UINT32_FIELD) {
+            append_le64(zip64, entry.uncompressed_size);
+        }
+        if (compressed_size == MAX_UINT32_FIELD) {
+            append_le64(zip64, entry.compressed_size);
+        }
+        if (local_offset == MAX_UINT32_FIELD) {
+            append_le64(zip64, entry.local_offset);
+        }
+
+        std::vector<unsigned char> extra;
+        uint16_t version_needed = entry.version_needed;
+
+        if (!zip64.empty()) {
+            append_le16(extra, ZIP64_EXTRA_ID);
+            append_le16(extra, static_cast<uint16_t>(zip64.size()));
+            append_bytes(extra, zip64.data(), zip64.size());
+            version_needed = std::max(version_needed, ZIP64_VERSION);
+        }
+        append_bytes(extra, entry.extra.data(), entry.extra.size());
+
+        if (entry.name.size() > MAX_UINT16_FIELD
+                || extra.size() > MAX_UINT16_FIELD) {
+            LOGE("%s: Header fields are too large", entry.name.c_str());
+            return ErrorCode::ArchiveWriteHeaderError;
+        }
+
+        append_le32(buf, CENTRAL_HEADER_SIG);
+        append_le16(buf, entry.version_made_by);
+        append_le16(buf, version_needed);
+        append_le16(buf, entry.flags);
+        append_le16(buf, entry.method);
+        append_le16(buf, entry.dos_time);
+        append_le16(buf, entry.dos_date);
+        append_le32(buf, entry.crc);
+        append_le32(buf, compressed_size);
+        append_le32(buf, uncompressed_size);
+        append_le16(buf, static_cast<uint16_t>(entry.name.size()));
+        append_le16(buf, static_cast<uint16_t>(extra.size()));
+        append_le16(buf, static_cast<uint16_t>(entry.comment.size()));
+        append_le16(buf, 0);
+        append_le16(buf, entry.internal_attrs);
+        append_le32(buf, entry.external_attrs);
+        append_le32(buf, local_offset);
+        append_bytes(buf, entry.name.data(), entry.name.size());
+        append_bytes(buf, extra.data(), extra.size());
+        append_bytes(buf, entry.comment.data(), entry.comment.size());
+
+        if (buf.size() >= COPY_BUFFER_SIZE) {
+            result = write(buf.data(), buf.size());
+            if (result != ErrorCode::NoError) {
+                return result;
+            }
+            buf.clear();
+        }
+    }
+
+    uint64_t cd_size = m_output_offset + buf.size() - cd_offset;
+    uint64_t count = m_output_entries.size();
+
+    if (count >= MAX_UINT16_FIELD || cd_size >= MAX_UINT32_FIELD
+            || cd_offset >= MAX_UINT32_FIELD) {
+        uint64_t zip64_eocd_offset = cd_offset + cd_size;
+
+        append_le32(buf, ZIP64_EOCD_SIG);
+        append_le64(buf, ZIP64_EOCD_SIZE - 12);
+        append_le16(buf, ZIP64_VERSION);
+        append_le16(buf, ZIP64_VERSION);
+        append_le32(buf, 0);
+        append_le32(buf, 0);
+        append_le64(buf, count);
+        append_le64(buf, count);
+        append_le64(buf, cd_size);
+        append_le64(buf, cd_offset);
+
+        append_le32(buf, ZIP64_LOCATOR_SIG);
+        append_le32(buf, 0);
+        append_le64(buf, zip64_eocd_offset);
+        append_le32(buf, 1);
+    }
+
+    append_le32(buf, EOCD_SIG);
+    append_le16(buf, 0);
+    append_le16(buf, 0);
+    append_le16(buf, static_cast<uint16_t>(
+            std::min<uint64_t>(count, MAX_UINT16_FIELD)));
+    append_le16(buf, static_cast<uint16_t>(
+            std::min<uint64_t>(count, MAX_UINT16_FIELD)));
+    append_le32(buf, static_cast<uint32_t>(
+            std::min<uint64_t>(cd_size, MAX_UINT32_FIELD)));
+    append_le32(buf, static_cast<uint32_t>(
+            std::min<uint64_t>(cd_offset, MAX_UINT32_FIELD)));
+    append_le16(buf, 0);
+
+    result = write(buf.data(), buf.size());
+    if (result != ErrorCode::NoError) {
+        return result;
+    }
+
+    (void) m_input.close();
+
+    auto close_ret = m_output.close();
+    if (!close_ret) {
+        LOGE("Failed to close output zip: %s",
+             close_ret.error().message().c_str());
+        return ErrorCode::FileCloseError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Number of entries in the input zip
+ */
+uint64_t ZipSplicer::entries() const
+{
+    return m_input_entries.size();
+}
+
+/*!
+ * \brief Total uncompressed size of the entries in the input zip
+ */
+uint64_t ZipSplicer::total_size() const
+{
+    uint64_t size = 0;
+
+    for (auto const &entry : m_input_entries) {
+        size += entry.uncompressed_size;
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Copy entries from the input zip to the output zip
+ *
+ * Entries are copied in the order that they appear in the input zip. Runs of
+ * entries that are neither excluded nor renamed are copied as a single byte
+ * range.
+ *
+ * \param exclude Entries to skip
+ * \param renames Entries to copy under a different name. Only the local header
+ *                is rewritten for these.
+ * \param cb Callback for progress updates. The entry count includes skipped
+ *           entries and the byte count is in terms of uncompressed sizes.
+ *           Patching is cancelled if the callback returns false.
+ * \param userdata User data pointer to pass to \p cb
+ *
+ * \return ErrorCode::PatchingCancelled if the callback cancelled the copy
+ */
+ErrorCode ZipSplicer::copy_entries(
+        const std::unordered_set<std::string> &exclude,
+        const std::unordered_map<std::string, std::string> &renames,
+        ProgressCallback cb, void *userdata)
+{
+    auto const &entries = m_input_entries;
+    size_t i = 0;
+
+    auto is_untouched = [&](const Entry &entry) {
+        return exclude.find(entry.name) == exclude.end()
+                && renames.find(entry.name) == renames.end();
+    };
+
+    while (i < entries.size()) {
+        auto const &entry = entries[i];
+
+        if (exclude.find(entry.name) != exclude.end()) {
+            ++m_copied_entries;
+            ++i;
+        } else {
+            auto it = renames.find(entry.name);
+            if (it != renames.end()) {
+                auto ret = copy_renamed(entry, it->second);
+                if (ret != ErrorCode::NoError) {
+                    return ret;
+                }
+
+                m_copied_bytes += entry.uncompressed_size;
+                ++m_copied_entries;
+                ++i;
+            } else {
+                size_t end = i + 1;
+                while (end < entries.size() && is_untouched(entries[end])) {
+                    ++end;
+                }
+
+                auto ret = copy_run(entries, i, end, cb, userdata);
+                if (ret != ErrorCode::NoError) {
+                    return ret;
+                }
+
+                i = end;
+                continue;
+            }
+        }
+
+        if (cb && !cb(m_copied_entries, m_copied_bytes, userdata)) {
+            return ErrorCode::PatchingCancelled;
+        }
+    }
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Add precompressed entry to the output zip
+ */
+ErrorCode ZipSplicer::add_deflated_file(
+        const std::string &name, const MinizipUtils::DeflatedData &deflated)
+{
+    if (name.size() > MAX_UINT16_FIELD) {
+        LOGE("%s: Name is too long", name.c_str());
+        return ErrorCode::ArchiveWriteHeaderError;
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.version_made_by = DEFAULT_VERSION;
+    entry.flags = 0;
+    entry.method = METHOD_DEFLATED;
+    entry.dos_time = static_cast<uint16_t>(deflated.dos_date);
+    entry.dos_date = static_cast<uint16_t>(deflated.dos_date >> 16);
+    entry.crc = deflated.crc;
+    entry.compressed_size = deflated.data.size();
+    entry.uncompressed_size = deflated.uncompressed_size;
+    entry.internal_attrs = 0;
+    entry.external_attrs = 0;
+    entry.local_offset = m_output_offset;
+    entry.record_end = 0;
+
+    bool zip64 = entry.compressed_size >= MAX_UINT32_FIELD
+            || entry.uncompressed_size >= MAX_UINT32_FIELD;
+
+    entry.version_needed = zip64 ? ZIP64_VERSION : DEFAULT_VERSION;
+
+    std::vector<unsigned char> header;
+
+    append_le32(header, LOCAL_HEADER_SIG);
+    append_le16(header, entry.version_needed);
+    append_le16(header, entry.flags);
+    append_le16(header, entry.method);
+    append_le16(header, entry.dos_time);
+    append_le16(header, entry.dos_date);
+    append_le32(header, entry.crc);
+    if (zip64) {
+        // Both sizes must be in the local zip64 extra field
+        append_le32(header, MAX_UINT32_FIELD);
+        append_le32(header, MAX_UINT32_FIELD);
+    } else {
+        append_le32(header, static_cast<uint32_t>(entry.compressed_size));
+        append_le32(header, static_cast<uint32_t>(entry.uncompressed_size));
+    }
+    append_le16(header, static_cast<uint16_t>(name.size()));
+    append_le16(header, zip64 ? 20 : 0);
+    append_bytes(header, name.data(), name.size());
+    if (zip64) {
+        append_le16(header, ZIP64_EXTRA_ID);
+        append_le16(header, 16);
+        append_le64(header, entry.uncompressed_size);
+        append_le64(header, entry.compressed_size);
+    }
+
+    auto ret = write(header.data(), header.size());
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    ret = write(deflated.data.data(), deflated.data.size());
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    m_output_entries.push_back(std::move(entry));
+
+    return ErrorCode::NoError;
+}
+
+ErrorCode ZipSplicer::read_central_directory()
+{
+    auto file_size = m_input.seek(0, SEEK_END);
+    if (!file_size) {
+        LOGE("Failed to seek input zip: %s",
+             file_size.error().message().c_str());
+        return ErrorCode::FileSeekError;
+    }
+
+    if (file_size.value() < EOCD_SIZE) {
+        LOGE("Input zip is too small");
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    // The end of central directory record is followed by a comment of up to
+    // 64 KiB
+    size_t tail_size = static_cast<size_t>(std::min<uint64_t>(
+            file_size.value(), EOCD_SIZE + MAX_COMMENT_SIZE));
+    uint64_t tail_offset = file_size.value() - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+
+    auto ret = file_pread_exact(m_input, tail.data(), tail.size(),
+                                tail_offset);
+    if (!ret) {
+        LOGE("Failed to read end of input zip: %s",
+             ret.error().message().c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    size_t eocd_pos = tail_size - EOCD_SIZE;
+    bool found = false;
+
+    while (true) {
+        const unsigned char *p = tail.data() + eocd_pos;
+
+        if (read_le32(p) == EOCD_SIG
+                && eocd_pos + EOCD_SIZE + read_le16(p + 20) <= tail_size) {
+            found = true;
+            break;
+        }
+
+        if (eocd_pos == 0) {
+            break;
+        }
+        --eocd_pos;
+    }
+
+    if (!found) {
+        LOGE("Failed to find end of central directory record");
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    const unsigned char *eocd = tail.data() + eocd_pos;
+    uint64_t eocd_offset = tail_offset + eocd_pos;
+    uint16_t disk = read_le16(eocd + 4);
+    uint16_t cd_disk = read_le16(eocd + 6);
+    uint64_t disk_entries = read_le16(eocd + 8);
+    uint64_t entries = read_le16(eocd + 10);
+    uint64_t cd_size = read_le32(eocd + 12);
+    uint64_t cd_offset = read_le32(eocd + 16);
+    // Offset of the first zip64 or regular end of central directory record
+    uint64_t cd_limit = eocd_offset;
+
+    if (eocd_offset >= ZIP64_LOCATOR_SIZE) {
+        unsigned char locator[ZIP64_LOCATOR_SIZE];
+
+        ret = file_pread_exact(m_input, locator, sizeof(locator),
+                               eocd_offset - ZIP64_LOCATOR_SIZE);
+        if (!ret) {
+            LOGE("Failed to read zip64 locator: %s",
+                 ret.error().message().c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        if (read_le32(locator) == ZIP64_LOCATOR_SIG) {
+            uint64_t zip64_eocd_offset = read_le64(locator + 8);
+            unsigned char zip64_eocd[ZIP64_EOCD_SIZE];
+
+            if (read_le32(locator + 4) != 0 || read_le32(locator + 16) != 1
+                    || zip64_eocd_offset > eocd_offset - ZIP64_LOCATOR_SIZE
+                            - ZIP64_EOCD_SIZE) {
+                LOGE("Multi-disk or invalid zip64 archives are not supported");
+                return ErrorCode::ArchiveReadHeaderError;
+            }
+
+            ret = file_pread_exact(m_input, zip64_eocd, sizeof(zip64_eocd),
+                                   zip64_eocd_offset);
+            if (!ret || read_le32(zip64_eocd) != ZIP64_EOCD_SIG) {
+                LOGE("Failed to read zip64 end of central directory record");
+                return ErrorCode::ArchiveReadHeaderError;
+            }
+
+            disk = read_le32(zip64_eocd + 16) == 0 ? 0 : 1;
+            cd_disk = read_le32(zip64_eocd + 20) == 0 ? 0 : 1;
+            disk_entries = read_le64(zip64_eocd + 24);
+            entries = read_le64(zip64_eocd + 32);
+            cd_size = read_le64(zip64_eocd + 40);
+            cd_offset = read_le64(zip64_eocd + 48);
+            cd_limit = zip64_eocd_offset;
+        }
+    }
+
+    if (disk != 0 || cd_disk != 0 || disk_entries != entries) {
+        LOGE("Multi-disk archives are not supported");
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    if (cd_offset > cd_limit || cd_size > cd_limit - cd_offset) {
+        LOGE("Central directory is out of bounds");
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    // cd_size is bounded by the file size, but may not fit in memory on
+    // 32-bit systems
+    if (cd_size > SIZE_MAX) {
+        LOGE("Central directory is too large: %" PRIu64, cd_size);
+        return ErrorCode::MemoryAllocationError;
+    }
+
+    std::vector<unsigned char> cd(static_cast<size_t>(cd_size));
+
+    ret = file_pread_exact(m_input, cd.data(), cd.size(), cd_offset);
+    if (!ret) {
+        LOGE("Failed to read central directory: %s",
+             ret.error().message().c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<Entry> result;
+    size_t pos = 0;
+
+    for (uint64_t i = 0; i < entries; ++i) {
+        if (cd.size() - pos < CENTRAL_HEADER_SIZE
+                || read_le32(cd.data() + pos) != CENTRAL_HEADER_SIG) {
+            LOGE("Invalid central directory header at entry %" PRIu64, i);
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        const unsigned char *p = cd.data() + pos;
+        size_t name_size = read_le16(p + 28);
+        size_t extra_size = read_le16(p + 30);
+        size_t comment_size = read_le16(p + 32);
+        uint16_t disk_start = read_le16(p + 34);
+
+        if (cd.size() - pos - CENTRAL_HEADER_SIZE
+                < name_size + extra_size + comment_size) {
+            LOGE("Truncated central directory header at entry %" PRIu64, i);
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        const unsigned char *name = p + CENTRAL_HEADER_SIZE;
+        const unsigned char *extra = name + name_size;
+        const unsigned char *comment = extra + extra_size;
+
+        Entry entry;
+        entry.name.assign(reinterpret_cast<const char *>(name), name_size);
+        entry.version_made_by = read_le16(p + 4);
+        entry.version_needed = read_le16(p + 6);
+        entry.flags = read_le16(p + 8);
+        entry.method = read_le16(p + 10);
+        entry.dos_time = read_le16(p + 12);
+        entry.dos_date = read_le16(p + 14);
+        entry.crc = read_le32(p + 16);
+        entry.compressed_size = read_le32(p + 20);
+        entry.uncompressed_size = read_le32(p + 24);
+        entry.comment.assign(comment, comment + comment_size);
+        entry.internal_attrs = read_le16(p + 36);
+        entry.external_attrs = read_le32(p + 38);
+        entry.local_offset = read_le32(p + 42);
+
+        // Split the zip64 extended information from the other extra fields.
+        // It is regenerated when the central directory is written.
+        for (size_t extra_pos = 0; extra_pos < extra_size;) {
+            if (extra_size - extra_pos < 4) {
+                // Keep trailing padding as-is
+                entry.extra.insert(entry.extra.end(), extra + extra_pos,
+                                   extra + extra_size);
+                break;
+            }
+
+            const unsigned char *field = extra + extra_pos;
+            uint16_t id = read_le16(field);
+            size_t size = read_le16(field + 2);
+
+            if (size > extra_size - extra_pos - 4) {
+                LOGE("%s: Invalid extra field", entry.name.c_str());
+                return ErrorCode::ArchiveReadHeaderError;
+            }
+
+            if (id == ZIP64_EXTRA_ID) {
+                const unsigned char *data = field + 4;
+                const unsigned char *data_end = data + size;
+
+                auto read_field = [&](uint64_t &value) {
+                    if (value != MAX_UINT32_FIELD) {
+                        return true;
+                    } else if (data_end - data < 8) {
+                        return false;
+                    }
+                    value = read_le64(data);
+                    data += 8;
+                    return true;
+                };
+
+                if (!read_field(entry.uncompressed_size)
+                        || !read_field(entry.compressed_size)
+                        || !read_field(entry.local_offset)) {
+                    LOGE("%s: Invalid zip64 extra field", entry.name.c_str());
+                    return ErrorCode::ArchiveReadHeaderError;
+                }
+
+                if (disk_start == MAX_UINT16_FIELD && data_end - data >= 4) {
+                    disk_start = read_le32(data) == 0 ? 0 : 1;
+                }
+            } else {
+                entry.extra.insert(entry.extra.end(), field,
+                                   field + 4 + size);
+            }
+
+            extra_pos += 4 + size;
+        }
+
+        if (disk_start != 0) {
+            LOGE("%s: Multi-disk archives are not supported",
+                 entry.name.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        result.push_back(std::move(entry));
+        pos += CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size;
+    }
+
+    // Local records are copied in file order. Each record extends to the
+    // start of the next one, which covers the data descriptor, if any.
+    std::stable_sort(result.begin(), result.end(),
+                     [](const Entry &a, const Entry &b) {
+        return a.local_offset < b.local_offset;
+    });
+
+    for (size_t i = 0; i < result.size(); ++i) {
+        uint64_t end = i + 1 < result.size()
+                ? result[i + 1].local_offset : cd_offset;
+
+        if (end <= result[i].local_offset
+                || end - result[i].local_offset
+                        < LOCAL_HEADER_SIZE + result[i].compressed_size) {
+            LOGE("%s: Local file record overlaps with another record",
+                 result[i].name.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        result[i].record_end = end;
+    }
+
+    m_input_entries.swap(result);
+    m_input_cd_offset = cd_offset;
+
+    return ErrorCode::NoError;
+}
+
+ErrorCode ZipSplicer::copy_run(const std::vector<Entry> &entries,
+                               size_t begin, size_t end,
+                               ProgressCallback cb, void *userdata)
+{
+    uint64_t start = entries[begin].local_offset;
+    uint64_t stop = entries[end - 1].record_end;
+
+    for (size_t i = begin; i < end; ++i) {
+        Entry entry = entries[i];
+        entry.local_offset = m_output_offset + (entry.local_offset - start);
+        m_output_entries.push_back(std::move(entry));
+    }
+
+    uint64_t offset = start;
+    size_t i = begin;
+
+    while (offset < stop) {
+        uint64_t n = std::min(stop - offset, COPY_CHUNK_SIZE);
+
+        auto ret = copy_data(offset, n);
+        if (ret != ErrorCode::NoError) {
+            return ret;
+        }
+
+        offset += n;
+
+        for (; i < end && entries[i].record_end <= offset; ++i) {
+            m_copied_bytes += entries[i].uncompressed_size;
+            ++m_copied_entries;
+        }
+
+        // Scale partially copied entry to its uncompressed size
+        uint64_t partial = 0;
+
+        if (i < end && offset > entries[i].local_offset) {
+            double ratio = static_cast<double>(
+                    offset - entries[i].local_offset)
+                    / static_cast<double>(
+                    entries[i].record_end - entries[i].local_offset);
+            partial = static_cast<uint64_t>(
+                    ratio * static_cast<double>(entries[i].uncompressed_size));
+        }
+
+        if (cb && !cb(m_copied_entries, m_copied_bytes + partial, userdata)) {
+            return ErrorCode::PatchingCancelled;
+        }
+    }
+
+    return ErrorCode::NoError;
+}
+
+ErrorCode ZipSplicer::copy_renamed(const Entry &entry, const std::string &name)
+{
+    if (name.size() > MAX_UINT16_FIELD) {
+        LOGE("%s: Name is too long", name.c_str());
+        return ErrorCode::ArchiveWriteHeaderError;
+    }
+
+    unsigned char header[LOCAL_HEADER_SIZE];
+
+    auto ret = file_pread_exact(m_input, header, sizeof(header),
+                                entry.local_offset);
+    if (!ret || read_le32(header) != LOCAL_HEADER_SIG) {
+        LOGE("%s: Failed to read local header", entry.name.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    uint64_t name_size = read_le16(header + 26);
+    uint64_t extra_size = read_le16(header + 28);
+    uint64_t data_offset = entry.local_offset + LOCAL_HEADER_SIZE + name_size
+            + extra_size;
+
+    if (data_offset > entry.record_end) {
+        LOGE("%s: Local header is out of bounds", entry.name.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<unsigned char> extra(static_cast<size_t>(extra_size));
+
+    ret = file_pread_exact(m_input, extra.data(), extra.size(),
+                           data_offset - extra_size);
+    if (!ret) {
+        LOGE("%s: Failed to read local extra field", entry.name.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    write_le16(header + 26, static_cast<uint16_t>(name.size()));
+
+    std::vector<unsigned char> buf;
+    append_bytes(buf, header, sizeof(header));
+    append_bytes(buf, name.data(), name.size());
+    append_bytes(buf, extra.data(), extra.size());
+
+    Entry renamed = entry;
+    renamed.name = name;
+    renamed.local_offset = m_output_offset;
+
+    auto result = write(buf.data(), buf.size());
+    if (result != ErrorCode::NoError) {
+        return result;
+    }
+
+    // Data and data descriptor are unchanged
+    result = copy_data(data_offset, entry.record_end - data_offset);
+    if (result != ErrorCode::NoError) {
+        return result;
+    }
+
+    m_output_entries.push_back(std::move(renamed));
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Copy byte range from the input zip to the end of the output zip
+ */
+ErrorCode ZipSplicer::copy_data(uint64_t offset, uint64_t size)
+{
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    while (m_kernel_copy && size > 0) {
+        auto in_offset = static_cast<loff_t>(offset);
+        auto out_offset = static_cast<loff_t>(m_output_offset);
+
+        ssize_t n = syscall(__NR_copy_file_range, m_input_fd, &in_offset,
+                            m_output_fd, &out_offset,
+                            static_cast<size_t>(size), 0u);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (is_unsupported_copy_error(errno)) {
+                // Fall back to copying the rest through a buffer
+                m_kernel_copy = false;
+                break;
+            }
+
+            LOGE("Failed to copy data: %s", strerror(errno));
+            return ErrorCode::ArchiveWriteDataError;
+        } else if (n == 0) {
+            LOGE("Input zip was truncated while copying");
+            return ErrorCode::ArchiveReadDataError;
+        }
+
+        offset += static_cast<uint64_t>(n);
+        size -= static_cast<uint64_t>(n);
+        m_output_offset += static_cast<uint64_t>(n);
+    }
+#endif
+
+    if (size == 0) {
+        return ErrorCode::NoError;
+    }
+
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(size, COPY_BUFFER_SIZE)));
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+
+        auto ret = file_pread_exact(m_input, buf.data(), n, offset);
+        if (!ret) {
+            LOGE("Failed to read input zip: %s",
+                 ret.error().message().c_str());
+            return ErrorCode::ArchiveReadDataError;
+        }
+
+        auto result = write(buf.data(), n);
+        if (result != ErrorCode::NoError) {
+            return result;
+        }
+
+        offset += n;
+        size -= n;
+    }
+
+    return ErrorCode::NoError;
+}
+
+ErrorCode ZipSplicer::write(const void *data, size_t size)
+{
+    auto ret = file_pwrite_exact(m_output, data, size, m_output_offset);
+    if (!ret) {
+        LOGE("Failed to write output zip: %s", ret.error().message().c_str());
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    m_output_offset += size;
+
+    return ErrorCode::NoError;
+}
+
+}
+}
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "mbcommon/common.h"
 
@@ -29,6 +30,9 @@ namespace io
 {
 
 MB_EXPORT bool create_directories(const std::string &path);
+MB_EXPORT bool is_directory(const std::string &path);
+MB_EXPORT bool list_files(const std::string &path,
+                          std::vector<std::string> &names);
 
 }
 }
@@ -22,6 +22,7 @@
 #include <cstring>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
 
@@ -31,6 +32,7 @@
 #  include <windows.h>
 #else
 #  include <cerrno>
+#  include <dirent.h>
 #  include <sys/stat.h>
 #endif
 
@@ -105,5 +107,151 @@ bool create_directories(const std::string &path)
     return true;
 }
 
+/*!
+ * \brief Check whether a path refers to a directory
+ *
+ * Symlinks are followed. If the path cannot be examined (eg. because it does
+ * not exist), the last error is set and false is returned.
+ *
+ * \param path Path to check
+ *
+ * \return Whether \p path exists and is a directory
+ */
+bool is_directory(const std::string &path)
+{
+#ifdef _WIN32
+    auto w_path = mb::utf8_to_wcs(path);
+    if (!w_path) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to convert UTF-8 to UTF-16: %s",
+                path.c_str(), w_path.error().message().c_str()));
+        return false;
+    }
+
+    DWORD dw_attrib = GetFileAttributesW(w_path.value().c_str());
+    if (dw_attrib == INVALID_FILE_ATTRIBUTES) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to get attributes: %s",
+                path.c_str(), mb::ec_from_win32().message().c_str()));
+        return false;
+    }
+
+    return dw_attrib & FILE_ATTRIBUTE_DIRECTORY;
+#else
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) < 0) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to stat: %s", path.c_str(), strerror(errno)));
+        return false;
+    }
+
+    return S_ISDIR(sb.st_mode);
+#endif
+}
+
+/*!
+ * \brief Get names of the regular files in a directory
+ *
+ * Subdirectories are not traversed and entries that are not regular files
+ * (eg. directories, devices, and broken symlinks) are skipped. The names are
+ * returned in the order that the OS reports them.
+ *
+ * \param[in] path Directory path
+ * \param[out] names Output list of file names (not full paths)
+ *
+ * \return Whether the directory was successfully read
+ */
+bool list_files(const std::string &path, std::vector<std::string> &names)
+{
+    names.clear();
+
+#ifdef _WIN32
+    auto w_pattern = mb::utf8_to_wcs(path + "\\*");
+    if (!w_pattern) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to convert UTF-8 to UTF-16: %s",
+                path.c_str(), w_pattern.error().message().c_str()));
+        return false;
+    }
+
+    WIN32_FIND_DATAW data;
+    HANDLE h_find = FindFirstFileW(w_pattern.value().c_str(), &data);
+    if (h_find == INVALID_HANDLE_VALUE) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to open directory: %s",
+                path.c_str(), mb::ec_from_win32().message().c_str()));
+        return false;
+    }
+
+    auto close_find = finally([&] {
+        FindClose(h_find);
+    });
+
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+
+        auto name = mb::wcs_to_utf8(data.cFileName);
+        if (!name) {
+            set_last_error(Error::PlatformError, mb::format(
+                    "%s: Failed to convert UTF-16 to UTF-8: %s",
+                    path.c_str(), name.error().message().c_str()));
+            return false;
+        }
+
+        names.push_back(std::move(name.value()));
+    } while (FindNextFileW(h_find, &data));
+
+    if (GetLastError() != ERROR_NO_MORE_FILES) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to read directory: %s",
+                path.c_str(), mb::ec_from_win32().message().c_str()));
+        return false;
+    }
+#else
+    DIR *dp = opendir(path.c_str());
+    if (!dp) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to open directory: %s",
+                path.c_str(), strerror(errno)));
+        return false;
+    }
+
+    auto close_dir = finally([&] {
+        closedir(dp);
+    });
+
+    struct dirent *ent;
+    struct stat sb;
+
+    while (true) {
+        errno = 0;
+        ent = readdir(dp);
+        if (!ent) {
+            break;
+        }
+
+        std::string file_path(path);
+        file_path += '/';
+        file_path += ent->d_name;
+
+        if (stat(file_path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+            names.emplace_back(ent->d_name);
+        }
+    }
+
+    if (errno != 0) {
+        set_last_error(Error::PlatformError, mb::format(
+                "%s: Failed to read directory: %s",
+                path.c_str(), strerror(errno)));
+        return false;
+    }
+#endif
+
+    return true;
+}
+
 }
 }
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+#include "mbcommon/flags.h"
+#include "mbcommon/outcome.h"
+
+#include "mbsparse/sparse.h"
+
+namespace mb
+{
+namespace sparse
+{
+
+enum class FlashFlag : uint8_t
+{
+    //! Discard "don't care" regions with `BLKDISCARD`
+    DiscardDontCare = 1 << 0,
+    //! Zero "don't care" regions with `BLKZEROOUT`
+    ZeroDontCare    = 1 << 1,
+};
+MB_DECLARE_FLAGS(FlashFlags, FlashFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(FlashFlags)
+
+using FlashProgressCb = void (*)(uint64_t bytes, uint64_t total,
+                                 void *userdata);
+
+MB_EXPORT oc::result<void> flash_sparse_file(SparseFile &file, int fd,
+                                             FlashFlags flags,
+                                             FlashProgressCb progress_cb,
+                                             void *userdata);
+
+}
+}
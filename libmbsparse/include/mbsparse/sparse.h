@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "mbcommon/file.h"
+#include "mbcommon/optional.h"
 
 #include "mbsparse/sparse_p.h"
 
@@ -31,6 +32,22 @@ namespace mb
 namespace sparse
 {
 
+/*!
+ * \brief Range of the output file described by a single sparse chunk
+ */
+struct SparseExtent
+{
+    /*! \brief Chunk type (`CHUNK_TYPE_RAW`, `CHUNK_TYPE_FILL`, or
+     *         `CHUNK_TYPE_DONT_CARE`) */
+    uint16_t type;
+    /*! \brief Start of byte range in output file */
+    uint64_t begin;
+    /*! \brief End of byte range in output file */
+    uint64_t end;
+    /*! \brief Fill value for `CHUNK_TYPE_FILL` chunks */
+    uint32_t fill_val;
+};
+
 class MB_EXPORT SparseFile : public File
 {
 public:
@@ -49,11 +66,20 @@ public:
     // File size
     uint64_t size();
 
+    // Chunk index
+    oc::result<void> write_index(File &file);
+    oc::result<void> read_index(File &file);
+
+    // Chunk iteration
+    oc::result<optional<SparseExtent>> current_extent();
+
 protected:
     oc::result<void> on_open() override;
     oc::result<void> on_close() override;
     oc::result<size_t> on_read(void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<size_t> on_pread(void *buf, size_t size,
+                                uint64_t offset) override;
 
 private:
     void clear();
@@ -80,6 +106,8 @@ private:
 
     File *m_file;
     detail::Seekability m_seekability;
+    // Absolute offset of the sparse data in the input file (if seekable)
+    uint64_t m_base_offset;
 
     // Expected CRC32 checksum. We currently do *not* validate this. It would
     // only work if the entire file was read sequentially anyway.
@@ -46,6 +46,9 @@ enum class SparseFileError
     InvalidCrc32Chunk           = 36,
 
     InternalError               = 40,
+
+    // Chunk index errors
+    InvalidIndex                = 50,
 };
 
 MB_EXPORT std::error_code make_error_code(SparseFileError e);
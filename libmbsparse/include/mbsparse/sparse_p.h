@@ -94,6 +94,37 @@ struct ChunkInfo
     uint32_t fill_val;
 };
 
+constexpr char INDEX_MAGIC[8] = { 'M', 'B', 'S', 'P', 'I', 'D', 'X', '\0' };
+constexpr uint32_t INDEX_VERSION =          1;
+
+/*
+ * Chunk index format (all integers are little endian):
+ * - IndexHeader
+ * - IndexEntry for each chunk (IndexHeader::shdr.total_chunks entries)
+ */
+
+struct IndexHeader
+{
+    char magic[8];           // INDEX_MAGIC
+    uint32_t version;        // INDEX_VERSION
+    uint32_t entry_sz;       // sizeof(IndexEntry)
+    SparseHeader shdr;       // Copy of the sparse header of the indexed file
+    uint32_t reserved;
+};
+
+struct IndexEntry
+{
+    uint16_t type;           // Same as ChunkInfo::type
+    uint16_t reserved1;
+    uint32_t fill_val;       // Same as ChunkInfo::fill_val
+    uint64_t begin;          // Same as ChunkInfo::begin
+    uint64_t end;            // Same as ChunkInfo::end
+    uint64_t src_begin;      // Same as ChunkInfo::src_begin
+    uint64_t src_end;        // Same as ChunkInfo::src_end
+    uint64_t raw_begin;      // Same as ChunkInfo::raw_begin
+    uint64_t raw_end;        // Same as ChunkInfo::raw_end
+};
+
 enum class Seekability : uint8_t
 {
     CanSeek,
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse_p.h"
+
+namespace mb
+{
+namespace sparse
+{
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+
+    SparseWriter();
+    SparseWriter(File *file);
+    SparseWriter(File *file, uint32_t block_size, bool crc32);
+    virtual ~SparseWriter();
+
+    SparseWriter(SparseWriter &&other) noexcept;
+    SparseWriter & operator=(SparseWriter &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file);
+    oc::result<void> open(File *file, uint32_t block_size, bool crc32);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> write_blocks(const unsigned char *data, size_t n_blocks);
+    oc::result<void> begin_chunk(uint16_t type, uint32_t fill_val);
+    oc::result<void> end_chunk();
+    oc::result<void> write_crc32_chunk();
+    oc::result<void> write_sparse_header();
+
+    File *m_file;
+    uint32_t m_block_size;
+    bool m_crc32_enabled;
+
+    // Offset of the sparse header in the output file
+    uint64_t m_base_offset;
+    // Current offset in the output file
+    uint64_t m_cur_offset;
+
+    // Partial block that has not been encoded yet
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Running CRC32 checksum of the unsparsed data
+    uint32_t m_crc32;
+
+    uint32_t m_total_blocks;
+    uint32_t m_total_chunks;
+
+    // Chunk that is currently being built (0 if there is none)
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    uint32_t m_chunk_fill_val;
+    // [CHUNK_TYPE_RAW only] Offset of the chunk header in the output file
+    uint64_t m_chunk_offset;
+    /*! \endcond */
+};
+
+}
+}
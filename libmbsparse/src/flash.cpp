@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/flash.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_util.h"
+
+namespace mb
+{
+namespace sparse
+{
+
+using namespace detail;
+
+/*! \brief Size of the I/O buffers used for raw and fill chunks */
+static constexpr size_t FLASH_BUF_SIZE = 1024 * 1024;
+/*! \brief Alignment of the I/O buffers (suitable for O_DIRECT) */
+static constexpr size_t FLASH_BUF_ALIGN = 4096;
+
+using AlignedBuf = std::unique_ptr<unsigned char, decltype(free) *>;
+
+static oc::result<AlignedBuf> alloc_aligned(size_t size)
+{
+    void *ptr;
+
+    int ret = posix_memalign(&ptr, FLASH_BUF_ALIGN, size);
+    if (ret != 0) {
+        return ec_from_errno(ret);
+    }
+
+    return AlignedBuf(static_cast<unsigned char *>(ptr), &free);
+}
+
+static oc::result<void> pwrite_exact(int fd, const void *buf, size_t size,
+                                     uint64_t offset)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pwrite64(fd, ptr, size, static_cast<off64_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            return std::make_error_code(std::errc::no_space_on_device);
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Issue a block device range ioctl
+ *
+ * \return
+ *   * True if the ioctl succeeded
+ *   * False if the ioctl is not supported for \p fd or the range
+ *   * Otherwise, the error code
+ */
+static oc::result<bool> block_range_ioctl(int fd, unsigned long request,
+                                          uint64_t offset, uint64_t size)
+{
+    uint64_t range[2] = { offset, size };
+
+    if (ioctl(fd, request, &range) < 0) {
+        switch (errno) {
+        case ENOTTY:
+        case EOPNOTSUPP:
+        case EINVAL:
+            return false;
+        default:
+            return ec_from_errno();
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write a sparse file to a block device (or regular file)
+ *
+ * Unlike reading the sparse file sequentially and writing the expanded data,
+ * this processes one chunk at a time:
+ *
+ * * `CHUNK_TYPE_RAW` chunks are copied with large aligned writes.
+ * * `CHUNK_TYPE_FILL` chunks are written from a buffer that is pre-filled with
+ *   the fill value. The sparse file's underlying file is never read.
+ * * `CHUNK_TYPE_DONT_CARE` chunks are skipped entirely, unless
+ *   FlashFlag::DiscardDontCare (`BLKDISCARD`) or FlashFlag::ZeroDontCare
+ *   (`BLKZEROOUT`) is specified. If \p fd does not support `BLKZEROOUT`, zeros
+ *   are written instead. Unsupported `BLKDISCARD` requests are ignored.
+ *
+ * Since the sparse file is only ever seeked forwards, its underlying file does
+ * not need to support seeking.
+ *
+ * If \p fd refers to a regular file, it will be extended to the full size of
+ * the sparse file if the sparse file ends with a skipped region.
+ *
+ * \param file Opened sparse file. Data is written starting from the current
+ *             file position.
+ * \param fd File descriptor of the target. Data is written using positional
+ *           writes at the same offsets as in \p file.
+ * \param flags Flags controlling how "don't care" chunks are handled
+ * \param progress_cb Optional callback to report the number of bytes processed
+ * \param userdata User data pointer to pass to \p progress_cb
+ *
+ * \return Nothing if the sparse file is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> flash_sparse_file(SparseFile &file, int fd, FlashFlags flags,
+                                   FlashProgressCb progress_cb, void *userdata)
+{
+    OUTCOME_TRY(offset, file.seek(0, SEEK_CUR));
+    const uint64_t total = file.size();
+
+    OUTCOME_TRY(buf, alloc_aligned(FLASH_BUF_SIZE));
+
+    // Allocated on demand. The fill buffer has extra room so that writes can
+    // start at any offset within the 4-byte pattern.
+    AlignedBuf fill_buf(nullptr, &free);
+    optional<uint32_t> fill_buf_val;
+
+    auto report = [&](uint64_t bytes) {
+        if (progress_cb) {
+            progress_cb(bytes, total, userdata);
+        }
+    };
+
+    while (true) {
+        OUTCOME_TRY(extent, file.current_extent());
+        if (!extent) {
+            break;
+        }
+
+        switch (extent->type) {
+        case CHUNK_TYPE_RAW:
+            while (offset < extent->end) {
+                auto to_copy = static_cast<size_t>(std::min<uint64_t>(
+                        FLASH_BUF_SIZE, extent->end - offset));
+
+                OUTCOME_TRYV(file_read_exact(file, buf.get(), to_copy));
+                OUTCOME_TRYV(pwrite_exact(fd, buf.get(), to_copy, offset));
+
+                offset += to_copy;
+                report(offset);
+            }
+            break;
+
+        case CHUNK_TYPE_FILL: {
+            if (!fill_buf) {
+                OUTCOME_TRY(new_buf, alloc_aligned(
+                        FLASH_BUF_SIZE + sizeof(uint32_t)));
+                fill_buf = std::move(new_buf);
+            }
+            if (fill_buf_val != extent->fill_val) {
+                uint32_t fill_val = mb_htole32(extent->fill_val);
+                for (size_t i = 0; i < FLASH_BUF_SIZE + sizeof(uint32_t);
+                        i += sizeof(uint32_t)) {
+                    memcpy(fill_buf.get() + i, &fill_val, sizeof(fill_val));
+                }
+                fill_buf_val = extent->fill_val;
+            }
+
+            while (offset < extent->end) {
+                auto shift = (offset - extent->begin) % sizeof(uint32_t);
+                auto to_write = static_cast<size_t>(std::min<uint64_t>(
+                        FLASH_BUF_SIZE, extent->end - offset));
+
+                OUTCOME_TRYV(pwrite_exact(fd, fill_buf.get() + shift,
+                                          to_write, offset));
+
+                offset += to_write;
+                report(offset);
+            }
+
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+            break;
+        }
+
+        case CHUNK_TYPE_DONT_CARE: {
+            uint64_t size = extent->end - offset;
+
+            if (flags & FlashFlag::DiscardDontCare) {
+                OUTCOME_TRYV(block_range_ioctl(fd, BLKDISCARD, offset, size));
+            }
+            if (flags & FlashFlag::ZeroDontCare) {
+                OUTCOME_TRY(zeroed, block_range_ioctl(
+                        fd, BLKZEROOUT, offset, size));
+
+                if (!zeroed) {
+                    memset(buf.get(), 0, FLASH_BUF_SIZE);
+
+                    for (uint64_t pos = offset; pos < extent->end;) {
+                        auto to_write = static_cast<size_t>(
+                                std::min<uint64_t>(FLASH_BUF_SIZE,
+                                                   extent->end - pos));
+                        OUTCOME_TRYV(pwrite_exact(fd, buf.get(), to_write,
+                                                  pos));
+                        pos += to_write;
+                    }
+                }
+            }
+
+            offset = extent->end;
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+            report(offset);
+            break;
+        }
+
+        default:
+            MB_UNREACHABLE("Invalid chunk type: %" PRIu16, extent->type);
+        }
+    }
+
+    // Skipped regions at the end of the image won't extend regular files
+    struct stat64 sb;
+    if (fstat64(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISREG(sb.st_mode) && static_cast<uint64_t>(sb.st_size) < total
+            && ftruncate64(fd, static_cast<off64_t>(total)) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+}
+}
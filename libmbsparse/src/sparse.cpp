@@ -190,6 +190,7 @@ SparseFile::SparseFile(SparseFile &&other) noexcept
     : File(std::move(other))
     , m_file(other.m_file)
     , m_seekability(other.m_seekability)
+    , m_base_offset(other.m_base_offset)
     , m_expected_crc32(other.m_expected_crc32)
     , m_cur_src_offset(other.m_cur_src_offset)
     , m_cur_tgt_offset(other.m_cur_tgt_offset)
@@ -209,6 +210,7 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
 
     m_file = rhs.m_file;
     m_seekability = rhs.m_seekability;
+    m_base_offset = rhs.m_base_offset;
     m_expected_crc32 = rhs.m_expected_crc32;
     m_cur_src_offset = rhs.m_cur_src_offset;
     m_cur_tgt_offset = rhs.m_cur_tgt_offset;
@@ -256,6 +258,227 @@ uint64_t SparseFile::size()
     return m_file_size;
 }
 
+/*!
+ * \brief Write chunk index
+ *
+ * All remaining chunk headers are read (if they haven't been already) and an
+ * index of every chunk is written to \p file. The index can be passed to
+ * read_index() when the same sparse file is opened again to avoid reading all
+ * of the chunk headers.
+ *
+ * \note This function requires the underlying file to support random seeking.
+ *
+ * \param file File to write the index to
+ *
+ * \return Nothing if the index is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseFile::write_index(File &file)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // There is no chunk at the end of the file, so this loads all of them
+    OUTCOME_TRYV(move_to_chunk(m_file_size));
+
+    IndexHeader ihdr = {};
+    memcpy(ihdr.magic, INDEX_MAGIC, sizeof(ihdr.magic));
+    ihdr.version = mb_htole32(INDEX_VERSION);
+    ihdr.entry_sz = mb_htole32(sizeof(IndexEntry));
+    ihdr.shdr = m_shdr;
+    // Byte swapping is symmetric, so this converts back to little endian
+    fix_sparse_header_byte_order(ihdr.shdr);
+
+    std::vector<IndexEntry> entries;
+    entries.reserve(m_chunks.size());
+
+    for (auto const &chunk : m_chunks) {
+        IndexEntry entry = {};
+        entry.type = mb_htole16(chunk.type);
+        entry.fill_val = mb_htole32(chunk.fill_val);
+        entry.begin = mb_htole64(chunk.begin);
+        entry.end = mb_htole64(chunk.end);
+        entry.src_begin = mb_htole64(chunk.src_begin);
+        entry.src_end = mb_htole64(chunk.src_end);
+        entry.raw_begin = mb_htole64(chunk.raw_begin);
+        entry.raw_end = mb_htole64(chunk.raw_end);
+        entries.push_back(entry);
+    }
+
+    OUTCOME_TRYV(file_write_exact(file, &ihdr, sizeof(ihdr)));
+    OUTCOME_TRYV(file_write_exact(file, entries.data(),
+                                  entries.size() * sizeof(IndexEntry)));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Load chunk index
+ *
+ * Load an index previously written by write_index(). Once loaded, any offset in
+ * the sparse file can be located with a binary search without reading any
+ * chunk headers from the underlying file.
+ *
+ * The index is checked against the sparse header and must describe a
+ * contiguous sequence of valid chunks. However, the data in the sparse file is
+ * not read, so the caller is responsible for making sure that the index was
+ * generated from the same file (eg. by comparing modification times).
+ *
+ * \note This function requires the underlying file and \p file to support
+ *       random seeking.
+ *
+ * \param file File to read the index from
+ *
+ * \return Nothing if the index is successfully loaded. Otherwise, the error
+ *         code. If the error is SparseFileError::InvalidIndex, then the sparse
+ *         file can still be used normally.
+ */
+oc::result<void> SparseFile::read_index(File &file)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    IndexHeader ihdr;
+    OUTCOME_TRYV(file_read_exact(file, &ihdr, sizeof(ihdr)));
+
+    fix_sparse_header_byte_order(ihdr.shdr);
+
+    if (memcmp(ihdr.magic, INDEX_MAGIC, sizeof(ihdr.magic)) != 0
+            || mb_le32toh(ihdr.version) != INDEX_VERSION
+            || mb_le32toh(ihdr.entry_sz) != sizeof(IndexEntry)
+            || memcmp(&ihdr.shdr, &m_shdr, sizeof(m_shdr)) != 0) {
+        DEBUG("Index header does not match sparse file");
+        return SparseFileError::InvalidIndex;
+    }
+
+    // Don't trust total_chunks for the allocation until the index is known
+    // to be large enough to hold that many entries
+    OUTCOME_TRY(entries_offset, file.seek(0, SEEK_CUR));
+    OUTCOME_TRY(index_size, file.seek(0, SEEK_END));
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(entries_offset), SEEK_SET));
+
+    if (index_size < entries_offset
+            || (index_size - entries_offset) / sizeof(IndexEntry)
+                    < m_shdr.total_chunks) {
+        DEBUG("Index is too small for %" PRIu32 " chunks",
+              m_shdr.total_chunks);
+        return SparseFileError::InvalidIndex;
+    }
+
+    std::vector<IndexEntry> entries(m_shdr.total_chunks);
+    OUTCOME_TRYV(file_read_exact(file, entries.data(),
+                                 entries.size() * sizeof(IndexEntry)));
+
+    std::vector<ChunkInfo> chunks;
+    chunks.reserve(entries.size());
+
+    uint64_t tgt_offset = 0;
+    uint64_t src_offset = m_shdr.file_hdr_sz;
+
+    for (auto const &entry : entries) {
+        ChunkInfo ci = {};
+        ci.type = mb_le16toh(entry.type);
+        ci.fill_val = mb_le32toh(entry.fill_val);
+        ci.begin = mb_le64toh(entry.begin);
+        ci.end = mb_le64toh(entry.end);
+        ci.src_begin = mb_le64toh(entry.src_begin);
+        ci.src_end = mb_le64toh(entry.src_end);
+        ci.raw_begin = mb_le64toh(entry.raw_begin);
+        ci.raw_end = mb_le64toh(entry.raw_end);
+
+        bool valid = ci.begin == tgt_offset
+                && ci.end >= ci.begin
+                && (ci.end - ci.begin) % m_shdr.blk_sz == 0
+                && ci.src_begin == src_offset
+                && ci.src_end >= ci.src_begin + m_shdr.chunk_hdr_sz;
+
+        switch (ci.type) {
+        case CHUNK_TYPE_RAW:
+            valid = valid
+                    && ci.raw_begin == ci.src_begin + m_shdr.chunk_hdr_sz
+                    && ci.raw_end == ci.src_end
+                    && ci.raw_end - ci.raw_begin == ci.end - ci.begin;
+            break;
+        case CHUNK_TYPE_FILL:
+        case CHUNK_TYPE_DONT_CARE:
+            break;
+        case CHUNK_TYPE_CRC32:
+            valid = valid && ci.begin == ci.end;
+            break;
+        default:
+            valid = false;
+            break;
+        }
+
+        if (!valid) {
+            DEBUG("Invalid index entry for chunk #%" MB_PRIzu, chunks.size());
+            return SparseFileError::InvalidIndex;
+        }
+
+        tgt_offset = ci.end;
+        src_offset = ci.src_end;
+
+        chunks.push_back(std::move(ci));
+    }
+
+    if (tgt_offset != m_file_size) {
+        DEBUG("Indexed chunks end (%" PRIu64 ") before the file size "
+              "specified in the sparse header (%" PRIu64 ")",
+              tgt_offset, m_file_size);
+        return SparseFileError::InvalidIndex;
+    }
+
+    m_chunks = std::move(chunks);
+    m_chunk = m_chunks.end();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get the extent containing the current file position
+ *
+ * The chunk header for the current file position is read if it hasn't been
+ * already. The returned extent always describes the entire chunk, so the
+ * current file position may be after SparseExtent::begin.
+ *
+ * This allows callers to process the sparse file one chunk at a time. For
+ * example, data for a `CHUNK_TYPE_FILL` or `CHUNK_TYPE_DONT_CARE` chunk does
+ * not need to be read at all. The caller can just seek to SparseExtent::end,
+ * which only requires forward skipping even if the underlying file is not
+ * seekable.
+ *
+ * \return
+ *   * The extent containing the current file position
+ *   * Nothing if the current file position is at or past EOF
+ *   * Otherwise, the error code
+ */
+oc::result<optional<SparseExtent>> SparseFile::current_extent()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return optional<SparseExtent>();
+    }
+
+    SparseExtent extent;
+    extent.type = m_chunk->type;
+    extent.begin = m_chunk->begin;
+    extent.end = m_chunk->end;
+    extent.fill_val = m_chunk->fill_val;
+
+    return optional<SparseExtent>(extent);
+}
+
 /*!
  * \brief Open sparse file for reading
  *
@@ -321,6 +544,7 @@ oc::result<void> SparseFile::on_open()
     if (seek_ret) {
         DEBUG("File supports random seeking");
         m_seekability = Seekability::CanSeek;
+        m_base_offset = seek_ret.value();
         m_cur_src_offset -= n;
         n = 0;
     } else if (seek_ret.error() != FileErrorC::Unsupported) {
@@ -400,19 +624,14 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
             OPER("Raw data is %" PRIu64 " bytes into the raw chunk", diff);
 
             uint64_t raw_src_offset = m_chunk->raw_begin + diff;
-            if (raw_src_offset != m_cur_src_offset) {
+            if (raw_src_offset > m_cur_src_offset) {
+                // Forward seeks may have skipped over part of the chunk
+                OUTCOME_TRYV(skip_bytes(raw_src_offset - m_cur_src_offset));
+            } else if (raw_src_offset < m_cur_src_offset) {
                 assert(m_seekability == Seekability::CanSeek);
 
-                int64_t seek_offset;
-                if (raw_src_offset < m_cur_src_offset) {
-                    seek_offset = -static_cast<int64_t>(
-                            m_cur_src_offset - raw_src_offset);
-                } else {
-                    seek_offset = static_cast<int64_t>(
-                            raw_src_offset - m_cur_src_offset);
-                }
-
-                OUTCOME_TRYV(wseek(seek_offset));
+                OUTCOME_TRYV(wseek(-static_cast<int64_t>(
+                        m_cur_src_offset - raw_src_offset)));
             }
 
             OUTCOME_TRYV(wread(buf, static_cast<size_t>(to_read)));
@@ -465,7 +684,10 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
  * \p whence takes the same \a SEEK_SET, \a SEEK_CUR, and \a SEEK_END values as
  * \a lseek() in `\<stdio.h\>`.
  *
- * \note Seeking will only work if the underlying file handle supports seeking.
+ * \note Seeking backwards will only work if the underlying file handle supports
+ *       seeking. Seeking forwards is always supported, though the skipped data
+ *       may need to be read and discarded if the underlying file handle does
+ *       not support forward skipping.
  *
  * \param offset Offset to seek
  * \param whence \a SEEK_SET, \a SEEK_CUR, or \a SEEK_END
@@ -477,11 +699,6 @@ oc::result<uint64_t> SparseFile::on_seek(int64_t offset, int whence)
 {
     OPER("seek(%" PRId64 ", %d)", offset, whence);
 
-    if (m_seekability != Seekability::CanSeek) {
-        DEBUG("Underlying file does not support seeking");
-        return FileError::UnsupportedSeek;
-    }
-
     uint64_t new_offset;
     switch (whence) {
     case SEEK_SET:
@@ -513,6 +730,12 @@ oc::result<uint64_t> SparseFile::on_seek(int64_t offset, int whence)
         MB_UNREACHABLE("Invalid seek whence: %d", whence);
     }
 
+    if (m_seekability != Seekability::CanSeek
+            && new_offset < m_cur_tgt_offset) {
+        DEBUG("Underlying file does not support seeking backwards");
+        return FileError::UnsupportedSeek;
+    }
+
     OUTCOME_TRYV(move_to_chunk(new_offset));
 
     // May move past EOF, which is okay (mimics lseek behavior), but read()
@@ -521,9 +744,92 @@ oc::result<uint64_t> SparseFile::on_seek(int64_t offset, int whence)
     return new_offset;
 }
 
+/*!
+ * \brief Read sparse file at the specified offset
+ *
+ * If all of the chunk headers have been loaded (eg. by read_index() or
+ * write_index()), then this function does not modify any state in the
+ * SparseFile. Raw chunk data is read with a positional read on the underlying
+ * file and fill and "don't care" chunks are synthesized without accessing the
+ * underlying file at all. This function is then safe to call from multiple
+ * threads at once as long as the underlying file's pread() is.
+ *
+ * Otherwise, the positional read is emulated with seek() and read().
+ *
+ * \note This function requires the underlying file to support random seeking.
+ *
+ * \param buf Buffer to read data into
+ * \param size Number of bytes to read
+ * \param offset Offset of the sparse file to read from
+ *
+ * \return Number of bytes read. Fewer than \p size bytes are read only if EOF
+ *         is reached. Otherwise, the error code.
+ */
+oc::result<size_t> SparseFile::on_pread(void *buf, size_t size,
+                                        uint64_t offset)
+{
+    OPER("pread(buf, %" MB_PRIzu ", %" PRIu64 ")", size, offset);
+
+    if (m_seekability != Seekability::CanSeek) {
+        DEBUG("Underlying file does not support seeking");
+        return FileError::UnsupportedSeek;
+    }
+
+    if (m_chunks.size() < m_shdr.total_chunks) {
+        return File::on_pread(buf, size, offset);
+    }
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total_read = 0;
+
+    auto chunk = binary_find(m_chunks.cbegin(), m_chunks.cend(), offset,
+                             OffsetComp());
+
+    for (; chunk != m_chunks.cend() && size > 0; ++chunk) {
+        if (chunk->begin == chunk->end) {
+            // CRC32 chunks do not contain data
+            continue;
+        }
+
+        uint64_t diff = offset - chunk->begin;
+        size_t to_read = static_cast<size_t>(
+                std::min<uint64_t>(size, chunk->end - offset));
+
+        switch (chunk->type) {
+        case CHUNK_TYPE_RAW: {
+            OUTCOME_TRYV(file_pread_exact(*m_file, ptr, to_read,
+                                          m_base_offset + chunk->raw_begin
+                                                  + diff));
+            break;
+        }
+        case CHUNK_TYPE_FILL: {
+            uint32_t fill_val = mb_htole32(chunk->fill_val);
+            auto fill_bytes = reinterpret_cast<unsigned char *>(&fill_val);
+            for (size_t i = 0; i < to_read; ++i) {
+                ptr[i] = fill_bytes[(diff + i) % sizeof(fill_val)];
+            }
+            break;
+        }
+        case CHUNK_TYPE_DONT_CARE:
+            memset(ptr, 0, to_read);
+            break;
+        default:
+            MB_UNREACHABLE("Invalid chunk type: %" PRIu16, chunk->type);
+        }
+
+        ptr += to_read;
+        size -= to_read;
+        offset += to_read;
+        total_read += to_read;
+    }
+
+    return total_read;
+}
+
 void SparseFile::clear()
 {
     m_file = nullptr;
+    m_base_offset = 0;
     m_expected_crc32 = 0;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
@@ -579,6 +885,8 @@ oc::result<void> SparseFile::skip_bytes(uint64_t bytes)
             set_fatal();
             return FileError::UnexpectedEof;
         }
+
+        m_cur_src_offset += bytes;
         return oc::success();
     }
 
@@ -803,8 +1111,12 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidCrc32Chunk;
     }
 
+    uint64_t src_begin = m_cur_src_offset - m_shdr.chunk_hdr_sz;
+
     OUTCOME_TRYV(wread(&crc32, sizeof(crc32)));
 
+    uint64_t src_end = m_cur_src_offset;
+
     m_expected_crc32 = mb_le32toh(crc32);
 
     ChunkInfo ci;
@@ -812,8 +1124,8 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = src_begin;
+    ci.src_end = src_end;
 
     return std::move(ci);
 }
@@ -872,10 +1184,19 @@ SparseFile::process_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
  */
 oc::result<void> SparseFile::move_to_chunk(uint64_t offset)
 {
-    // No action needed if the offset is in the current chunk
-    if (m_chunk != m_chunks.end()
-            && offset >= m_chunk->begin && offset < m_chunk->end) {
-        return oc::success();
+    if (m_chunk != m_chunks.end()) {
+        // No action needed if the offset is in the current chunk
+        if (offset >= m_chunk->begin && offset < m_chunk->end) {
+            return oc::success();
+        }
+
+        // Sequential reads usually continue into the next chunk
+        auto next = std::next(m_chunk);
+        if (next != m_chunks.end()
+                && offset >= next->begin && offset < next->end) {
+            m_chunk = next;
+            return oc::success();
+        }
     }
 
     // If the offset is in the current range of chunks, then do a binary search
@@ -65,6 +65,8 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'crc32' chunk";
     case SparseFileError::InternalError:
         return "(internal error)";
+    case SparseFileError::InvalidIndex:
+        return "invalid or mismatched chunk index";
     default:
         return "(unknown sparse file error)";
     }
@@ -0,0 +1,670 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+#include <array>
+
+#include <cinttypes>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+namespace mb
+{
+using namespace detail;
+
+namespace sparse
+{
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+// Largest raw chunk whose total_sz still fits in a uint32_t
+static uint32_t max_raw_chunk_blocks(uint32_t block_size)
+{
+    return static_cast<uint32_t>(
+            (UINT32_MAX - sizeof(ChunkHeader)) / block_size);
+}
+
+static void fix_sparse_header_byte_order(SparseHeader &header)
+{
+    header.magic = mb_htole32(header.magic);
+    header.major_version = mb_htole16(header.major_version);
+    header.minor_version = mb_htole16(header.minor_version);
+    header.file_hdr_sz = mb_htole16(header.file_hdr_sz);
+    header.chunk_hdr_sz = mb_htole16(header.chunk_hdr_sz);
+    header.blk_sz = mb_htole32(header.blk_sz);
+    header.total_blks = mb_htole32(header.total_blks);
+    header.total_chunks = mb_htole32(header.total_chunks);
+    header.image_checksum = mb_htole32(header.image_checksum);
+}
+
+static void fix_chunk_header_byte_order(ChunkHeader &header)
+{
+    header.chunk_type = mb_htole16(header.chunk_type);
+    header.reserved1 = mb_htole16(header.reserved1);
+    header.chunk_sz = mb_htole32(header.chunk_sz);
+    header.total_sz = mb_htole32(header.total_sz);
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++j) {
+                c = (c & 1) ? (c >> 1) ^ 0xedb88320u : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    crc = ~crc;
+    while (size-- > 0) {
+        crc = table[(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t crc32_update_zeros(uint32_t crc, size_t size)
+{
+    static const unsigned char zeros[4096] = {};
+
+    while (size > 0) {
+        size_t n = std::min(size, sizeof(zeros));
+        crc = crc32_update(crc, zeros, n);
+        size -= n;
+    }
+
+    return crc;
+}
+
+/*!
+ * \brief Check if a block consists of a repeating 32-bit value
+ *
+ * The block is compared against the pattern 64 bytes at a time with a
+ * branchless inner loop, which compilers turn into SIMD instructions. Mismatches
+ * are therefore found within the first few bytes for typical raw data, while
+ * uniform blocks are scanned at memory bandwidth.
+ *
+ * \param data Block data
+ * \param size Block size (must be a multiple of 4)
+ * \param[out] fill_val Repeating value (in host byte order)
+ *
+ * \return Whether the block is uniform
+ */
+static bool is_fill_block(const unsigned char *data, size_t size,
+                          uint32_t &fill_val)
+{
+    uint32_t word;
+    memcpy(&word, data, sizeof(word));
+
+    const uint64_t pattern = (static_cast<uint64_t>(word) << 32) | word;
+    size_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        uint64_t diff = 0;
+
+        for (size_t j = 0; j < 64; j += sizeof(uint64_t)) {
+            uint64_t value;
+            memcpy(&value, data + i + j, sizeof(value));
+            diff |= value ^ pattern;
+        }
+
+        if (diff != 0) {
+            return false;
+        }
+    }
+
+    for (; i < size; i += sizeof(uint32_t)) {
+        uint32_t value;
+        memcpy(&value, data + i, sizeof(value));
+        if (value != word) {
+            return false;
+        }
+    }
+
+    fill_val = mb_le32toh(word);
+    return true;
+}
+
+/*! \endcond */
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write Android sparse file image.
+ *
+ * Data written to the SparseWriter is split into blocks and encoded as it is
+ * received. Runs of all-zero blocks are stored as `CHUNK_TYPE_DONT_CARE`
+ * chunks, runs of blocks that consist of a single repeating 32-bit value are
+ * stored as `CHUNK_TYPE_FILL` chunks, and everything else is stored as
+ * `CHUNK_TYPE_RAW` chunks. If enabled, a `CHUNK_TYPE_CRC32` chunk containing
+ * the checksum of the unsparsed data is appended when the file is closed.
+ *
+ * \note Zero blocks are written as "don't care" chunks, so when the image is
+ *       flashed, the corresponding blocks on the target device are left
+ *       untouched rather than being zeroed. This is the desired behavior for
+ *       filesystem images.
+ */
+
+/*!
+ * \var SparseWriter::DEFAULT_BLOCK_SIZE
+ *
+ * \brief Default block size of the sparse image
+ */
+constexpr uint32_t SparseWriter::DEFAULT_BLOCK_SIZE;
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file writer from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *)
+ *
+ * \param file File to write to
+ */
+SparseWriter::SparseWriter(File *file)
+    : SparseWriter()
+{
+    (void) open(file);
+}
+
+/*!
+ * \brief Open sparse file writer from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, uint32_t, bool)
+ *
+ * \param file File to write to
+ * \param block_size Block size of the sparse image
+ * \param crc32 Whether to append a CRC32 chunk
+ */
+SparseWriter::SparseWriter(File *file, uint32_t block_size, bool crc32)
+    : SparseWriter()
+{
+    (void) open(file, block_size, crc32);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+SparseWriter::SparseWriter(SparseWriter &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_block_size(other.m_block_size)
+    , m_crc32_enabled(other.m_crc32_enabled)
+    , m_base_offset(other.m_base_offset)
+    , m_cur_offset(other.m_cur_offset)
+    , m_block(std::move(other.m_block))
+    , m_block_used(other.m_block_used)
+    , m_crc32(other.m_crc32)
+    , m_total_blocks(other.m_total_blocks)
+    , m_total_chunks(other.m_total_chunks)
+    , m_chunk_type(other.m_chunk_type)
+    , m_chunk_blocks(other.m_chunk_blocks)
+    , m_chunk_fill_val(other.m_chunk_fill_val)
+    , m_chunk_offset(other.m_chunk_offset)
+{
+    other.clear();
+}
+
+SparseWriter & SparseWriter::operator=(SparseWriter &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_block_size = rhs.m_block_size;
+    m_crc32_enabled = rhs.m_crc32_enabled;
+    m_base_offset = rhs.m_base_offset;
+    m_cur_offset = rhs.m_cur_offset;
+    m_block.swap(rhs.m_block);
+    m_block_used = rhs.m_block_used;
+    m_crc32 = rhs.m_crc32;
+    m_total_blocks = rhs.m_total_blocks;
+    m_total_chunks = rhs.m_total_chunks;
+    m_chunk_type = rhs.m_chunk_type;
+    m_chunk_blocks = rhs.m_chunk_blocks;
+    m_chunk_fill_val = rhs.m_chunk_fill_val;
+    m_chunk_offset = rhs.m_chunk_offset;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open sparse file writer from File handle.
+ *
+ * This is equivalent to `open(file, DEFAULT_BLOCK_SIZE, false)`.
+ *
+ * \param file File to write to
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::open(File *file)
+{
+    return open(file, DEFAULT_BLOCK_SIZE, false);
+}
+
+/*!
+ * \brief Open sparse file writer from File handle.
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * \param file File to write to
+ * \param block_size Block size of the sparse image. Must be a non-zero
+ *                   multiple of 4.
+ * \param crc32 Whether to append a CRC32 chunk when the file is closed
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::open(File *file, uint32_t block_size,
+                                    bool crc32)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_block_size = block_size;
+        m_crc32_enabled = crc32;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * The underlying file must support seeking because the sparse header and the
+ * raw chunk headers are written after their sizes are known. The sparse image
+ * is written starting at the current file position.
+ *
+ * \note This function will fail if the file handle is not open.
+ *
+ * \return Nothing if the sparse file is successfully opened. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::on_open()
+{
+    if (!m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_block_size == 0 || m_block_size % sizeof(uint32_t) != 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(offset, m_file->seek(0, SEEK_CUR));
+    m_base_offset = offset;
+    m_cur_offset = offset;
+
+    // Reserve space for the sparse header
+    SparseHeader shdr = {};
+    OUTCOME_TRYV(file_write_exact(*m_file, &shdr, sizeof(shdr)));
+    m_cur_offset += sizeof(shdr);
+
+    m_block.resize(m_block_size);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish writing the sparse file
+ *
+ * The last block is padded with zeros if the amount of data written is not a
+ * multiple of the block size. The pending chunk, the optional CRC32 chunk, and
+ * the sparse header are then written out. The underlying file is left
+ * positioned at the end of the sparse image.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if the sparse image is successfully finalized. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::on_close()
+{
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    // Nothing to finalize if opening failed or a previous write failed
+    if (state() != FileState::Opened) {
+        return oc::success();
+    }
+
+    if (m_block_used > 0) {
+        size_t padding = m_block_size - m_block_used;
+        memset(m_block.data() + m_block_used, 0, padding);
+        if (m_crc32_enabled) {
+            m_crc32 = crc32_update_zeros(m_crc32, padding);
+        }
+
+        OUTCOME_TRYV(write_blocks(m_block.data(), 1));
+        m_block_used = 0;
+    }
+
+    OUTCOME_TRYV(end_chunk());
+
+    if (m_crc32_enabled) {
+        OUTCOME_TRYV(write_crc32_chunk());
+    }
+
+    return write_sparse_header();
+}
+
+/*!
+ * \brief Write data to sparse file
+ *
+ * The data is encoded one block at a time. Any trailing partial block is
+ * buffered until more data is written or the file is closed. If an error
+ * occurs, the sparse file is put in the fatal state because the output file may
+ * no longer be consistent.
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return \p size if all of the data is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<size_t> SparseWriter::on_write(const void *buf, size_t size)
+{
+    auto data = static_cast<const unsigned char *>(buf);
+    size_t remaining = size;
+    bool success = false;
+
+    auto fatal = finally([&] {
+        if (!success) {
+            set_fatal();
+        }
+    });
+
+    if (m_crc32_enabled) {
+        m_crc32 = crc32_update(m_crc32, buf, size);
+    }
+
+    // Complete the partially filled block
+    if (m_block_used > 0) {
+        size_t n = std::min(remaining, m_block_size - m_block_used);
+        memcpy(m_block.data() + m_block_used, data, n);
+        m_block_used += n;
+        data += n;
+        remaining -= n;
+
+        if (m_block_used < m_block_size) {
+            success = true;
+            return size;
+        }
+
+        OUTCOME_TRYV(write_blocks(m_block.data(), 1));
+        m_block_used = 0;
+    }
+
+    // Encode full blocks directly from the caller's buffer
+    size_t n_blocks = remaining / m_block_size;
+    if (n_blocks > 0) {
+        OUTCOME_TRYV(write_blocks(data, n_blocks));
+        data += n_blocks * m_block_size;
+        remaining -= n_blocks * m_block_size;
+    }
+
+    memcpy(m_block.data(), data, remaining);
+    m_block_used = remaining;
+
+    success = true;
+    return size;
+}
+
+/*! \cond INTERNAL */
+
+void SparseWriter::clear()
+{
+    m_file = nullptr;
+    m_block_size = DEFAULT_BLOCK_SIZE;
+    m_crc32_enabled = false;
+    m_base_offset = 0;
+    m_cur_offset = 0;
+    m_block.clear();
+    m_block.shrink_to_fit();
+    m_block_used = 0;
+    m_crc32 = 0;
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_offset = 0;
+}
+
+/*!
+ * \brief Encode full blocks
+ *
+ * Consecutive blocks of the same kind are merged into a single chunk.
+ * Consecutive raw blocks are written to the output file with a single write.
+ *
+ * \param data Block data
+ * \param n_blocks Number of blocks in \p data
+ *
+ * \return Nothing if the blocks are successfully encoded. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::write_blocks(const unsigned char *data,
+                                            size_t n_blocks)
+{
+    const unsigned char *raw_begin = nullptr;
+    size_t raw_size = 0;
+
+    auto flush_raw = [&]() -> oc::result<void> {
+        if (raw_size > 0) {
+            OUTCOME_TRYV(file_write_exact(*m_file, raw_begin, raw_size));
+            m_cur_offset += raw_size;
+            raw_size = 0;
+        }
+        return oc::success();
+    };
+
+    for (size_t i = 0; i < n_blocks; ++i) {
+        const unsigned char *block = data + i * m_block_size;
+        uint16_t type = CHUNK_TYPE_RAW;
+        uint32_t fill_val = 0;
+
+        if (is_fill_block(block, m_block_size, fill_val)) {
+            type = fill_val == 0 ? CHUNK_TYPE_DONT_CARE : CHUNK_TYPE_FILL;
+        }
+
+        if (m_total_blocks == UINT32_MAX) {
+            return FileError::IntegerOverflow;
+        }
+
+        bool extend = type == m_chunk_type
+                && (type != CHUNK_TYPE_FILL || fill_val == m_chunk_fill_val)
+                && (type == CHUNK_TYPE_RAW
+                        ? m_chunk_blocks < max_raw_chunk_blocks(m_block_size)
+                        : m_chunk_blocks < UINT32_MAX);
+
+        if (!extend) {
+            OUTCOME_TRYV(flush_raw());
+            OUTCOME_TRYV(end_chunk());
+            OUTCOME_TRYV(begin_chunk(type, fill_val));
+        }
+
+        if (type == CHUNK_TYPE_RAW) {
+            if (raw_size == 0) {
+                raw_begin = block;
+            }
+            raw_size += m_block_size;
+        }
+
+        ++m_chunk_blocks;
+        ++m_total_blocks;
+    }
+
+    return flush_raw();
+}
+
+/*!
+ * \brief Start a new chunk
+ *
+ * For raw chunks, space for the chunk header is reserved so that the raw data
+ * can be streamed to the output file. The header is filled in by end_chunk().
+ */
+oc::result<void> SparseWriter::begin_chunk(uint16_t type, uint32_t fill_val)
+{
+    m_chunk_type = type;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = fill_val;
+
+    if (type == CHUNK_TYPE_RAW) {
+        ChunkHeader chdr = {};
+
+        m_chunk_offset = m_cur_offset;
+        OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+        m_cur_offset += sizeof(chdr);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish the current chunk, if any
+ */
+oc::result<void> SparseWriter::end_chunk()
+{
+    if (m_chunk_type == 0) {
+        return oc::success();
+    }
+
+    ChunkHeader chdr = {};
+    chdr.chunk_type = m_chunk_type;
+    chdr.chunk_sz = m_chunk_blocks;
+    chdr.total_sz = sizeof(chdr);
+
+    switch (m_chunk_type) {
+    case CHUNK_TYPE_RAW: {
+        chdr.total_sz += m_chunk_blocks * m_block_size;
+        fix_chunk_header_byte_order(chdr);
+
+        OUTCOME_TRYV(file_pwrite_exact(*m_file, &chdr, sizeof(chdr),
+                                       m_chunk_offset));
+        break;
+    }
+    case CHUNK_TYPE_FILL: {
+        uint32_t fill_val = mb_htole32(m_chunk_fill_val);
+
+        chdr.total_sz += sizeof(fill_val);
+        fix_chunk_header_byte_order(chdr);
+
+        OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+        OUTCOME_TRYV(file_write_exact(*m_file, &fill_val, sizeof(fill_val)));
+        m_cur_offset += sizeof(chdr) + sizeof(fill_val);
+        break;
+    }
+    case CHUNK_TYPE_DONT_CARE: {
+        fix_chunk_header_byte_order(chdr);
+
+        OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+        m_cur_offset += sizeof(chdr);
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %" PRIu16, m_chunk_type);
+    }
+
+    ++m_total_chunks;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Append CRC32 chunk containing the checksum of the unsparsed data
+ */
+oc::result<void> SparseWriter::write_crc32_chunk()
+{
+    ChunkHeader chdr = {};
+    uint32_t crc32 = mb_htole32(m_crc32);
+
+    chdr.chunk_type = CHUNK_TYPE_CRC32;
+    chdr.chunk_sz = 0;
+    chdr.total_sz = sizeof(chdr) + sizeof(crc32);
+    fix_chunk_header_byte_order(chdr);
+
+    OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+    OUTCOME_TRYV(file_write_exact(*m_file, &crc32, sizeof(crc32)));
+    m_cur_offset += sizeof(chdr) + sizeof(crc32);
+
+    ++m_total_chunks;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Fill in the sparse header reserved by on_open()
+ */
+oc::result<void> SparseWriter::write_sparse_header()
+{
+    SparseHeader shdr = {};
+    shdr.magic = SPARSE_HEADER_MAGIC;
+    shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    shdr.minor_version = 0;
+    shdr.file_hdr_sz = sizeof(SparseHeader);
+    shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    shdr.blk_sz = m_block_size;
+    shdr.total_blks = m_total_blocks;
+    shdr.total_chunks = m_total_chunks;
+    shdr.image_checksum = m_crc32_enabled ? m_crc32 : 0;
+    fix_sparse_header_byte_order(shdr);
+
+    return file_pwrite_exact(*m_file, &shdr, sizeof(shdr), m_base_offset);
+}
+
+/*! \endcond */
+
+}
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/flash.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+class UnseekableMemoryFile : public MemoryFile
+{
+protected:
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+};
+
+struct SparseFlashTest : testing::Test
+{
+    UnseekableMemoryFile _source_file;
+    SparseFile _file;
+    void *_data = nullptr;
+    size_t _size = 0;
+    FILE *_target = nullptr;
+    std::vector<unsigned char> _expected;
+
+    virtual ~SparseFlashTest()
+    {
+        if (_target) {
+            fclose(_target);
+        }
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        _target = tmpfile();
+        ASSERT_NE(_target, nullptr);
+    }
+
+    void build_image(bool trailing_zeros)
+    {
+        // 2 raw blocks
+        for (int i = 0; i < 128; ++i) {
+            _expected.push_back(static_cast<unsigned char>(i));
+        }
+        // 3 fill blocks
+        for (int i = 0; i < 48; ++i) {
+            _expected.insert(_expected.end(), { 0x78, 0x56, 0x34, 0x12 });
+        }
+        // 2 zero blocks
+        _expected.insert(_expected.end(), 128, 0);
+        // 1 raw block
+        _expected.insert(_expected.end(), 64, 0xab);
+        if (trailing_zeros) {
+            // 2 zero blocks
+            _expected.insert(_expected.end(), 128, 0);
+        }
+
+        MemoryFile output(&_data, &_size);
+        ASSERT_TRUE(output.is_open());
+
+        SparseWriter writer;
+        ASSERT_TRUE(writer.open(&output, 64, false));
+        ASSERT_TRUE(writer.write(_expected.data(), _expected.size()));
+        ASSERT_TRUE(writer.close());
+        ASSERT_TRUE(output.close());
+
+        ASSERT_TRUE(_source_file.open(_data, _size));
+        ASSERT_TRUE(_file.open(&_source_file));
+    }
+
+    std::vector<unsigned char> read_target()
+    {
+        struct stat sb;
+        EXPECT_EQ(fstat(fileno(_target), &sb), 0);
+
+        std::vector<unsigned char> buf(static_cast<size_t>(sb.st_size));
+        EXPECT_EQ(pread(fileno(_target), buf.data(), buf.size(), 0),
+                  static_cast<ssize_t>(buf.size()));
+        return buf;
+    }
+};
+
+TEST_F(SparseFlashTest, FlashSkipsDontCareChunks)
+{
+    build_image(false);
+
+    // Pre-fill target so that skipped regions are detectable
+    std::vector<unsigned char> garbage(_expected.size(), 0xff);
+    ASSERT_EQ(pwrite(fileno(_target), garbage.data(), garbage.size(), 0),
+              static_cast<ssize_t>(garbage.size()));
+
+    ASSERT_TRUE(flash_sparse_file(_file, fileno(_target), FlashFlags(),
+                                  nullptr, nullptr));
+
+    auto expected = _expected;
+    std::fill(expected.begin() + 320, expected.begin() + 448, 0xff);
+    ASSERT_EQ(read_target(), expected);
+}
+
+TEST_F(SparseFlashTest, FlashZeroDontCareFallsBackToWrites)
+{
+    build_image(false);
+
+    std::vector<unsigned char> garbage(_expected.size(), 0xff);
+    ASSERT_EQ(pwrite(fileno(_target), garbage.data(), garbage.size(), 0),
+              static_cast<ssize_t>(garbage.size()));
+
+    ASSERT_TRUE(flash_sparse_file(
+            _file, fileno(_target),
+            FlashFlag::DiscardDontCare | FlashFlag::ZeroDontCare,
+            nullptr, nullptr));
+
+    ASSERT_EQ(read_target(), _expected);
+}
+
+TEST_F(SparseFlashTest, FlashExtendsRegularFile)
+{
+    build_image(true);
+
+    std::vector<uint64_t> progress;
+    auto cb = [](uint64_t bytes, uint64_t total, void *userdata) {
+        ASSERT_EQ(total, 640u);
+        static_cast<std::vector<uint64_t> *>(userdata)->push_back(bytes);
+    };
+
+    ASSERT_TRUE(flash_sparse_file(_file, fileno(_target), FlashFlags(),
+                                  cb, &progress));
+
+    ASSERT_EQ(read_target(), _expected);
+    ASSERT_FALSE(progress.empty());
+    ASSERT_EQ(progress.back(), 640u);
+    ASSERT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+}
@@ -729,3 +729,244 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, SeekForwardWithUnseekableFile)
+{
+    char buf[4];
+    build_valid_data();
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Seek into the middle of the raw chunk
+    ASSERT_TRUE(_file.seek(6, SEEK_SET));
+    auto extent = _file.current_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_TRUE(extent.value());
+    ASSERT_EQ(extent.value()->type, CHUNK_TYPE_RAW);
+    ASSERT_EQ(extent.value()->begin, 0u);
+    ASSERT_EQ(extent.value()->end, 16u);
+
+    ASSERT_TRUE(_file.read(buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "6789", sizeof(buf)), 0);
+
+    // Skip over the fill chunk
+    ASSERT_TRUE(_file.seek(32, SEEK_SET));
+    extent = _file.current_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_TRUE(extent.value());
+    ASSERT_EQ(extent.value()->type, CHUNK_TYPE_DONT_CARE);
+
+    // Seeking backwards still fails
+    auto ret = _file.seek(0, SEEK_SET);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_file.seek(0, SEEK_END));
+    extent = _file.current_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_FALSE(extent.value());
+}
+
+TEST_F(SparseTest, WriteAndReadIndex)
+{
+    char buf[1024];
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    MemoryFile index_file;
+    build_valid_data();
+
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+
+    // Generate index
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.write_index(index_file));
+    ASSERT_EQ(index_size, sizeof(IndexHeader) + 4 * sizeof(IndexEntry));
+    ASSERT_TRUE(_file.close());
+
+    // Reopen with the index and make sure no chunk headers are read
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(index_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.read_index(index_file));
+
+    ASSERT_TRUE(_file.seek(-16, SEEK_END));
+    memset(static_cast<char *>(_data) + sizeof(SparseHeader), 0xff,
+           sizeof(ChunkHeader));
+
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 16u);
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 32, 16), 0);
+
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(index_file.close());
+
+    free(index_data);
+}
+
+TEST_F(SparseTest, ReadMismatchedIndexFails)
+{
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    MemoryFile index_file;
+    build_valid_data();
+
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.write_index(index_file));
+    ASSERT_TRUE(_file.close());
+
+    // Change the total block count in the copy of the sparse header
+    auto ihdr = static_cast<IndexHeader *>(index_data);
+    ihdr->shdr.total_blks = mb_htole32(mb_le32toh(ihdr->shdr.total_blks) + 1);
+
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(index_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto ret = _file.read_index(index_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidIndex);
+
+    // The sparse file should still be usable
+    char buf[1024];
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data));
+
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(index_file.close());
+
+    free(index_data);
+}
+
+TEST_F(SparseTest, ReadTruncatedIndexFails)
+{
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    MemoryFile index_file;
+    build_valid_data();
+
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.write_index(index_file));
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(index_file.close());
+
+    // Drop the last entry
+    MemoryFile truncated_file(index_data, index_size - sizeof(IndexEntry));
+    ASSERT_TRUE(truncated_file.is_open());
+
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto ret = _file.read_index(truncated_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidIndex);
+
+    ASSERT_TRUE(_file.close());
+
+    free(index_data);
+}
+
+TEST_F(SparseTest, IndexRequiresSeekableFile)
+{
+    MemoryFile index_file;
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    build_valid_data();
+
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto ret = _file.write_index(index_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ret = _file.read_index(index_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(index_file.close());
+
+    free(index_data);
+}
+
+TEST_F(SparseTest, PreadValidData)
+{
+    char buf[1024];
+    build_valid_data();
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Emulated with seek() and read() until all chunks are loaded
+    auto n = _file.pread(buf, 8, 12);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 8u);
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 12, 8), 0);
+
+    // Load all chunks
+    MemoryFile index_file;
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+    ASSERT_TRUE(_file.write_index(index_file));
+    ASSERT_TRUE(index_file.close());
+    free(index_data);
+
+    // Read across every chunk boundary at every alignment
+    for (size_t offset = 0; offset <= sizeof(expected_valid_data); ++offset) {
+        n = _file.pread(buf, sizeof(buf), offset);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), sizeof(expected_valid_data) - offset);
+        ASSERT_EQ(memcmp(buf, expected_valid_data + offset, n.value()), 0);
+    }
+
+    // Reads past EOF return no data
+    n = _file.pread(buf, sizeof(buf), 1000);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    // File position is not affected
+    auto pos = _file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, PreadWithNonZeroBaseOffset)
+{
+    char buf[1024];
+
+    ASSERT_TRUE(_source_file.write("garbage", 7));
+    build_valid_data();
+    ASSERT_TRUE(_source_file.seek(7, SEEK_SET));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    MemoryFile index_file;
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+    ASSERT_TRUE(_file.write_index(index_file));
+    ASSERT_TRUE(index_file.close());
+    free(index_data);
+
+    auto n = _file.pread(buf, sizeof(buf), 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data) - 4);
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 4, n.value()), 0);
+
+    ASSERT_TRUE(_file.close());
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+struct SparseWriterTest : testing::Test
+{
+    MemoryFile _output_file;
+    SparseWriter _writer;
+    void *_data = nullptr;
+    size_t _size = 0;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_output_file.open(&_data, &_size));
+    }
+
+    SparseHeader read_sparse_header()
+    {
+        SparseHeader shdr;
+        memcpy(&shdr, _data, sizeof(shdr));
+        shdr.magic = mb_le32toh(shdr.magic);
+        shdr.blk_sz = mb_le32toh(shdr.blk_sz);
+        shdr.total_blks = mb_le32toh(shdr.total_blks);
+        shdr.total_chunks = mb_le32toh(shdr.total_chunks);
+        shdr.image_checksum = mb_le32toh(shdr.image_checksum);
+        return shdr;
+    }
+
+    std::vector<ChunkHeader> read_chunk_headers()
+    {
+        std::vector<ChunkHeader> chunks;
+        auto ptr = static_cast<const unsigned char *>(_data);
+        size_t offset = sizeof(SparseHeader);
+
+        while (offset < _size) {
+            ChunkHeader chdr;
+            memcpy(&chdr, ptr + offset, sizeof(chdr));
+            chdr.chunk_type = mb_le16toh(chdr.chunk_type);
+            chdr.chunk_sz = mb_le32toh(chdr.chunk_sz);
+            chdr.total_sz = mb_le32toh(chdr.total_sz);
+            chunks.push_back(chdr);
+            offset += chdr.total_sz;
+        }
+
+        return chunks;
+    }
+
+    std::vector<unsigned char> read_back()
+    {
+        std::vector<unsigned char> buf;
+        unsigned char temp[256];
+
+        EXPECT_TRUE(_output_file.seek(0, SEEK_SET));
+
+        SparseFile file;
+        EXPECT_TRUE(file.open(&_output_file));
+
+        while (true) {
+            auto n = file.read(temp, sizeof(temp));
+            EXPECT_TRUE(n);
+            if (!n || n.value() == 0) {
+                break;
+            }
+            buf.insert(buf.end(), temp, temp + n.value());
+        }
+
+        return buf;
+    }
+};
+
+TEST_F(SparseWriterTest, CheckOpeningUnopenedFileFails)
+{
+    MemoryFile file;
+
+    auto result = _writer.open(&file);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::InvalidState);
+}
+
+TEST_F(SparseWriterTest, CheckInvalidBlockSizeFails)
+{
+    auto result = _writer.open(&_output_file, 0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+
+    result = _writer.open(&_output_file, 6, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(SparseWriterTest, WriteEmptyFile)
+{
+    ASSERT_TRUE(_writer.open(&_output_file));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(_size, sizeof(SparseHeader));
+
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.magic, SPARSE_HEADER_MAGIC);
+    ASSERT_EQ(shdr.blk_sz, SparseWriter::DEFAULT_BLOCK_SIZE);
+    ASSERT_EQ(shdr.total_blks, 0u);
+    ASSERT_EQ(shdr.total_chunks, 0u);
+
+    ASSERT_TRUE(read_back().empty());
+}
+
+TEST_F(SparseWriterTest, WriteMixedChunks)
+{
+    std::vector<unsigned char> data;
+
+    // 2 raw blocks
+    for (int i = 0; i < 128; ++i) {
+        data.push_back(static_cast<unsigned char>(i));
+    }
+    // 3 fill blocks
+    for (int i = 0; i < 48; ++i) {
+        data.insert(data.end(), { 0x78, 0x56, 0x34, 0x12 });
+    }
+    // 2 zero blocks
+    data.insert(data.end(), 128, 0);
+    // 1 raw block
+    data.insert(data.end(), 64, 0xab);
+    data[data.size() - 1] = 0xcd;
+
+    ASSERT_TRUE(_writer.open(&_output_file, 64, false));
+    // Write in odd-sized pieces to exercise partial block buffering
+    for (size_t offset = 0; offset < data.size(); offset += 37) {
+        size_t n = std::min<size_t>(37, data.size() - offset);
+        ASSERT_TRUE(_writer.write(data.data() + offset, n));
+    }
+    ASSERT_TRUE(_writer.close());
+
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.blk_sz, 64u);
+    ASSERT_EQ(shdr.total_blks, 8u);
+    ASSERT_EQ(shdr.total_chunks, 4u);
+
+    auto chunks = read_chunk_headers();
+    ASSERT_EQ(chunks.size(), 4u);
+    ASSERT_EQ(chunks[0].chunk_type, CHUNK_TYPE_RAW);
+    ASSERT_EQ(chunks[0].chunk_sz, 2u);
+    ASSERT_EQ(chunks[0].total_sz, sizeof(ChunkHeader) + 128);
+    ASSERT_EQ(chunks[1].chunk_type, CHUNK_TYPE_FILL);
+    ASSERT_EQ(chunks[1].chunk_sz, 3u);
+    ASSERT_EQ(chunks[1].total_sz, sizeof(ChunkHeader) + 4);
+    ASSERT_EQ(chunks[2].chunk_type, CHUNK_TYPE_DONT_CARE);
+    ASSERT_EQ(chunks[2].chunk_sz, 2u);
+    ASSERT_EQ(chunks[2].total_sz, sizeof(ChunkHeader));
+    ASSERT_EQ(chunks[3].chunk_type, CHUNK_TYPE_RAW);
+    ASSERT_EQ(chunks[3].chunk_sz, 1u);
+
+    ASSERT_EQ(read_back(), data);
+}
+
+TEST_F(SparseWriterTest, WritePadsPartialBlock)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 8, false));
+    ASSERT_TRUE(_writer.write("abcdefghij", 10));
+    ASSERT_TRUE(_writer.close());
+
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.total_blks, 2u);
+
+    std::vector<unsigned char> expected{
+        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 0, 0, 0, 0, 0, 0
+    };
+    ASSERT_EQ(read_back(), expected);
+}
+
+TEST_F(SparseWriterTest, WriteCrc32Chunk)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 8, true));
+    ASSERT_TRUE(_writer.write("123456789", 9));
+    ASSERT_TRUE(_writer.close());
+
+    // Blocks: "12345678", "9\0\0\0\0\0\0\0"
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.total_blks, 2u);
+    ASSERT_EQ(shdr.total_chunks, 2u);
+
+    auto chunks = read_chunk_headers();
+    ASSERT_EQ(chunks.size(), 2u);
+    ASSERT_EQ(chunks[1].chunk_type, CHUNK_TYPE_CRC32);
+    ASSERT_EQ(chunks[1].chunk_sz, 0u);
+    ASSERT_EQ(chunks[1].total_sz, sizeof(ChunkHeader) + 4);
+
+    uint32_t crc32;
+    memcpy(&crc32, static_cast<char *>(_data) + _size - 4, sizeof(crc32));
+    crc32 = mb_le32toh(crc32);
+
+    // CRC32 of "123456789\0\0\0\0\0\0\0"
+    ASSERT_EQ(crc32, 0x0e8c1a27u);
+    ASSERT_EQ(shdr.image_checksum, crc32);
+
+    ASSERT_EQ(read_back().size(), 16u);
+}
+
+TEST_F(SparseWriterTest, WriteAtNonZeroOffset)
+{
+    ASSERT_TRUE(_output_file.write("prefix", 6));
+
+    ASSERT_TRUE(_writer.open(&_output_file, 4, false));
+    ASSERT_TRUE(_writer.write("\0\0\0\0\0\0\0\0", 8));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(memcmp(_data, "prefix", 6), 0);
+
+    SparseHeader shdr;
+    memcpy(&shdr, static_cast<char *>(_data) + 6, sizeof(shdr));
+    ASSERT_EQ(mb_le32toh(shdr.magic), SPARSE_HEADER_MAGIC);
+    ASSERT_EQ(mb_le32toh(shdr.total_blks), 2u);
+    ASSERT_EQ(mb_le32toh(shdr.total_chunks), 1u);
+}
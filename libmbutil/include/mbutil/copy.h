@@ -21,6 +21,8 @@
 
 #include <string>
 
+#include <cstdint>
+
 #include "mbcommon/flags.h"
 
 namespace mb
@@ -34,11 +36,14 @@ enum class CopyFlag : uint8_t
     CopyXattrs      = 1 << 1,
     ExcludeTopLevel = 1 << 2,
     FollowSymlinks  = 1 << 3,
+    SparseFiles     = 1 << 4,
 };
 MB_DECLARE_FLAGS(CopyFlags, CopyFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(CopyFlags)
 
 bool copy_data_fd(int fd_source, int fd_target);
+bool copy_data_fd(int fd_source, int fd_target, uint64_t size);
+bool copy_data_fd_sparse(int fd_source, int fd_target, bool skip_zero_blocks);
 bool copy_xattrs(const std::string &source, const std::string &target);
 bool copy_stat(const std::string &source, const std::string &target);
 bool copy_contents(const std::string &source, const std::string &target);
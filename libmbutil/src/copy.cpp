@@ -19,12 +19,19 @@
 
 #include "mbutil/copy.h"
 
+#include <algorithm>
+#include <memory>
+
 #include <cerrno>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/falloc.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
@@ -45,30 +52,473 @@ namespace mb
 namespace util
 {
 
-bool copy_data_fd(int fd_source, int fd_target)
+// Maximum number of bytes to request from the kernel in a single call
+static constexpr size_t MAX_KERNEL_COPY_SIZE = 1024 * 1024 * 1024;
+
+// Size and alignment of the buffer used if the kernel can't copy the data
+static constexpr size_t FALLBACK_BUFFER_SIZE = 1024 * 1024;
+static constexpr size_t FALLBACK_BUFFER_ALIGN = 4096;
+
+using KernelCopyFn = ssize_t (*)(int fd_source, int fd_target, size_t count);
+
+static ssize_t copy_file_range_fn(int fd_source, int fd_target, size_t count)
 {
-    char buf[10240];
-    ssize_t nread;
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_source, nullptr, fd_target,
+                   nullptr, count, 0u);
+#else
+    (void) fd_source;
+    (void) fd_target;
+    (void) count;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
 
-    while ((nread = read(fd_source, buf, sizeof buf)) > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+static ssize_t sendfile_fn(int fd_source, int fd_target, size_t count)
+{
+    return sendfile(fd_target, fd_source, nullptr, count);
+}
+
+static ssize_t splice_fn(int fd_source, int fd_target, size_t count)
+{
+#if defined(__NR_splice) && defined(SPLICE_F_MOVE)
+    return syscall(__NR_splice, fd_source, nullptr, fd_target, nullptr,
+                   count, SPLICE_F_MOVE);
+#else
+    (void) fd_source;
+    (void) fd_target;
+    (void) count;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Errors reported for old kernels, cross-filesystem copies, unsupported file
+// types, and files opened with O_APPEND
+static bool is_unsupported_copy_error(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == ENOTSUP || error == EBADF;
+}
+
+// Copy until EOF or until `remaining` reaches 0. If the method can't be used
+// for the given file descriptors, `unsupported` is set and nothing is copied.
+static bool kernel_copy(KernelCopyFn fn, int fd_source, int fd_target,
+                        uint64_t &remaining, bool &unsupported)
+{
+    bool copied_any = false;
+
+    unsupported = false;
+
+    while (remaining > 0) {
+        size_t count = static_cast<size_t>(
+                std::min<uint64_t>(remaining, MAX_KERNEL_COPY_SIZE));
+
+        ssize_t n = fn(fd_source, fd_target, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (!copied_any && is_unsupported_copy_error(errno)) {
+                unsupported = true;
+                return true;
+            }
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        copied_any = true;
+        remaining -= static_cast<uint64_t>(n);
+    }
 
-        do {
-            if ((nwritten = write(fd_target, out_ptr,
-                                  static_cast<size_t>(nread))) < 0) {
+    return true;
+}
+
+static bool buffer_copy(int fd_source, int fd_target, uint64_t &remaining)
+{
+    void *ptr;
+
+    int ret = posix_memalign(&ptr, FALLBACK_BUFFER_ALIGN, FALLBACK_BUFFER_SIZE);
+    if (ret != 0) {
+        errno = ret;
+        return false;
+    }
+
+    std::unique_ptr<char, decltype(free) *> buf(static_cast<char *>(ptr), free);
+
+    while (remaining > 0) {
+        size_t to_read = static_cast<size_t>(
+                std::min<uint64_t>(remaining, FALLBACK_BUFFER_SIZE));
+
+        ssize_t nread = read(fd_source, buf.get(), to_read);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (nread == 0) {
+            break;
+        }
+
+        remaining -= static_cast<uint64_t>(nread);
+
+        char *out_ptr = buf.get();
+
+        while (nread > 0) {
+            ssize_t nwritten = write(fd_target, out_ptr,
+                                     static_cast<size_t>(nread));
+            if (nwritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 return false;
             }
 
             nread -= nwritten;
             out_ptr += nwritten;
-        } while (nread > 0);
+        }
+    }
+
+    return true;
+}
+
+static bool copy_data_fd_impl(int fd_source, int fd_target, uint64_t &remaining)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+    bool unsupported = true;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return false;
+    }
+
+    // Files in pseudo-filesystems, such as procfs, report a size of 0 and may
+    // appear empty to the kernel copy functions, so they're handled below.
+    if (S_ISREG(sb_source.st_mode) && sb_source.st_size > 0) {
+        if (S_ISREG(sb_target.st_mode)) {
+            // Allows reflinks and server-side copies on supported filesystems
+            if (!kernel_copy(copy_file_range_fn, fd_source, fd_target,
+                             remaining, unsupported)) {
+                return false;
+            }
+        }
+
+        if (unsupported && !kernel_copy(sendfile_fn, fd_source, fd_target,
+                                        remaining, unsupported)) {
+            return false;
+        }
+    } else if (S_ISFIFO(sb_source.st_mode)) {
+        if (!kernel_copy(splice_fn, fd_source, fd_target, remaining,
+                         unsupported)) {
+            return false;
+        }
+    }
+
+    // Copy whatever is left. If a kernel-assisted method reached EOF, then this
+    // is just a single read() call that returns 0.
+    return buffer_copy(fd_source, fd_target, remaining);
+}
+
+/*!
+ * \brief Copy data between file descriptors until EOF is reached
+ *
+ * The data is copied with `copy_file_range()`, `sendfile()`, or `splice()` if
+ * the kernel supports it for the given file descriptors. Otherwise, the data is
+ * copied through a large user space buffer. The copy starts at the current
+ * file offset of both file descriptors and the offsets are advanced by the
+ * number of bytes copied.
+ *
+ * \param fd_source Source file descriptor
+ * \param fd_target Target file descriptor
+ *
+ * \return true on success, false on failure with errno set appropriately
+ */
+bool copy_data_fd(int fd_source, int fd_target)
+{
+    uint64_t remaining = UINT64_MAX;
+
+    return copy_data_fd_impl(fd_source, fd_target, remaining);
+}
+
+/*!
+ * \brief Copy a specific number of bytes between file descriptors
+ *
+ * \sa copy_data_fd(int, int)
+ *
+ * \param fd_source Source file descriptor
+ * \param fd_target Target file descriptor
+ * \param size Number of bytes to copy
+ *
+ * \return true on success, false on failure with errno set appropriately. If
+ *         EOF is reached before \p size bytes are copied, errno is set to
+ *         `ENODATA`.
+ */
+bool copy_data_fd(int fd_source, int fd_target, uint64_t size)
+{
+    uint64_t remaining = size;
+
+    if (!copy_data_fd_impl(fd_source, fd_target, remaining)) {
+        return false;
+    } else if (remaining > 0) {
+        errno = ENODATA;
+        return false;
+    }
+
+    return true;
+}
+
+// Granularity of all-zero block detection
+static constexpr size_t SPARSE_BLOCK_SIZE = 4096;
+
+static bool is_zero_block(const char *buf, size_t size)
+{
+    return size > 0 && buf[0] == 0 && memcmp(buf, buf + 1, size - 1) == 0;
+}
+
+static bool pwrite_exact(int fd, const char *buf, size_t size, off64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite64(fd, buf, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        buf += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
     }
 
-    return nread == 0;
+    return true;
 }
 
-static bool copy_data(const std::string &source, const std::string &target)
+// Make [offset, offset + size) read back as zeros in the target. Nothing needs
+// to be done past the current end of the file because ftruncate() or a later
+// write will leave a hole there. Data that already exists is deallocated if
+// the filesystem supports it and overwritten with zeros otherwise.
+static bool make_hole(int fd, off64_t offset, off64_t size, off64_t file_size)
+{
+    if (offset >= file_size) {
+        return true;
+    }
+
+    size = std::min(size, file_size - offset);
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate64(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    offset, size) == 0) {
+        return true;
+    } else if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        return false;
+    }
+#endif
+
+    static const char zeros[SPARSE_BLOCK_SIZE] = {};
+
+    while (size > 0) {
+        size_t n = static_cast<size_t>(
+                std::min<off64_t>(size, SPARSE_BLOCK_SIZE));
+
+        if (!pwrite_exact(fd, zeros, n, offset)) {
+            return false;
+        }
+
+        offset += static_cast<off64_t>(n);
+        size -= static_cast<off64_t>(n);
+    }
+
+    return true;
+}
+
+// Copy the data region [src_offset, src_offset + size) to dst_offset, turning
+// all-zero blocks into holes if requested
+static bool copy_data_region(int fd_source, int fd_target, char *buf,
+                             off64_t src_offset, off64_t dst_offset,
+                             off64_t size, off64_t &dst_size,
+                             bool skip_zero_blocks)
+{
+    while (size > 0) {
+        size_t to_read = static_cast<size_t>(
+                std::min<off64_t>(size, FALLBACK_BUFFER_SIZE));
+
+        ssize_t nread = pread64(fd_source, buf, to_read, src_offset);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (nread == 0) {
+            // File was truncated while copying
+            errno = ENODATA;
+            return false;
+        }
+
+        size_t n = static_cast<size_t>(nread);
+        size_t pos = 0;
+
+        // Coalesce consecutive blocks of the same kind into a single write or
+        // hole punching operation
+        while (pos < n) {
+            size_t block = std::min(n - pos, SPARSE_BLOCK_SIZE);
+            bool zero = skip_zero_blocks && is_zero_block(buf + pos, block);
+            size_t run = block;
+
+            while (pos + run < n) {
+                block = std::min(n - pos - run, SPARSE_BLOCK_SIZE);
+                if (zero != (skip_zero_blocks
+                        && is_zero_block(buf + pos + run, block))) {
+                    break;
+                }
+                run += block;
+            }
+
+            off64_t offset = dst_offset + static_cast<off64_t>(pos);
+
+            if (zero) {
+                if (!make_hole(fd_target, offset, static_cast<off64_t>(run),
+                               dst_size)) {
+                    return false;
+                }
+            } else {
+                if (!pwrite_exact(fd_target, buf + pos, run, offset)) {
+                    return false;
+                }
+                dst_size = std::max(dst_size,
+                                    offset + static_cast<off64_t>(run));
+            }
+
+            pos += run;
+        }
+
+        src_offset += nread;
+        dst_offset += nread;
+        size -= nread;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy data between file descriptors while preserving holes
+ *
+ * The data regions of the source file are found with `SEEK_DATA` and
+ * `SEEK_HOLE`. Holes in the source file are recreated in the target file
+ * instead of being written out as zeros. If \p skip_zero_blocks is true, then
+ * blocks in the data regions that consist entirely of zeros are also turned
+ * into holes. Existing data in the target file is deallocated with
+ * `fallocate(FALLOC_FL_PUNCH_HOLE)` if the filesystem supports it and
+ * overwritten with zeros otherwise.
+ *
+ * Like copy_data_fd(int, int), the copy starts at the current file offset of
+ * both file descriptors and continues until the end of the source file. If
+ * either file descriptor does not refer to a regular file, this function is
+ * equivalent to copy_data_fd(int, int).
+ *
+ * \param fd_source Source file descriptor
+ * \param fd_target Target file descriptor
+ * \param skip_zero_blocks Whether to detect all-zero blocks in the source
+ *
+ * \return true on success, false on failure with errno set appropriately
+ */
+bool copy_data_fd_sparse(int fd_source, int fd_target, bool skip_zero_blocks)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return false;
+    }
+
+    if (!S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)) {
+        return copy_data_fd(fd_source, fd_target);
+    }
+
+    off64_t src_offset = lseek64(fd_source, 0, SEEK_CUR);
+    if (src_offset < 0) {
+        return false;
+    }
+    off64_t dst_offset = lseek64(fd_target, 0, SEEK_CUR);
+    if (dst_offset < 0) {
+        return false;
+    }
+
+    const off64_t src_size = static_cast<off64_t>(sb_source.st_size);
+    off64_t dst_size = static_cast<off64_t>(sb_target.st_size);
+
+    void *ptr;
+
+    int ret = posix_memalign(&ptr, FALLBACK_BUFFER_ALIGN, FALLBACK_BUFFER_SIZE);
+    if (ret != 0) {
+        errno = ret;
+        return false;
+    }
+
+    std::unique_ptr<char, decltype(free) *> buf(static_cast<char *>(ptr), free);
+
+    while (src_offset < src_size) {
+        off64_t data_offset = lseek64(fd_source, src_offset, SEEK_DATA);
+        off64_t hole_offset;
+
+        if (data_offset < 0) {
+            if (errno == ENXIO) {
+                // Only a hole remains
+                data_offset = src_size;
+                hole_offset = src_size;
+            } else if (errno == EINVAL || errno == ENOTSUP
+                    || errno == EOPNOTSUPP) {
+                // SEEK_DATA is not supported, so treat everything as data
+                data_offset = src_offset;
+                hole_offset = src_size;
+            } else {
+                return false;
+            }
+        } else {
+            hole_offset = lseek64(fd_source, data_offset, SEEK_HOLE);
+            if (hole_offset < 0) {
+                return false;
+            }
+            hole_offset = std::min(hole_offset, src_size);
+        }
+
+        if (data_offset > src_offset) {
+            if (!make_hole(fd_target, dst_offset, data_offset - src_offset,
+                           dst_size)) {
+                return false;
+            }
+            dst_offset += data_offset - src_offset;
+        }
+
+        if (hole_offset > data_offset) {
+            if (!copy_data_region(fd_source, fd_target, buf.get(),
+                                  data_offset, dst_offset,
+                                  hole_offset - data_offset, dst_size,
+                                  skip_zero_blocks)) {
+                return false;
+            }
+            dst_offset += hole_offset - data_offset;
+        }
+
+        src_offset = hole_offset;
+    }
+
+    // Extend the file if it ends with a hole
+    if (dst_size < dst_offset && ftruncate64(fd_target, dst_offset) < 0) {
+        return false;
+    }
+
+    if (lseek64(fd_source, src_offset, SEEK_SET) < 0
+            || lseek64(fd_target, dst_offset, SEEK_SET) < 0) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool copy_data(const std::string &source, const std::string &target,
+                      CopyFlags flags)
 {
     int fd_source = -1;
     int fd_target = -1;
@@ -91,7 +541,23 @@ static bool copy_data(const std::string &source, const std::string &target)
         close(fd_target);
     });
 
-    return copy_data_fd(fd_source, fd_target);
+    struct stat sb;
+    if (fstat(fd_source, &sb) < 0) {
+        return false;
+    }
+
+    // Preserve holes if the source file has any, even if the caller did not
+    // ask for all-zero blocks to be skipped
+    bool has_holes = S_ISREG(sb.st_mode)
+            && static_cast<uint64_t>(sb.st_blocks) * 512
+                    < static_cast<uint64_t>(sb.st_size);
+
+    if ((flags & CopyFlag::SparseFiles) || has_holes) {
+        return copy_data_fd_sparse(fd_source, fd_target,
+                                   flags & CopyFlag::SparseFiles);
+    } else {
+        return copy_data_fd(fd_source, fd_target);
+    }
 }
 
 bool copy_xattrs(const std::string &source, const std::string &target)
@@ -289,7 +755,7 @@ bool copy_file(const std::string &source, const std::string &target,
         [[clang::fallthrough]];
 
     case S_IFREG:
-        if (!copy_data(source, target)) {
+        if (!copy_data(source, target, flags)) {
             LOGE("%s: Failed to copy data: %s",
                  target.c_str(), strerror(errno));
             return false;
@@ -469,7 +935,7 @@ public:
         }
 
         // Copy file contents
-        if (!copy_data(_curr->fts_accpath, _curtgtpath)) {
+        if (!copy_data(_curr->fts_accpath, _curtgtpath, _copyflags)) {
             _error_msg = format("%s: Failed to copy data: %s",
                                 _curtgtpath.c_str(), strerror(errno));
             LOGW("%s", _error_msg.c_str());
@@ -28,10 +28,10 @@
 #include <fcntl.h>
 #include <linux/fs.h>
 #include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/finally.h"
 
 namespace mb
@@ -143,35 +143,15 @@ bool file_write_data(const std::string &path,
 
 bool file_find_one_of(const std::string &path, std::vector<std::string> items)
 {
-    struct stat sb;
-    void *map = MAP_FAILED;
-    int fd = -1;
+    MmapFile file;
 
-    if ((fd = open(path.c_str(), O_RDONLY)) < 0) {
+    if (!file.open(path)) {
         return false;
     }
 
-    auto close_fd = finally([&] {
-        close(fd);
-    });
-
-    if (fstat(fd, &sb) < 0) {
-        return false;
-    }
-
-    map = mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ, MAP_PRIVATE,
-               fd, 0);
-    if (map == MAP_FAILED) {
-        return false;
-    }
-
-    auto unmap_map = finally([&] {
-        munmap(map, static_cast<size_t>(sb.st_size));
-    });
-
     for (auto const &item : items) {
-        if (memmem(map, static_cast<size_t>(sb.st_size),
-                   item.data(), item.size())) {
+        if (file.size() > 0 && memmem(file.data(), file.size(),
+                                      item.data(), item.size())) {
             return true;
         }
     }
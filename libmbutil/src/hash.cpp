@@ -25,6 +25,8 @@
 #include <cstdio>
 #include <cstring>
 
+#include "mbcommon/hash.h"
+
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbutil/hash"
@@ -57,15 +59,20 @@ bool sha512_hash(const std::string &path,
     unsigned char buf[10240];
     size_t n;
 
-    SHA512_CTX ctx;
-    if (!SHA512_Init(&ctx)) {
-        LOGE("openssl: SHA512_Init() failed");
+    // Hash on a helper thread so that the hashing overlaps with the reads
+    Hasher hasher;
+    auto ret = hasher.init(HashAlgorithm::Sha512, HashFlag::Background);
+    if (!ret) {
+        LOGE("Failed to initialize SHA512 hasher: %s",
+             ret.error().message().c_str());
         return false;
     }
 
     while ((n = fread(buf, 1, sizeof(buf), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf, n)) {
-            LOGE("openssl: SHA512_Update() failed");
+        ret = hasher.update(buf, n);
+        if (!ret) {
+            LOGE("Failed to update SHA512 hash: %s",
+                 ret.error().message().c_str());
             return false;
         }
         if (n < sizeof(buf)) {
@@ -79,11 +86,15 @@ bool sha512_hash(const std::string &path,
         return false;
     }
 
-    if (!SHA512_Final(digest, &ctx)) {
-        LOGE("openssl: SHA512_Final() failed");
+    auto result = hasher.finish();
+    if (!result) {
+        LOGE("Failed to finalize SHA512 hash: %s",
+             result.error().message().c_str());
         return false;
     }
 
+    memcpy(digest, result.value().data(), result.value().size());
+
     return true;
 }
 
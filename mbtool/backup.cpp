@@ -323,7 +323,9 @@ static Result backup_boot_image(const std::shared_ptr<Rom> &rom,
     struct stat sb;
     if (stat(boot_image_path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", boot_image_path.c_str());
-        if (!util::copy_file(boot_image_path, boot_image_backup, 0)) {
+        // Boot images dumped from a partition are mostly zero padding
+        if (!util::copy_file(boot_image_path, boot_image_backup,
+                             util::CopyFlag::SparseFiles)) {
             return Result::Failed;
         }
     } else {
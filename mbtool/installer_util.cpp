@@ -26,6 +26,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #include <archive.h>
@@ -38,13 +39,14 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
-#include "mbcommon/file/standard.h"
+#include "mbcommon/file/fd.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/optional.h"
 #include "mbcommon/string.h"
 
 #include "mblog/logging.h"
 
+#include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/path.h"
 
@@ -551,12 +553,22 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
     };
 
-    StandardFile fin;
-    StandardFile fout;
+    FdFile fin;
+    FdFile fout;
     optional<uint64_t> offset;
 
+    // The file descriptors are used directly so that the kernel can copy the
+    // unmodified data. This is fine because FdFile does not buffer anything.
+
     // Open input file
-    auto open_ret = fin.open(input_file, FileOpenMode::ReadOnly);
+    int fd_in = open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_in < 0) {
+        LOGE("%s: Failed to open for reading: %s",
+             input_file.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto open_ret = fin.open(fd_in, true);
     if (!open_ret) {
         LOGE("%s: Failed to open for reading: %s",
              input_file.c_str(), open_ret.error().message().c_str());
@@ -564,7 +576,15 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
     }
 
     // Open output file
-    open_ret = fout.open(output_file, FileOpenMode::WriteOnly);
+    int fd_out = open(output_file.c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd_out < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_file.c_str(), strerror(errno));
+        return false;
+    }
+
+    open_ret = fout.open(fd_out, true);
     if (!open_ret) {
         LOGE("%s: Failed to open for writing: %s",
              output_file.c_str(), open_ret.error().message().c_str());
@@ -600,7 +620,7 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
     if (offset) {
         LOGD("RKP pattern found at offset: 0x%" PRIx64, *offset);
 
-        if (!copy_file_to_file(fin, fout, *offset)) {
+        if (!copy_file_to_file(fd_in, fd_out, *offset)) {
             return false;
         }
 
@@ -620,7 +640,7 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         }
     }
 
-    if (!copy_file_to_file_eof(fin, fout)) {
+    if (!copy_file_to_file_eof(fd_in, fd_out)) {
         return false;
     }
 
@@ -670,51 +690,21 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file(File &fin, File &fout, uint64_t to_copy)
+bool InstallerUtil::copy_file_to_file(int fd_in, int fd_out, uint64_t to_copy)
 {
-    char buf[10240];
-
-    while (to_copy > 0) {
-        size_t to_read = static_cast<size_t>(
-                std::min<uint64_t>(to_copy, sizeof(buf)));
-
-        auto n = file_read_retry(fin, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to read data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        n = file_write_retry(fout, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to write data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        to_copy -= to_read;
+    if (!util::copy_data_fd(fd_in, fd_out, to_copy)) {
+        LOGE("Failed to copy data: %s", strerror(errno));
+        return false;
     }
 
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file_eof(File &fin, File &fout)
+bool InstallerUtil::copy_file_to_file_eof(int fd_in, int fd_out)
 {
-    char buf[10240];
-
-    while (true) {
-        auto n_read = file_read_retry(fin, buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read data: %s", n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        auto n_written = file_write_retry(fout, buf, n_read.value());
-        if (!n_written || n_written.value() != n_read.value()) {
-            LOGE("Failed to write data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
+    if (!util::copy_data_fd(fd_in, fd_out)) {
+        LOGE("Failed to copy data: %s", strerror(errno));
+        return false;
     }
 
     return true;
@@ -22,11 +22,12 @@
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
 #include "ramdisk_patcher.h"
 
 namespace mb
 {
-class File;
 
 class InstallerUtil
 {
@@ -56,8 +57,8 @@ public:
                              const std::string &with);
 
 private:
-    static bool copy_file_to_file(File &fin, File &fout, uint64_t to_copy);
-    static bool copy_file_to_file_eof(File &fin, File &fout);
+    static bool copy_file_to_file(int fd_in, int fd_out, uint64_t to_copy);
+    static bool copy_file_to_file_eof(int fd_in, int fd_out);
 };
 
 }
@@ -27,9 +27,8 @@
 #include <dirent.h>
 #include <sys/stat.h>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/finally.h"
+#include "mbcommon/hash.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/chmod.h"
@@ -184,6 +183,77 @@ struct Flashable
     std::vector<unsigned char> data;
 };
 
+/*!
+ * \brief Read a file into memory and compute its SHA512 hash
+ *
+ * The hash is computed on a helper thread while the file is being read so
+ * that hashing large images doesn't require a second pass over the data.
+ *
+ * \param path Path to file
+ * \param data_out Output buffer for the file contents
+ * \param sha512_out SHA512 hex digest output
+ *
+ * \return True if the file was successfully read and hashed. Otherwise, false
+ *         and errno set appropriately.
+ */
+static bool read_and_hash(const std::string &path,
+                          std::vector<unsigned char> &data_out,
+                          std::string &sha512_out)
+{
+    static constexpr size_t READ_CHUNK_SIZE = 1024 * 1024;
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    auto close_fp = finally([&] {
+        fclose(fp);
+    });
+
+    Hasher hasher;
+    if (!hasher.init(HashAlgorithm::Sha512, HashFlag::Background)) {
+        errno = EIO;
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+
+    while (true) {
+        size_t offset = data.size();
+        data.resize(offset + READ_CHUNK_SIZE);
+
+        size_t n = fread(data.data() + offset, 1, READ_CHUNK_SIZE, fp);
+        data.resize(offset + n);
+
+        if (n > 0 && !hasher.update(data.data() + offset, n)) {
+            errno = EIO;
+            return false;
+        }
+
+        if (n < READ_CHUNK_SIZE) {
+            break;
+        }
+    }
+
+    if (ferror(fp)) {
+        errno = EIO;
+        return false;
+    }
+
+    auto digest = hasher.finish();
+    if (!digest) {
+        errno = EIO;
+        return false;
+    }
+
+    data_out.swap(data);
+    sha512_out = util::hex_string(digest.value().data(),
+                                  digest.value().size());
+
+    return true;
+}
+
 /*!
  * \brief Perform non-recursive search for a block device
  *
@@ -354,17 +424,14 @@ SwitchRomResult switch_rom(const std::string &id,
         // If memory becomes an issue, an alternative method is to create a
         // temporary directory in /data/multiboot/ that's only writable by root
         // and copy the images there.
-        if (!util::file_read_all(f.image, f.data)) {
+        //
+        // The actual sha512sum is computed while the image is being read.
+        if (!read_and_hash(f.image, f.data, f.hash)) {
             LOGE("%s: Failed to read image: %s",
                  f.image.c_str(), strerror(errno));
             return SwitchRomResult::Failed;
         }
 
-        // Get actual sha512sum
-        unsigned char digest[SHA512_DIGEST_LENGTH];
-        SHA512(f.data.data(), f.data.size(), digest);
-        f.hash = util::hex_string(digest, SHA512_DIGEST_LENGTH);
-
         if (force_update_checksums) {
             checksums_update(&props, id, util::base_name(f.image), f.hash);
         }
@@ -457,18 +524,15 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
     }
 
     std::vector<unsigned char> data;
+    std::string hash;
 
-    if (!util::file_read_all(boot_blockdev, data)) {
+    // Get actual sha512sum
+    if (!read_and_hash(boot_blockdev, data, hash)) {
         LOGE("%s: Failed to read block device: %s",
              boot_blockdev.c_str(), strerror(errno));
         return false;
     }
 
-    // Get actual sha512sum
-    unsigned char digest[SHA512_DIGEST_LENGTH];
-    SHA512(data.data(), data.size(), digest);
-    std::string hash = util::hex_string(digest, SHA512_DIGEST_LENGTH);
-
     // Add to checksums.prop
     std::unordered_map<std::string, std::string> props;
     checksums_read(&props);
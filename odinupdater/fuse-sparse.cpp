@@ -19,16 +19,15 @@
 
 #define FUSE_USE_VERSION 26
 
-#include <mutex>
-#include <new>
-
 #include <cerrno>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #ifdef __clang__
@@ -57,7 +56,12 @@
 
 // libmbcommon
 #include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/optional.h"
 
 // libmbsparse
@@ -69,15 +73,19 @@
 #define OFF_T off_t
 #endif
 
-static char source_fd_path[50];
+// Default read sizes. These can be overridden with the max_read and
+// max_readahead mount options.
+#define DEFAULT_MAX_READ        "131072"
+#define DEFAULT_MAX_READAHEAD   "1048576"
+
+static const char *source_path;
 static uint64_t sparse_size;
 
-struct context
-{
-    mb::StandardFile source_file;
-    mb::sparse::SparseFile sparse_file;
-    std::mutex mutex;
-};
+// The sparse file is opened once and shared by all threads. Once the chunk
+// index is loaded, SparseFile::pread() does not modify any state and
+// FdFile::pread() maps directly to pread64(), so reads need no locking.
+static mb::FdFile source_file;
+static mb::sparse::SparseFile sparse_file;
 
 static mb::optional<int> extract_errno(std::error_code ec)
 {
@@ -100,126 +108,270 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -EROFS;
     }
 
-    context *ctx = new(std::nothrow) context();
-    if (!ctx) {
-        return -ENOMEM;
-    }
+    // The contents never change, so the page cache can be kept across opens
+    fi->keep_cache = 1;
 
-    auto ret = ctx->source_file.open(source_fd_path,
-                                     mb::FileOpenMode::ReadOnly);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
-    }
+    return 0;
+}
 
-    ret = ctx->sparse_file.open(&ctx->source_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
+/*!
+ * \brief Read callback for fuse
+ *
+ * This may be called concurrently from multiple fuse threads.
+ */
+static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
+                     fuse_file_info *fi)
+{
+    (void) path;
+    (void) fi;
+
+    if (offset < 0) {
+        return -EINVAL;
     }
 
-    fi->fh = reinterpret_cast<uint64_t>(ctx);
+    auto n = sparse_file.pread(buf, size, static_cast<uint64_t>(offset));
+    if (!n) {
+        return -extract_errno(n.error()).value_or(EIO);
+    }
 
-    return 0;
+    return static_cast<int>(n.value());
 }
 
 /*!
- * \brief Release callback for fuse
+ * \brief getattr (stat) callback for fuse
  */
-static int fuse_release(const char *path, fuse_file_info *fi)
+static int fuse_getattr(const char *path, struct stat *stbuf)
 {
     (void) path;
 
-    delete reinterpret_cast<context *>(fi->fh);
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_size = static_cast<OFF_T>(sparse_size);
 
     return 0;
 }
 
+#define INDEX_SOURCE_MAGIC      "FSIDXSRC"
+
 /*!
- * \brief Read from sparse file
+ * \brief Identity of the source file that a saved chunk index belongs to
  *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
+ * This is written in native byte order before the chunk index because the
+ * index file is only meant to be reused on the same device. The sparse header
+ * is already compared by SparseFile::read_index().
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+struct IndexSourceInfo
 {
-    // Seek to position
-    auto new_offset = ctx->sparse_file.seek(offset, SEEK_SET);
-    if (!new_offset) {
-        return -extract_errno(new_offset.error()).value_or(EIO);
-    }
+    char magic[8];
+    uint64_t size;
+    uint64_t inode;
+    int64_t mtime;
+    int64_t ctime;
+};
 
-    auto n = ctx->sparse_file.read(buf, size);
-    if (!n) {
-        return -extract_errno(n.error()).value_or(EIO);
+/*!
+ * \brief Get identity of the source file
+ */
+static bool get_source_info(int fd, IndexSourceInfo &info)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0) {
+        fprintf(stderr, "%s: Failed to stat: %s\n",
+                source_path, strerror(errno));
+        return false;
     }
 
-    return static_cast<int>(n.value());
+    memset(&info, 0, sizeof(info));
+    memcpy(info.magic, INDEX_SOURCE_MAGIC, sizeof(info.magic));
+    info.size = static_cast<uint64_t>(sb.st_size);
+    info.inode = static_cast<uint64_t>(sb.st_ino);
+    info.mtime = static_cast<int64_t>(sb.st_mtime);
+    info.ctime = static_cast<int64_t>(sb.st_ctime);
+
+    return true;
 }
 
 /*!
- * \brief Read callback for fuse
+ * \brief Load the chunk index from \p path into \a sparse
+ *
+ * The index is ignored if it was saved for a different source file or if the
+ * source file was modified since then.
  */
-static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
-                     fuse_file_info *fi)
+static bool load_index_file(mb::sparse::SparseFile &sparse, const char *path,
+                            const IndexSourceInfo &source_info)
 {
-    (void) path;
+    mb::StandardFile index_file;
+    IndexSourceInfo saved_info;
+
+    auto ret = index_file.open(path, mb::FileOpenMode::ReadOnly);
+    if (!ret) {
+        return false;
+    }
+
+    ret = mb::file_read_exact(index_file, &saved_info, sizeof(saved_info));
+    if (!ret) {
+        fprintf(stderr, "%s: Ignoring chunk index: %s\n",
+                path, ret.error().message().c_str());
+        return false;
+    } else if (memcmp(&saved_info, &source_info, sizeof(saved_info)) != 0) {
+        fprintf(stderr, "%s: Ignoring chunk index for a different file\n",
+                path);
+        return false;
+    }
 
-    context *ctx = reinterpret_cast<context *>(fi->fh);
+    ret = sparse.read_index(index_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Ignoring chunk index: %s\n",
+                path, ret.error().message().c_str());
+        return false;
+    }
 
-    std::lock_guard<std::mutex> lock(ctx->mutex);
-    return fuse_read_locked(ctx, buf, size, offset);
+    return true;
 }
 
 /*!
- * \brief getattr (stat) callback for fuse
+ * \brief Save the chunk index in \p data to \p path
  */
-static int fuse_getattr(const char *path, struct stat *stbuf)
+static void save_index_file(const char *path,
+                            const IndexSourceInfo &source_info,
+                            const void *data, size_t size)
 {
-    (void) path;
+    mb::StandardFile index_file;
 
-    stbuf->st_mode = S_IFREG | 0444;
-    stbuf->st_size = static_cast<OFF_T>(sparse_size);
+    auto ret = index_file.open(path, mb::FileOpenMode::WriteOnly);
+    if (ret) {
+        ret = mb::file_write_exact(index_file, &source_info,
+                                   sizeof(source_info));
+    }
+    if (ret) {
+        ret = mb::file_write_exact(index_file, data, size);
+    }
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to save chunk index: %s\n",
+                path, ret.error().message().c_str());
+    }
+}
 
-    return 0;
+/*!
+ * \brief Build the chunk index for the sparse file
+ *
+ * The chunk headers are read through a buffered file to avoid a syscall for
+ * every header. If \p index_path is not null, the chunk index is loaded from
+ * that file if it is valid and was saved for the current source file.
+ * Otherwise, it is regenerated and written to that file.
+ *
+ * \param fd Source file descriptor
+ * \param index_path Path to chunk index file or nullptr
+ * \param[out] index_data Pointer to malloc'd chunk index
+ * \param[out] index_size Size of chunk index
+ *
+ * \return Whether the index was successfully built
+ */
+static bool build_index(int fd, const char *index_path,
+                        void **index_data, size_t *index_size)
+{
+    mb::FdFile file;
+    mb::BufferedFile buffered_file;
+    mb::sparse::SparseFile sparse;
+    mb::MemoryFile index_file;
+
+    auto ret = file.open(fd, false);
+    if (ret) {
+        ret = buffered_file.open(&file);
+    }
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                source_path, ret.error().message().c_str());
+        return false;
+    }
+
+    ret = sparse.open(&buffered_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
+                source_path, ret.error().message().c_str());
+        return false;
+    }
+
+    IndexSourceInfo source_info;
+    bool have_source_info = index_path && get_source_info(fd, source_info);
+    bool have_index_file = have_source_info
+            && load_index_file(sparse, index_path, source_info);
+
+    ret = index_file.open(index_data, index_size);
+    if (ret) {
+        ret = sparse.write_index(index_file);
+    }
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to build chunk index: %s\n",
+                source_path, ret.error().message().c_str());
+        return false;
+    }
+
+    if (have_source_info && !have_index_file) {
+        save_index_file(index_path, source_info, *index_data, *index_size);
+    }
+
+    return true;
 }
 
 /*!
- * \brief Get size of sparse file (needed for fuse_getattr())
+ * \brief Open the shared sparse file and load its chunk index
  */
-static int get_sparse_file_size()
+static bool open_sparse_file(int fd, const char *index_path)
 {
-    mb::StandardFile source_file;
-    mb::sparse::SparseFile sparse_file;
+    void *index_data = nullptr;
+    size_t index_size = 0;
+
+    auto free_index = mb::finally([&] {
+        free(index_data);
+    });
+
+    if (!build_index(fd, index_path, &index_data, &index_size)) {
+        return false;
+    }
 
-    auto ret = source_file.open(source_fd_path, mb::FileOpenMode::ReadOnly);
+    auto ret = source_file.open(fd, false);
     if (!ret) {
         fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        return -extract_errno(ret.error()).value_or(EIO);
+                source_path, ret.error().message().c_str());
+        return false;
+    }
+
+    // build_index() moved the file position
+    auto seek_ret = source_file.seek(0, SEEK_SET);
+    if (!seek_ret) {
+        fprintf(stderr, "%s: Failed to seek file: %s\n",
+                source_path, seek_ret.error().message().c_str());
+        return false;
     }
 
     ret = sparse_file.open(&source_file);
     if (!ret) {
         fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        return -extract_errno(ret.error()).value_or(EIO);
+                source_path, ret.error().message().c_str());
+        return false;
+    }
+
+    mb::MemoryFile index_file(index_data, index_size);
+
+    ret = sparse_file.read_index(index_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to load chunk index: %s\n",
+                source_path, ret.error().message().c_str());
+        return false;
     }
 
+    // Needed for fuse_getattr()
     sparse_size = sparse_file.size();
 
-    return 0;
+    return true;
 }
 
 struct arg_ctx
 {
     char *source_file = nullptr;
     char *target_file = nullptr;
+    char *index_file = nullptr;
     bool show_help = false;
 };
 
@@ -232,6 +384,7 @@ static fuse_opt fuse_opts[] =
 {
     FUSE_OPT_KEY("-h",     KEY_HELP),
     FUSE_OPT_KEY("--help", KEY_HELP),
+    { "index=%s", offsetof(arg_ctx, index_file), 0 },
     FUSE_OPT_END
 };
 
@@ -242,6 +395,11 @@ static void usage(FILE *stream, const char *progname)
             "\n"
             "general options:\n"
             "    -o opt,[opt...]        comma-separated list of mount options\n"
+            "    -o index=<file>        load/save chunk index from/to file\n"
+            "    -o max_read=<n>        maximum size of read requests\n"
+            "                           (default: " DEFAULT_MAX_READ ")\n"
+            "    -o max_readahead=<n>   maximum size of kernel readahead\n"
+            "                           (default: " DEFAULT_MAX_READAHEAD ")\n"
             "    -h   --help            show this help message\n"
             "\n",
             progname);
@@ -293,16 +451,24 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
-        fd = open(arg_ctx.source_file, O_RDONLY);
+        source_path = arg_ctx.source_file;
+
+        fd = open(arg_ctx.source_file, O_RDONLY | O_CLOEXEC);
         if (fd < 0) {
             fprintf(stderr, "%s: Failed to open: %s\n",
                     arg_ctx.source_file, strerror(errno));
             return EXIT_FAILURE;
         }
-        snprintf(source_fd_path, sizeof(source_fd_path),
-                 "/proc/self/fd/%d", fd);
 
-        if (get_sparse_file_size() < 0) {
+        if (!open_sparse_file(fd, arg_ctx.index_file)) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+
+        // Insert the defaults before the user-specified options so that they
+        // can be overridden. fuse runs multithreaded unless -s is passed.
+        if (fuse_opt_insert_arg(&args, 1, "-omax_read=" DEFAULT_MAX_READ
+                                ",max_readahead=" DEFAULT_MAX_READAHEAD) < 0) {
             close(fd);
             return EXIT_FAILURE;
         }
@@ -313,17 +479,19 @@ int main(int argc, char *argv[])
     fuse_oper.getattr = fuse_getattr;
     fuse_oper.open    = fuse_open;
     fuse_oper.read    = fuse_read;
-    fuse_oper.release = fuse_release;
 
     int fuse_ret = fuse_main(args.argc, args.argv, &fuse_oper, nullptr);
 
     if (!arg_ctx.show_help) {
+        (void) sparse_file.close();
+        (void) source_file.close();
         close(fd);
     }
 
     fuse_opt_free_args(&args);
     free(arg_ctx.source_file);
     free(arg_ctx.target_file);
+    free(arg_ctx.index_file);
 
     return fuse_ret;
 }
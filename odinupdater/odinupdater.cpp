@@ -18,7 +18,10 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include <cerrno>
@@ -28,6 +31,7 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -35,11 +39,11 @@
 // libmbcommon
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/callbacks.h"
-#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 
 // libmbsparse
+#include "mbsparse/flash.h"
 #include "mbsparse/sparse.h"
 
 // libmbdevice
@@ -65,6 +69,10 @@
 #define FUSE_SPARSE_FILE        "fuse-sparse"
 #define DEVICE_JSON_FILE        "multiboot/device.json"
 
+// Decompression pipeline: 8 x 1 MiB buffers
+#define PIPE_BUFFER_SIZE        (1024 * 1024)
+#define PIPE_BUFFER_COUNT       8
+
 #define TEMP_CACHE_SPARSE_FILE  "/tmp/cache.img.ext4"
 #define TEMP_CACHE_MOUNT_FILE   "/tmp/cache.img"
 #define TEMP_CACHE_MOUNT_DIR    "/tmp/cache"
@@ -342,30 +350,264 @@ static bool load_block_devs()
     return true;
 }
 
-static mb::oc::result<size_t> cb_zip_read(mb::File &file, void *userdata,
-                                          void *buf, size_t size)
+/*!
+ * \brief Bounded pipeline between libarchive decompression and the writer
+ *
+ * A background thread decompresses the current archive entry into a ring of
+ * large buffers while the caller's thread writes out the previously filled
+ * buffers. If the writer falls behind, the decompression thread blocks until
+ * a buffer is released. Buffers are always consumed in order.
+ */
+class ArchivePipe
 {
-    (void) file;
+public:
+    ArchivePipe(archive *a, size_t buf_size, size_t buf_count)
+        : m_archive(a)
+        , m_bufs(buf_count, std::vector<char>(buf_size))
+        , m_sizes(buf_count)
+        , m_head(0)
+        , m_tail(0)
+        , m_filled(0)
+        , m_holding(false)
+        , m_pos(0)
+        , m_eof(false)
+        , m_cancelled(false)
+        , m_started(false)
+    {
+    }
 
-    archive *a = static_cast<archive *>(userdata);
-    uint64_t total = 0;
+    ~ArchivePipe()
+    {
+        stop();
+    }
 
-    while (size > 0) {
-        la_ssize_t n = archive_read_data(a, buf, size);
-        if (n < 0) {
-            error("libarchive: Failed to read data: %s",
-                  archive_error_string(a));
-            return mb::ec_from_errno(archive_errno(a));
-        } else if (n == 0) {
-            break;
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ArchivePipe)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ArchivePipe)
+
+    bool start()
+    {
+        int ret = pthread_create(&m_thread, nullptr, &thread_fn, this);
+        if (ret != 0) {
+            error("Failed to start decompression thread: %s", strerror(ret));
+            return false;
         }
 
-        total += static_cast<size_t>(n);
-        size -= static_cast<size_t>(n);
-        buf = static_cast<char *>(buf) + n;
+        m_started = true;
+        return true;
     }
 
-    return static_cast<size_t>(total);
+    void stop()
+    {
+        if (m_started) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cancelled = true;
+            }
+            m_space_cv.notify_one();
+
+            pthread_join(m_thread, nullptr);
+            m_started = false;
+        }
+    }
+
+    /*!
+     * \brief Get next filled buffer
+     *
+     * The buffer returned by the previous call is released back to the
+     * decompression thread.
+     *
+     * \return Whether the next buffer was successfully retrieved. \p size is
+     *         set to 0 when the end of the entry is reached.
+     */
+    bool next(const char **data, size_t *size)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (m_holding) {
+            m_tail = (m_tail + 1) % m_bufs.size();
+            --m_filled;
+            m_holding = false;
+            m_pos = 0;
+            m_space_cv.notify_one();
+        }
+
+        m_data_cv.wait(lock, [this]{
+            return m_filled > 0 || m_eof || m_ec;
+        });
+
+        if (m_filled > 0) {
+            m_holding = true;
+            *data = m_bufs[m_tail].data();
+            *size = m_sizes[m_tail];
+            return true;
+        } else if (m_ec) {
+            return false;
+        } else {
+            *size = 0;
+            return true;
+        }
+    }
+
+    /*!
+     * \brief Read data from pipe, crossing buffer boundaries as needed
+     */
+    mb::oc::result<size_t> read(void *buf, size_t size)
+    {
+        size_t total = 0;
+
+        while (size > 0) {
+            if (!m_holding || m_pos == m_sizes[m_tail]) {
+                const char *data;
+                size_t n;
+
+                if (!next(&data, &n)) {
+                    return m_ec;
+                } else if (n == 0) {
+                    break;
+                }
+            }
+
+            size_t to_copy = std::min(size, m_sizes[m_tail] - m_pos);
+            memcpy(buf, m_bufs[m_tail].data() + m_pos, to_copy);
+
+            m_pos += to_copy;
+            total += to_copy;
+            size -= to_copy;
+            buf = static_cast<char *>(buf) + to_copy;
+        }
+
+        return total;
+    }
+
+    /*!
+     * \brief Error message from libarchive if decompression failed
+     */
+    const std::string & error_string() const
+    {
+        return m_error_string;
+    }
+
+private:
+    static void * thread_fn(void *userdata)
+    {
+        static_cast<ArchivePipe *>(userdata)->decompress();
+        return nullptr;
+    }
+
+    void decompress()
+    {
+        while (true) {
+            size_t index;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_space_cv.wait(lock, [this]{
+                    return m_filled < m_bufs.size() || m_cancelled;
+                });
+                if (m_cancelled) {
+                    return;
+                }
+                index = m_head;
+            }
+
+            // The buffer at m_head is not visible to the consumer until
+            // m_filled is incremented, so it can be filled without the lock
+            auto &buf = m_bufs[index];
+            size_t size = 0;
+
+            while (size < buf.size()) {
+                la_ssize_t n = archive_read_data(
+                        m_archive, buf.data() + size, buf.size() - size);
+                if (n < 0) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_error_string = archive_error_string(m_archive);
+                    m_ec = mb::ec_from_errno(archive_errno(m_archive));
+                    if (!m_ec) {
+                        m_ec = std::make_error_code(std::errc::io_error);
+                    }
+                    m_data_cv.notify_one();
+                    return;
+                } else if (n == 0) {
+                    break;
+                }
+
+                size += static_cast<size_t>(n);
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (size > 0) {
+                m_sizes[index] = size;
+                m_head = (m_head + 1) % m_bufs.size();
+                ++m_filled;
+            }
+            if (size < buf.size()) {
+                m_eof = true;
+            }
+            m_data_cv.notify_one();
+
+            if (m_eof) {
+                return;
+            }
+        }
+    }
+
+    archive *m_archive;
+    pthread_t m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_space_cv;
+    std::condition_variable m_data_cv;
+
+    std::vector<std::vector<char>> m_bufs;
+    std::vector<size_t> m_sizes;
+    // Next buffer to fill
+    size_t m_head;
+    // Next buffer to consume (or the buffer currently held by the consumer)
+    size_t m_tail;
+    // Number of filled buffers, including the one held by the consumer
+    size_t m_filled;
+    bool m_holding;
+    // Position in held buffer for read()
+    size_t m_pos;
+
+    bool m_eof;
+    bool m_cancelled;
+    bool m_started;
+    std::error_code m_ec;
+    std::string m_error_string;
+};
+
+static mb::oc::result<size_t> cb_pipe_read(mb::File &file, void *userdata,
+                                           void *buf, size_t size)
+{
+    (void) file;
+
+    auto pipe = static_cast<ArchivePipe *>(userdata);
+
+    auto n = pipe->read(buf, size);
+    if (!n) {
+        error("libarchive: Failed to read data: %s",
+              pipe->error_string().c_str());
+    }
+
+    return n;
+}
+
+#if DEBUG_SKIP_FLASH_SYSTEM
+MB_UNUSED
+#endif
+static void cb_flash_progress(uint64_t bytes, uint64_t total, void *userdata)
+{
+    uint64_t *old_bytes = static_cast<uint64_t *>(userdata);
+
+    // Rate limit: update progress only after difference exceeds 0.1%
+    double old_ratio = static_cast<double>(*old_bytes) / total;
+    double new_ratio = static_cast<double>(bytes) / total;
+    if (new_ratio - old_ratio >= 0.001) {
+        set_progress(new_ratio);
+        *old_bytes = bytes;
+    }
 }
 
 #if DEBUG_SKIP_FLASH_SYSTEM
@@ -377,7 +619,6 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
     ScopedArchive a{archive_read_new(), &archive_read_free};
     mb::CallbackFile file;
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
 
     if (!a) {
         error("Out of memory");
@@ -394,8 +635,15 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return result;
     }
 
-    auto open_ret = file.open(nullptr, nullptr, &cb_zip_read, nullptr, nullptr,
-                              nullptr, a.get());
+    // Decompress in a separate thread so it overlaps with the block device
+    // writes
+    ArchivePipe pipe(a.get(), PIPE_BUFFER_SIZE, PIPE_BUFFER_COUNT);
+    if (!pipe.start()) {
+        return ExtractResult::Error;
+    }
+
+    auto open_ret = file.open(nullptr, nullptr, &cb_pipe_read, nullptr, nullptr,
+                              nullptr, &pipe);
     if (!open_ret) {
         error("Failed to open sparse file in zip: %s",
               open_ret.error().message().c_str());
@@ -409,58 +657,39 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    open_ret = out_file.open(out_filename, mb::FileOpenMode::WriteOnly);
-    if (!open_ret) {
+    int fd = open64(out_filename, O_WRONLY | O_CLOEXEC | O_LARGEFILE);
+    if (fd < 0) {
         error("%s: Failed to open for writing: %s",
-              out_filename, open_ret.error().message().c_str());
+              out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
-    char buf[10240];
-    uint64_t cur_bytes = 0;
-    uint64_t max_bytes = sparse_file.size();
-    uint64_t old_bytes = 0;
-
-    set_progress(0);
-
-    while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
-        if (!n) {
-            error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
-            return ExtractResult::Error;
-        } else if (n.value() == 0) {
-            break;
-        }
-
-        // Rate limit: update progress only after difference exceeds 0.1%
-        double old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
+    auto close_fd = mb::finally([&fd]{
+        if (fd >= 0) {
+            close(fd);
         }
+    });
 
-        char *out_ptr = buf;
+    set_progress(0);
 
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
-                return ExtractResult::Error;
-            }
+    // Stream the chunks directly to the block device. "Don't care" regions are
+    // zeroed with BLKZEROOUT instead of writing the zeros ourselves.
+    uint64_t old_bytes = 0;
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
-        }
+    auto flash_ret = mb::sparse::flash_sparse_file(
+            sparse_file, fd, mb::sparse::FlashFlag::ZeroDontCare,
+            &cb_flash_progress, &old_bytes);
+    if (!flash_ret) {
+        error("%s: Failed to flash sparse file %s: %s",
+              out_filename, zip_filename,
+              flash_ret.error().message().c_str());
+        return ExtractResult::Error;
     }
 
-    auto close_ret = out_file.close();
-    if (!close_ret) {
-        error("%s: Failed to close file: %s",
-              out_filename, close_ret.error().message().c_str());
+    int close_fd_ret = close(fd);
+    fd = -1;
+    if (close_fd_ret < 0) {
+        error("%s: Failed to close file: %s", out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
@@ -471,8 +700,8 @@ static ExtractResult extract_raw_file(const char *zip_filename,
                                       const char *out_filename)
 {
     ScopedArchive a{archive_read_new(), &archive_read_free};
-    char buf[10240];
-    la_ssize_t n;
+    const char *buf;
+    size_t size;
     int fd;
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = 0;
@@ -508,9 +737,23 @@ static ExtractResult extract_raw_file(const char *zip_filename,
         close(fd);
     });
 
+    ArchivePipe pipe(a.get(), PIPE_BUFFER_SIZE, PIPE_BUFFER_COUNT);
+    if (!pipe.start()) {
+        return ExtractResult::Error;
+    }
+
     set_progress(0);
 
-    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+    // Write out each buffer while the next ones are being decompressed
+    while (true) {
+        if (!pipe.next(&buf, &size)) {
+            error("libarchive: %s: Failed to read %s: %s",
+                  zip_file, zip_filename, pipe.error_string().c_str());
+            return ExtractResult::Error;
+        } else if (size == 0) {
+            break;
+        }
+
         // Rate limit: update progress only after difference exceeds 0.1%
         old_ratio = static_cast<double>(old_bytes) / max_bytes;
         new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -519,24 +762,22 @@ static ExtractResult extract_raw_file(const char *zip_filename,
             old_bytes = cur_bytes;
         }
 
-        char *out_ptr = buf;
-        ssize_t nwritten;
-
-        do {
-            if ((nwritten = write(fd, out_ptr, static_cast<size_t>(n))) < 0) {
+        while (size > 0) {
+            ssize_t nwritten = pwrite64(fd, buf, size,
+                                        static_cast<off64_t>(cur_bytes));
+            if (nwritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 error("%s: Failed to write: %s",
                       out_filename, strerror(errno));
                 return ExtractResult::Error;
             }
 
-            n -= nwritten;
-            out_ptr += nwritten;
-        } while (n > 0);
-    }
-    if (n != 0) {
-        error("libarchive: %s: Failed to read %s: %s",
-              zip_file, zip_filename, archive_error_string(a.get()));
-        return ExtractResult::Error;
+            size -= static_cast<size_t>(nwritten);
+            buf += nwritten;
+            cur_bytes += static_cast<uint64_t>(nwritten);
+        }
     }
 
     return ExtractResult::Ok;